@@ -17,6 +17,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include <iostream>
 #include <limits>
+#include <string>
 
 #ifdef _OPENMP
 #include <omp.h>
@@ -24,11 +25,17 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include "../utility/bitmap.hpp"
 #include "../utility/open_mp.hpp"
+#include "../utility/metrics.hpp"
+#include "../utility/mmap.hpp"
+#include "../utility/task_scheduler.hpp"
 
 namespace bfs {
 
 static const uint16_t k_infinite_level = std::numeric_limits<uint16_t>::max();
 
+/// The edges of a vertex of a higher degree are scanned by several tasks (task runtime only)
+static const uint64_t k_default_hub_degree = 4096;
+
 /// \brief initialize variables to run BFS
 /// \param num_vertices The number of vertices
 /// \param level A pointer of level array
@@ -58,6 +65,22 @@ void print_omp_configuration() {
 #endif
 }
 
+/// \brief Visits the edges [first_edge, last_edge) of a vertex of the current level
+/// \return Whether a vertex is visited for the first time
+inline bool visit_edges(const uint64_t first_edge, const uint64_t last_edge, const uint64_t *const edges,
+                        const uint16_t current_level, uint16_t *const level, uint64_t *visited_filter) {
+  bool visited_new_vertex = false;
+  for (uint64_t i = first_edge; i < last_edge; ++i) {
+    const uint64_t trg = edges[i];
+    if (!utility::get_bit(visited_filter, trg) && level[trg] == k_infinite_level) {
+      level[trg] = current_level + 1;
+      utility::set_bit(visited_filter, trg);
+      visited_new_vertex = true;
+    }
+  }
+  return visited_new_vertex;
+}
+
 /// \brief BFS kernel.
 /// This kernel runs with OpenMP.
 /// In order to simplify the implementation of this kernel,
@@ -68,36 +91,158 @@ void print_omp_configuration() {
 /// \param edges A pointer of an edges array
 /// \param level A pointer of level array
 /// \param visited_filter A pointer of an bitset for visited filter
+/// \param metrics If given, every level is a phase, and the frontier vertices
+/// and scanned edges of every thread are counted
 uint16_t run_bfs(const size_t num_vertices,
                  const uint64_t *const index,
                  const uint64_t *const edges,
                  uint16_t *const level,
-                 uint64_t *visited_filter) {
+                 uint64_t *visited_filter,
+                 utility::metrics *const metrics = nullptr) {
 
   print_omp_configuration();
 
   uint16_t current_level = 0;
   bool visited_new_vertex = false;
 
+  utility::metrics::id frontier_id = 0;
+  utility::metrics::id edges_id = 0;
+  if (metrics) {
+    frontier_id = metrics->counter("frontier vertices");
+    edges_id = metrics->counter("edges scanned");
+  }
+
   while (true) { /// BFS main loop
+    if (metrics) metrics->begin("level " + std::to_string(current_level));
 
     /// BFS loop for a single level
     /// We assume that the cost of generating threads at every level is negligible
 #ifdef _OPENMP
-#pragma omp parallel for schedule (runtime)
+#pragma omp parallel
+#endif
+    {
+      uint64_t frontier = 0;
+      uint64_t scanned = 0;
+#ifdef _OPENMP
+#pragma omp for schedule (runtime)
 #endif
-    for (uint64_t src = 0; src < num_vertices; ++src) { /// BFS loop for each level
-      if (level[src] != current_level) continue;
-      for (size_t i = index[src]; i < index[src + 1]; ++i) {
-        const uint64_t trg = edges[i];
-        if (!utility::get_bit(visited_filter, trg) && level[trg] == k_infinite_level) {
-          level[trg] = current_level + 1;
-          utility::set_bit(visited_filter, trg);
+      for (uint64_t src = 0; src < num_vertices; ++src) { /// BFS loop for each level
+        if (level[src] != current_level) continue;
+        ++frontier;
+        scanned += index[src + 1] - index[src];
+        if (visit_edges(index[src], index[src + 1], edges, current_level, level, visited_filter))
           visited_new_vertex = true;
-        }
+      }
+      if (metrics) {
+        utility::metrics::thread_slot &slot = metrics->local();
+        slot.add(frontier_id, frontier);
+        slot.add(edges_id, scanned);
       }
     }
 
+    if (metrics) metrics->end();
+    if (!visited_new_vertex) break;
+
+    ++current_level;
+    visited_new_vertex = false;
+  } /// End of BFS main loop
+
+  return current_level;
+}
+
+/// \brief BFS kernel on the work-stealing task runtime (see utility/task_scheduler.hpp).
+/// The vertices of a level are split by the adaptive parallel_for. While a
+/// range of vertices is scanned, an I/O task faults in the edges of the
+/// frontier vertices of the next range, and the edges of a hub vertex (degree
+/// above hub_degree) are scanned by several tasks.
+/// Races are handled as in the OpenMP kernel.
+/// \param scheduler The task scheduler; the metrics, if given, need a slot per worker
+/// \param hub_degree Degree above which the edges of a vertex are split into tasks of this many edges
+uint16_t run_bfs(const size_t num_vertices,
+                 const uint64_t *const index,
+                 const uint64_t *const edges,
+                 uint16_t *const level,
+                 uint64_t *visited_filter,
+                 utility::task_scheduler &scheduler,
+                 utility::metrics *const metrics = nullptr,
+                 const uint64_t hub_degree = k_default_hub_degree) {
+
+  std::cout << "Run with the task runtime: " << scheduler.num_threads() << " threads, "
+            << scheduler.num_io_workers() << " I/O workers" << std::endl;
+
+  uint16_t current_level = 0;
+  bool visited_new_vertex = false;
+
+  utility::metrics::id frontier_id = 0;
+  utility::metrics::id edges_id = 0;
+  utility::metrics::id hubs_id = 0;
+  if (metrics) {
+    frontier_id = metrics->counter("frontier vertices");
+    edges_id = metrics->counter("edges scanned");
+    hubs_id = metrics->counter("hub vertices");
+  }
+
+  const uint64_t k_page_size = utility::get_page_size();
+
+  // Faults in the edges of the frontier vertices in [first, last)
+  auto prefetch_frontier_edges = [&](const uint64_t first, const uint64_t last) {
+    for (uint64_t src = first; src < last; ++src) {
+      if (level[src] != current_level || index[src] == index[src + 1]) continue;
+      utility::touch_pages(edges + index[src], (index[src + 1] - index[src]) * sizeof(uint64_t));
+    }
+  };
+
+  while (true) { /// BFS main loop
+    if (metrics) metrics->begin("level " + std::to_string(current_level));
+
+    utility::task_group prefetches;
+    scheduler.parallel_for(0, num_vertices, [&](const uint64_t first, const uint64_t last) {
+      // A prefetch of less than a page of edges is not worth a task
+      const uint64_t next_last = std::min<uint64_t>(num_vertices, last + (last - first));
+      if (last < next_last && (index[next_last] - index[last]) * sizeof(uint64_t) > k_page_size)
+        scheduler.spawn_io(prefetches, [&prefetch_frontier_edges, last, next_last]() {
+          prefetch_frontier_edges(last, next_last);
+        });
+
+      uint64_t frontier = 0;
+      uint64_t scanned = 0;
+      uint64_t hubs = 0;
+      for (uint64_t src = first; src < last; ++src) {
+        if (level[src] != current_level) continue;
+        ++frontier;
+        const uint64_t degree = index[src + 1] - index[src];
+        scanned += degree;
+        if (degree <= hub_degree) {
+          if (visit_edges(index[src], index[src + 1], edges, current_level, level, visited_filter))
+            visited_new_vertex = true;
+          continue;
+        }
+
+        ++hubs;
+        utility::task_group hub;
+        for (uint64_t e = index[src] + hub_degree; e < index[src + 1]; e += hub_degree) {
+          const uint64_t e_last = std::min(e + hub_degree, index[src + 1]);
+          scheduler.spawn(hub, [=, &visited_new_vertex]() {
+            if (visit_edges(e, e_last, edges, current_level, level, visited_filter))
+              visited_new_vertex = true;
+          });
+        }
+        if (visit_edges(index[src], index[src] + hub_degree, edges, current_level, level, visited_filter))
+          visited_new_vertex = true;
+        scheduler.wait(hub);
+      }
+
+      if (metrics) {
+        utility::metrics::thread_slot &slot = metrics->slot(utility::task_scheduler::worker_index());
+        slot.add(frontier_id, frontier);
+        slot.add(edges_id, scanned);
+        slot.add(hubs_id, hubs);
+      }
+    });
+    // Prefetches still queued are of no use, but they refer to this level
+    scheduler.wait(prefetches);
+
+    if (metrics) metrics->end();
     if (!visited_new_vertex) break;
 
     ++current_level;
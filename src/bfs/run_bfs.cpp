@@ -13,6 +13,7 @@ Public License along with this program; if not, write to the Free Software
 Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 */
 #include <unistd.h>
+#include <getopt.h>
 #include <iostream>
 #include <vector>
 #include <tuple>
@@ -26,12 +27,18 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include "../utility/time.hpp"
 #include "../utility/file.hpp"
 #include "../utility/mmap.hpp"
+#include "../utility/phase.hpp"
+#include "../utility/memory_pressure.hpp"
+#include "../utility/metrics.hpp"
+#include "../utility/task_scheduler.hpp"
+#include "../utility/cache_control.hpp"
 
 struct bfs_options {
   size_t num_vertices{0};
   size_t num_edges{0};
   std::string graph_file_name;
   bool use_mmap{false};
+  utility::cache_mode cache{utility::cache_mode::as_is};
 };
 
 void disp_umap_env_variables() {
@@ -45,6 +52,9 @@ void disp_umap_env_variables() {
       << "UMAP_EVICT_LOW_WATER_THRESHOLD  - currently: " << umapcfg_get_evict_low_water_threshold() << " percent full\n"
       << "UMAP_EVICT_HIGH_WATER_THRESHOLD - currently: " << umapcfg_get_evict_high_water_threshold()
       << " percent full\n"
+      << "MEMORY_PRESSURE_FREE, MEMORY_PRESSURE_SCHEDULE, MEMORY_PRESSURE_PERIOD, MEMORY_PRESSURE_BACKEND\n"
+      << "                                - memory left for the run, see utility/memory_pressure.hpp\n"
+      << "TASK_RUNTIME, TASK_IO_WORKERS   - omp or tasks (work-stealing runtime), see utility/task_scheduler.hpp\n"
       << std::endl;
 }
 
@@ -53,15 +63,22 @@ void usage() {
             << "-n\t#vertices\n"
             << "-m\t#edges\n"
             << "-g\tGraph file name\n"
-            << "-s\tUse system mmap" << std::endl;
+            << "-s\tUse system mmap\n"
+            << "--cold\tEvict the graph from memory before the BFS\n"
+            << "--warm\tRead the graph into memory before the BFS" << std::endl;
 
   disp_umap_env_variables();
 }
 
 void parse_options(int argc, char **argv,
                    bfs_options &options) {
+  static const struct option long_options[] = {
+      {"cold", no_argument, nullptr, 'C'},
+      {"warm", no_argument, nullptr, 'W'},
+      {nullptr, 0, nullptr, 0}
+  };
   int c;
-  while ((c = getopt(argc, argv, "n:m:g:sh")) != -1) {
+  while ((c = getopt_long(argc, argv, "n:m:g:sh", long_options, nullptr)) != -1) {
     switch (c) {
       case 'n': /// Required
         options.num_vertices = std::stoull(optarg);
@@ -78,6 +95,12 @@ void parse_options(int argc, char **argv,
       case 's':options.use_mmap = true;
         break;
 
+      case 'C':options.cache = utility::cache_mode::cold;
+        break;
+
+      case 'W':options.cache = utility::cache_mode::warm;
+        break;
+
       case 'h':usage();
         std::exit(0);
     }
@@ -89,7 +112,8 @@ void disp_bfs_options(const bfs_options &options) {
             << "\n#vertices: " << options.num_vertices
             << "\n#edges: " << options.num_edges
             << "\nGraph file: " << options.graph_file_name
-            << "\nUse system mmap: " << options.use_mmap << std::endl;
+            << "\nUse system mmap: " << options.use_mmap
+            << "\nCache: " << utility::cache_mode_name(options.cache) << std::endl;
 }
 
 size_t calculate_umap_pagesize_aligned_graph_file_size(const size_t num_vertices, const size_t num_edges) {
@@ -174,13 +198,26 @@ int main(int argc, char **argv) {
   parse_options(argc, argv, options);
   disp_bfs_options(options);
   if (!options.use_mmap) disp_umap_env_variables();
+  const auto pressure = utility::memory_pressure_from_env();
+  const auto scheduler = utility::task_scheduler_from_env();
 
   std::cout << "Initial #of page faults" << std::endl;
   print_num_page_faults();
 
+  utility::phase_recorder phases("run_bfs", scheduler ? scheduler->num_workers() : 0);
+  phases.set_attribute("vertices", options.num_vertices);
+  phases.set_attribute("edges", options.num_edges);
+  phases.set_attribute("usemmap", options.use_mmap);
+  phases.set_attribute("threads", omp_get_max_threads());
+  phases.set_attribute("runtime", scheduler ? "tasks" : "omp");
+  phases.set_attribute("cache", utility::cache_mode_name(options.cache));
+  if (pressure) phases.set_attribute("memory_pressure", utility::pressure_backend_name(pressure->backend()));
+
   const uint64_t *index = nullptr;
   const uint64_t *edges = nullptr;
+  phases.begin("umap INIT");
   std::tie(index, edges) = map_graph(options);
+  phases.end();
 
   // Array to store each vertex's level (a distance from the source vertex)
   std::vector<uint16_t> level(options.num_vertices);
@@ -191,20 +228,45 @@ int main(int argc, char **argv) {
   bfs::init_bfs(options.num_vertices, level.data(), visited_filter.data());
   find_bfs_root(options.num_vertices, index, level.data());
 
+  const size_t graph_file_size = utility::get_file_size(options.graph_file_name);
+  if (options.cache != utility::cache_mode::as_is) {
+    if (options.cache == utility::cache_mode::cold) {
+      phases.begin("Evict");
+      if (!utility::evict_mapped_file(options.graph_file_name, options.use_mmap, graph_file_size,
+                                      const_cast<uint64_t *>(index))) {
+        std::cerr << "Failed to map the graph again" << std::endl;
+        std::abort();
+      }
+    } else {
+      phases.begin("Prewarm", graph_file_size);
+      utility::prewarm_region(index, graph_file_size, omp_get_max_threads());
+    }
+    phases.end();
+    const utility::cache_state state = utility::check_cache_state(options.cache, index, graph_file_size,
+                                                                  {options.graph_file_name});
+    phases.set_attribute("region_resident", state.region_resident);
+  }
+
   std::cout << "Before BFS #of page faults" << std::endl;
   print_num_page_faults();
-  const auto bfs_start_time = utility::elapsed_time_sec();
-  const uint16_t max_level = bfs::run_bfs(options.num_vertices, index, edges, level.data(), visited_filter.data());
-  const auto bfs_time = utility::elapsed_time_sec(bfs_start_time);
+  // Data bytes are the bytes of the graph, so the phase rate is a traversal rate
+  phases.begin("BFS", (options.num_vertices + 1 + options.num_edges) * sizeof(uint64_t));
+  const uint16_t max_level = scheduler
+                             ? bfs::run_bfs(options.num_vertices, index, edges, level.data(), visited_filter.data(),
+                                            *scheduler, &phases.metrics())
+                             : bfs::run_bfs(options.num_vertices, index, edges, level.data(), visited_filter.data(),
+                                            &phases.metrics());
+  if (scheduler) utility::record_task_scheduler_stats(*scheduler, phases.metrics());
+  const auto bfs_time = phases.end().wall_sec;
   std::cout << "BFS took (s)\t" << bfs_time << std::endl;
   std::cout << "After BFS #of page faults" << std::endl;
   print_num_page_faults();
 
   count_level(options.num_vertices, max_level, level.data());
 
-  utility::unmap_file(options.use_mmap,
-                      utility::get_file_size(options.graph_file_name),
-                      const_cast<uint64_t *>(index));
+  phases.begin("umap TERM");
+  utility::unmap_file(options.use_mmap, graph_file_size, const_cast<uint64_t *>(index));
+  phases.finish();
 
   return 0;
 }
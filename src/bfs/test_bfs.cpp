@@ -122,5 +122,17 @@ int main(int argc, char **argv) {
   validate_level(level, bfs_level_reference_file_name);
   std::cout << "Passed validation" << std::endl;
 
+  // The task runtime, with a low hub degree so that hub vertices are split into tasks
+  {
+    utility::task_scheduler scheduler;
+    bfs::init_bfs(num_vertices, level.data(), visited_filter.data());
+    level[0] = 0;
+    bfs::run_bfs(num_vertices, index, edges, level.data(), visited_filter.data(), scheduler, nullptr, 16);
+    std::cout << "Finished BFS with the task runtime" << std::endl;
+  }
+
+  validate_level(level, bfs_level_reference_file_name);
+  std::cout << "Passed validation" << std::endl;
+
   return 0;
 }
@@ -29,6 +29,10 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include "../utility/commandline.hpp"
 #include "../utility/umap_fits_file.hpp"
 #include "../utility/time.hpp"
+#include "../utility/metrics.hpp"
+#include "../utility/phase.hpp"
+#include "../utility/task_scheduler.hpp"
+#include "../utility/cache_control.hpp"
 #include "torben.hpp"
 #include "utility.hpp"
 #include "vector.hpp"
@@ -39,6 +43,8 @@ using namespace median;
 
 using pixel_type = float;
 constexpr size_t default_num_random_vector = 100000;
+// Vectors of a batch of the task runtime: their pixels are gathered, then their medians computed
+constexpr size_t k_vectors_per_batch = 64;
 
 void map_fits(const std::string &filename,
               size_t *size_x,
@@ -70,6 +76,29 @@ std::size_t get_num_vectors() {
   return num_random_vector;
 }
 
+/// \brief Names of the FITS files of the cube, as PerFits_alloc_cube finds them
+std::vector<std::string> fits_file_names(const std::string &basename, const size_t size_k) {
+  std::vector<std::string> names;
+  for (size_t i = 1; i <= size_k; ++i) names.push_back(basename + std::to_string(i) + ".fits");
+  return names;
+}
+
+/// \brief Evicts the FITS files or reads the cube into memory before the vectors are shot (--cold/--warm)
+/// The cube was just mapped, so a cold cube only needs the files dropped from the page cache.
+void set_cache_state(const utility::cache_mode cache, const pixel_type *const image_data, const size_t cube_bytes,
+                     const std::vector<std::string> &file_names, const int num_threads, utility::phase_recorder &phases) {
+  if (cache == utility::cache_mode::as_is) return;
+  if (cache == utility::cache_mode::cold) {
+    phases.begin("Evict");
+    for (const auto &f : file_names) utility::drop_file_cache(f);
+  } else {
+    phases.begin("Prewarm", cube_bytes);
+    utility::prewarm_region(image_data, cube_bytes, num_threads);
+  }
+  phases.end();
+  utility::check_cache_state(cache, image_data, cube_bytes, file_names);
+}
+
 std::vector<double> read_timestamp(const size_t size_k) {
   std::vector<double> timestamp_list;
 
@@ -96,12 +125,47 @@ std::vector<double> read_timestamp(const size_t size_k) {
   return timestamp_list;
 }
 
+/// \brief Draws random vectors that start in the first frame of the cube
+class random_vector_generator {
+ public:
+  random_vector_generator(const cube<pixel_type> &cube, const unsigned int seed)
+      : m_rnd_engine(seed),
+        m_x_start_dist(0, std::get<0>(cube.size()) - 1),
+        m_y_start_dist(0, std::get<1>(cube.size()) - 1),
+        m_x_beta_dist(3, 2),
+        m_y_beta_dist(3, 2),
+        m_plus_or_minus(0, 1) {}
+
+  vector_xy operator()() {
+    const double x_intercept = m_x_start_dist(m_rnd_engine);
+    const double y_intercept = m_y_start_dist(m_rnd_engine);
+
+    // Changed to the const value to 2 from 25 so that vectors won't access
+    // out of range of the cube with a large number of frames
+    //
+    // This is a temporary measures
+    const double x_slope = m_x_beta_dist(m_rnd_engine) * 2 * (m_plus_or_minus(m_rnd_engine) ? -1 : 1);
+    const double y_slope = m_y_beta_dist(m_rnd_engine) * 2 * (m_plus_or_minus(m_rnd_engine) ? -1 : 1);
+
+    return vector_xy{x_slope, x_intercept, y_slope, y_intercept};
+  }
+
+ private:
+  std::mt19937 m_rnd_engine;
+  std::uniform_int_distribution<int> m_x_start_dist;
+  std::uniform_int_distribution<int> m_y_start_dist;
+  beta_distribution m_x_beta_dist;
+  beta_distribution m_y_beta_dist;
+  std::uniform_int_distribution<int> m_plus_or_minus;
+};
+
 std::pair<double, std::vector<std::pair<pixel_type, vector_xy>>>
-shoot_vector(const cube<pixel_type> &cube, const std::size_t num_random_vector) {
+shoot_vector(const cube<pixel_type> &cube, const std::size_t num_random_vector, utility::metrics &metrics) {
   // Array to store results of the median calculation
   std::vector<std::pair<pixel_type, vector_xy>> result(num_random_vector);
 
-  double total_execution_time = 0.0;
+  const utility::metrics::id latency_id = metrics.histogram("median latency", "ns");
+  const utility::metrics::id vectors_id = metrics.counter("vectors");
   int numthreads = 1;
 
 #ifdef _OPENMP
@@ -114,45 +178,88 @@ shoot_vector(const cube<pixel_type> &cube, const std::size_t num_random_vector)
       numthreads = omp_get_num_threads();
       std::cout << "num threads: " << numthreads << std::endl;
     }
-    std::mt19937 rnd_engine(123 + omp_get_thread_num());
+    random_vector_generator next_vector(cube, 123 + omp_get_thread_num());
 #else
-    std::mt19937 rnd_engine(123);
+    random_vector_generator next_vector(cube, 123);
 #endif
-    std::uniform_int_distribution<int> x_start_dist(0, std::get<0>(cube.size()) - 1);
-    std::uniform_int_distribution<int> y_start_dist(0, std::get<1>(cube.size()) - 1);
-    beta_distribution x_beta_dist(3, 2);
-    beta_distribution y_beta_dist(3, 2);
-    std::uniform_int_distribution<int> plus_or_minus(0, 1);
+    utility::metrics::thread_slot &slot = metrics.local();
 
     // Shoot random vectors using multiple threads
 #ifdef _OPENMP
 #pragma omp for
 #endif
     for (int i = 0; i < num_random_vector; ++i) {
-      const double x_intercept = x_start_dist(rnd_engine);
-      const double y_intercept = y_start_dist(rnd_engine);
-
-      // Changed to the const value to 2 from 25 so that vectors won't access
-      // out of range of the cube with a large number of frames
-      //
-      // This is a temporary measures
-      const double x_slope = x_beta_dist(rnd_engine) * 2 * (plus_or_minus(rnd_engine) ? -1 : 1);
-      const double y_slope = y_beta_dist(rnd_engine) * 2 * (plus_or_minus(rnd_engine) ? -1 : 1);
-
-      vector_xy vector{x_slope, x_intercept, y_slope, y_intercept};
+      const vector_xy vector = next_vector();
 
       cube_iterator_with_vector<pixel_type> begin(cube, vector, 0.0);
       cube_iterator_with_vector<pixel_type> end(cube, vector);
 
       // median calculation using Torben algorithm
-      const auto start = utility::elapsed_time_sec();
+      const uint64_t start = utility::tsc_clock::ns();
       result[i].first = torben(begin, end);
-      total_execution_time += utility::elapsed_time_sec(start);
+      slot.record(latency_id, utility::tsc_clock::ns() - start);
+      slot.add(vectors_id);
       result[i].second = vector;
     }
   }
 
-  return std::make_pair(total_execution_time / numthreads, result);
+  // Time of the median calculations per thread
+  return std::make_pair(metrics.merged(latency_id).sum() / 1e9 / numthreads, result);
+}
+
+/// \brief shoot_vector on the work-stealing task runtime (see utility/task_scheduler.hpp)
+/// The vectors are shot in batches. The pixels of a batch are gathered first,
+/// in an I/O scope, so that another worker computes medians while this one
+/// waits for the pixels to be paged in; the medians are then computed from
+/// memory. Every batch has its own random engine, so the vectors do not
+/// depend on the scheduling.
+std::pair<double, std::vector<std::pair<pixel_type, vector_xy>>>
+shoot_vector(const cube<pixel_type> &cube, const std::size_t num_random_vector, utility::task_scheduler &scheduler,
+             utility::metrics &metrics) {
+  std::vector<std::pair<pixel_type, vector_xy>> result(num_random_vector);
+
+  const utility::metrics::id latency_id = metrics.histogram("median latency", "ns");
+  const utility::metrics::id gather_id = metrics.histogram("batch gather latency", "ns");
+  const utility::metrics::id vectors_id = metrics.counter("vectors");
+  std::cout << "num threads: " << scheduler.num_threads() << " (+" << scheduler.num_io_workers() << " I/O workers)"
+            << std::endl;
+
+  const std::size_t num_batches = (num_random_vector + k_vectors_per_batch - 1) / k_vectors_per_batch;
+  scheduler.parallel_for(0, num_batches, [&](const uint64_t first_batch, const uint64_t last_batch) {
+    utility::metrics::thread_slot &slot = metrics.slot(utility::task_scheduler::worker_index());
+    std::vector<pixel_type> values;
+    std::vector<std::size_t> offsets;
+    for (uint64_t batch = first_batch; batch < last_batch; ++batch) {
+      random_vector_generator next_vector(cube, 123 + batch);
+      const std::size_t first = batch * k_vectors_per_batch;
+      const std::size_t last = std::min(first + k_vectors_per_batch, num_random_vector);
+
+      values.clear();
+      offsets.assign(1, 0);
+      {
+        utility::task_scheduler::io_scope io(scheduler);
+        const uint64_t start = utility::tsc_clock::ns();
+        for (std::size_t i = first; i < last; ++i) {
+          result[i].second = next_vector();
+          cube_iterator_with_vector<pixel_type> begin(cube, result[i].second, 0.0);
+          cube_iterator_with_vector<pixel_type> end(cube, result[i].second);
+          for (auto itr = begin; itr != end; ++itr) values.push_back(*itr);
+          offsets.push_back(values.size());
+        }
+        slot.record(gather_id, utility::tsc_clock::ns() - start);
+      }
+
+      for (std::size_t i = first; i < last; ++i) {
+        const uint64_t start = utility::tsc_clock::ns();
+        result[i].first = torben(values.begin() + offsets[i - first], values.begin() + offsets[i - first + 1]);
+        slot.record(latency_id, utility::tsc_clock::ns() - start);
+        slot.add(vectors_id);
+      }
+    }
+  }, 1);
+
+  // Time of the median calculations per thread
+  return std::make_pair(metrics.merged(latency_id).sum() / 1e9 / scheduler.num_threads(), result);
 }
 
 void print_top_median(const cube<pixel_type> &cube,
@@ -201,25 +308,43 @@ int main(int argc, char **argv) {
   omp_set_num_threads(options.numthreads);
 #endif
 
+  const auto scheduler = utility::task_scheduler_from_env();
+  utility::phase_recorder phases("run_random_vector", scheduler ? scheduler->num_workers() : 0);
+  utility::metrics &metrics = phases.metrics();
+
   size_t size_x; size_t size_y; size_t size_k;
   pixel_type *image_data;
+  phases.begin("map FITS");
   map_fits(options.filename, &size_x, &size_y, &size_k, &image_data);
   cube<pixel_type> cube(size_x, size_y, size_k, image_data, read_timestamp(size_k));
+  phases.end();
+
+  const utility::cache_mode cache = options.cold ? utility::cache_mode::cold
+                                  : (options.warm ? utility::cache_mode::warm : utility::cache_mode::as_is);
+  set_cache_state(cache, image_data, size_x * size_y * size_k * sizeof(pixel_type),
+                  fits_file_names(options.filename, size_k), options.numthreads, phases);
 
   const std::size_t num_random_vector = get_num_vectors();
 
   const auto start = utility::elapsed_time_sec();
-  auto result = shoot_vector(cube, num_random_vector);
+  phases.begin("shoot vectors");
+  auto result = scheduler ? shoot_vector(cube, num_random_vector, *scheduler, metrics)
+                         : shoot_vector(cube, num_random_vector, metrics);
+  phases.end();
+  if (scheduler) utility::record_task_scheduler_stats(*scheduler, metrics);
   double txt = utility::elapsed_time_sec(start);
   double thread_exec = result.first;
 
   std::cout << "#of vectors = " << num_random_vector
             << "\nexecution time (sec) = " << txt
+            << "\nmedian calculation time per thread (sec) = " << thread_exec
             << "\nvectors/sec = " << static_cast<double>(num_random_vector) / txt << std::endl;
 
   print_top_median(cube, std::min(num_random_vector, static_cast<size_t>(10)), result.second);
 
+  phases.begin("free cube");
   utility::umap_fits_file::PerFits_free_cube(image_data);
+  phases.finish();
 
   return 0;
 }
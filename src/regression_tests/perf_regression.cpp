@@ -0,0 +1,288 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2019 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+
+// Performance regression check: runs a command several times, reads back the
+// phases it records (PHASE_LOG_FILE, see utility/phase.hpp), and compares the
+// runtime, page faults and throughput of the phases with the baselines of the
+// test on this host. A metric regresses when the whole 95% confidence interval
+// of its mean is outside of the tolerance band around the baseline, so noise
+// alone does not fail a test. A test without baselines for the host is
+// skipped. With --update, the baselines of the test on the host are replaced
+// by the measured ones instead.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+#include <unistd.h>
+
+#include "../umap_bench/bench_runner.hpp"
+#include "../utility/statistics.hpp"
+
+using namespace std;
+
+/// ctest reports a test that returns this code as skipped (SKIP_RETURN_CODE)
+static const int k_skip_return_code = 77;
+
+static void usage(const char *pname) {
+  std::cerr
+    << "Usage: " << pname << " --name NAME --baselines FILE [options] -- command [args...]\n\n"
+    << " --name NAME          - name of the test in the baselines file\n"
+    << " --baselines FILE     - CSV file of baselines: host,test,metric,count,mean,stddev,tolerance\n"
+    << " --host NAME          - machine whose baselines are used; default: the host name\n"
+    << " --phases A,B         - phases to check; default: the wall time of the process\n"
+    << " --repetitions N      - measured runs; default: 5\n"
+    << " --warmup N           - unmeasured runs before them; default: 1\n"
+    << " --tolerance F        - tolerance band of new baselines (0.25: +/-25%); default: 0.25\n"
+    << " --env NAME=VALUE     - added to the environment of the command; may be repeated\n"
+    << " --log FILE           - output of the command; default: NAME.log\n"
+    << " --update             - replace the baselines of the test with the measured values\n"
+    << std::endl;
+  exit(1);
+}
+
+/// \brief Whether a larger value of a metric is better (throughput) or worse (time, faults)
+static bool higher_is_better(const std::string &metric) {
+  const std::string suffix = "mb_per_sec";
+  return metric.size() >= suffix.size() && metric.compare(metric.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+struct baseline {
+  std::string host;
+  std::string test;
+  std::string metric;
+  std::size_t count{0};
+  double mean{0.0};
+  double stddev{0.0};
+  double tolerance{0.0};
+};
+
+/// \brief Limits of the tolerance band of a baseline: its mean +/- a width
+/// The width is tolerance x mean, and at least the timer and scheduling noise
+/// of short phases (k_wall_slack_sec, also in the throughput of the phase) and
+/// the faults of the runtime itself (k_fault_slack).
+static void tolerance_band(const baseline &b, const std::vector<baseline> &baselines, double *low, double *high) {
+  const double k_wall_slack_sec = 0.002;
+  const double k_fault_slack = 16.0;
+
+  double width = b.tolerance * b.mean;
+  if (b.metric.find("wall_sec") != std::string::npos) {
+    width = std::max(width, k_wall_slack_sec);
+  } else if (b.metric.find("faults") != std::string::npos) {
+    width = std::max(width, k_fault_slack);
+  } else if (higher_is_better(b.metric)) {
+    const std::string phase = b.metric.substr(0, b.metric.rfind('.'));
+    for (const auto &wall : baselines) {
+      if (wall.host == b.host && wall.test == b.test && wall.metric == phase + ".wall_sec" && wall.mean > 0.0)
+        width = std::max(width, b.mean * k_wall_slack_sec / wall.mean);
+    }
+  }
+  *low = b.mean - width;
+  *high = b.mean + width;
+}
+
+static std::vector<baseline> read_baselines(const std::string &file_name) {
+  std::vector<baseline> baselines;
+  std::ifstream ifs(file_name);
+  std::string line;
+  for (int line_number = 1; std::getline(ifs, line); ++line_number) {
+    if (line.empty() || line[0] == '#' || line.compare(0, 5, "host,") == 0) continue;
+    const std::vector<std::string> fields = umap_bench::split_list(line);
+    if (fields.size() != 7) {
+      std::cerr << file_name << ":" << line_number << ": expected 7 fields: " << line << std::endl;
+      exit(1);
+    }
+    baseline b;
+    b.host = fields[0];
+    b.test = fields[1];
+    b.metric = fields[2];
+    b.count = std::stoul(fields[3]);
+    b.mean = std::stod(fields[4]);
+    b.stddev = std::stod(fields[5]);
+    b.tolerance = std::stod(fields[6]);
+    baselines.push_back(b);
+  }
+  return baselines;
+}
+
+static void write_baselines(const std::string &file_name, const std::vector<baseline> &baselines) {
+  std::ofstream ofs(file_name);
+  if (!ofs.is_open()) {
+    std::cerr << "Failed to write " << file_name << std::endl;
+    exit(1);
+  }
+  ofs << "host,test,metric,count,mean,stddev,tolerance\n";
+  for (const auto &b : baselines)
+    ofs << b.host << "," << b.test << "," << b.metric << "," << b.count << "," << b.mean << "," << b.stddev << ","
+        << b.tolerance << "\n";
+}
+
+int main(int argc, char **argv)
+{
+  std::string name;
+  std::string host;
+  std::string baselines_file_name;
+  std::vector<std::string> phases;
+  int repetitions = 5;
+  int warmup = 1;
+  double tolerance = 0.25;
+  bool update = false;
+  umap_bench::run_spec spec;
+
+  int i = 1;
+  for (; i < argc; ++i) {
+    const std::string arg = argv[i];
+    auto value = [&]() -> std::string {
+      if (i + 1 >= argc) usage(argv[0]);
+      return argv[++i];
+    };
+    if (arg == "--") {
+      ++i;
+      break;
+    }
+    if (arg == "--name") name = value();
+    else if (arg == "--baselines") baselines_file_name = value();
+    else if (arg == "--host") host = value();
+    else if (arg == "--phases") phases = umap_bench::split_list(value());
+    else if (arg == "--repetitions") repetitions = std::atoi(value().c_str());
+    else if (arg == "--warmup") warmup = std::atoi(value().c_str());
+    else if (arg == "--tolerance") tolerance = std::atof(value().c_str());
+    else if (arg == "--log") spec.log_file_name = value();
+    else if (arg == "--update") update = true;
+    else if (arg == "--env") {
+      const std::string kv = value();
+      const std::size_t eq = kv.find('=');
+      if (eq == std::string::npos) usage(argv[0]);
+      spec.env.emplace_back(kv.substr(0, eq), kv.substr(eq + 1));
+    } else {
+      usage(argv[0]);
+    }
+  }
+  for (; i < argc; ++i) spec.args.push_back(argv[i]);
+  if (name.empty() || baselines_file_name.empty() || spec.args.empty() || repetitions < 2 || warmup < 0
+      || tolerance <= 0.0)
+    usage(argv[0]);
+  if (spec.log_file_name == "/dev/null") spec.log_file_name = name + ".log";
+  if (host.empty()) {
+    char host_name[256] = {0};
+    if (gethostname(host_name, sizeof(host_name) - 1) != 0) {
+      std::cerr << "Failed to get the host name; pass --host" << std::endl;
+      return 1;
+    }
+    host = host_name;
+  }
+
+  // Metric name -> samples, in the order the metrics are first seen
+  std::vector<std::string> metric_names;
+  std::map<std::string, std::vector<double>> samples;
+  auto add = [&](const std::string &metric, const double value) {
+    if (samples.count(metric) == 0) metric_names.push_back(metric);
+    samples[metric].push_back(value);
+  };
+
+  std::cout << "[" << name << "] " << umap_bench::command_line(spec) << std::endl;
+  for (int rep = -warmup; rep < repetitions; ++rep) {
+    const umap_bench::run_output out = umap_bench::run_command(spec);
+    if (!out.ok) {
+      std::cerr << "[" << name << "] run " << rep << " failed (exit status " << out.exit_status << "), see "
+                << spec.log_file_name << std::endl;
+      return 1;
+    }
+    if (rep < 0) continue;
+
+    if (phases.empty()) {
+      add("wall_sec", out.wall_sec);
+      continue;
+    }
+    for (const auto &phase : phases) {
+      const utility::phase_record *p = umap_bench::find_phase(out, phase);
+      if (p == nullptr) {
+        std::cerr << "[" << name << "] the command did not record phase " << phase << std::endl;
+        return 1;
+      }
+      add(phase + ".wall_sec", p->wall_sec);
+      add(phase + ".faults", p->minor_faults + p->major_faults);
+      if (p->data_bytes)
+        add(phase + ".data_mb_per_sec", p->data_bytes / (p->wall_sec > 0.0 ? p->wall_sec : 1e-9) / 1e6);
+    }
+  }
+
+  std::vector<baseline> baselines = read_baselines(baselines_file_name);
+
+  if (update) {
+    std::vector<baseline> kept;
+    for (const auto &b : baselines)
+      if (b.host != host || b.test != name) kept.push_back(b);
+    for (const auto &metric : metric_names) {
+      const utility::sample_summary s = utility::summarize(samples[metric]);
+      baseline b;
+      b.host = host;
+      b.test = name;
+      b.metric = metric;
+      b.count = s.count;
+      b.mean = s.mean;
+      b.stddev = s.stddev;
+      b.tolerance = tolerance;
+      // The tolerance band of a metric already checked is kept
+      for (const auto &old : baselines)
+        if (old.host == host && old.test == name && old.metric == metric) b.tolerance = old.tolerance;
+      kept.push_back(b);
+    }
+    write_baselines(baselines_file_name, kept);
+    std::cout << "[" << name << "] baselines of " << host << " written to " << baselines_file_name << std::endl;
+    return 0;
+  }
+
+  std::printf("%-32s %14s %14s %14s %8s  %s\n", "metric", "baseline", "mean", "95% CI +/-", "ratio", "status");
+  int checked = 0;
+  int regressions = 0;
+  for (const auto &metric : metric_names) {
+    const utility::sample_summary s = utility::summarize(samples[metric]);
+    const baseline *b = nullptr;
+    for (const auto &candidate : baselines)
+      if (candidate.host == host && candidate.test == name && candidate.metric == metric) b = &candidate;
+    if (b == nullptr) {
+      std::printf("%-32s %14s %14.6g %14.6g %8s  no baseline\n", metric.c_str(), "-", s.mean, s.ci_high - s.mean,
+          "-");
+      continue;
+    }
+    ++checked;
+
+    double low;
+    double high;
+    tolerance_band(*b, baselines, &low, &high);
+    const char *status = "ok";
+    if (higher_is_better(metric)) {
+      if (s.ci_high < low) status = "REGRESSION";
+      else if (s.ci_low > high) status = "improved";
+    } else {
+      if (s.ci_low > high) status = "REGRESSION";
+      else if (s.ci_high < low) status = "improved";
+    }
+    if (std::string(status) == "REGRESSION") ++regressions;
+    std::printf("%-32s %14.6g %14.6g %14.6g %8.3f  %s\n", metric.c_str(), b->mean, s.mean, s.ci_high - s.mean,
+        b->mean != 0.0 ? s.mean / b->mean : 0.0, status);
+  }
+
+  if (checked == 0) {
+    std::cout << "[" << name << "] no baselines of " << host << " in " << baselines_file_name
+              << "; run with --update to record them" << std::endl;
+    return k_skip_return_code;
+  }
+  if (regressions) {
+    std::cout << "[" << name << "] " << regressions << " metric(s) regressed beyond the tolerance band" << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,613 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#include <unistd.h>
+#include <getopt.h>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <random>
+#include <functional>
+
+#include "umap/umap.h"
+#include "sparse_matrix.hpp"
+#include "../utility/umap_file.hpp"
+#include "../utility/file.hpp"
+#include "../utility/mmap.hpp"
+#include "../utility/phase.hpp"
+#include "../utility/memory_pressure.hpp"
+#include "../utility/metrics.hpp"
+#include "../utility/cache_control.hpp"
+
+enum class solver_kind {
+  power,  // y = W x, x = y / |y|
+  jacobi, // x = D^-1 (b + W x)
+  cg      // conjugate gradient on A = D - W
+};
+
+struct spmv_options {
+  size_t num_vertices{0};
+  size_t num_edges{0};
+  std::string graph_file_name;
+  std::string values_file_name;
+  solver_kind solver{solver_kind::power};
+  size_t num_iterations{20};
+  size_t block_nonzeros{1ULL << 16};
+  size_t sell_chunk_height{0}; // 0: CSR
+  size_t sell_sort_window{1024};
+  bool map_vectors{false};
+  bool use_mmap{false};
+  bool validate{false};
+  utility::cache_mode cache{utility::cache_mode::as_is};
+};
+
+const char *solver_name(const solver_kind solver) {
+  switch (solver) {
+    case solver_kind::power: return "spmv";
+    case solver_kind::jacobi: return "jacobi";
+    case solver_kind::cg: return "cg";
+  }
+  return "unknown";
+}
+
+void disp_umap_env_variables() {
+  std::cout
+      << "Environment Variable Configuration (command line arguments obsolete):\n"
+      << "UMAP_PAGESIZE                   - currently: " << umapcfg_get_umap_page_size() << " bytes\n"
+      << "UMAP_PAGE_FILLERS               - currently: " << umapcfg_get_num_fillers() << " fillers\n"
+      << "UMAP_PAGE_EVICTORS              - currently: " << umapcfg_get_num_evictors() << " evictors\n"
+      << "UMAP_READ_AHEAD                 - currently: " << umapcfg_get_read_ahead() << " pages\n"
+      << "UMAP_BUFSIZE                    - currently: " << umapcfg_get_max_pages_in_buffer() << " pages\n"
+      << "UMAP_EVICT_LOW_WATER_THRESHOLD  - currently: " << umapcfg_get_evict_low_water_threshold() << " percent full\n"
+      << "UMAP_EVICT_HIGH_WATER_THRESHOLD - currently: " << umapcfg_get_evict_high_water_threshold()
+      << " percent full\n"
+      << "MEMORY_PRESSURE_FREE, MEMORY_PRESSURE_SCHEDULE, MEMORY_PRESSURE_PERIOD, MEMORY_PRESSURE_BACKEND\n"
+      << "                                - memory left for the run, see utility/memory_pressure.hpp\n"
+      << std::endl;
+}
+
+void usage() {
+  std::cout << "SpMV options:\n"
+            << "-n\t#vertices (rows)\n"
+            << "-m\t#edges (nonzeros)\n"
+            << "-g\tGraph file name (CSR graph of ingest_edge_list)\n"
+            << "-w\tValues file name; generated if it does not exist (default: <graph file>.values)\n"
+            << "-k\tKernel: spmv (power iteration), jacobi or cg (default: spmv)\n"
+            << "-i\t#iterations (default: 20)\n"
+            << "-b\t#nonzeros per row block (default: 65536)\n"
+            << "-s\tUse system mmap\n"
+            << "--sell C\tConvert the matrix to SELL-C-sigma, C = 4, 8, 16 or 32\n"
+            << "--sigma S\tSorting window of SELL-C-sigma, in rows (default: 1024)\n"
+            << "--map-vectors\tKeep the vectors in a mapped file (<graph file>.vectors) instead of DRAM\n"
+            << "--validate\tCheck the SpMV against a serial one and the solution of jacobi and cg\n"
+            << "--cold\tEvict the matrix from memory before the iterations\n"
+            << "--warm\tRead the matrix into memory before the iterations" << std::endl;
+
+  disp_umap_env_variables();
+}
+
+void parse_options(int argc, char **argv, spmv_options &options) {
+  static const struct option long_options[] = {
+      {"sell", required_argument, nullptr, 'L'},
+      {"sigma", required_argument, nullptr, 'S'},
+      {"map-vectors", no_argument, nullptr, 'V'},
+      {"validate", no_argument, nullptr, 'X'},
+      {"cold", no_argument, nullptr, 'C'},
+      {"warm", no_argument, nullptr, 'W'},
+      {nullptr, 0, nullptr, 0}
+  };
+  int c;
+  while ((c = getopt_long(argc, argv, "n:m:g:w:k:i:b:sh", long_options, nullptr)) != -1) {
+    switch (c) {
+      case 'n': /// Required
+        options.num_vertices = std::stoull(optarg);
+        break;
+
+      case 'm': /// Required
+        options.num_edges = std::stoull(optarg);
+        break;
+
+      case 'g': /// Required
+        options.graph_file_name = optarg;
+        break;
+
+      case 'w':options.values_file_name = optarg;
+        break;
+
+      case 'k': {
+        const std::string name(optarg);
+        if (name == "spmv") options.solver = solver_kind::power;
+        else if (name == "jacobi") options.solver = solver_kind::jacobi;
+        else if (name == "cg") options.solver = solver_kind::cg;
+        else {
+          std::cerr << "Unknown kernel: " << name << std::endl;
+          std::exit(1);
+        }
+        break;
+      }
+
+      case 'i':options.num_iterations = std::stoull(optarg);
+        break;
+
+      case 'b':options.block_nonzeros = std::stoull(optarg);
+        break;
+
+      case 's':options.use_mmap = true;
+        break;
+
+      case 'L':options.sell_chunk_height = std::stoull(optarg);
+        break;
+
+      case 'S':options.sell_sort_window = std::stoull(optarg);
+        break;
+
+      case 'V':options.map_vectors = true;
+        break;
+
+      case 'X':options.validate = true;
+        break;
+
+      case 'C':options.cache = utility::cache_mode::cold;
+        break;
+
+      case 'W':options.cache = utility::cache_mode::warm;
+        break;
+
+      case 'h':usage();
+        std::exit(0);
+
+      default:usage();
+        std::exit(1);
+    }
+  }
+
+  if (options.num_vertices == 0 || options.num_edges == 0 || options.graph_file_name.empty()) {
+    std::cerr << "-n, -m and -g are required" << std::endl;
+    std::exit(1);
+  }
+  if (options.sell_chunk_height != 0 && !spmv::supported_chunk_height(options.sell_chunk_height)) {
+    std::cerr << "Unsupported SELL chunk height " << options.sell_chunk_height << "; use 4, 8, 16 or 32" << std::endl;
+    std::exit(1);
+  }
+  if (options.sell_sort_window == 0 || options.block_nonzeros == 0) {
+    std::cerr << "--sigma and -b must be positive" << std::endl;
+    std::exit(1);
+  }
+  if (options.values_file_name.empty()) options.values_file_name = options.graph_file_name + ".values";
+}
+
+void disp_spmv_options(const spmv_options &options) {
+  std::cout << "SpMV options:"
+            << "\n#vertices: " << options.num_vertices
+            << "\n#edges: " << options.num_edges
+            << "\nGraph file: " << options.graph_file_name
+            << "\nValues file: " << options.values_file_name
+            << "\nKernel: " << solver_name(options.solver)
+            << "\n#iterations: " << options.num_iterations
+            << "\n#nonzeros per row block: " << options.block_nonzeros
+            << "\nSELL chunk height: " << options.sell_chunk_height
+            << "\nSELL sorting window: " << options.sell_sort_window
+            << "\nMapped vectors: " << options.map_vectors
+            << "\nUse system mmap: " << options.use_mmap
+            << "\nCache: " << utility::cache_mode_name(options.cache) << std::endl;
+}
+
+/// \brief A file mapped with umap or mmap
+struct mapped_file {
+  std::string name;
+  size_t size{0};
+  void *addr{nullptr};
+};
+
+// Umap requires page size aligned files
+size_t umap_page_aligned_size(const size_t size) {
+  const size_t page_size = umapcfg_get_umap_page_size();
+  return (size + page_size - 1) / page_size * page_size;
+}
+
+/// \brief Maps a file of size bytes; creates it if it does not exist with that size (or if create is true)
+/// \return The mapping and whether the file was created
+std::pair<mapped_file, bool> map_file(const std::string &file_name, const size_t size, const bool use_mmap,
+                                      bool create) {
+  create = create || utility::get_file_size(file_name) != static_cast<ssize_t>(size);
+  mapped_file file;
+  file.name = file_name;
+  file.size = size;
+  file.addr = utility::map_in_file(file_name, false, !create, use_mmap, size, nullptr);
+  if (!file.addr) {
+    std::cerr << "Failed to map " << file_name << std::endl;
+    std::abort();
+  }
+  return std::make_pair(file, create);
+}
+
+mapped_file map_graph(const spmv_options &options) {
+  const size_t size = umap_page_aligned_size((options.num_vertices + 1 + options.num_edges) * sizeof(uint64_t));
+  if (!options.use_mmap && !utility::extend_file_size(options.graph_file_name, size)) {
+    std::cerr << "Failed to extend the graph file to " << size << std::endl;
+    std::abort();
+  }
+  return map_file(options.graph_file_name, utility::get_file_size(options.graph_file_name),
+                  options.use_mmap, false).first;
+}
+
+/// \brief Writes the symmetric weight of every edge
+void generate_values(const uint64_t num_rows, const uint64_t *const index, const uint64_t *const columns,
+                     double *const values) {
+#pragma omp parallel for schedule(dynamic, 1024)
+  for (uint64_t row = 0; row < num_rows; ++row) {
+    for (uint64_t i = index[row]; i < index[row + 1]; ++i)
+      values[i] = spmv::edge_weight(row, columns[i]);
+  }
+}
+
+/// \brief The solver vectors, in DRAM or in one mapped file (one page aligned vector after another)
+class vector_set {
+ public:
+  vector_set(const size_t num_vectors, const size_t length, const spmv_options &options) {
+    if (!options.map_vectors) {
+      m_dram.assign(num_vectors * length, 0.0);
+      for (size_t v = 0; v < num_vectors; ++v) m_vectors.push_back(m_dram.data() + v * length);
+      return;
+    }
+    const size_t stride = umap_page_aligned_size(length * sizeof(double));
+    m_file = map_file(options.graph_file_name + ".vectors", num_vectors * stride, options.use_mmap, true).first;
+    for (size_t v = 0; v < num_vectors; ++v)
+      m_vectors.push_back(reinterpret_cast<double *>(static_cast<char *>(m_file.addr) + v * stride));
+  }
+
+  double *operator[](const size_t v) { return m_vectors[v]; }
+
+  void unmap(const bool use_mmap) {
+    if (m_file.addr) utility::unmap_file(use_mmap, m_file.size, m_file.addr);
+    m_file.addr = nullptr;
+  }
+
+ private:
+  std::vector<double> m_dram;
+  mapped_file m_file;
+  std::vector<double *> m_vectors;
+};
+
+double dot(const uint64_t n, const double *const x, const double *const y) {
+  double sum = 0.0;
+#pragma omp parallel for reduction(+:sum)
+  for (uint64_t i = 0; i < n; ++i) sum += x[i] * y[i];
+  return sum;
+}
+
+// Exact solution of the linear systems
+double exact_solution(const uint64_t i) {
+  return 1.0 + static_cast<double>(i % 10) / 10.0;
+}
+
+/// \brief Compares y = W x with a serial CSR SpMV for a random x
+bool validate_multiply(const spmv::csr_matrix &a,
+                       const std::function<void(const double *, double *)> &multiply) {
+  std::mt19937_64 rnd(123);
+  std::uniform_real_distribution<double> dist(-1.0, 1.0);
+  std::vector<double> x(a.num_rows);
+  for (auto &v : x) v = dist(rnd);
+  std::vector<double> y(a.num_rows, 0.0);
+  multiply(x.data(), y.data());
+
+  double max_error = 0.0;
+  for (uint64_t row = 0; row < a.num_rows; ++row) {
+    double sum = 0.0;
+    for (uint64_t i = a.index[row]; i < a.index[row + 1]; ++i) sum += a.values[i] * x[a.columns[i]];
+    max_error = std::max(max_error, std::fabs(y[row] - sum) / std::max(1.0, std::fabs(sum)));
+  }
+  std::cout << "SpMV max relative error\t" << max_error << std::endl;
+  return max_error <= 1e-12;
+}
+
+/// \brief Makes the mapped matrix files cold or warm and checks them
+void set_cache_state(const spmv_options &options, std::vector<mapped_file> &files,
+                     utility::phase_recorder &phases) {
+  size_t total_size = 0;
+  for (const auto &f : files) total_size += f.size;
+  if (options.cache == utility::cache_mode::cold) {
+    phases.begin("Evict");
+    for (auto &f : files) {
+      if (!utility::evict_mapped_file(f.name, options.use_mmap, f.size, f.addr)) {
+        std::cerr << "Failed to map " << f.name << " again" << std::endl;
+        std::abort();
+      }
+    }
+  } else {
+    phases.begin("Prewarm", total_size);
+    for (const auto &f : files) utility::prewarm_region(f.addr, f.size, omp_get_max_threads());
+  }
+  phases.end();
+
+  double resident_size = 0.0;
+  for (const auto &f : files)
+    resident_size += utility::check_cache_state(options.cache, f.addr, f.size, {f.name}).region_resident * f.size;
+  phases.set_attribute("region_resident", total_size ? resident_size / total_size : 0.0);
+}
+
+void print_num_page_faults() {
+  const auto num_page_faults = utility::get_num_page_faults();
+  std::cout << "#of minor page faults\t" << num_page_faults.first << std::endl;
+  std::cout << "#of major page faults\t" << num_page_faults.second << std::endl;
+}
+
+int main(int argc, char **argv) {
+  spmv_options options;
+
+  parse_options(argc, argv, options);
+  disp_spmv_options(options);
+  if (!options.use_mmap) disp_umap_env_variables();
+  const auto pressure = utility::memory_pressure_from_env();
+
+  std::cout << "Initial #of page faults" << std::endl;
+  print_num_page_faults();
+
+  const bool use_sell = options.sell_chunk_height != 0;
+  std::string layout_name = "csr";
+  if (use_sell)
+    layout_name = "sell-" + std::to_string(options.sell_chunk_height) + "-" + std::to_string(options.sell_sort_window);
+
+  utility::phase_recorder phases("run_spmv");
+  phases.set_attribute("vertices", options.num_vertices);
+  phases.set_attribute("edges", options.num_edges);
+  phases.set_attribute("kernel", solver_name(options.solver));
+  phases.set_attribute("layout", layout_name);
+  phases.set_attribute("iterations", options.num_iterations);
+  phases.set_attribute("vectors", options.map_vectors ? "mapped" : "dram");
+  phases.set_attribute("usemmap", options.use_mmap);
+  phases.set_attribute("threads", omp_get_max_threads());
+  phases.set_attribute("cache", utility::cache_mode_name(options.cache));
+  if (pressure) phases.set_attribute("memory_pressure", utility::pressure_backend_name(pressure->backend()));
+
+  // ---------- Map the matrix ---------- //
+  phases.begin("umap INIT");
+  const mapped_file graph = map_graph(options);
+  spmv::csr_matrix csr;
+  csr.num_rows = options.num_vertices;
+  csr.index = static_cast<const uint64_t *>(graph.addr);
+  csr.columns = csr.index + options.num_vertices + 1;
+  if (csr.num_nonzeros() != options.num_edges) {
+    std::cerr << "The graph has " << csr.num_nonzeros() << " edges, not " << options.num_edges << std::endl;
+    std::abort();
+  }
+
+  const auto values_mapping = map_file(options.values_file_name,
+                                       umap_page_aligned_size(options.num_edges * sizeof(double)),
+                                       options.use_mmap, false);
+  const mapped_file values = values_mapping.first;
+  csr.values = static_cast<const double *>(values.addr);
+  if (values_mapping.second) {
+    phases.begin("Generate values", options.num_edges * sizeof(double));
+    generate_values(csr.num_rows, csr.index, csr.columns, static_cast<double *>(values.addr));
+  }
+
+  // ---------- Prepare the layout and the vectors ---------- //
+  phases.begin("Prepare");
+  const std::vector<uint64_t> blocks = spmv::make_row_blocks(csr, options.block_nonzeros);
+  spmv::sell_layout sell_layout;
+  spmv::sell_matrix sell;
+  mapped_file sell_file;
+  std::vector<mapped_file> matrix_files;
+  uint64_t matrix_bytes = 0; // read by one SpMV
+  if (use_sell) {
+    sell_layout = spmv::make_sell_layout(csr, options.sell_chunk_height, options.sell_sort_window);
+    const uint64_t num_entries = sell_layout.chunk_offsets.back();
+    const size_t columns_size = umap_page_aligned_size(num_entries * sizeof(uint64_t));
+    sell_file = map_file(options.graph_file_name + ".sell", columns_size + umap_page_aligned_size(num_entries * sizeof(double)),
+                         options.use_mmap, true).first;
+    uint64_t *const sell_columns = static_cast<uint64_t *>(sell_file.addr);
+    double *const sell_values = reinterpret_cast<double *>(static_cast<char *>(sell_file.addr) + columns_size);
+    spmv::fill_sell(csr, sell_layout, sell_columns, sell_values);
+    sell.layout = &sell_layout;
+    sell.columns = sell_columns;
+    sell.values = sell_values;
+    matrix_files.push_back(sell_file);
+    matrix_bytes = num_entries * (sizeof(uint64_t) + sizeof(double));
+
+    const double padding = static_cast<double>(num_entries) / std::max<uint64_t>(csr.num_nonzeros(), 1) - 1.0;
+    std::cout << "SELL-C-sigma: " << sell_layout.chunk_offsets.size() - 1 << " chunks, "
+              << num_entries << " entries, padding " << padding * 100.0 << " %" << std::endl;
+    phases.set_attribute("sell_padding", padding);
+  } else {
+    matrix_files.push_back(graph);
+    matrix_files.push_back(values);
+    matrix_bytes = (csr.num_rows + 1) * sizeof(uint64_t) + csr.num_nonzeros() * (sizeof(uint64_t) + sizeof(double));
+    std::cout << "Row blocks: " << blocks.size() - 1 << std::endl;
+  }
+
+  const std::function<void(const double *, double *)> multiply =
+      [&](const double *const x, double *const y) {
+        if (use_sell) spmv::multiply(sell, x, y);
+        else spmv::multiply(csr, blocks, x, y);
+      };
+
+  if (options.validate && !validate_multiply(csr, multiply)) {
+    std::cerr << "SpMV validation failed" << std::endl;
+    return 1;
+  }
+
+  const uint64_t n = csr.num_rows;
+  // power: x, y; jacobi: x, x_new, y = W x, b, d; cg: x, r, p, q = A p, b, d
+  enum { X = 0, Y = 1, R = 1, X_NEW = 1, P = 2, WX = 2, Q = 3, B = 4, D = 5 };
+  vector_set vectors(options.solver == solver_kind::power ? 2 : 6, n, options);
+  double *const x = vectors[X];
+  double rhs_norm = 1.0;
+  if (options.solver == solver_kind::power) {
+#pragma omp parallel for
+    for (uint64_t i = 0; i < n; ++i) x[i] = 1.0 / std::sqrt(static_cast<double>(n));
+  } else {
+    // d = 1 + W 1 and b = A x* = d x* - W x*
+    double *const b = vectors[B];
+    double *const d = vectors[D];
+    double *const tmp = vectors[Q];
+#pragma omp parallel for
+    for (uint64_t i = 0; i < n; ++i) x[i] = 1.0;
+    multiply(x, d);
+#pragma omp parallel for
+    for (uint64_t i = 0; i < n; ++i) {
+      d[i] += 1.0;
+      x[i] = exact_solution(i);
+    }
+    multiply(x, tmp);
+#pragma omp parallel for
+    for (uint64_t i = 0; i < n; ++i) {
+      b[i] = d[i] * x[i] - tmp[i];
+      x[i] = 0.0;
+    }
+    rhs_norm = std::sqrt(dot(n, b, b));
+    if (options.solver == solver_kind::cg) {
+      // x = 0, so r = p = b
+#pragma omp parallel for
+      for (uint64_t i = 0; i < n; ++i) vectors[R][i] = vectors[P][i] = b[i];
+    }
+  }
+  phases.end();
+
+  if (options.cache != utility::cache_mode::as_is) {
+    set_cache_state(options, matrix_files, phases);
+  }
+
+  // ---------- Iterations ---------- //
+  const uint64_t vector_flops = (options.solver == solver_kind::power) ? 3 : (options.solver == solver_kind::jacobi) ? 7 : 12;
+  const uint64_t flops_per_iteration = 2 * csr.num_nonzeros() + vector_flops * n;
+
+  utility::metrics &metrics = phases.metrics();
+  const auto iteration_time = metrics.histogram("iteration time", "ns");
+
+  std::cout << "Before the iterations #of page faults" << std::endl;
+  print_num_page_faults();
+  std::printf("%6s %12s %10s %12s %12s %10s %10s %14s\n",
+              "Iter", "Time(s)", "GFLOP/s", "Read(MB)", "Written(MB)", "MinorFlt", "MajorFlt",
+              options.solver == solver_kind::power ? "Norm" : "Residual");
+
+  // Data bytes are the bytes of the matrix read by all iterations
+  phases.begin("Solve", matrix_bytes * options.num_iterations);
+  double rr = (options.solver == solver_kind::cg) ? rhs_norm * rhs_norm : 0.0;
+  double total_sec = 0.0;
+  for (size_t iter = 0; iter < options.num_iterations; ++iter) {
+    const auto start_io = utility::get_io_bytes();
+    const auto start_faults = utility::get_num_page_faults();
+    const uint64_t start_ns = utility::tsc_clock::ns();
+    double value = 0.0; // norm or relative residual
+
+    if (options.solver == solver_kind::power) {
+      double *const y = vectors[Y];
+      metrics.begin("SpMV");
+      multiply(x, y);
+      metrics.end();
+      metrics.begin("vector");
+      const double norm = std::sqrt(dot(n, y, y));
+      const double scale = (norm > 0.0) ? 1.0 / norm : 0.0;
+#pragma omp parallel for
+      for (uint64_t i = 0; i < n; ++i) x[i] = y[i] * scale;
+      metrics.end();
+      value = norm;
+
+    } else if (options.solver == solver_kind::jacobi) {
+      double *const x_new = vectors[X_NEW];
+      double *const wx = vectors[WX];
+      const double *const b = vectors[B];
+      const double *const d = vectors[D];
+      metrics.begin("SpMV");
+      multiply(x, wx);
+      metrics.end();
+      metrics.begin("vector");
+      double residual = 0.0;
+#pragma omp parallel for reduction(+:residual)
+      for (uint64_t i = 0; i < n; ++i) {
+        const double r = b[i] - d[i] * x[i] + wx[i];
+        residual += r * r;
+        x_new[i] = (b[i] + wx[i]) / d[i];
+      }
+#pragma omp parallel for
+      for (uint64_t i = 0; i < n; ++i) x[i] = x_new[i];
+      metrics.end();
+      value = std::sqrt(residual) / rhs_norm;
+
+    } else {
+      double *const r = vectors[R];
+      double *const p = vectors[P];
+      double *const q = vectors[Q];
+      const double *const d = vectors[D];
+      metrics.begin("SpMV");
+      multiply(p, q);
+      metrics.end();
+      metrics.begin("vector");
+      double pq = 0.0;
+#pragma omp parallel for reduction(+:pq)
+      for (uint64_t i = 0; i < n; ++i) {
+        q[i] = d[i] * p[i] - q[i];
+        pq += p[i] * q[i];
+      }
+      const double alpha = (pq > 0.0) ? rr / pq : 0.0;
+      double rr_new = 0.0;
+#pragma omp parallel for reduction(+:rr_new)
+      for (uint64_t i = 0; i < n; ++i) {
+        x[i] += alpha * p[i];
+        r[i] -= alpha * q[i];
+        rr_new += r[i] * r[i];
+      }
+      const double beta = (rr > 0.0) ? rr_new / rr : 0.0;
+#pragma omp parallel for
+      for (uint64_t i = 0; i < n; ++i) p[i] = r[i] + beta * p[i];
+      rr = rr_new;
+      metrics.end();
+      value = std::sqrt(rr) / rhs_norm;
+    }
+
+    const uint64_t elapsed_ns = utility::tsc_clock::ns() - start_ns;
+    metrics.record(iteration_time, elapsed_ns);
+    const auto io = utility::get_io_bytes();
+    const auto faults = utility::get_num_page_faults();
+    const double sec = elapsed_ns / 1e9;
+    total_sec += sec;
+    std::printf("%6zu %12.6f %10.3f %12.2f %12.2f %10zu %10zu %14.6e\n",
+                iter, sec, flops_per_iteration / std::max(sec, 1e-9) / 1e9,
+                (io.first - start_io.first) / 1e6, (io.second - start_io.second) / 1e6,
+                faults.first - start_faults.first, faults.second - start_faults.second, value);
+  }
+  const utility::phase_record solve = phases.end();
+
+  const size_t iterations = std::max<size_t>(options.num_iterations, 1);
+  std::cout << "Iterations took (s)\t" << solve.wall_sec << std::endl;
+  std::cout << "GFLOP/s\t" << flops_per_iteration * options.num_iterations / std::max(total_sec, 1e-9) / 1e9 << std::endl;
+  std::cout << "Matrix MB per iteration\t" << matrix_bytes / 1e6 << std::endl;
+  std::cout << "Read MB per iteration\t" << solve.read_bytes / 1e6 / iterations << std::endl;
+  std::cout << "Written MB per iteration\t" << solve.write_bytes / 1e6 / iterations << std::endl;
+  std::cout << "Major page faults per iteration\t" << static_cast<double>(solve.major_faults) / iterations << std::endl;
+  std::cout << "After the iterations #of page faults" << std::endl;
+  print_num_page_faults();
+
+  bool valid = true;
+  if (options.validate && options.solver != solver_kind::power) {
+    double max_error = 0.0;
+    for (uint64_t i = 0; i < n; ++i)
+      max_error = std::max(max_error, std::fabs(x[i] - exact_solution(i)) / exact_solution(i));
+    std::cout << "Solution max relative error\t" << max_error << std::endl;
+    valid = max_error <= 1e-6;
+    if (!valid) std::cerr << "The solution did not converge; more iterations (-i) are needed" << std::endl;
+  }
+
+  phases.begin("umap TERM");
+  vectors.unmap(options.use_mmap);
+  if (use_sell) utility::unmap_file(options.use_mmap, sell_file.size, sell_file.addr);
+  utility::unmap_file(options.use_mmap, values.size, values.addr);
+  utility::unmap_file(options.use_mmap, graph.size, graph.addr);
+  phases.finish();
+
+  return valid ? 0 : 1;
+}
@@ -0,0 +1,209 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about the sparse matrix
+/// The matrix W is the CSR graph written by ingest_edge_list (an index array
+/// of #vertices + 1 offsets followed by the column of every edge, all
+/// uint64_t, in one file) plus a values file of one double per edge.
+/// Generated values are symmetric, w(u, v) = w(v, u) in (0.5, 1], so that
+/// for the symmetric graphs of rmat_edge_generator the solver matrix
+///   A = D - W,  D(i, i) = 1 + sum_j w(i, j)
+/// is symmetric and strictly diagonally dominant, hence positive definite:
+/// Jacobi converges for any graph and CG for a symmetric one.
+///  - Row blocks: the rows are cut into blocks of about the same number of
+///    nonzeros; the threads take blocks dynamically, so every thread streams
+///    contiguous ranges of the mapped matrix and hub rows do not unbalance
+///    the threads.
+///  - SELL-C-sigma (Kreutzer et al., SIAM J. Sci. Comput. 2014): within
+///    windows of sigma rows, the rows are sorted by length; every chunk of C
+///    rows is padded to its longest row and stored column by column, so that
+///    the C rows of a chunk are computed with SIMD. The chunks are written to
+///    a file that is mapped like the CSR arrays; the permutation and the
+///    chunk offsets are in DRAM.
+
+#ifndef UMAP_APPS_SPMV_SPARSE_MATRIX_HPP
+#define UMAP_APPS_SPMV_SPARSE_MATRIX_HPP
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <numeric>
+#include <iostream>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace spmv {
+
+/// \brief Symmetric pseudo-random weight of the edge (u, v), in (0.5, 1]
+inline double edge_weight(const uint64_t u, const uint64_t v) {
+  // splitmix64 of the unordered pair
+  uint64_t z = std::min(u, v) * 0x9E3779B97F4A7C15ULL + std::max(u, v) + 0x632BE59BD9B4E019ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  z ^= z >> 31;
+  return 0.5 + 0.5 * (static_cast<double>((z >> 11) + 1) / static_cast<double>(1ULL << 53));
+}
+
+/// \brief A CSR matrix whose arrays are mapped
+struct csr_matrix {
+  uint64_t num_rows{0};
+  const uint64_t *index{nullptr};   // num_rows + 1 offsets
+  const uint64_t *columns{nullptr}; // index[num_rows] columns
+  const double *values{nullptr};    // index[num_rows] values
+
+  uint64_t num_nonzeros() const { return index[num_rows]; }
+};
+
+/// \brief Cuts the rows into blocks of about nonzeros_per_block nonzeros
+/// \return The first row of every block, and num_rows at the end
+inline std::vector<uint64_t> make_row_blocks(const csr_matrix &a, const uint64_t nonzeros_per_block) {
+  std::vector<uint64_t> blocks(1, 0);
+  uint64_t block_start = a.index[0];
+  for (uint64_t row = 0; row < a.num_rows; ++row) {
+    if (a.index[row + 1] - block_start >= nonzeros_per_block) {
+      blocks.push_back(row + 1);
+      block_start = a.index[row + 1];
+    }
+  }
+  if (blocks.back() != a.num_rows) blocks.push_back(a.num_rows);
+  return blocks;
+}
+
+/// \brief y = W x, by row blocks
+inline void multiply(const csr_matrix &a, const std::vector<uint64_t> &blocks, const double *const x,
+                     double *const y) {
+  const int64_t num_blocks = blocks.size() - 1;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+  for (int64_t b = 0; b < num_blocks; ++b) {
+    for (uint64_t row = blocks[b]; row < blocks[b + 1]; ++row) {
+      double sum = 0.0;
+      for (uint64_t i = a.index[row]; i < a.index[row + 1]; ++i)
+        sum += a.values[i] * x[a.columns[i]];
+      y[row] = sum;
+    }
+  }
+}
+
+/// \brief Shape of a SELL-C-sigma matrix: everything but the entries
+struct sell_layout {
+  uint64_t chunk_height{0};             // C
+  uint64_t sort_window{0};              // sigma
+  uint64_t num_rows{0};
+  std::vector<uint64_t> chunk_offsets;  // first entry of every chunk, and the number of entries at the end
+  std::vector<uint64_t> permutation;    // row of the CSR matrix of every SELL row
+};
+
+/// \brief Sorts the rows of every window by length and sizes the chunks, reading the CSR index only
+inline sell_layout make_sell_layout(const csr_matrix &a, const uint64_t chunk_height, const uint64_t sort_window) {
+  sell_layout s;
+  s.chunk_height = chunk_height;
+  s.sort_window = sort_window;
+  s.num_rows = a.num_rows;
+  s.permutation.resize(a.num_rows);
+  std::iota(s.permutation.begin(), s.permutation.end(), 0);
+  auto length = [&a](const uint64_t row) { return a.index[row + 1] - a.index[row]; };
+  for (uint64_t first = 0; first < a.num_rows; first += sort_window) {
+    const uint64_t last = std::min(first + sort_window, a.num_rows);
+    std::stable_sort(s.permutation.begin() + first, s.permutation.begin() + last,
+                     [&length](const uint64_t r1, const uint64_t r2) { return length(r1) > length(r2); });
+  }
+
+  const uint64_t num_chunks = (a.num_rows + chunk_height - 1) / chunk_height;
+  s.chunk_offsets.assign(num_chunks + 1, 0);
+  for (uint64_t c = 0; c < num_chunks; ++c) {
+    uint64_t width = 0;
+    for (uint64_t r = c * chunk_height; r < std::min((c + 1) * chunk_height, a.num_rows); ++r)
+      width = std::max(width, length(s.permutation[r]));
+    s.chunk_offsets[c + 1] = s.chunk_offsets[c] + width * chunk_height;
+  }
+  return s;
+}
+
+/// \brief Entries of a SELL-C-sigma matrix; padding entries have the value 0 and a valid column
+struct sell_matrix {
+  const sell_layout *layout{nullptr};
+  const uint64_t *columns{nullptr};
+  const double *values{nullptr};
+};
+
+/// \brief Writes the entries of the SELL-C-sigma matrix of a CSR matrix
+inline void fill_sell(const csr_matrix &a, const sell_layout &s, uint64_t *const columns, double *const values) {
+  const int64_t num_chunks = s.chunk_offsets.size() - 1;
+  const uint64_t c_height = s.chunk_height;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 64)
+#endif
+  for (int64_t c = 0; c < num_chunks; ++c) {
+    const uint64_t width = (s.chunk_offsets[c + 1] - s.chunk_offsets[c]) / c_height;
+    for (uint64_t r = 0; r < c_height; ++r) {
+      const uint64_t sell_row = c * c_height + r;
+      const uint64_t row = (sell_row < a.num_rows) ? s.permutation[sell_row] : 0;
+      const uint64_t length = (sell_row < a.num_rows) ? a.index[row + 1] - a.index[row] : 0;
+      for (uint64_t j = 0; j < width; ++j) {
+        const uint64_t pos = s.chunk_offsets[c] + j * c_height + r;
+        columns[pos] = (j < length) ? a.columns[a.index[row] + j] : 0;
+        values[pos] = (j < length) ? a.values[a.index[row] + j] : 0.0;
+      }
+    }
+  }
+}
+
+/// \brief y = W x, one chunk of C rows at a time
+template <uint64_t C>
+void multiply_sell_chunks(const sell_matrix &m, const double *const x, double *const y) {
+  const sell_layout &s = *m.layout;
+  const int64_t num_chunks = s.chunk_offsets.size() - 1;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 64)
+#endif
+  for (int64_t c = 0; c < num_chunks; ++c) {
+    double sum[C] = {};
+    for (uint64_t pos = s.chunk_offsets[c]; pos < s.chunk_offsets[c + 1]; pos += C) {
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+      for (uint64_t r = 0; r < C; ++r)
+        sum[r] += m.values[pos + r] * x[m.columns[pos + r]];
+    }
+    for (uint64_t r = 0; r < C && c * C + r < s.num_rows; ++r)
+      y[s.permutation[c * C + r]] = sum[r];
+  }
+}
+
+/// \brief Chunk heights of the SIMD kernels
+inline bool supported_chunk_height(const uint64_t c) {
+  return c == 4 || c == 8 || c == 16 || c == 32;
+}
+
+/// \brief y = W x
+inline void multiply(const sell_matrix &m, const double *const x, double *const y) {
+  switch (m.layout->chunk_height) {
+    case 4: multiply_sell_chunks<4>(m, x, y); break;
+    case 8: multiply_sell_chunks<8>(m, x, y); break;
+    case 16: multiply_sell_chunks<16>(m, x, y); break;
+    case 32: multiply_sell_chunks<32>(m, x, y); break;
+    default:
+      std::cerr << "Unsupported SELL chunk height: " << m.layout->chunk_height << std::endl;
+      std::abort();
+  }
+}
+
+} // namespace spmv
+#endif //UMAP_APPS_SPMV_SPARSE_MATRIX_HPP
@@ -0,0 +1,198 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about the benchmark runner
+/// Every run is a child process (fork + execvp) with extra environment
+/// variables. The child's output goes to a log file, and PHASE_LOG_FILE
+/// points to a private file from which the phases of the run (see
+/// utility/phase.hpp) are read back when the child exits.
+
+#ifndef UMAP_BENCH_BENCH_RUNNER_HPP
+#define UMAP_BENCH_BENCH_RUNNER_HPP
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "../utility/phase.hpp"
+#include "../utility/cache_control.hpp"
+#include "../utility/time.hpp"
+
+namespace umap_bench {
+
+struct run_spec {
+  std::vector<std::string> args;                           // args[0] is the program
+  std::vector<std::pair<std::string, std::string>> env;    // added to the environment of the run
+  std::string log_file_name{"/dev/null"};                  // stdout and stderr of the run are appended here
+};
+
+struct run_output {
+  bool ok{false};
+  int exit_status{-1};
+  double wall_sec{0.0};
+  std::string json;                         // the phase record of the run, if the program writes one
+  std::vector<utility::phase_record> phases;
+};
+
+/// \brief Replaces every {key} of text with its value
+inline std::string substitute(std::string text, const std::map<std::string, std::string> &values) {
+  for (const auto &kv : values) {
+    const std::string pattern = "{" + kv.first + "}";
+    std::size_t pos = 0;
+    while ((pos = text.find(pattern, pos)) != std::string::npos) {
+      text.replace(pos, pattern.size(), kv.second);
+      pos += kv.second.size();
+    }
+  }
+  return text;
+}
+
+/// \brief Splits a list such as "1,2,4" into its items
+inline std::vector<std::string> split_list(const std::string &list, const char separator = ',') {
+  std::vector<std::string> items;
+  std::stringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, separator)) {
+    const std::size_t first = item.find_first_not_of(" \t");
+    const std::size_t last = item.find_last_not_of(" \t");
+    if (first != std::string::npos)
+      items.push_back(item.substr(first, last - first + 1));
+  }
+  return items;
+}
+
+/// \brief Parses a size with an optional K, M, G or T suffix (powers of 1024)
+inline uint64_t parse_size(const std::string &text) {
+  char *end = nullptr;
+  const double value = std::strtod(text.c_str(), &end);
+  uint64_t unit = 1;
+  switch (end ? *end : '\0') {
+    case 'k': case 'K': unit = 1ULL << 10; break;
+    case 'm': case 'M': unit = 1ULL << 20; break;
+    case 'g': case 'G': unit = 1ULL << 30; break;
+    case 't': case 'T': unit = 1ULL << 40; break;
+    default: break;
+  }
+  return (uint64_t)(value * unit);
+}
+
+/// \brief Runs one command to completion and reads back its phases
+inline run_output run_command(const run_spec &spec) {
+  run_output out;
+  if (spec.args.empty()) return out;
+
+  char phase_file_name[] = "/tmp/umap_bench_phases_XXXXXX";
+  const int phase_fd = ::mkstemp(phase_file_name);
+  if (phase_fd == -1) {
+    ::perror("mkstemp");
+    return out;
+  }
+  ::close(phase_fd);
+
+  const auto start = utility::elapsed_time_sec();
+  const pid_t pid = ::fork();
+  if (pid == -1) {
+    ::perror("fork");
+    ::unlink(phase_file_name);
+    return out;
+  }
+
+  if (pid == 0) {
+    for (const auto &kv : spec.env)
+      ::setenv(kv.first.c_str(), kv.second.c_str(), 1);
+    ::setenv("PHASE_LOG_FILE", phase_file_name, 1);
+    ::setenv("PHASE_LOG_FORMAT", "json", 1);
+
+    const int log_fd = ::open(spec.log_file_name.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (log_fd != -1) {
+      ::dup2(log_fd, STDOUT_FILENO);
+      ::dup2(log_fd, STDERR_FILENO);
+      ::close(log_fd);
+    }
+
+    std::vector<char *> argv;
+    for (const auto &a : spec.args)
+      argv.push_back(const_cast<char *>(a.c_str()));
+    argv.push_back(nullptr);
+    ::execvp(argv[0], argv.data());
+    ::perror("execvp");
+    ::_exit(127);
+  }
+
+  int status = 0;
+  while (::waitpid(pid, &status, 0) == -1) {
+    if (errno != EINTR) {
+      ::perror("waitpid");
+      break;
+    }
+  }
+  out.wall_sec = utility::elapsed_time_sec(start);
+  out.exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+
+  std::ifstream ifs(phase_file_name);
+  std::string line;
+  while (std::getline(ifs, line))
+    if (!line.empty()) out.json = line;
+  ::unlink(phase_file_name);
+
+  out.phases = utility::parse_phase_records(out.json);
+  out.ok = (out.exit_status == 0);
+  return out;
+}
+
+/// \brief Runs a command line with /bin/sh
+inline run_output run_shell(const std::string &command, const std::vector<std::pair<std::string, std::string>> &env,
+                            const std::string &log_file_name) {
+  run_spec spec;
+  spec.args = {"/bin/sh", "-c", command};
+  spec.env = env;
+  spec.log_file_name = log_file_name;
+  return run_command(spec);
+}
+
+/// \brief Returns the phase with the given name, or nullptr
+inline const utility::phase_record *find_phase(const run_output &out, const std::string &name) {
+  for (const auto &p : out.phases)
+    if (p.name == name) return &p;
+  return nullptr;
+}
+
+/// \brief Returns the command line of a run, for logs
+inline std::string command_line(const run_spec &spec) {
+  std::ostringstream ss;
+  for (const auto &kv : spec.env)
+    ss << kv.first << "=" << kv.second << " ";
+  for (std::size_t i = 0; i < spec.args.size(); ++i)
+    ss << (i ? " " : "") << spec.args[i];
+  return ss.str();
+}
+
+} // namespace umap_bench
+
+#endif //UMAP_BENCH_BENCH_RUNNER_HPP
@@ -0,0 +1,209 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about the sweep spec
+/// A sweep spec is an INI file:
+///   [sweep]       repetitions, cache (cold|warm|both), threads, files to
+///                 evict for cold runs, drop_cache_command, output files
+///   [vars]        NAME = value, for {NAME} in commands and files; the
+///                 command line can override them (umap_bench --set)
+///   [env]         one line per environment variable: NAME = value list
+///   [app NAME]    command, optional setup and prepare commands, phases to
+///                 report, and overrides of threads, files and env.NAME
+/// Lists are comma separated; every combination of the lists is a
+/// configuration. Commands may use {threads}, {rep}, {cache}, {NAME} for
+/// every environment variable of the sweep, and {pages}: data_bytes divided
+/// by UMAP_PAGESIZE (4096 if it is not swept).
+
+#ifndef UMAP_BENCH_SWEEP_SPEC_HPP
+#define UMAP_BENCH_SWEEP_SPEC_HPP
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <fstream>
+#include <iostream>
+
+#include "bench_runner.hpp"
+
+namespace umap_bench {
+
+/// \brief Environment variables and their values, in the order of the spec
+typedef std::vector<std::pair<std::string, std::vector<std::string>>> env_lists;
+
+struct app_spec {
+  std::string name;
+  std::string command;               // the measured run
+  std::string setup;                 // before every run (e.g. to initialize data that the run modifies)
+  std::string prepare;               // once, before the first run of the app
+  std::vector<std::string> phases;   // phases to report; empty: all of them
+  std::vector<std::string> threads;  // empty: the threads of the sweep
+  std::vector<std::string> files;    // empty: the files of the sweep
+  env_lists env;                     // overrides the lists of the sweep
+  uint64_t data_bytes{0};            // 0: the data size of the sweep
+};
+
+struct sweep_spec {
+  int repetitions{3};
+  std::string cache{"cold"};         // cold, warm or both
+  std::vector<std::string> threads{"1"};
+  std::vector<std::string> files;    // evicted from the page cache before every cold run
+  std::string drop_cache_command;    // run by /bin/sh before every cold run, if set
+  std::string output_file_name{"umap_bench_results.csv"};
+  std::string raw_output_file_name;  // one line per run and metric, if set
+  std::string log_file_name{"umap_bench.log"};
+  uint64_t data_bytes{0};            // for {pages}
+  std::map<std::string, std::string> vars;
+  env_lists env;
+  std::vector<app_spec> apps;
+};
+
+namespace spec_detail {
+
+inline std::string trim(const std::string &text) {
+  const std::size_t first = text.find_first_not_of(" \t\r");
+  if (first == std::string::npos) return std::string();
+  const std::size_t last = text.find_last_not_of(" \t\r");
+  return text.substr(first, last - first + 1);
+}
+
+inline void set_env_list(env_lists *env, const std::string &name, const std::vector<std::string> &values) {
+  for (auto &kv : *env) {
+    if (kv.first == name) {
+      kv.second = values;
+      return;
+    }
+  }
+  env->emplace_back(name, values);
+}
+
+} // namespace spec_detail
+
+/// \brief Reads a sweep spec; prints the offending line and exits on errors
+inline sweep_spec read_sweep_spec(const std::string &file_name) {
+  std::ifstream ifs(file_name);
+  if (!ifs.is_open()) {
+    std::cerr << "Failed to open " << file_name << std::endl;
+    exit(1);
+  }
+
+  sweep_spec spec;
+  std::string section;
+  std::string line;
+  for (int line_number = 1; std::getline(ifs, line); ++line_number) {
+    line = spec_detail::trim(line);
+    if (line.empty() || line[0] == '#' || line[0] == ';') continue;
+
+    auto error = [&](const std::string &what) {
+      std::cerr << file_name << ":" << line_number << ": " << what << ": " << line << std::endl;
+      exit(1);
+    };
+
+    if (line[0] == '[') {
+      if (line.back() != ']') error("invalid section");
+      section = spec_detail::trim(line.substr(1, line.size() - 2));
+      if (section.compare(0, 4, "app ") == 0) {
+        spec.apps.push_back(app_spec());
+        spec.apps.back().name = spec_detail::trim(section.substr(4));
+        section = "app";
+      } else if (section != "sweep" && section != "vars" && section != "env") {
+        error("unknown section");
+      }
+      continue;
+    }
+
+    const std::size_t eq = line.find('=');
+    if (eq == std::string::npos) error("expected key = value");
+    const std::string key = spec_detail::trim(line.substr(0, eq));
+    const std::string value = spec_detail::trim(line.substr(eq + 1));
+    if (value.empty()) error("empty value");
+
+    if (section == "sweep") {
+      if (key == "repetitions") spec.repetitions = std::atoi(value.c_str());
+      else if (key == "cache") spec.cache = value;
+      else if (key == "threads") spec.threads = split_list(value);
+      else if (key == "files") spec.files = split_list(value);
+      else if (key == "drop_cache_command") spec.drop_cache_command = value;
+      else if (key == "output") spec.output_file_name = value;
+      else if (key == "raw_output") spec.raw_output_file_name = value;
+      else if (key == "log") spec.log_file_name = value;
+      else if (key == "data_bytes") spec.data_bytes = parse_size(value);
+      else error("unknown key");
+    } else if (section == "vars") {
+      spec.vars[key] = value;
+    } else if (section == "env") {
+      spec_detail::set_env_list(&spec.env, key, split_list(value));
+    } else if (section == "app") {
+      app_spec &app = spec.apps.back();
+      if (key == "command") app.command = value;
+      else if (key == "setup") app.setup = value;
+      else if (key == "prepare") app.prepare = value;
+      else if (key == "phases") app.phases = split_list(value);
+      else if (key == "threads") app.threads = split_list(value);
+      else if (key == "files") app.files = split_list(value);
+      else if (key == "data_bytes") app.data_bytes = parse_size(value);
+      else if (key.compare(0, 4, "env.") == 0) spec_detail::set_env_list(&app.env, key.substr(4), split_list(value));
+      else error("unknown key");
+    } else {
+      error("key outside of a section");
+    }
+  }
+
+  if (spec.cache != "cold" && spec.cache != "warm" && spec.cache != "both") {
+    std::cerr << file_name << ": cache must be cold, warm or both: " << spec.cache << std::endl;
+    exit(1);
+  }
+  if (spec.repetitions < 1 || spec.apps.empty()) {
+    std::cerr << file_name << ": needs at least one [app NAME] and one repetition" << std::endl;
+    exit(1);
+  }
+  for (const auto &app : spec.apps) {
+    if (app.command.empty()) {
+      std::cerr << file_name << ": app " << app.name << " has no command" << std::endl;
+      exit(1);
+    }
+  }
+  return spec;
+}
+
+/// \brief Environment lists of an app: those of the sweep, overridden or extended by the app's
+inline env_lists app_env_lists(const sweep_spec &spec, const app_spec &app) {
+  env_lists env = spec.env;
+  for (const auto &kv : app.env)
+    spec_detail::set_env_list(&env, kv.first, kv.second);
+  return env;
+}
+
+/// \brief Every combination of the values of the lists, in the order of the lists
+inline std::vector<std::vector<std::pair<std::string, std::string>>> expand(const env_lists &lists) {
+  std::vector<std::vector<std::pair<std::string, std::string>>> combinations(1);
+  for (const auto &list : lists) {
+    std::vector<std::vector<std::pair<std::string, std::string>>> next;
+    for (const auto &combination : combinations) {
+      for (const auto &value : list.second) {
+        next.push_back(combination);
+        next.back().emplace_back(list.first, value);
+      }
+    }
+    combinations.swap(next);
+  }
+  return combinations;
+}
+
+} // namespace umap_bench
+
+#endif //UMAP_BENCH_SWEEP_SPEC_HPP
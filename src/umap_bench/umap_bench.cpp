@@ -0,0 +1,235 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2019 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+
+// Benchmark runner: runs the apps of a sweep spec (see sweep_spec.hpp) for
+// every combination of environment variables and thread counts, several
+// times with a cold or warm page cache, reads back the phases every run
+// records (PHASE_LOG_FILE, see utility/phase.hpp), and writes one results
+// table with the mean, standard deviation and 95% confidence interval of
+// every metric.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+#include "bench_runner.hpp"
+#include "sweep_spec.hpp"
+#include "../utility/statistics.hpp"
+
+using namespace std;
+
+static void usage(const char *pname) {
+  std::cerr
+    << "Usage: " << pname << " [--dry-run] [--set NAME=VALUE]... spec.ini\n\n"
+    << " --dry-run         - print the runs without running them\n"
+    << " --set NAME=VALUE  - overrides a variable of the [vars] section\n\n"
+    << "See README.md for the format of the sweep spec.\n"
+    << std::endl;
+  exit(1);
+}
+
+/// \brief Metrics of one run, in the order they were added
+struct run_metrics {
+  std::vector<std::string> names;
+  std::map<std::string, double> values;
+
+  void add(const std::string &name, const double value) {
+    if (values.count(name) == 0) names.push_back(name);
+    values[name] = value;
+  }
+};
+
+/// \brief Wall time of the process, and the accounting of every reported phase
+run_metrics collect_metrics(const umap_bench::run_output &out, const umap_bench::app_spec &app) {
+  run_metrics m;
+  m.add("wall_sec", out.wall_sec);
+  for (const auto &p : out.phases) {
+    if (!app.phases.empty() && std::find(app.phases.begin(), app.phases.end(), p.name) == app.phases.end())
+      continue;
+    m.add(p.name + ".wall_sec", p.wall_sec);
+    m.add(p.name + ".cpu_sec", p.cpu_sec);
+    m.add(p.name + ".read_bytes", p.read_bytes);
+    m.add(p.name + ".write_bytes", p.write_bytes);
+    m.add(p.name + ".minor_faults", p.minor_faults);
+    m.add(p.name + ".major_faults", p.major_faults);
+    if (p.data_bytes)
+      m.add(p.name + ".data_mb_per_sec", p.data_bytes / (p.wall_sec > 0.0 ? p.wall_sec : 1e-9) / 1e6);
+  }
+  return m;
+}
+
+/// \brief Empties the page cache of the files before a cold run
+void drop_caches(const umap_bench::sweep_spec &spec, const std::vector<std::string> &files,
+                 const std::map<std::string, std::string> &values) {
+  for (const auto &f : files)
+    utility::drop_file_cache(umap_bench::substitute(f, values));
+  if (!spec.drop_cache_command.empty()) {
+    const auto out = umap_bench::run_shell(spec.drop_cache_command, {}, spec.log_file_name);
+    if (!out.ok)
+      std::cerr << "drop_cache_command failed (exit status " << out.exit_status << ")" << std::endl;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  bool dry_run = false;
+  std::string spec_file_name;
+  std::vector<std::string> overrides;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--dry-run") dry_run = true;
+    else if (arg == "--set" && i + 1 < argc) overrides.push_back(argv[++i]);
+    else if (arg[0] == '-' || !spec_file_name.empty()) usage(argv[0]);
+    else spec_file_name = arg;
+  }
+  if (spec_file_name.empty()) usage(argv[0]);
+
+  umap_bench::sweep_spec spec = umap_bench::read_sweep_spec(spec_file_name);
+  for (const auto &o : overrides) {
+    const std::size_t eq = o.find('=');
+    if (eq == std::string::npos || spec.vars.count(o.substr(0, eq)) == 0) {
+      std::cerr << "--set " << o << ": not a NAME=VALUE of the [vars] of " << spec_file_name << std::endl;
+      exit(1);
+    }
+    spec.vars[o.substr(0, eq)] = o.substr(eq + 1);
+  }
+
+  // Every environment variable of any app is a column of the results
+  std::vector<std::string> env_names;
+  for (const auto &app : spec.apps) {
+    for (const auto &kv : umap_bench::app_env_lists(spec, app))
+      if (std::find(env_names.begin(), env_names.end(), kv.first) == env_names.end())
+        env_names.push_back(kv.first);
+  }
+  std::string config_header = "app,cache,threads";
+  for (const auto &name : env_names) config_header += "," + name;
+
+  std::ofstream results;
+  std::ofstream raw;
+  if (!dry_run) {
+    results.open(spec.output_file_name);
+    results << config_header << ",metric,count,failed,mean,stddev,ci_low,ci_high,min,median,max\n";
+    if (!spec.raw_output_file_name.empty()) {
+      raw.open(spec.raw_output_file_name);
+      raw << config_header << ",rep,exit_status,metric,value\n";
+    }
+  }
+
+  const std::vector<std::string> caches = (spec.cache == "both") ? std::vector<std::string>{"cold", "warm"}
+                                                                 : std::vector<std::string>{spec.cache};
+  for (const auto &app : spec.apps) {
+    const auto combinations = umap_bench::expand(umap_bench::app_env_lists(spec, app));
+    const std::vector<std::string> &threads = app.threads.empty() ? spec.threads : app.threads;
+    const std::vector<std::string> &files = app.files.empty() ? spec.files : app.files;
+    const uint64_t data_bytes = app.data_bytes ? app.data_bytes : spec.data_bytes;
+
+    if (!app.prepare.empty()) {
+      // The first thread count and the first or only UMAP_PAGESIZE give {threads} and {pages}
+      std::map<std::string, std::string> values = spec.vars;
+      values["threads"] = threads.front();
+      uint64_t pagesize = 4096;
+      for (const auto &kv : combinations.front())
+        if (kv.first == "UMAP_PAGESIZE") pagesize = std::stoull(kv.second);
+      if (data_bytes) values["pages"] = std::to_string(data_bytes / pagesize);
+      const std::string prepare = umap_bench::substitute(app.prepare, values);
+      std::cout << "[" << app.name << "] prepare: " << prepare << std::endl;
+      if (!dry_run && !umap_bench::run_shell(prepare, {}, spec.log_file_name).ok) {
+        std::cerr << "[" << app.name << "] prepare failed; skipping the app" << std::endl;
+        continue;
+      }
+    }
+
+    for (const auto &env : combinations) {
+      for (const auto &t : threads) {
+        for (const auto &cache : caches) {
+          std::map<std::string, std::string> values = spec.vars;
+          values["threads"] = t;
+          values["cache"] = cache;
+          uint64_t pagesize = 4096;
+          for (const auto &kv : env) {
+            values[kv.first] = kv.second;
+            if (kv.first == "UMAP_PAGESIZE") pagesize = std::stoull(kv.second);
+          }
+          if (data_bytes) values["pages"] = std::to_string(data_bytes / pagesize);
+
+          std::vector<std::pair<std::string, std::string>> run_env = env;
+          run_env.emplace_back("OMP_NUM_THREADS", t);
+
+          std::ostringstream config;
+          config << app.name << "," << cache << "," << t;
+          for (const auto &name : env_names) {
+            config << ",";
+            for (const auto &kv : env)
+              if (kv.first == name) config << kv.second;
+          }
+
+          std::vector<std::string> metric_names;
+          std::map<std::string, std::vector<double>> samples;
+          int failed = 0;
+          // A warm run follows an unmeasured run of the same configuration
+          const int first_rep = (cache == "warm") ? -1 : 0;
+          for (int rep = first_rep; rep < spec.repetitions; ++rep) {
+            values["rep"] = std::to_string(rep);
+            const std::string command = umap_bench::substitute(app.command, values);
+            const std::string setup = umap_bench::substitute(app.setup, values);
+            std::cout << "[" << app.name << "] " << config.str() << " rep " << rep << ": " << command << std::endl;
+            if (dry_run) continue;
+
+            if (!setup.empty() && !umap_bench::run_shell(setup, run_env, spec.log_file_name).ok) {
+              std::cerr << "  setup failed: " << setup << std::endl;
+              ++failed;
+              continue;
+            }
+            if (cache == "cold")
+              drop_caches(spec, files, values);
+
+            const umap_bench::run_output out = umap_bench::run_shell(command, run_env, spec.log_file_name);
+            if (rep < 0) continue;
+            if (!out.ok) {
+              std::cerr << "  failed (exit status " << out.exit_status << ")" << std::endl;
+              ++failed;
+              continue;
+            }
+            const run_metrics m = collect_metrics(out, app);
+            for (const auto &name : m.names) {
+              if (samples.count(name) == 0) metric_names.push_back(name);
+              samples[name].push_back(m.values.at(name));
+              if (raw.is_open())
+                raw << config.str() << "," << rep << "," << out.exit_status << "," << name << ","
+                    << m.values.at(name) << "\n";
+            }
+          }
+          if (dry_run) continue;
+
+          for (const auto &name : metric_names) {
+            const utility::sample_summary s = utility::summarize(samples[name]);
+            results << config.str() << "," << name << "," << s.count << "," << failed << "," << s.mean << ","
+                    << s.stddev << "," << s.ci_low << "," << s.ci_high << "," << s.min << "," << s.median << ","
+                    << s.max << "\n";
+            // Times are echoed for a quick look; everything is in the results table
+            if (name == "wall_sec" || name.find(".wall_sec") != std::string::npos)
+              std::printf("  %-32s %12.6f s +/- %.6f (%lu runs)\n", name.c_str(), s.mean, s.ci_high - s.mean,
+                  s.count);
+          }
+          results.flush();
+        }
+      }
+    }
+  }
+
+  if (!dry_run)
+    std::cout << "Results written to " << spec.output_file_name << std::endl;
+  return 0;
+}
@@ -0,0 +1,442 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2019 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+
+// Several processes map the same file (umap or mmap) and read it at the same
+// time, with a BFS over a CSR graph or random reads.
+// The processes are forked from this program and step together through a
+// control block in shared memory (a process-shared barrier and one result
+// slot per process); the parent only waits for them. Reports the aggregate throughput, the storage reads
+// summed over the processes against the distinct bytes they touched
+// (duplicated I/O), and the memory footprint (per-process RSS/PSS and the
+// growth of the page cache).
+// umap reads the file with O_DIRECT into a buffer of every process, while
+// mmap shares the page cache between the processes.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif // _GNU_SOURCE
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <csignal>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "umap/umap.h"
+#include "../utility/umap_file.hpp"
+#include "../utility/mmap.hpp"
+#include "../utility/file.hpp"
+#include "../utility/time.hpp"
+#include "../utility/random.hpp"
+#include "../utility/bitmap.hpp"
+#include "../bfs/bfs_kernel.hpp"
+
+struct multiproc_options {
+  int processes{2};
+  int threads{1};
+  bool usemmap{false};
+  std::string pattern{"random"};   // random, zipfian[:theta] or bfs
+  double zipf_theta{0.99};
+  std::string file_name;
+  uint64_t num_vertices{0};        // bfs
+  uint64_t num_edges{0};           // bfs
+  uint64_t accesses{0};            // random reads per thread; 0: as many as pages
+  uint64_t seed{123};
+  bool same_sequence{false};       // all processes read the same random pages
+  std::string csv_file_name;
+};
+
+static void usage(const char *pname) {
+  std::cerr
+    << "Usage: " << pname << " -f file [options]\n\n"
+    << " -f, --file FILE         - file to map (a CSR graph from ingest_edge_list for bfs)\n"
+    << " -P, --processes N       - processes (default: 2)\n"
+    << " -t, --threads N         - threads per process (default: 1)\n"
+    << " -s, --usemmap           - use mmap instead of umap\n"
+    << " -p, --pattern NAME      - random, zipfian[:theta] (0.99) or bfs (default: random)\n"
+    << " -n, --vertices N        - bfs: #vertices\n"
+    << " -m, --edges N           - bfs: #edges\n"
+    << " -a, --accesses N        - random: reads per thread (default: #pages of the file)\n"
+    << " -S, --seed N            - random: seed (default: 123); process p uses seed + p\n"
+    << " -x, --same-sequence     - random: all processes use the same seed\n"
+    << " -o, --output FILE       - file to append one CSV line per run to\n"
+    << "\n The umap runtime of every process is configured by the UMAP_* environment variables.\n"
+    << std::endl;
+  exit(1);
+}
+
+multiproc_options get_options(int argc, char **argv) {
+  multiproc_options opts;
+  static struct option long_options[] = {
+    {"file",          required_argument, nullptr, 'f'},
+    {"processes",     required_argument, nullptr, 'P'},
+    {"threads",       required_argument, nullptr, 't'},
+    {"usemmap",       no_argument,       nullptr, 's'},
+    {"pattern",       required_argument, nullptr, 'p'},
+    {"vertices",      required_argument, nullptr, 'n'},
+    {"edges",         required_argument, nullptr, 'm'},
+    {"accesses",      required_argument, nullptr, 'a'},
+    {"seed",          required_argument, nullptr, 'S'},
+    {"same-sequence", no_argument,       nullptr, 'x'},
+    {"output",        required_argument, nullptr, 'o'},
+    {"help",          no_argument,       nullptr, 'h'},
+    {0, 0, 0, 0}
+  };
+
+  int c;
+  while ((c = getopt_long(argc, argv, "f:P:t:sp:n:m:a:S:xo:h", long_options, nullptr)) != -1) {
+    switch (c) {
+      case 'f': opts.file_name = optarg; break;
+      case 'P': opts.processes = std::atoi(optarg); break;
+      case 't': opts.threads = std::atoi(optarg); break;
+      case 's': opts.usemmap = true; break;
+      case 'p': opts.pattern = optarg; break;
+      case 'n': opts.num_vertices = std::stoull(optarg); break;
+      case 'm': opts.num_edges = std::stoull(optarg); break;
+      case 'a': opts.accesses = std::stoull(optarg); break;
+      case 'S': opts.seed = std::stoull(optarg); break;
+      case 'x': opts.same_sequence = true; break;
+      case 'o': opts.csv_file_name = optarg; break;
+      default: usage(argv[0]);
+    }
+  }
+
+  const std::size_t colon = opts.pattern.find(':');
+  if (colon != std::string::npos) {
+    opts.zipf_theta = std::stod(opts.pattern.substr(colon + 1));
+    opts.pattern = opts.pattern.substr(0, colon);
+  }
+  if (opts.file_name.empty() || opts.processes < 1 || opts.threads < 1
+      || (opts.pattern != "random" && opts.pattern != "zipfian" && opts.pattern != "bfs")
+      || (opts.pattern == "bfs" && (opts.num_vertices == 0 || opts.num_edges == 0)))
+    usage(argv[0]);
+  return opts;
+}
+
+/// \brief Results of one process, written by the process into the control block
+struct process_slot {
+  int ok;
+  double wall_sec;
+  uint64_t start_ns;        // CLOCK_MONOTONIC, comparable between the processes
+  uint64_t end_ns;
+  uint64_t accesses;        // reads (random) or traversed edges (bfs)
+  uint64_t read_bytes;
+  uint64_t minor_faults;
+  uint64_t major_faults;
+  uint64_t pagesize;        // of the mapping
+  utility::memory_footprint footprint;  // at the end of the run, before unmapping
+};
+
+/// \brief Shared by the parent and the processes
+struct control_block {
+  pthread_barrier_t barrier;  // between the processes
+  uint64_t file_size;         // set by process 0 once the file is ready to map
+  uint64_t cached_bytes;      // set by process 0 when all processes are done, before unmapping
+  uint64_t available_bytes;
+};
+
+static inline uint64_t getns(void)
+{
+  struct timespec ts;
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (((uint64_t)ts.tv_sec) * 1000000000ULL) + ts.tv_nsec;
+}
+
+/// \brief Touched pages are tracked in units of this size, across all processes
+static const uint64_t k_touch_unit = 4096;
+
+void *map_shared(const std::size_t size) {
+  void *const p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    ::perror("mmap of the control block");
+    exit(1);
+  }
+  return p;
+}
+
+void mark_touched(uint64_t *const touched, const uint64_t first_byte, const uint64_t end_byte) {
+  for (uint64_t u = first_byte / k_touch_unit; u * k_touch_unit < end_byte; ++u)
+    __atomic_fetch_or(&touched[utility::bitmap_global_pos(u)], 1ULL << utility::bitmap_local_pos(u),
+                      __ATOMIC_RELAXED);
+}
+
+/// \brief Page of the i-th random read; a pure function of (seed, i)
+inline uint64_t random_page(const uint64_t seed, const uint64_t i, const uint64_t num_pages,
+                            const utility::zipfian_distribution *const zipf) {
+  const uint64_t r = utility::counter_random(seed, i);
+  return zipf ? (*zipf)(utility::to_unit_interval(r)) : r % num_pages;
+}
+
+/// \brief Random reads of one word per access; returns the sum of the words read
+uint64_t run_random(const uint64_t *const region, const uint64_t num_pages, const uint64_t pagesize,
+                    const uint64_t reads, const uint64_t seed, const utility::zipfian_distribution *const zipf) {
+  const uint64_t words_per_page = pagesize / sizeof(uint64_t);
+  uint64_t sum = 0;
+#pragma omp parallel for reduction(+:sum) schedule(static)
+  for (uint64_t i = 0; i < reads; ++i) {
+    const uint64_t page = random_page(seed, i, num_pages, zipf);
+    sum += region[page * words_per_page + utility::counter_random(seed + 1, i) % words_per_page];
+  }
+  return sum;
+}
+
+/// \brief Runs one process: maps the file, runs the pattern between the barriers, and reports
+void run_process(const int p, const multiproc_options &opts, control_block *const control,
+                 process_slot *const slot, uint64_t *const touched) {
+  omp_set_num_threads(opts.threads);
+  slot->ok = 0;
+
+  // Umap requires a page size aligned file
+  if (p == 0) {
+    uint64_t size = utility::get_file_size(opts.file_name);
+    if (!opts.usemmap) {
+      const uint64_t pagesize = utility::get_umap_page_size();
+      const uint64_t aligned = (size + pagesize - 1) / pagesize * pagesize;
+      if (aligned != size && utility::extend_file_size(opts.file_name, aligned))
+        size = aligned;
+    }
+    control->file_size = size;
+  }
+  pthread_barrier_wait(&control->barrier);  // file ready
+
+  const uint64_t file_size = control->file_size;
+  slot->pagesize = opts.usemmap ? utility::get_page_size() : utility::get_umap_page_size();
+  uint64_t *const region = static_cast<uint64_t *>(
+      utility::map_in_file(opts.file_name, false, true, opts.usemmap, file_size, nullptr));
+  if (region == nullptr)
+    std::cerr << "Process " << p << " failed to map " << opts.file_name << std::endl;
+
+  const uint64_t num_pages = file_size / slot->pagesize;
+  const uint64_t reads = (opts.accesses ? opts.accesses : num_pages) * opts.threads;
+  const uint64_t seed = opts.same_sequence ? opts.seed : opts.seed + p;
+  std::unique_ptr<utility::zipfian_distribution> zipf;
+  if (opts.pattern == "zipfian")
+    zipf.reset(new utility::zipfian_distribution(num_pages, opts.zipf_theta));
+  std::vector<uint16_t> level;
+  std::vector<uint64_t> visited_filter;
+  if (opts.pattern == "bfs") {
+    level.resize(opts.num_vertices);
+    visited_filter.resize(utility::bitmap_size(opts.num_vertices));
+  }
+
+  pthread_barrier_wait(&control->barrier);  // all mapped
+  const auto io_before = utility::get_io_bytes();
+  const auto faults_before = utility::get_num_page_faults();
+  pthread_barrier_wait(&control->barrier);  // start
+
+  slot->start_ns = getns();
+  uint64_t checksum = 0;
+  if (region && opts.pattern == "bfs") {
+    const uint64_t *const index = region;
+    const uint64_t *const edges = region + opts.num_vertices + 1;
+    bfs::init_bfs(opts.num_vertices, level.data(), visited_filter.data());
+    for (uint64_t src = 0; src < opts.num_vertices; ++src) {
+      if (index[src + 1] > index[src]) {
+        level[src] = 0;
+        break;
+      }
+    }
+    checksum = bfs::run_bfs(opts.num_vertices, index, edges, level.data(), visited_filter.data());
+  } else if (region) {
+    checksum = run_random(region, num_pages, slot->pagesize, reads, seed, zipf.get());
+  }
+  slot->end_ns = getns();
+  slot->wall_sec = (slot->end_ns - slot->start_ns) / 1e9;
+
+  const auto io_after = utility::get_io_bytes();
+  const auto faults_after = utility::get_num_page_faults();
+  slot->read_bytes = io_after.first - io_before.first;
+  slot->minor_faults = faults_after.first - faults_before.first;
+  slot->major_faults = faults_after.second - faults_before.second;
+  slot->footprint = utility::get_memory_footprint();
+  slot->ok = (region != nullptr);
+  pthread_barrier_wait(&control->barrier);  // done
+  if (p == 0) {
+    control->cached_bytes = utility::get_meminfo_bytes("Cached");
+    control->available_bytes = utility::get_meminfo_bytes("MemAvailable");
+  }
+  pthread_barrier_wait(&control->barrier);  // measured
+
+  // Outside of the measurement: count the work and record the touched pages
+  if (region && opts.pattern == "bfs") {
+    const uint64_t *const index = region;
+    uint64_t traversed = 0;
+    mark_touched(touched, 0, (opts.num_vertices + 1) * sizeof(uint64_t));
+    for (uint64_t v = 0; v < opts.num_vertices; ++v) {
+      if (level[v] == bfs::k_infinite_level || index[v + 1] == index[v]) continue;
+      traversed += index[v + 1] - index[v];
+      mark_touched(touched, (opts.num_vertices + 1 + index[v]) * sizeof(uint64_t),
+                   (opts.num_vertices + 1 + index[v + 1]) * sizeof(uint64_t));
+    }
+    slot->accesses = traversed;
+  } else if (region) {
+    // The reads are replayed to record the touched pages
+#pragma omp parallel for schedule(static)
+    for (uint64_t i = 0; i < reads; ++i) {
+      const uint64_t page = random_page(seed, i, num_pages, zipf.get());
+      mark_touched(touched, page * slot->pagesize, (page + 1) * slot->pagesize);
+    }
+    slot->accesses = reads;
+  }
+  std::fprintf(stdout, "Process %d: checksum %lu\n", p, checksum);
+
+  if (region)
+    utility::unmap_file(opts.usemmap, file_size, region);
+}
+
+int main(int argc, char **argv)
+{
+  const multiproc_options opts = get_options(argc, argv);
+  if (utility::get_file_size(opts.file_name) <= 0) {
+    std::cerr << "Cannot read the size of " << opts.file_name << std::endl;
+    return 1;
+  }
+  if (opts.pattern == "bfs"
+      && (uint64_t)utility::get_file_size(opts.file_name) < (opts.num_vertices + 1 + opts.num_edges) * sizeof(uint64_t)) {
+    std::cerr << opts.file_name << " is smaller than a CSR graph of " << opts.num_vertices << " vertices and "
+              << opts.num_edges << " edges" << std::endl;
+    return 1;
+  }
+
+  control_block *const control = static_cast<control_block *>(map_shared(sizeof(control_block)));
+  process_slot *const slots = static_cast<process_slot *>(map_shared(sizeof(process_slot) * opts.processes));
+  // A umap page size aligned file is at most one umap page larger; 1 GB of slack covers any page size
+  const uint64_t max_units = (utility::get_file_size(opts.file_name) + (1ULL << 30)) / k_touch_unit;
+  const std::size_t touched_size = utility::bitmap_size(max_units) * sizeof(uint64_t);
+  uint64_t *const touched = static_cast<uint64_t *>(map_shared(touched_size));
+
+  pthread_barrierattr_t attr;
+  pthread_barrierattr_init(&attr);
+  pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_barrier_init(&control->barrier, &attr, opts.processes);
+  pthread_barrierattr_destroy(&attr);
+
+  const uint64_t cached_before = utility::get_meminfo_bytes("Cached");
+  const uint64_t available_before = utility::get_meminfo_bytes("MemAvailable");
+
+  std::vector<pid_t> pids;
+  for (int p = 0; p < opts.processes; ++p) {
+    const pid_t pid = ::fork();
+    if (pid == -1) {
+      // The barriers need every process
+      ::perror("fork");
+      for (const pid_t child : pids) ::kill(child, SIGKILL);
+      return 1;
+    }
+    if (pid == 0) {
+      run_process(p, opts, control, &slots[p], touched);
+      ::_exit(0);
+    }
+    pids.push_back(pid);
+  }
+
+  // A process that dies would leave the others waiting at a barrier: kill them
+  bool ok = true;
+  for (std::size_t remaining = pids.size(); remaining > 0; --remaining) {
+    int status = 0;
+    const pid_t pid = ::waitpid(-1, &status, 0);
+    if (pid == -1) break;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      if (ok) {
+        std::cerr << "Process " << pid << " failed (status " << status << "); stopping the others" << std::endl;
+        for (const pid_t child : pids)
+          if (child != pid) ::kill(child, SIGKILL);
+      }
+      ok = false;
+    }
+  }
+  if (!ok) return 1;
+
+  // From the first start to the last end
+  uint64_t first_start = slots[0].start_ns, last_end = slots[0].end_ns;
+  for (int p = 1; p < opts.processes; ++p) {
+    first_start = std::min(first_start, slots[p].start_ns);
+    last_end = std::max(last_end, slots[p].end_ns);
+  }
+  const double wall_sec = (last_end - first_start) / 1e9;
+  const uint64_t cached_after = control->cached_bytes;
+  const uint64_t available_after = control->available_bytes;
+
+  // Distinct bytes touched by the processes, in pages of the mapping
+  const uint64_t pagesize = slots[0].pagesize ? slots[0].pagesize : k_touch_unit;
+  const uint64_t units_per_page = std::max(pagesize / k_touch_unit, (uint64_t)1);
+  uint64_t touched_pages = 0;
+  for (uint64_t first = 0; first < max_units; first += units_per_page) {
+    for (uint64_t u = first; u < std::min(first + units_per_page, max_units); ++u) {
+      if (utility::get_bit(touched, u)) {
+        ++touched_pages;
+        break;
+      }
+    }
+  }
+  const uint64_t unique_bytes = touched_pages * pagesize;
+
+  uint64_t accesses = 0, read_bytes = 0, major_faults = 0, rss = 0, pss = 0, private_bytes = 0;
+  const char *const unit = (opts.pattern == "bfs") ? "edges" : "reads";
+  std::fprintf(stdout, "%7s %10s %14s %14s %12s %10s %12s %12s %12s\n", "Process", "Wall(s)", unit,
+      (std::string(unit) + "/s").c_str(), "Read(MB)", "MajorFlt", "RSS(MB)", "PSS(MB)", "Private(MB)");
+  for (int p = 0; p < opts.processes; ++p) {
+    const process_slot &s = slots[p];
+    ok = ok && s.ok;
+    accesses += s.accesses;
+    read_bytes += s.read_bytes;
+    major_faults += s.major_faults;
+    rss += s.footprint.rss;
+    pss += s.footprint.pss;
+    private_bytes += s.footprint.private_bytes;
+    std::fprintf(stdout, "%7d %10.3f %14lu %14.0f %12.1f %10lu %12.1f %12.1f %12.1f%s\n", p, s.wall_sec, s.accesses,
+        s.accesses / (s.wall_sec > 0.0 ? s.wall_sec : 1e-9), s.read_bytes / 1048576.0, s.major_faults,
+        s.footprint.rss / 1048576.0, s.footprint.pss / 1048576.0, s.footprint.private_bytes / 1048576.0,
+        s.ok ? "" : " (failed)");
+  }
+
+  const double throughput = accesses / (wall_sec > 0.0 ? wall_sec : 1e-9);
+  // 1: every distinct byte was read from storage once, whatever the number of processes
+  const double duplication = unique_bytes ? (double)read_bytes / unique_bytes : 0.0;
+  const int64_t cache_growth = (int64_t)cached_after - (int64_t)cached_before;
+  const int64_t available_drop = (int64_t)available_before - (int64_t)available_after;
+
+  std::fprintf(stdout, "\n%d processes x %d threads, %s, %s\n", opts.processes, opts.threads,
+      opts.usemmap ? "mmap" : "umap", opts.pattern.c_str());
+  std::fprintf(stdout, "  Aggregate throughput: %f M %s/s (%f seconds)\n", throughput / 1e6, unit, wall_sec);
+  std::fprintf(stdout, "  Storage reads: %lu bytes for %lu distinct bytes touched (duplication %f)\n",
+      read_bytes, unique_bytes, duplication);
+  std::fprintf(stdout, "  Memory: RSS %f MB, PSS %f MB, private %f MB (sum over the processes)\n",
+      rss / 1048576.0, pss / 1048576.0, private_bytes / 1048576.0);
+  std::fprintf(stdout, "  System: page cache %+f MB, available memory %+f MB\n",
+      cache_growth / 1048576.0, -available_drop / 1048576.0);
+
+  if (!opts.csv_file_name.empty()) {
+    std::ofstream ofs(opts.csv_file_name, std::ios::app);
+    if (ofs.tellp() == 0)
+      ofs << "backend,pattern,processes,threads,pagesize,file_bytes,seconds,accesses,accesses_per_sec,"
+             "read_bytes,unique_bytes,duplication,major_faults,rss_bytes,pss_bytes,private_bytes,"
+             "page_cache_growth_bytes,available_drop_bytes,ok\n";
+    ofs << (opts.usemmap ? "mmap" : "umap") << "," << opts.pattern << "," << opts.processes << ","
+        << opts.threads << "," << pagesize << "," << control->file_size << "," << wall_sec << ","
+        << accesses << "," << throughput << "," << read_bytes << "," << unique_bytes << "," << duplication << ","
+        << major_faults << "," << rss << "," << pss << "," << private_bytes << "," << cache_growth << ","
+        << available_drop << "," << ok << "\n";
+  }
+
+  pthread_barrier_destroy(&control->barrier);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,121 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2019 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+
+// Memory pressure without root (see utility/memory_pressure.hpp): leaves only
+// the given memory free, or follows a schedule, while a command runs or until
+// interrupted. With the cgroup backend, the command runs in the limited cgroup;
+// with the balloon backend, the balloon is held by this process, so it also
+// acts as a noisy neighbour of programs started elsewhere.
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "../utility/memory_pressure.hpp"
+
+using namespace std;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_signal(int) { interrupted = 1; }
+
+static void usage(const char *pname) {
+  std::cerr
+    << "Usage: " << pname << " [--backend auto|cgroup|balloon] (--free SIZE | --schedule T:SIZE,...)"
+    << " [--period SEC] [-- command args...]\n\n"
+    << " --backend B        - cgroup (delegated cgroup v2), balloon (mlocked memory) or auto; default: auto\n"
+    << " --free SIZE        - memory to leave free, e.g. 8G\n"
+    << " --schedule STEPS   - seconds:size steps, e.g. 0:8G,10:2G,20:8G\n"
+    << " --period SEC       - start the schedule over every SEC seconds\n\n"
+    << "Without a command, the pressure is held until SIGINT or SIGTERM.\n"
+    << std::endl;
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  utility::pressure_backend backend = utility::pressure_backend::automatic;
+  std::vector<utility::pressure_step> steps;
+  double period_sec = 0.0;
+
+  int i = 1;
+  for (; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--") {
+      ++i;
+      break;
+    }
+    if (i + 1 >= argc) usage(argv[0]);
+    const std::string value = argv[++i];
+    if (arg == "--backend") {
+      if (!utility::parse_pressure_backend(value, &backend)) usage(argv[0]);
+    } else if (arg == "--free") {
+      utility::pressure_step step;
+      if (!utility::parse_bytes(value, &step.free_bytes)) usage(argv[0]);
+      steps.assign(1, step);
+    } else if (arg == "--schedule") {
+      if (!utility::parse_pressure_schedule(value, &steps)) usage(argv[0]);
+    } else if (arg == "--period") {
+      period_sec = std::atof(value.c_str());
+    } else {
+      usage(argv[0]);
+    }
+  }
+  if (steps.empty() || (period_sec > 0.0 && period_sec <= steps.back().at_sec)) usage(argv[0]);
+
+  utility::memory_pressure pressure(backend);
+  std::cerr << "Backend: " << utility::pressure_backend_name(pressure.backend()) << ", reference: "
+            << pressure.reference_bytes() / (1ULL << 20) << " MB" << std::endl;
+  if (steps.front().at_sec == 0.0 && !pressure.set_free_bytes(steps.front().free_bytes))
+    return 1;
+  if (steps.size() > 1 || steps.front().at_sec > 0.0 || period_sec > 0.0)
+    pressure.start_schedule(steps, period_sec);
+
+  // Without SA_RESTART, so that waitpid returns to forward the signal
+  struct sigaction action;
+  std::memset(&action, 0, sizeof(action));
+  action.sa_handler = on_signal;
+  sigemptyset(&action.sa_mask);
+  ::sigaction(SIGINT, &action, nullptr);
+  ::sigaction(SIGTERM, &action, nullptr);
+
+  if (i >= argc) {
+    std::cerr << "Holding; interrupt to release" << std::endl;
+    while (!interrupted) ::pause();
+    return 0;
+  }
+
+  const pid_t pid = ::fork();
+  if (pid == -1) {
+    ::perror("fork");
+    return 1;
+  }
+  if (pid == 0) {
+    ::execvp(argv[i], argv + i);
+    ::perror("execvp");
+    ::_exit(127);
+  }
+  int status = 0;
+  while (::waitpid(pid, &status, 0) == -1) {
+    if (errno != EINTR) {
+      ::perror("waitpid");
+      return 1;
+    }
+    if (interrupted) ::kill(pid, SIGTERM);
+  }
+  if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+  return WEXITSTATUS(status);
+}
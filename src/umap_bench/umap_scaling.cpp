@@ -0,0 +1,304 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2019 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+
+// Scaling sweep of a fault-heavy kernel (e.g. umapcpu or umapsort) over
+// app threads x UMAP_PAGE_FILLERS x UMAP_PAGE_EVICTORS x UMAP_PAGESIZE,
+// for a fixed data size and buffer size in bytes.
+// Every configuration is run several times; the throughput of one phase of
+// the kernel is summarized with a 95% confidence interval, and the
+// saturation point of every dimension is reported.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <tuple>
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <getopt.h>
+
+#include "bench_runner.hpp"
+#include "../utility/statistics.hpp"
+
+using namespace std;
+
+struct scaling_options {
+  std::vector<std::string> threads{"1", "2", "4", "8"};
+  std::vector<std::string> fillers{"1", "2", "4"};
+  std::vector<std::string> evictors{"1", "2", "4"};
+  std::vector<std::string> pagesizes{"4096"};
+  uint64_t data_bytes{0};
+  uint64_t buffer_bytes{0};
+  int trials{3};
+  std::string phase{"Test"};
+  double threshold{0.95};
+  std::string output_file_name{"umap_scaling.csv"};
+  std::string saturation_file_name;
+  std::string log_file_name{"/dev/null"};
+  std::vector<std::string> command;
+};
+
+static void usage(const char *pname) {
+  std::cerr
+    << "Usage: " << pname << " [options] -- command [args]\n\n"
+    << " The command line may use {threads}, {pages}, {pagesize}, {fillers}, {evictors}, {bufsize} and {trial}.\n\n"
+    << " --threads LIST          - app threads (default: 1,2,4,8)\n"
+    << " --fillers LIST          - UMAP_PAGE_FILLERS (default: 1,2,4)\n"
+    << " --evictors LIST         - UMAP_PAGE_EVICTORS (default: 1,2,4)\n"
+    << " --pagesizes LIST        - UMAP_PAGESIZE in bytes (default: 4096)\n"
+    << " --data-bytes SIZE       - data size; {pages} = SIZE / page size (required, K/M/G/T suffixes)\n"
+    << " --buffer-bytes SIZE     - umap buffer size; UMAP_BUFSIZE = SIZE / page size (required)\n"
+    << " --trials N              - runs of every configuration (default: 3)\n"
+    << " --phase NAME            - phase of the kernel whose throughput is measured (default: Test)\n"
+    << " --threshold FRACTION    - saturation: first point within FRACTION of the best (default: 0.95)\n"
+    << " --output FILE           - scaling table, CSV (default: umap_scaling.csv)\n"
+    << " --saturation-output FILE - saturation points, CSV\n"
+    << " --log FILE              - output of the runs (default: /dev/null)\n"
+    << "\nExample:\n  " << pname
+    << " --threads 1,2,4,8,16 --fillers 1,4,16 --evictors 1,4 --pagesizes 4096,65536 --data-bytes 64G"
+       " --buffer-bytes 8G -- ../umapcpu/umapcpu --noinit -f /mnt/ssd/data -p {pages} -t {threads}\n"
+    << std::endl;
+  exit(1);
+}
+
+scaling_options get_options(int argc, char **argv) {
+  scaling_options opts;
+  static struct option long_options[] = {
+    {"threads",           required_argument, nullptr, 't'},
+    {"fillers",           required_argument, nullptr, 'F'},
+    {"evictors",          required_argument, nullptr, 'E'},
+    {"pagesizes",         required_argument, nullptr, 'P'},
+    {"data-bytes",        required_argument, nullptr, 'd'},
+    {"buffer-bytes",      required_argument, nullptr, 'b'},
+    {"trials",            required_argument, nullptr, 'n'},
+    {"phase",             required_argument, nullptr, 'p'},
+    {"threshold",         required_argument, nullptr, 'T'},
+    {"output",            required_argument, nullptr, 'o'},
+    {"saturation-output", required_argument, nullptr, 's'},
+    {"log",               required_argument, nullptr, 'l'},
+    {"help",              no_argument,       nullptr, 'h'},
+    {0, 0, 0, 0}
+  };
+
+  int c;
+  while ((c = getopt_long(argc, argv, "+", long_options, nullptr)) != -1) {
+    switch (c) {
+      case 't': opts.threads = umap_bench::split_list(optarg); break;
+      case 'F': opts.fillers = umap_bench::split_list(optarg); break;
+      case 'E': opts.evictors = umap_bench::split_list(optarg); break;
+      case 'P': opts.pagesizes = umap_bench::split_list(optarg); break;
+      case 'd': opts.data_bytes = umap_bench::parse_size(optarg); break;
+      case 'b': opts.buffer_bytes = umap_bench::parse_size(optarg); break;
+      case 'n': opts.trials = std::atoi(optarg); break;
+      case 'p': opts.phase = optarg; break;
+      case 'T': opts.threshold = std::atof(optarg); break;
+      case 'o': opts.output_file_name = optarg; break;
+      case 's': opts.saturation_file_name = optarg; break;
+      case 'l': opts.log_file_name = optarg; break;
+      default: usage(argv[0]);
+    }
+  }
+  for (int i = optind; i < argc; ++i)
+    opts.command.push_back(argv[i]);
+
+  if (opts.command.empty() || opts.data_bytes == 0 || opts.buffer_bytes == 0 || opts.trials < 1
+      || opts.threads.empty() || opts.fillers.empty() || opts.evictors.empty() || opts.pagesizes.empty())
+    usage(argv[0]);
+  return opts;
+}
+
+/// \brief One point of the grid
+struct config {
+  uint64_t threads;
+  uint64_t fillers;
+  uint64_t evictors;
+  uint64_t pagesize;
+
+  bool operator<(const config &other) const {
+    return std::tie(pagesize, evictors, fillers, threads)
+        < std::tie(other.pagesize, other.evictors, other.fillers, other.threads);
+  }
+};
+
+struct config_result {
+  std::vector<double> throughput;   // one per successful trial
+  std::vector<double> cpu_per_wall;
+  std::vector<double> major_faults;
+  std::vector<double> io_bytes;
+  int failed{0};
+  utility::sample_summary summary;
+};
+
+/// \brief Throughput of a phase: MB/s of its data, or runs/s if it has no data size
+double phase_throughput(const utility::phase_record &p) {
+  const double wall = p.wall_sec > 0.0 ? p.wall_sec : 1e-6;
+  return p.data_bytes ? p.data_bytes / wall / 1e6 : 1.0 / wall;
+}
+
+int main(int argc, char **argv)
+{
+  const scaling_options opts = get_options(argc, argv);
+
+  std::vector<config> grid;
+  for (const auto &ps : opts.pagesizes)
+    for (const auto &e : opts.evictors)
+      for (const auto &f : opts.fillers)
+        for (const auto &t : opts.threads)
+          grid.push_back(config{std::stoull(t), std::stoull(f), std::stoull(e), std::stoull(ps)});
+
+  std::map<config, config_result> results;
+  bool has_data_bytes = true;
+
+  // Trials are interleaved so that a slow drift of the system spreads over all configurations
+  for (int trial = 0; trial < opts.trials; ++trial) {
+    for (const config &cfg : grid) {
+      const uint64_t pages = opts.data_bytes / cfg.pagesize;
+      const uint64_t bufsize = std::max(opts.buffer_bytes / cfg.pagesize, (uint64_t)1);
+      const std::map<std::string, std::string> values = {
+        {"threads", std::to_string(cfg.threads)}, {"fillers", std::to_string(cfg.fillers)},
+        {"evictors", std::to_string(cfg.evictors)}, {"pagesize", std::to_string(cfg.pagesize)},
+        {"pages", std::to_string(pages)}, {"bufsize", std::to_string(bufsize)},
+        {"trial", std::to_string(trial)}};
+
+      umap_bench::run_spec spec;
+      for (const auto &arg : opts.command)
+        spec.args.push_back(umap_bench::substitute(arg, values));
+      spec.env = {{"UMAP_PAGE_FILLERS", values.at("fillers")}, {"UMAP_PAGE_EVICTORS", values.at("evictors")},
+                  {"UMAP_PAGESIZE", values.at("pagesize")}, {"UMAP_BUFSIZE", values.at("bufsize")}};
+      spec.log_file_name = opts.log_file_name;
+
+      const umap_bench::run_output out = umap_bench::run_command(spec);
+      const utility::phase_record *phase = umap_bench::find_phase(out, opts.phase);
+      config_result &r = results[cfg];
+      if (!out.ok || phase == nullptr) {
+        ++r.failed;
+        fprintf(stderr, "Trial %d failed (exit status %d%s): %s\n", trial, out.exit_status,
+            (out.ok && phase == nullptr) ? ", phase not found" : "", umap_bench::command_line(spec).c_str());
+        continue;
+      }
+      has_data_bytes = has_data_bytes && phase->data_bytes > 0;
+      r.throughput.push_back(phase_throughput(*phase));
+      r.cpu_per_wall.push_back(phase->wall_sec > 0.0 ? phase->cpu_sec / phase->wall_sec : 0.0);
+      r.major_faults.push_back(phase->major_faults);
+      r.io_bytes.push_back(phase->read_bytes + phase->write_bytes);
+      fprintf(stderr, "Trial %d: threads %lu, fillers %lu, evictors %lu, pagesize %lu: %f %s\n", trial,
+          cfg.threads, cfg.fillers, cfg.evictors, cfg.pagesize, r.throughput.back(),
+          phase->data_bytes ? "MB/s" : "runs/s");
+    }
+  }
+
+  for (auto &kv : results)
+    kv.second.summary = utility::summarize(kv.second.throughput);
+  const char *const unit = has_data_bytes ? "MB/s" : "runs/s";
+
+  // Speedup relative to the fewest threads with the same fillers, evictors and page size
+  std::ofstream csv(opts.output_file_name);
+  csv << "threads,fillers,evictors,pagesize,trials,failed,mean,stddev,ci_low,ci_high,min,median,max,"
+         "speedup,efficiency,cpu_per_wall,major_faults,io_bytes\n";
+  printf("Scaling of phase %s (%s, mean and 95%% confidence interval over %d trials)\n", opts.phase.c_str(), unit,
+      opts.trials);
+  printf("%8s %8s %8s %9s %12s %12s %12s %8s %6s %8s\n", "Threads", "Fillers", "Evictors", "PageSize",
+      "Mean", "CI low", "CI high", "Speedup", "Eff.", "CPU/W");
+  for (const config &cfg : grid) {
+    const config_result &r = results[cfg];
+    config base = cfg;
+    base.threads = std::stoull(opts.threads.front());
+    const double base_mean = results[base].summary.mean;
+    const double speedup = base_mean > 0.0 ? r.summary.mean / base_mean : 0.0;
+    const double efficiency = speedup * base.threads / cfg.threads;
+    const double cpu_per_wall = utility::summarize(r.cpu_per_wall).mean;
+
+    printf("%8lu %8lu %8lu %9lu %12.3f %12.3f %12.3f %8.2f %6.2f %8.2f%s\n", cfg.threads, cfg.fillers,
+        cfg.evictors, cfg.pagesize, r.summary.mean, r.summary.ci_low, r.summary.ci_high, speedup, efficiency,
+        cpu_per_wall, r.failed ? " (failed trials)" : "");
+    csv << cfg.threads << "," << cfg.fillers << "," << cfg.evictors << "," << cfg.pagesize << ","
+        << r.summary.count << "," << r.failed << "," << r.summary.mean << "," << r.summary.stddev << ","
+        << r.summary.ci_low << "," << r.summary.ci_high << "," << r.summary.min << "," << r.summary.median << ","
+        << r.summary.max << "," << speedup << "," << efficiency << "," << cpu_per_wall << ","
+        << utility::summarize(r.major_faults).mean << "," << utility::summarize(r.io_bytes).mean << "\n";
+  }
+
+  // Saturation point of every dimension, for every combination of the other dimensions:
+  // the smallest value whose mean throughput is within the threshold of the best one
+  std::ofstream saturation_csv;
+  if (!opts.saturation_file_name.empty()) {
+    saturation_csv.open(opts.saturation_file_name);
+    saturation_csv << "dimension,threads,fillers,evictors,pagesize,saturation_value,saturation_mean,best_value,"
+                      "best_mean,rising_at_end\n";
+  }
+  printf("\nSaturation points (first value within %.0f%% of the best; * = still rising at the largest value)\n",
+      opts.threshold * 100);
+  printf("%-9s %-44s %10s %12s %10s %12s\n", "Dimension", "Other parameters", "Saturation", "Mean", "Best", "Best mean");
+
+  const char *const dimensions[] = {"threads", "fillers", "evictors", "pagesize"};
+  for (int d = 0; d < 4; ++d) {
+    // Groups of configurations that differ only in dimension d
+    std::map<config, std::vector<config>> groups;
+    for (const config &cfg : grid) {
+      config key = cfg;
+      if (d == 0) key.threads = 0;
+      if (d == 1) key.fillers = 0;
+      if (d == 2) key.evictors = 0;
+      if (d == 3) key.pagesize = 0;
+      groups[key].push_back(cfg);
+    }
+
+    for (const auto &g : groups) {
+      if (g.second.size() < 2) continue;
+      auto value_of = [d](const config &c) {
+        return d == 0 ? c.threads : d == 1 ? c.fillers : d == 2 ? c.evictors : c.pagesize;
+      };
+      std::vector<config> points = g.second;
+      std::sort(points.begin(), points.end(),
+                [&](const config &a, const config &b) { return value_of(a) < value_of(b); });
+
+      double best_mean = 0.0;
+      config best = points.front();
+      for (const config &p : points) {
+        if (results[p].summary.mean > best_mean) {
+          best_mean = results[p].summary.mean;
+          best = p;
+        }
+      }
+      if (best_mean <= 0.0) continue;
+      config saturation = best;
+      for (const config &p : points) {
+        if (results[p].summary.mean >= opts.threshold * best_mean) {
+          saturation = p;
+          break;
+        }
+      }
+      // Still rising: the best is the largest value and its confidence interval is above the previous mean
+      const config &last = points.back();
+      const config &before_last = points[points.size() - 2];
+      const bool rising = (value_of(best) == value_of(last))
+          && results[last].summary.ci_low > results[before_last].summary.mean;
+
+      char others[128];
+      std::snprintf(others, sizeof(others), "threads %s fillers %s evictors %s pagesize %s",
+          d == 0 ? "-" : std::to_string(g.first.threads).c_str(),
+          d == 1 ? "-" : std::to_string(g.first.fillers).c_str(),
+          d == 2 ? "-" : std::to_string(g.first.evictors).c_str(),
+          d == 3 ? "-" : std::to_string(g.first.pagesize).c_str());
+      printf("%-9s %-44s %10lu %12.3f %10lu %12.3f%s\n", dimensions[d], others, value_of(saturation),
+          results[saturation].summary.mean, value_of(best), best_mean, rising ? " *" : "");
+      if (saturation_csv.is_open()) {
+        saturation_csv << dimensions[d] << "," << g.first.threads << "," << g.first.fillers << ","
+                       << g.first.evictors << "," << g.first.pagesize << "," << value_of(saturation) << ","
+                       << results[saturation].summary.mean << "," << value_of(best) << "," << best_mean << ","
+                       << (rising ? 1 : 0) << "\n";
+      }
+    }
+  }
+
+  printf("\nScaling table written to %s\n", opts.output_file_name.c_str());
+  return 0;
+}
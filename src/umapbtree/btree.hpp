@@ -0,0 +1,492 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about the B+-tree
+/// A B+-tree of 8-byte keys and 8-byte values in a mapped region (umap or
+/// mmap), so that it persists in its file:
+///  - Every node is one page of the region (the umap page size), so that a
+///    node is faulted in, cached and evicted as one unit. Page 0 is a header
+///    (root, allocated pages, entries); nodes are allocated from page 1 on and
+///    are never freed.
+///  - A node has a 24-byte header (version, level, count, next leaf) and
+///    then all its keys, followed by the children (inner nodes) or values
+///    (leaves), so a search reads only the key array. Inner node keys
+///    separate the children: child i has the keys < key i, child i + 1 the
+///    keys >= key i. Leaves are linked in key order for range scans.
+///  - Optimistic lock coupling (Leis et al., "Optimistic Lock Coupling: A
+///    Scalable and Efficient General-Purpose Synchronization Method", IEEE
+///    Data Eng. Bull. 2019): every node has a version whose bit 1 is a write
+///    lock. Readers do not write to the nodes; they read the version, read the
+///    node, and check that the version did not change, restarting from the
+///    root otherwise, so lookups do not dirty the shared inner nodes. Inserts
+///    go down the same way and lock only the nodes they modify; full nodes are
+///    split on the way down, so a split only modifies the node, its parent and
+///    the new sibling.
+///  - The bulk load builds the tree bottom-up from sorted unique keys: the
+///    leaves, and then every inner level, are written by all threads, each
+///    node to the given fill factor so that later inserts do not split right
+///    away. The leaves are allocated first and the inner nodes after them.
+/// Nodes are read without atomics between the version checks, as in the
+/// paper; a reader never dereferences a child it has not validated.
+
+#ifndef UMAP_APPS_UMAPBTREE_BTREE_HPP
+#define UMAP_APPS_UMAPBTREE_BTREE_HPP
+
+#include <cstdint>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace umapbtree {
+
+const uint64_t k_tree_magic = 0x756d617062747232ULL; // "umapbtr2"
+const uint64_t k_no_page = 0;
+
+struct tree_header {
+  uint64_t magic;
+  uint64_t page_size;
+  uint64_t num_pages;
+  std::atomic<uint64_t> root;
+  std::atomic<uint64_t> next_page;
+  std::atomic<uint64_t> num_entries;
+};
+
+struct node_header {
+  std::atomic<uint64_t> version;
+  uint16_t level; // 0: leaf
+  uint16_t reserved;
+  uint32_t count; // keys; a 2 MB leaf holds 131070
+  uint64_t next;  // leaves: the next leaf; k_no_page for the last one
+};
+static_assert(sizeof(node_header) == 24, "The node header must be 24 bytes");
+
+/// \brief What an operation did; restart is internal
+enum class result {
+  found,
+  not_found,
+  inserted,
+  updated,
+  full,   // no page left for a split
+  restart
+};
+
+class btree {
+ public:
+  /// \param region The mapped region; one node per page, page 0 is the header
+  btree(void *const region, const uint64_t region_bytes, const uint64_t page_size)
+      : m_base(static_cast<char *>(region)),
+        m_header(static_cast<tree_header *>(region)),
+        m_page_size(page_size),
+        m_num_pages(region_bytes / page_size),
+        m_inner_capacity((page_size - sizeof(node_header) - sizeof(uint64_t)) / (2 * sizeof(uint64_t))),
+        m_leaf_capacity((page_size - sizeof(node_header)) / (2 * sizeof(uint64_t))) {}
+
+  /// \brief Writes the header of an empty tree: one empty leaf
+  void init() {
+    m_header->magic = k_tree_magic;
+    m_header->page_size = m_page_size;
+    m_header->num_pages = m_num_pages;
+    m_header->next_page.store(1);
+    m_header->num_entries.store(0);
+    const uint64_t leaf = allocate();
+    init_node(leaf, 0);
+    m_header->root.store(leaf);
+  }
+
+  /// \brief Whether the region holds a tree of this page size and number of pages
+  bool valid() const {
+    return m_header->magic == k_tree_magic && m_header->page_size == m_page_size
+        && m_header->num_pages == m_num_pages;
+  }
+
+  uint64_t inner_capacity() const { return m_inner_capacity; }
+  uint64_t leaf_capacity() const { return m_leaf_capacity; }
+  uint64_t num_pages() const { return m_num_pages; }
+  uint64_t used_pages() const { return std::min(m_header->next_page.load(), m_num_pages); }
+  uint64_t num_entries() const { return m_header->num_entries.load(); }
+  void add_entries(const uint64_t n) { m_header->num_entries += n; }
+  uint64_t root() const { return m_header->root.load(std::memory_order_acquire); }
+  uint64_t height() const { return node(root())->level + 1; }
+
+  node_header *node(const uint64_t page) const {
+    return reinterpret_cast<node_header *>(m_base + page * m_page_size);
+  }
+  uint64_t *keys(node_header *const n) const { return reinterpret_cast<uint64_t *>(n + 1); }
+  uint64_t *children(node_header *const n) const { return keys(n) + m_inner_capacity; }
+  uint64_t *values(node_header *const n) const { return keys(n) + m_leaf_capacity; }
+
+  /// \brief Builds the tree from num_entries sorted unique keys with all threads
+  /// \param entry entry(i, &key, &value) reads the i-th entry
+  /// \param fill Fraction of every node filled, in (0, 1]
+  /// \return false if the tree does not fit
+  template <typename Entry>
+  bool bulk_load(const uint64_t num_entries, const Entry &entry, const double fill) {
+    if (num_entries == 0) {
+      init();
+      return true;
+    }
+    m_header->magic = k_tree_magic;
+    m_header->page_size = m_page_size;
+    m_header->num_pages = m_num_pages;
+    m_header->next_page.store(1);
+
+    const uint64_t per_leaf = std::max<uint64_t>(1, m_leaf_capacity * fill);
+    uint64_t num_nodes = (num_entries + per_leaf - 1) / per_leaf;
+    uint64_t first = m_header->next_page.fetch_add(num_nodes);
+    if (first + num_nodes > m_num_pages) return false;
+
+    // Smallest key of every node of the level being built
+    std::vector<uint64_t> low_keys(num_nodes);
+#pragma omp parallel for schedule(static)
+    for (uint64_t i = 0; i < num_nodes; ++i) {
+      const uint64_t begin = part(num_entries, i, num_nodes);
+      const uint64_t end = part(num_entries, i + 1, num_nodes);
+      node_header *const n = init_node(first + i, 0);
+      for (uint64_t e = begin; e < end; ++e) entry(e, &keys(n)[e - begin], &values(n)[e - begin]);
+      n->count = end - begin;
+      n->next = (i + 1 < num_nodes) ? first + i + 1 : k_no_page;
+      low_keys[i] = keys(n)[0];
+    }
+
+    const uint64_t per_inner = std::max<uint64_t>(2, (m_inner_capacity + 1) * fill);
+    uint16_t level = 0;
+    while (num_nodes > 1) {
+      ++level;
+      const uint64_t num_children = num_nodes;
+      const uint64_t first_child = first;
+      num_nodes = (num_children + per_inner - 1) / per_inner;
+      first = m_header->next_page.fetch_add(num_nodes);
+      if (first + num_nodes > m_num_pages) return false;
+
+      std::vector<uint64_t> parent_low_keys(num_nodes);
+#pragma omp parallel for schedule(static)
+      for (uint64_t i = 0; i < num_nodes; ++i) {
+        const uint64_t begin = part(num_children, i, num_nodes);
+        const uint64_t end = part(num_children, i + 1, num_nodes);
+        node_header *const n = init_node(first + i, level);
+        for (uint64_t c = begin; c < end; ++c) {
+          children(n)[c - begin] = first_child + c;
+          if (c > begin) keys(n)[c - begin - 1] = low_keys[c];
+        }
+        n->count = end - begin - 1;
+        parent_low_keys[i] = low_keys[begin];
+      }
+      low_keys.swap(parent_low_keys);
+    }
+    m_header->root.store(first);
+    m_header->num_entries.store(num_entries);
+    return true;
+  }
+
+  /// \brief Looks a key up
+  result lookup(const uint64_t key, uint64_t *const value) const {
+    for (;;) {
+      const result r = try_lookup(key, value);
+      if (r != result::restart) return r;
+    }
+  }
+
+  /// \brief Inserts a key, or updates its value if it is in the tree
+  result insert(const uint64_t key, const uint64_t value) {
+    for (;;) {
+      const result r = try_insert(key, value);
+      if (r != result::restart) return r;
+    }
+  }
+
+  /// \brief Calls visit(key, value) for up to max_entries entries with keys >= start, in key order
+  /// \return The number of entries visited
+  template <typename Visit>
+  uint64_t scan(uint64_t start, const uint64_t max_entries, const Visit &visit) const {
+    std::vector<std::pair<uint64_t, uint64_t>> buffer;
+    buffer.reserve(m_leaf_capacity);
+    uint64_t visited = 0;
+    while (visited < max_entries) {
+      // Restarts from the last key visited if a leaf changed under the scan
+      node_header *leaf = nullptr;
+      uint64_t version = 0;
+      if (!find_leaf(start, &leaf, &version)) continue;
+      bool restart = false;
+      bool end = false;
+      while (visited < max_entries) {
+        buffer.clear();
+        const uint64_t count = std::min<uint64_t>(leaf->count, m_leaf_capacity);
+        const uint64_t *const k = keys(leaf);
+        for (uint64_t i = std::lower_bound(k, k + count, start) - k;
+             i < count && buffer.size() < max_entries - visited; ++i)
+          buffer.emplace_back(k[i], values(leaf)[i]);
+        const uint64_t next = leaf->next;
+        if (!check(leaf, version)) {
+          restart = true;
+          break;
+        }
+        for (const auto &e : buffer) visit(e.first, e.second);
+        visited += buffer.size();
+        if (!buffer.empty()) {
+          if (buffer.back().first == UINT64_MAX) end = true;
+          start = buffer.back().first + 1;
+        }
+        if (next == k_no_page || end) {
+          end = true;
+          break;
+        }
+        // Leaves are never merged, so the next leaf holds the next keys even if this one was split since
+        leaf = node(next);
+        if (!read_lock(leaf, &version)) {
+          restart = true;
+          break;
+        }
+      }
+      if (end || !restart) break;
+    }
+    return visited;
+  }
+
+  /// \brief Visits the inner nodes from the root; calls visit(page, level) for every node, leaves included
+  /// Does not read the leaves. Not for concurrent inserts.
+  template <typename Visit>
+  void visit_nodes(const Visit &visit) const {
+    std::vector<uint64_t> level_nodes(1, root());
+    while (!level_nodes.empty()) {
+      std::vector<uint64_t> below;
+      for (const uint64_t page : level_nodes) {
+        node_header *const n = node(page);
+        visit(page, n->level);
+        if (n->level == 0) continue;
+        for (uint64_t c = 0; c <= n->count; ++c) {
+          if (n->level == 1) visit(children(n)[c], 0);
+          else below.push_back(children(n)[c]);
+        }
+      }
+      level_nodes.swap(below);
+    }
+  }
+
+ private:
+  /// \brief n * i / parts without overflow
+  static uint64_t part(const uint64_t n, const uint64_t i, const uint64_t parts) {
+    return static_cast<uint64_t>(static_cast<unsigned __int128>(n) * i / parts);
+  }
+
+  static bool locked(const uint64_t version) { return (version & 2) != 0; }
+
+  /// \brief Reads the version of an unlocked node
+  static bool read_lock(const node_header *const n, uint64_t *const version) {
+    const uint64_t v = n->version.load(std::memory_order_acquire);
+    if (locked(v)) return false;
+    *version = v;
+    return true;
+  }
+
+  /// \brief Whether the node did not change since its version was read
+  static bool check(const node_header *const n, const uint64_t version) {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return n->version.load(std::memory_order_relaxed) == version;
+  }
+
+  static bool upgrade(node_header *const n, const uint64_t version) {
+    uint64_t expected = version;
+    return n->version.compare_exchange_strong(expected, version + 2, std::memory_order_acquire);
+  }
+
+  static void write_unlock(node_header *const n) {
+    n->version.fetch_add(2, std::memory_order_release);
+  }
+
+  uint64_t allocate() {
+    const uint64_t page = m_header->next_page.fetch_add(1);
+    return (page < m_num_pages) ? page : k_no_page;
+  }
+
+  node_header *init_node(const uint64_t page, const uint16_t level) const {
+    node_header *const n = node(page);
+    n->version.store(0, std::memory_order_relaxed);
+    n->level = level;
+    n->count = 0;
+    n->reserved = 0;
+    n->next = k_no_page;
+    return n;
+  }
+
+  uint64_t child_for(node_header *const n, const uint64_t key) const {
+    const uint64_t count = std::min<uint64_t>(n->count, m_inner_capacity);
+    const uint64_t *const k = keys(n);
+    return children(n)[std::upper_bound(k, k + count, key) - k];
+  }
+
+  /// \brief Goes down to the leaf of a key; the leaf is read locked
+  bool find_leaf(const uint64_t key, node_header **const leaf, uint64_t *const version) const {
+    const uint64_t root_page = root();
+    node_header *n = node(root_page);
+    uint64_t v;
+    if (!read_lock(n, &v) || root_page != root()) return false;
+    while (n->level > 0) {
+      const uint64_t child = child_for(n, key);
+      if (!check(n, v)) return false;
+      node_header *const c = node(child);
+      uint64_t cv;
+      if (!read_lock(c, &cv) || !check(n, v)) return false;
+      n = c;
+      v = cv;
+    }
+    *leaf = n;
+    *version = v;
+    return true;
+  }
+
+  result try_lookup(const uint64_t key, uint64_t *const value) const {
+    node_header *leaf;
+    uint64_t version;
+    if (!find_leaf(key, &leaf, &version)) return result::restart;
+    const uint64_t count = std::min<uint64_t>(leaf->count, m_leaf_capacity);
+    const uint64_t *const k = keys(leaf);
+    const uint64_t pos = std::lower_bound(k, k + count, key) - k;
+    const bool found = pos < count && k[pos] == key;
+    if (found) *value = values(leaf)[pos];
+    if (!check(leaf, version)) return result::restart;
+    return found ? result::found : result::not_found;
+  }
+
+  /// \brief Splits a full node (write locked) into itself and a new right sibling
+  void split(node_header *const n, const uint64_t right_page, uint64_t *const separator) {
+    node_header *const right = init_node(right_page, n->level);
+    const uint64_t count = n->count;
+    const uint64_t mid = count / 2;
+    if (n->level == 0) {
+      // The right leaf takes the upper half of the entries
+      std::copy(keys(n) + mid, keys(n) + count, keys(right));
+      std::copy(values(n) + mid, values(n) + count, values(right));
+      right->count = count - mid;
+      right->next = n->next;
+      *separator = keys(right)[0];
+      n->next = right_page;
+    } else {
+      // The middle key moves up
+      *separator = keys(n)[mid];
+      std::copy(keys(n) + mid + 1, keys(n) + count, keys(right));
+      std::copy(children(n) + mid + 1, children(n) + count + 1, children(right));
+      right->count = count - mid - 1;
+    }
+    n->count = mid;
+  }
+
+  /// \brief Adds a separator and the child on its right to an inner node (write locked, not full)
+  void insert_child(node_header *const n, const uint64_t separator, const uint64_t child) {
+    const uint64_t count = n->count;
+    uint64_t *const k = keys(n);
+    const uint64_t pos = std::upper_bound(k, k + count, separator) - k;
+    std::copy_backward(k + pos, k + count, k + count + 1);
+    std::copy_backward(children(n) + pos + 1, children(n) + count + 1, children(n) + count + 2);
+    k[pos] = separator;
+    children(n)[pos + 1] = child;
+    n->count = count + 1;
+  }
+
+  /// \brief Splits a full node; its parent (or a new root) gets the new sibling
+  result split_node(node_header *const n, const uint64_t page, const uint64_t version,
+                    node_header *const parent, const uint64_t parent_version) {
+    if (parent && !upgrade(parent, parent_version)) return result::restart;
+    if (!upgrade(n, version)) {
+      if (parent) write_unlock(parent);
+      return result::restart;
+    }
+    if (!parent && page != root()) {
+      // Another thread grew the tree above this node
+      write_unlock(n);
+      return result::restart;
+    }
+    // The pages are taken before anything is modified, so a full region leaves the tree intact
+    const uint64_t right = allocate();
+    const uint64_t new_root = parent ? k_no_page : allocate();
+    if (right == k_no_page || (!parent && new_root == k_no_page)) {
+      write_unlock(n);
+      if (parent) write_unlock(parent);
+      return result::full;
+    }
+    uint64_t separator = 0;
+    split(n, right, &separator);
+    if (parent) {
+      insert_child(parent, separator, right);
+    } else {
+      node_header *const root_node = init_node(new_root, n->level + 1);
+      keys(root_node)[0] = separator;
+      children(root_node)[0] = page;
+      children(root_node)[1] = right;
+      root_node->count = 1;
+      m_header->root.store(new_root, std::memory_order_release);
+    }
+    write_unlock(n);
+    if (parent) write_unlock(parent);
+    return result::restart;
+  }
+
+  result try_insert(const uint64_t key, const uint64_t value) {
+    uint64_t page = root();
+    node_header *n = node(page);
+    uint64_t v;
+    if (!read_lock(n, &v) || page != root()) return result::restart;
+    node_header *parent = nullptr;
+    uint64_t parent_version = 0;
+
+    while (n->level > 0) {
+      if (n->count >= m_inner_capacity) return split_node(n, page, v, parent, parent_version);
+      if (parent && !check(parent, parent_version)) return result::restart;
+      parent = n;
+      parent_version = v;
+      page = child_for(n, key);
+      if (!check(parent, parent_version)) return result::restart;
+      n = node(page);
+      if (!read_lock(n, &v) || !check(parent, parent_version)) return result::restart;
+    }
+
+    if (n->count >= m_leaf_capacity) return split_node(n, page, v, parent, parent_version);
+    if (!upgrade(n, v)) return result::restart;
+    if (parent && !check(parent, parent_version)) {
+      write_unlock(n);
+      return result::restart;
+    }
+    const uint64_t count = n->count;
+    uint64_t *const k = keys(n);
+    uint64_t *const values_of_n = values(n);
+    const uint64_t pos = std::lower_bound(k, k + count, key) - k;
+    result r = result::updated;
+    if (pos < count && k[pos] == key) {
+      values_of_n[pos] = value;
+    } else {
+      std::copy_backward(k + pos, k + count, k + count + 1);
+      std::copy_backward(values_of_n + pos, values_of_n + count, values_of_n + count + 1);
+      k[pos] = key;
+      values_of_n[pos] = value;
+      n->count = count + 1;
+      r = result::inserted;
+    }
+    write_unlock(n);
+    return r;
+  }
+
+  char *m_base;
+  tree_header *m_header;
+  uint64_t m_page_size;
+  uint64_t m_num_pages;
+  uint64_t m_inner_capacity;
+  uint64_t m_leaf_capacity;
+};
+
+} // namespace umapbtree
+#endif //UMAP_APPS_UMAPBTREE_BTREE_HPP
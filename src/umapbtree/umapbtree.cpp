@@ -0,0 +1,581 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+// B+-tree index benchmark: bulk loads a B+-tree with page-sized nodes in a
+// file mapped with umap or mmap (see btree.hpp), from a sorted umapsort kv16
+// file or from generated keys, and then grows it round by round with
+// concurrent inserts. After every round, all threads run point lookups and
+// range scans; the program prints their throughput and latency, the page
+// faults per lookup, and which fraction of the inner nodes and of the leaves
+// is resident, as the tree grows past the buffer.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif // _GNU_SOURCE
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "umap/umap.h"
+#include "../utility/commandline.hpp"
+#include "../utility/umap_file.hpp"
+#include "../utility/file.hpp"
+#include "../utility/histogram.hpp"
+#include "../utility/phase.hpp"
+#include "../utility/memory_pressure.hpp"
+#include "../utility/metrics.hpp"
+#include "../utility/cache_control.hpp"
+#include "../utility/random.hpp"
+#include "../umapsort/record.hpp"
+#include "btree.hpp"
+
+struct btree_options {
+  std::string input_file_name;    // sorted kv16 file written by umapsort
+  uint64_t records{0};            // generated entries; 0: a quarter of the pages at UMAPBTREE_FILL
+  double fill_percent{70.0};
+  uint64_t rounds{4};
+  uint64_t inserts{0};            // per round, all threads; 0: a quarter of the loaded entries
+  uint64_t lookups{100000};       // per thread and round
+  uint64_t scans{10000};          // per thread and round
+  uint64_t max_scan_length{100};
+  uint64_t seed{123};
+  bool check{true};
+  std::string csv_file_name;
+};
+
+void disp_btree_env_variables(const btree_options &bopts) {
+  std::cerr
+    << "Benchmark Configuration (environment variables):\n"
+    << " UMAPBTREE_INPUT                 - currently: " << bopts.input_file_name
+    << " (sorted kv16 umapsort file to load; empty: generated keys)\n"
+    << " UMAPBTREE_RECORDS               - currently: " << bopts.records
+    << " generated entries (0: a quarter of the pages)\n"
+    << " UMAPBTREE_FILL                  - currently: " << bopts.fill_percent << " percent of every loaded node\n"
+    << " UMAPBTREE_ROUNDS                - currently: " << bopts.rounds << " rounds of inserts\n"
+    << " UMAPBTREE_INSERTS               - currently: " << bopts.inserts
+    << " inserts per round (0: a quarter of the loaded entries)\n"
+    << " UMAPBTREE_LOOKUPS               - currently: " << bopts.lookups << " lookups per thread and round\n"
+    << " UMAPBTREE_SCANS                 - currently: " << bopts.scans << " scans per thread and round\n"
+    << " UMAPBTREE_SCAN_LENGTH           - currently: " << bopts.max_scan_length << " entries at most per scan\n"
+    << " UMAPBTREE_SEED                  - currently: " << bopts.seed << "\n"
+    << " UMAPBTREE_CHECK                 - currently: " << bopts.check << " (1: check every leaf at the end)\n"
+    << " UMAPBTREE_CSV                   - currently: " << bopts.csv_file_name << " (summary, one line per round)\n"
+    << std::endl;
+}
+
+btree_options get_btree_options() {
+  btree_options bopts;
+
+  const char *buf = std::getenv("UMAPBTREE_INPUT");
+  if (buf != nullptr)
+    bopts.input_file_name = buf;
+
+  buf = std::getenv("UMAPBTREE_RECORDS");
+  if (buf != nullptr)
+    bopts.records = std::stoull(buf);
+
+  buf = std::getenv("UMAPBTREE_FILL");
+  if (buf != nullptr) {
+    bopts.fill_percent = std::stod(buf);
+    if (!(bopts.fill_percent > 0.0 && bopts.fill_percent <= 100.0)) {
+      std::cerr << "Invalid UMAPBTREE_FILL: " << buf << std::endl;
+      exit(1);
+    }
+  }
+
+  buf = std::getenv("UMAPBTREE_ROUNDS");
+  if (buf != nullptr)
+    bopts.rounds = std::stoull(buf);
+
+  buf = std::getenv("UMAPBTREE_INSERTS");
+  if (buf != nullptr)
+    bopts.inserts = std::stoull(buf);
+
+  buf = std::getenv("UMAPBTREE_LOOKUPS");
+  if (buf != nullptr)
+    bopts.lookups = std::stoull(buf);
+
+  buf = std::getenv("UMAPBTREE_SCANS");
+  if (buf != nullptr)
+    bopts.scans = std::stoull(buf);
+
+  buf = std::getenv("UMAPBTREE_SCAN_LENGTH");
+  if (buf != nullptr)
+    bopts.max_scan_length = std::max((uint64_t)std::stoull(buf), (uint64_t)1);
+
+  buf = std::getenv("UMAPBTREE_SEED");
+  if (buf != nullptr)
+    bopts.seed = std::stoull(buf);
+
+  buf = std::getenv("UMAPBTREE_CHECK");
+  if (buf != nullptr)
+    bopts.check = std::stoull(buf) != 0;
+
+  buf = std::getenv("UMAPBTREE_CSV");
+  if (buf != nullptr)
+    bopts.csv_file_name = buf;
+
+  return bopts;
+}
+
+/// \brief The value of every key, so that lookups and scans can check what they read
+inline uint64_t value_of(const uint64_t key) { return umapsort::record_detail::mix(key); }
+
+/// \brief Bulk loads the tree from a sorted kv16 file
+/// \return false on errors (printed)
+bool load_from_file(umapbtree::btree &tree, const btree_options &bopts, const bool usemmap) {
+  const ssize_t size = utility::get_file_size(bopts.input_file_name);
+  if (size <= 0 || size % sizeof(umapsort::kv_record) != 0) {
+    std::cerr << bopts.input_file_name << " is not a kv16 file" << std::endl;
+    return false;
+  }
+  void *const addr = utility::map_in_file(bopts.input_file_name, false, true, usemmap, size);
+  if (addr == nullptr) {
+    std::cerr << "Failed to map " << bopts.input_file_name << std::endl;
+    return false;
+  }
+  const umapsort::kv_record *const records = static_cast<const umapsort::kv_record *>(addr);
+  const uint64_t num_records = size / sizeof(umapsort::kv_record);
+
+  uint64_t unsorted = 0;
+#pragma omp parallel for schedule(static) reduction(+:unsorted)
+  for (uint64_t i = 1; i < num_records; ++i)
+    unsorted += (records[i - 1].key >= records[i].key);
+
+  bool ok = false;
+  if (unsorted) {
+    std::cerr << bopts.input_file_name << " is not sorted by unique keys (" << unsorted
+              << " keys out of order); sort it with UMAPSORT_RECORD=kv16 UMAPSORT_ORDER=ascending umapsort"
+              << std::endl;
+  } else {
+    ok = tree.bulk_load(num_records, [records](const uint64_t i, uint64_t *const key, uint64_t *const value) {
+      *key = records[i].key;
+      *value = records[i].value;
+    }, bopts.fill_percent / 100.0);
+    if (!ok)
+      std::cerr << num_records << " entries do not fit in " << tree.num_pages() << " pages" << std::endl;
+  }
+  utility::unmap_file(usemmap, size, addr);
+  return ok;
+}
+
+/// \brief Bulk loads the tree with evenly spaced keys
+bool load_generated(umapbtree::btree &tree, const uint64_t num_records, const double fill) {
+  const uint64_t spacing = UINT64_MAX / (num_records + 1);
+  const bool ok = tree.bulk_load(num_records, [spacing](const uint64_t i, uint64_t *const key, uint64_t *const value) {
+    *key = (i + 1) * spacing;
+    *value = value_of(*key);
+  }, fill);
+  if (!ok)
+    std::cerr << num_records << " entries do not fit in " << tree.num_pages() << " pages" << std::endl;
+  return ok;
+}
+
+/// \brief Keys of the tree for the lookups: the first key >= a random key, so it works for any loaded tree
+std::vector<uint64_t> sample_keys(const umapbtree::btree &tree, const uint64_t num_samples, const uint64_t seed) {
+  std::vector<uint64_t> samples(num_samples);
+#pragma omp parallel for schedule(static)
+  for (uint64_t i = 0; i < num_samples; ++i) {
+    uint64_t key = 0;
+    uint64_t start = utility::counter_random(seed, i);
+    // Past the largest key: take the first one
+    if (tree.scan(start, 1, [&key](const uint64_t k, uint64_t) { key = k; }) == 0)
+      tree.scan(0, 1, [&key](const uint64_t k, uint64_t) { key = k; });
+    samples[i] = key;
+  }
+  return samples;
+}
+
+struct residency {
+  uint64_t inner{0};
+  uint64_t inner_resident{0};
+  uint64_t leaves{0};
+  uint64_t leaves_resident{0};
+
+  double inner_fraction() const { return inner ? (double)inner_resident / inner : 0.0; }
+  double leaf_fraction() const { return leaves ? (double)leaves_resident / leaves : 0.0; }
+};
+
+/// \brief Which nodes are resident (mincore of their first page)
+/// mincore runs before the inner nodes are walked, which faults them in.
+residency node_residency(const umapbtree::btree &tree, void *const base_addr, const uint64_t pagesize) {
+  residency r;
+  const uint64_t system_page_size = utility::get_page_size();
+  const uint64_t used_bytes = tree.used_pages() * pagesize;
+  std::vector<unsigned char> vec((used_bytes + system_page_size - 1) / system_page_size);
+  if (::mincore(base_addr, used_bytes, vec.data()) != 0) {
+    ::perror("mincore");
+    return r;
+  }
+  tree.visit_nodes([&](const uint64_t page, const uint16_t level) {
+    const bool resident = vec[page * pagesize / system_page_size] & 1;
+    if (level == 0) {
+      ++r.leaves;
+      r.leaves_resident += resident;
+    } else {
+      ++r.inner;
+      r.inner_resident += resident;
+    }
+  });
+  return r;
+}
+
+struct round_result {
+  uint64_t round{0};
+  uint64_t entries{0};
+  uint64_t used_pages{0};
+  uint64_t height{0};
+  double tree_buffer_ratio{0.0};
+  uint64_t inserted{0};
+  uint64_t full{0};
+  utility::phase_record insert_phase;
+  utility::phase_record lookup_phase;
+  utility::phase_record scan_phase;
+  utility::latency_histogram insert_latency;
+  utility::latency_histogram lookup_latency;
+  utility::latency_histogram scan_latency;
+  uint64_t lookups{0};
+  uint64_t scans{0};
+  uint64_t scanned{0};
+  uint64_t misses{0};     // sampled keys that were not found
+  uint64_t bad_values{0}; // values that are not the ones of their key
+  uint64_t unordered{0};  // scans that did not return increasing keys
+  uint64_t checksum{0};   // of the values read
+  residency nodes;
+};
+
+/// \brief Bytes of the buffer; the umap buffer for umap, the memory left for the run for mmap
+double buffer_bytes(const utility::umt_optstruct_t &options, const utility::memory_pressure *const pressure) {
+  if (!options.usemmap)
+    return (double)umapcfg_get_max_pages_in_buffer() * umapcfg_get_umap_page_size();
+  return (pressure && pressure->free_bytes()) ? pressure->free_bytes()
+                                              : utility::get_meminfo_bytes("MemAvailable");
+}
+
+/// \brief Inserts random keys (round > 0), then runs the lookups and the scans of one round
+round_result run_round(umapbtree::btree &tree, const uint64_t round, const std::vector<uint64_t> &samples,
+                       const btree_options &bopts, const uint64_t inserts,
+                       utility::phase_recorder &phases) {
+  utility::metrics &metrics = phases.metrics();
+  round_result result;
+  result.round = round;
+  const std::string suffix = " " + std::to_string(round);
+  const uint64_t seed = utility::hash64(bopts.seed) ^ utility::hash64(round);
+
+  if (round > 0 && inserts > 0) {
+    const utility::metrics::id latency_id = metrics.histogram("insert latency" + suffix, "ns");
+    const utility::metrics::id inserted_id = metrics.counter("inserted" + suffix);
+    const utility::metrics::id full_id = metrics.counter("full" + suffix);
+    phases.begin("Insert" + suffix);
+#pragma omp parallel
+    {
+      utility::metrics::thread_slot &slot = metrics.local();
+#pragma omp for schedule(static)
+      for (uint64_t i = 0; i < inserts; ++i) {
+        const uint64_t key = utility::counter_random(seed, i);
+        const uint64_t start = utility::tsc_clock::ns();
+        const umapbtree::result r = tree.insert(key, value_of(key));
+        slot.record(latency_id, utility::tsc_clock::ns() - start);
+        if (r == umapbtree::result::inserted) slot.add(inserted_id);
+        else if (r == umapbtree::result::full) slot.add(full_id);
+      }
+    }
+    result.insert_phase = phases.end();
+    result.insert_latency = metrics.merged(latency_id);
+    result.inserted = metrics.total(inserted_id);
+    result.full = metrics.total(full_id);
+    tree.add_entries(result.inserted);
+  }
+
+  const utility::metrics::id lookup_id = metrics.histogram("lookup latency" + suffix, "ns");
+  const utility::metrics::id scan_id = metrics.histogram("scan latency" + suffix, "ns");
+  const utility::metrics::id scanned_id = metrics.counter("scanned entries" + suffix);
+  const utility::metrics::id misses_id = metrics.counter("misses" + suffix);
+  const utility::metrics::id bad_values_id = metrics.counter("bad values" + suffix);
+  const utility::metrics::id unordered_id = metrics.counter("unordered scans" + suffix);
+  const uint64_t num_samples = samples.size();
+  uint64_t checksum = 0;
+
+  phases.begin("Lookup" + suffix);
+#pragma omp parallel reduction(+:checksum)
+  {
+    const uint64_t thread = omp_get_thread_num();
+    const uint64_t thread_seed = seed ^ utility::hash64(2 * thread + 1);
+    utility::metrics::thread_slot &slot = metrics.local();
+    for (uint64_t i = 0; num_samples && i < bopts.lookups; ++i) {
+      const uint64_t key = samples[utility::counter_random(thread_seed, i) % num_samples];
+      uint64_t value = 0;
+      const uint64_t start = utility::tsc_clock::ns();
+      const umapbtree::result r = tree.lookup(key, &value);
+      slot.record(lookup_id, utility::tsc_clock::ns() - start);
+      if (r != umapbtree::result::found) slot.add(misses_id);
+      else if (value != value_of(key)) slot.add(bad_values_id);
+      checksum += value;
+    }
+  }
+  result.lookup_phase = phases.end();
+
+  phases.begin("Scan" + suffix);
+#pragma omp parallel reduction(+:checksum)
+  {
+    const uint64_t thread = omp_get_thread_num();
+    const uint64_t thread_seed = seed ^ utility::hash64(2 * thread + 2);
+    utility::metrics::thread_slot &slot = metrics.local();
+    for (uint64_t i = 0; num_samples && i < bopts.scans; ++i) {
+      const uint64_t first = samples[utility::counter_random(thread_seed, 2 * i) % num_samples];
+      const uint64_t length = 1 + utility::counter_random(thread_seed, 2 * i + 1) % bopts.max_scan_length;
+      uint64_t previous = 0;
+      uint64_t visited = 0;
+      bool ordered = true;
+      bool values_ok = true;
+      const uint64_t start = utility::tsc_clock::ns();
+      const uint64_t n = tree.scan(first, length, [&](const uint64_t key, const uint64_t value) {
+        ordered = ordered && key >= first && (visited == 0 || key > previous);
+        values_ok = values_ok && value == value_of(key);
+        previous = key;
+        ++visited;
+        checksum += value;
+      });
+      slot.record(scan_id, utility::tsc_clock::ns() - start);
+      slot.add(scanned_id, n);
+      if (n == 0) slot.add(misses_id);
+      if (!ordered) slot.add(unordered_id);
+      if (!values_ok) slot.add(bad_values_id);
+    }
+  }
+  result.scan_phase = phases.end();
+  result.checksum = checksum;
+
+  result.lookup_latency = metrics.merged(lookup_id);
+  result.scan_latency = metrics.merged(scan_id);
+  result.lookups = result.lookup_latency.count();
+  result.scans = result.scan_latency.count();
+  result.scanned = metrics.total(scanned_id);
+  result.misses = metrics.total(misses_id);
+  result.bad_values = metrics.total(bad_values_id);
+  result.unordered = metrics.total(unordered_id);
+  result.entries = tree.num_entries();
+  result.used_pages = tree.used_pages();
+  result.height = tree.height();
+  return result;
+}
+
+/// \brief Operations per second of a phase
+double rate(const uint64_t operations, const utility::phase_record &phase) {
+  return phase.wall_sec > 0.0 ? operations / phase.wall_sec : 0.0;
+}
+
+double faults_per(const utility::phase_record &phase, const uint64_t operations) {
+  return operations ? (double)(phase.minor_faults + phase.major_faults) / operations : 0.0;
+}
+
+void print_header() {
+  fprintf(stdout, "%5s %12s %10s %6s %9s %12s %12s %8s %8s %10s %12s %10s %10s %9s %9s\n",
+      "Round", "Entries", "Pages", "Height", "Tree/Buf", "Insert(K/s)", "Lookup(K/s)", "p50(ns)", "p99(ns)",
+      "Flt/lookup", "Scan(K/s)", "Entries/s", "Flt/scan", "Inner(%)", "Leaves(%)");
+}
+
+void print_round(const round_result &r) {
+  fprintf(stdout, "%5lu %12lu %10lu %6lu %9.3f %12.1f %12.1f %8lu %8lu %10.3f %12.1f %10.3g %10.3f %9.1f %9.1f\n",
+      r.round, r.entries, r.used_pages, r.height, r.tree_buffer_ratio,
+      rate(r.inserted + r.full, r.insert_phase) / 1e3,
+      rate(r.lookups, r.lookup_phase) / 1e3, r.lookup_latency.percentile(0.5), r.lookup_latency.percentile(0.99),
+      faults_per(r.lookup_phase, r.lookups),
+      rate(r.scans, r.scan_phase) / 1e3, rate(r.scanned, r.scan_phase), faults_per(r.scan_phase, r.scans),
+      100.0 * r.nodes.inner_fraction(), 100.0 * r.nodes.leaf_fraction());
+}
+
+/// \brief Appends one line to the summary CSV; writes the header if the file is new
+void write_csv(const round_result &r, const utility::umt_optstruct_t &options, const btree_options &bopts,
+               const uint64_t pagesize) {
+  if (bopts.csv_file_name.empty()) return;
+  std::ofstream ofs(bopts.csv_file_name, std::ios::app);
+  if (!ofs.good()) {
+    std::cerr << "Failed to open " << bopts.csv_file_name << std::endl;
+    return;
+  }
+  if (ofs.tellp() == 0) {
+    ofs << "backend,threads,pages,pagesize,umap_bufsize,round,entries,used_pages,height,tree_buffer_ratio,"
+           "inserts,inserts_per_sec,insert_p99_ns,lookups,lookups_per_sec,lookup_p50_ns,lookup_p99_ns,"
+           "lookup_p999_ns,faults_per_lookup,lookup_read_bytes,scans,scans_per_sec,scanned_per_sec,"
+           "scan_p50_ns,scan_p99_ns,faults_per_scan,inner_nodes,inner_resident,leaves,leaves_resident\n";
+  }
+  ofs << (options.usemmap ? "mmap" : "umap") << "," << options.numthreads << "," << options.numpages << ","
+      << pagesize << "," << umapcfg_get_max_pages_in_buffer() << "," << r.round << "," << r.entries << ","
+      << r.used_pages << "," << r.height << "," << r.tree_buffer_ratio << ","
+      << r.inserted + r.full << "," << rate(r.inserted + r.full, r.insert_phase) << ","
+      << r.insert_latency.percentile(0.99) << ","
+      << r.lookups << "," << rate(r.lookups, r.lookup_phase) << "," << r.lookup_latency.percentile(0.5) << ","
+      << r.lookup_latency.percentile(0.99) << "," << r.lookup_latency.percentile(0.999) << ","
+      << faults_per(r.lookup_phase, r.lookups) << "," << r.lookup_phase.read_bytes << ","
+      << r.scans << "," << rate(r.scans, r.scan_phase) << "," << rate(r.scanned, r.scan_phase) << ","
+      << r.scan_latency.percentile(0.5) << "," << r.scan_latency.percentile(0.99) << ","
+      << faults_per(r.scan_phase, r.scans) << "," << r.nodes.inner << "," << r.nodes.inner_resident << ","
+      << r.nodes.leaves << "," << r.nodes.leaves_resident << "\n";
+}
+
+/// \brief Walks all the leaves in key order; checks the order, the values and the number of entries
+bool check_tree(const umapbtree::btree &tree) {
+  uint64_t count = 0;
+  uint64_t previous = 0;
+  uint64_t unordered = 0;
+  uint64_t bad_values = 0;
+  tree.scan(0, UINT64_MAX, [&](const uint64_t key, const uint64_t value) {
+    if (count > 0 && key <= previous) ++unordered;
+    if (value != value_of(key)) ++bad_values;
+    previous = key;
+    ++count;
+  });
+  fprintf(stdout, "Checked %lu entries: %lu out of order, %lu wrong values (%lu expected)\n",
+      count, unordered, bad_values, tree.num_entries());
+  return unordered == 0 && bad_values == 0 && count == tree.num_entries();
+}
+
+int main(int argc, char **argv)
+{
+  utility::umt_optstruct_t options;
+  const uint64_t pagesize = utility::umt_getpagesize();
+
+  umt_getoptions(&options, argc, argv);
+  omp_set_num_threads(options.numthreads);
+
+  const btree_options bopts = get_btree_options();
+  disp_btree_env_variables(bopts);
+  const auto pressure = utility::memory_pressure_from_env();
+
+  if (options.numpages < 2) {
+    std::cerr << "The tree needs at least 2 pages (a header and a leaf)" << std::endl;
+    return 1;
+  }
+  const uint64_t totalbytes = options.numpages * pagesize;
+
+  utility::phase_recorder phases("umapbtree");
+  const utility::cache_mode cache = options.cold ? utility::cache_mode::cold
+                                  : (options.warm ? utility::cache_mode::warm : utility::cache_mode::as_is);
+  phases.set_attribute("threads", options.numthreads);
+  phases.set_attribute("pages", options.numpages);
+  phases.set_attribute("pagesize", pagesize);
+  phases.set_attribute("usemmap", options.usemmap);
+  phases.set_attribute("cache", utility::cache_mode_name(cache));
+  phases.set_attribute("input", bopts.input_file_name.empty() ? "generated" : bopts.input_file_name);
+  if (pressure) phases.set_attribute("memory_pressure", utility::pressure_backend_name(pressure->backend()));
+
+  phases.begin("umap INIT");
+  void *const base_addr = utility::map_in_file(options.filename, options.initonly,
+      options.noinit, options.usemmap, totalbytes);
+  if (base_addr == nullptr) {
+    std::cerr << "Failed to map " << options.filename << std::endl;
+    return 1;
+  }
+  phases.end();
+
+  // One node per page; the header takes page 0
+  umapbtree::btree tree(base_addr, totalbytes, pagesize);
+  fprintf(stdout, "%lu pages of %lu bytes, %lu keys per inner node, %lu entries per leaf, %lu threads\n",
+      options.numpages, pagesize, tree.inner_capacity(), tree.leaf_capacity(), options.numthreads);
+
+  if ( !options.noinit ) {
+    bool loaded;
+    if (!bopts.input_file_name.empty()) {
+      phases.begin("Load", utility::get_file_size(bopts.input_file_name));
+      loaded = load_from_file(tree, bopts, options.usemmap);
+    } else {
+      const uint64_t records = bopts.records ? bopts.records
+          : (uint64_t)((options.numpages / 4) * tree.leaf_capacity() * bopts.fill_percent / 100.0);
+      phases.begin("Load", records * 2 * sizeof(uint64_t));
+      loaded = load_generated(tree, records, bopts.fill_percent / 100.0);
+    }
+    const utility::phase_record load = phases.end();
+    if (!loaded) return 1;
+    fprintf(stdout, "Loaded %lu entries in %f seconds (%f K entries/sec): %lu pages, height %lu\n",
+        tree.num_entries(), load.wall_sec, tree.num_entries() / std::max(load.wall_sec, 1e-9) / 1e3,
+        tree.used_pages(), tree.height());
+  } else if (!tree.valid()) {
+    std::cerr << options.filename << " does not hold a tree of " << options.numpages << " pages of "
+              << pagesize << " bytes; load it without --noinit" << std::endl;
+    return 1;
+  }
+
+  bool valid = true;
+  if ( !options.initonly ) {
+    const uint64_t inserts = bopts.inserts ? bopts.inserts : tree.num_entries() / 4;
+    const uint64_t num_samples = std::min<uint64_t>(tree.num_entries(), 1ULL << 16);
+    phases.begin("Sample");
+    const std::vector<uint64_t> samples = sample_keys(tree, num_samples, bopts.seed);
+    phases.end();
+
+    if (cache != utility::cache_mode::as_is) {
+      if (cache == utility::cache_mode::cold) {
+        phases.begin("Evict");
+        if (utility::evict_mapped_file(options.filename, options.usemmap, totalbytes, base_addr) == nullptr) {
+          std::cerr << "Failed to map " << options.filename << " again" << std::endl;
+          return 1;
+        }
+      } else {
+        phases.begin("Prewarm", totalbytes);
+        utility::prewarm_region(base_addr, totalbytes, options.numthreads);
+      }
+      phases.end();
+      const utility::cache_state state = utility::check_cache_state(cache, base_addr, totalbytes,
+                                                                    {options.filename});
+      phases.set_attribute("region_resident", state.region_resident);
+    }
+
+    const double buffer = buffer_bytes(options, pressure.get());
+    phases.set_attribute("buffer_bytes", buffer);
+    uint64_t checksum = 0;
+    print_header();
+    for (uint64_t round = 0; round <= bopts.rounds; ++round) {
+      round_result r = run_round(tree, round, samples, bopts, inserts, phases);
+      r.tree_buffer_ratio = buffer > 0.0 ? r.used_pages * pagesize / buffer : 0.0;
+      r.nodes = node_residency(tree, base_addr, pagesize);
+      print_round(r);
+      write_csv(r, options, bopts, pagesize);
+      checksum += r.checksum;
+      if (r.full)
+        fprintf(stdout, "Note: the file is full, %lu inserts of round %lu did not fit\n", r.full, round);
+      if (r.misses || r.bad_values || r.unordered) {
+        fprintf(stderr, "Validation failed in round %lu: %lu keys not found, %lu wrong values, "
+            "%lu unordered scans\n", round, r.misses, r.bad_values, r.unordered);
+        valid = false;
+      }
+    }
+    fprintf(stdout, "Checksum of the values read: %lu\n", checksum);
+
+    if (bopts.check) {
+      phases.begin("Check");
+      valid = check_tree(tree) && valid;
+      phases.end();
+    }
+  }
+
+  phases.begin("umap TERM");
+  utility::unmap_file(options.usemmap, totalbytes, base_addr);
+  phases.finish();
+
+  return valid ? 0 : 1;
+}
@@ -0,0 +1,177 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about the access patterns
+/// Every thread accesses the pages of its working set (a window of the mapped
+/// region) in an order given by the pattern. The i-th access of a thread is a
+/// pure function of (seed, thread, i), so a run is reproducible whatever the
+/// scheduling, and the reads/writes mix is decided the same way.
+
+#ifndef UMAPCPU_ACCESS_PATTERN_HPP
+#define UMAPCPU_ACCESS_PATTERN_HPP
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <exception>
+
+#include "../utility/random.hpp"
+
+namespace umapcpu {
+
+enum class pattern {
+  sequential,  // pages in order, wrapping around the working set
+  strided,     // every stride-th page, shifted by one page at every wrap-around
+  random,      // uniform random pages
+  zipfian,     // Zipfian random pages; page 0 of the working set is the most popular
+  hotset       // a fraction of the pages gets a fraction of the accesses, uniformly
+};
+
+const pattern all_patterns[] = {pattern::sequential, pattern::strided, pattern::random,
+                                pattern::zipfian, pattern::hotset};
+
+inline const char *pattern_name(const pattern p) {
+  switch (p) {
+    case pattern::sequential: return "sequential";
+    case pattern::strided: return "strided";
+    case pattern::random: return "random";
+    case pattern::zipfian: return "zipfian";
+    case pattern::hotset: return "hotset";
+  }
+  return "unknown";
+}
+
+struct pattern_config {
+  pattern kind{pattern::sequential};
+  uint64_t stride_pages{16};
+  double zipf_theta{0.99};
+  double hot_fraction{0.1};       // fraction of the working set that is hot
+  double hot_probability{0.9};    // fraction of the accesses that go to the hot pages
+  double write_fraction{0.0};     // fraction of the accesses that are writes
+  uint64_t seed{123};
+};
+
+/// \brief Generates the pages accessed by one thread in a working set of num_pages pages
+class page_sequence {
+ public:
+  /// \param zipf Distribution over num_pages pages, shared by the threads (zipfian pattern only)
+  page_sequence(const pattern_config &config, const uint64_t num_pages, const uint64_t thread,
+                const utility::zipfian_distribution *const zipf = nullptr)
+      : m_config(config), m_num_pages(num_pages),
+        m_seed(utility::hash64(config.seed + thread)),
+        m_hot_pages(std::max((uint64_t)(config.hot_fraction * num_pages), (uint64_t)1)),
+        m_zipf(zipf) {
+    // The threads do not start at the same page of a shared working set
+    m_start = (config.kind == pattern::sequential || config.kind == pattern::strided)
+        ? utility::hash64(m_seed) % num_pages : 0;
+  }
+
+  /// \brief Page (index in the working set) of the i-th access
+  uint64_t page(const uint64_t i) const {
+    switch (m_config.kind) {
+      case pattern::sequential:
+        return (m_start + i) % m_num_pages;
+      case pattern::strided: {
+        const uint64_t position = i * m_config.stride_pages;
+        return (m_start + position % m_num_pages + position / m_num_pages) % m_num_pages;
+      }
+      case pattern::random:
+        return utility::counter_random(m_seed, i) % m_num_pages;
+      case pattern::zipfian:
+        return (*m_zipf)(utility::to_unit_interval(utility::counter_random(m_seed, i)));
+      case pattern::hotset: {
+        const uint64_t r = utility::counter_random(m_seed, i);
+        if (utility::to_unit_interval(r) < m_config.hot_probability || m_hot_pages >= m_num_pages)
+          return utility::counter_random(m_seed + 1, i) % m_hot_pages;
+        return m_hot_pages + utility::counter_random(m_seed + 1, i) % (m_num_pages - m_hot_pages);
+      }
+    }
+    return 0;
+  }
+
+  /// \brief Whether the i-th access is a write
+  bool is_write(const uint64_t i) const {
+    return m_config.write_fraction > 0.0
+        && utility::to_unit_interval(utility::counter_random(m_seed + 2, i)) < m_config.write_fraction;
+  }
+
+  /// \brief Word of the page touched by the i-th access
+  uint64_t word(const uint64_t i, const uint64_t words_per_page) const {
+    return utility::counter_random(m_seed + 3, i) % words_per_page;
+  }
+
+ private:
+  pattern_config m_config;
+  uint64_t m_num_pages;
+  uint64_t m_seed;
+  uint64_t m_start{0};
+  uint64_t m_hot_pages;
+  const utility::zipfian_distribution *m_zipf;
+};
+
+/// \brief Returns "name[:param]" with the parameter of the pattern, if it has one
+inline std::string pattern_label(const pattern_config &config) {
+  std::ostringstream label;
+  label << pattern_name(config.kind);
+  if (config.kind == pattern::strided)
+    label << ":" << config.stride_pages;
+  else if (config.kind == pattern::zipfian)
+    label << ":" << config.zipf_theta;
+  else if (config.kind == pattern::hotset)
+    label << ":" << config.hot_fraction << ":" << config.hot_probability;
+  return label.str();
+}
+
+/// \brief Parses "name[:param]": stride in pages, Zipf theta or hot fraction:probability
+inline bool parse_pattern(const std::string &spec, pattern_config *const config) {
+  const std::size_t colon = spec.find(':');
+  const std::string name = spec.substr(0, colon);
+  const std::string param = (colon == std::string::npos) ? std::string() : spec.substr(colon + 1);
+
+  for (const pattern p : all_patterns) {
+    if (name != pattern_name(p)) continue;
+    config->kind = p;
+    if (param.empty()) return true;
+    try {
+      if (p == pattern::strided) {
+        config->stride_pages = std::stoull(param);
+        return config->stride_pages > 0;
+      }
+      if (p == pattern::zipfian) {
+        config->zipf_theta = std::stod(param);
+        return config->zipf_theta > 0.0 && config->zipf_theta < 1.0;
+      }
+      if (p == pattern::hotset) {
+        const std::size_t colon2 = param.find(':');
+        config->hot_fraction = std::stod(param.substr(0, colon2));
+        if (colon2 != std::string::npos)
+          config->hot_probability = std::stod(param.substr(colon2 + 1));
+        return config->hot_fraction > 0.0 && config->hot_fraction <= 1.0
+            && config->hot_probability >= 0.0 && config->hot_probability <= 1.0;
+      }
+    } catch (const std::exception &) {
+      return false;
+    }
+    return false;
+  }
+  return false;
+}
+
+} // namespace umapcpu
+
+#endif //UMAPCPU_ACCESS_PATTERN_HPP
@@ -0,0 +1,190 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about the migration benchmark
+/// For every placement scenario, pairs of CPUs (a, b) with the relation of the
+/// scenario are picked from the sysfs topology, one pair per thread, with no
+/// CPU in two pairs. Every thread binds itself to a and faults in its own
+/// pages (first touch), then, after all threads are done, binds itself to b
+/// and touches the same pages again. Both steps are timed per access.
+/// Every scenario uses its own part of the region, so its pages are cold.
+
+#ifndef UMAPCPU_MIGRATION_HPP
+#define UMAPCPU_MIGRATION_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+#include <memory>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "../utility/topology.hpp"
+#include "../utility/histogram.hpp"
+#include "../utility/mmap.hpp"
+#include "access_pattern.hpp"
+
+namespace umapcpu {
+
+enum class placement {
+  same_cpu,      // faulted and touched on the same CPU
+  smt_sibling,   // another hardware thread of the same core
+  same_socket,   // another core of the same socket
+  cross_socket   // a core of another socket
+};
+
+const placement all_placements[] = {placement::same_cpu, placement::smt_sibling,
+                                    placement::same_socket, placement::cross_socket};
+
+inline const char *placement_name(const placement p) {
+  switch (p) {
+    case placement::same_cpu: return "same_cpu";
+    case placement::smt_sibling: return "smt_sibling";
+    case placement::same_socket: return "same_socket";
+    case placement::cross_socket: return "cross_socket";
+  }
+  return "unknown";
+}
+
+inline bool has_placement(const utility::cpu_info &a, const utility::cpu_info &b, const placement p) {
+  switch (p) {
+    case placement::same_cpu: return a.cpu == b.cpu;
+    case placement::smt_sibling: return a.cpu != b.cpu && a.package == b.package && a.core == b.core;
+    case placement::same_socket: return a.package == b.package && a.core != b.core;
+    case placement::cross_socket: return a.package != b.package;
+  }
+  return false;
+}
+
+/// \brief Picks up to max_pairs pairs of CPUs with the placement; no CPU is in two pairs
+inline std::vector<std::pair<utility::cpu_info, utility::cpu_info>>
+pick_cpu_pairs(const std::vector<utility::cpu_info> &cpus, const placement p, const std::size_t max_pairs) {
+  std::vector<std::pair<utility::cpu_info, utility::cpu_info>> pairs;
+  std::vector<bool> used(cpus.size(), false);
+  for (std::size_t i = 0; i < cpus.size() && pairs.size() < max_pairs; ++i) {
+    if (used[i]) continue;
+    for (std::size_t j = 0; j < cpus.size(); ++j) {
+      if ((used[j] && j != i) || !has_placement(cpus[i], cpus[j], p)) continue;
+      used[i] = used[j] = true;
+      pairs.emplace_back(cpus[i], cpus[j]);
+      break;
+    }
+  }
+  return pairs;
+}
+
+struct migration_result {
+  placement kind{placement::same_cpu};
+  std::vector<std::pair<utility::cpu_info, utility::cpu_info>> pairs;
+  uint64_t pages_per_pair{0};
+  utility::latency_histogram fault_latency;  // first touch, on the first CPU of the pairs
+  utility::latency_histogram touch_latency;  // second touch, on the second CPU
+  double fault_sec{0.0};
+  double touch_sec{0.0};
+  uint64_t touch_minor_faults{0};
+  uint64_t touch_major_faults{0};
+};
+
+/// \brief Faults pages in on the first CPU of every pair and touches them from the second one
+/// \param region The first page of the part of the mapped region used by the scenario
+/// \param getns Clock in ns
+template <typename Clock>
+migration_result run_migration(uint64_t *const region, const uint64_t num_pages, const uint64_t pagesize,
+                               const placement kind, const std::vector<utility::cpu_info> &cpus,
+                               const std::size_t max_pairs, const pattern_config &access, Clock getns) {
+  migration_result result;
+  result.kind = kind;
+  result.pairs = pick_cpu_pairs(cpus, kind, max_pairs);
+  if (result.pairs.empty()) return result;
+  result.pages_per_pair = num_pages / result.pairs.size();
+  if (result.pages_per_pair == 0) return result;
+  const uint64_t words_per_page = pagesize / sizeof(uint64_t);
+  std::unique_ptr<utility::zipfian_distribution> zipf;
+  if (access.kind == pattern::zipfian)
+    zipf.reset(new utility::zipfian_distribution(result.pages_per_pair, access.zipf_theta));
+
+  uint64_t fault_start = 0, fault_end = 0, touch_start = 0, touch_end = 0;
+  std::pair<std::size_t, std::size_t> faults_before;
+
+#pragma omp parallel num_threads(result.pairs.size())
+  {
+    const std::size_t t = omp_get_thread_num();
+    const auto &pair = result.pairs[t];
+    uint64_t *const pages = region + t * result.pages_per_pair * words_per_page;
+    const page_sequence seq(access, result.pages_per_pair, t, zipf.get());
+    utility::latency_histogram fault_latency;
+    utility::latency_histogram touch_latency;
+
+    cpu_set_t original;
+    CPU_ZERO(&original);
+    ::pthread_getaffinity_np(::pthread_self(), sizeof(original), &original);
+
+    utility::bind_to_cpu(pair.first.cpu);
+#pragma omp barrier
+#pragma omp single
+    fault_start = getns();
+    for (uint64_t i = 0; i < result.pages_per_pair; ++i) {
+      volatile uint64_t *const p = pages + i * words_per_page;
+      const uint64_t start = getns();
+      (void)*p;
+      fault_latency.add(getns() - start);
+    }
+#pragma omp barrier
+#pragma omp single
+    {
+      fault_end = getns();
+      faults_before = utility::get_num_page_faults();
+    }
+
+    utility::bind_to_cpu(pair.second.cpu);
+#pragma omp barrier
+#pragma omp single
+    touch_start = getns();
+    for (uint64_t i = 0; i < result.pages_per_pair; ++i) {
+      volatile uint64_t *const p = pages + seq.page(i) * words_per_page + seq.word(i, words_per_page);
+      const bool write = seq.is_write(i);
+      const uint64_t start = getns();
+      if (write)
+        *p = i;
+      else
+        (void)*p;
+      touch_latency.add(getns() - start);
+    }
+#pragma omp barrier
+#pragma omp single
+    touch_end = getns();
+
+    utility::bind_to_cpus(original);
+#pragma omp critical
+    {
+      result.fault_latency.merge(fault_latency);
+      result.touch_latency.merge(touch_latency);
+    }
+  }
+
+  const auto faults_after = utility::get_num_page_faults();
+  result.fault_sec = (fault_end - fault_start) / 1e9;
+  result.touch_sec = (touch_end - touch_start) / 1e9;
+  result.touch_minor_faults = faults_after.first - faults_before.first;
+  result.touch_major_faults = faults_after.second - faults_before.second;
+  return result;
+}
+
+} // namespace umapcpu
+
+#endif //UMAPCPU_MIGRATION_HPP
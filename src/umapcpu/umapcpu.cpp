@@ -12,12 +12,25 @@
  * License along with this program; if not, write to the Free Software
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
  */
+
+// Page-fault microbenchmark: every thread accesses one word per page of its
+// working set following an access pattern, and times every access.
+// Prints the throughput and the latency percentiles, and appends them
+// (and the latency histogram) to CSV files.
+// The migration mode faults pages in on one CPU and touches them from another
+// one, for CPU pairs picked from the topology (see migration.hpp).
+// The writeback mode only writes, and measures how fast dirty pages are
+// written back and how long the threads stall for it (see writeback.hpp).
+
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
 #endif // _GNU_SOURCE
 
 #include <iostream>
-#include <random>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
 #include <algorithm>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
@@ -32,11 +45,7 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <stdlib.h>
-#include <stdint.h>
-#include <unistd.h>    // optind
 #include <errno.h>
-#include <utmpx.h>
-#include <parallel/algorithm>
 
 #ifdef _OPENMP
 #include <omp.h>
@@ -45,37 +54,18 @@
 #include "umap/umap.h"
 #include "../utility/commandline.hpp"
 #include "../utility/umap_file.hpp"
+#include "../utility/histogram.hpp"
+#include "../utility/phase.hpp"
+#include "../utility/memory_pressure.hpp"
+#include "../utility/metrics.hpp"
+#include "access_pattern.hpp"
+#include "migration.hpp"
+#include "writeback.hpp"
 
-#define handle_error_en(en, msg) \
-  do { errno = en; perror(msg); exit(EXIT_FAILURE); } while (0)
-
-void cpu_setcpu(int cpu)
-{
-  int s;
-  cpu_set_t cpuset;
-  pthread_t thread;
-
-  thread = pthread_self();
-
-  CPU_ZERO(&cpuset);
-  CPU_SET(cpu, &cpuset);
-
-  s = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset);
-  if (s != 0)
-    handle_error_en(s, "pthread_setaffinity_np");
-
-  /* Check the actual affinity mask assigned to the thread */
-
-  s = pthread_getaffinity_np(thread, sizeof(cpu_set_t), &cpuset);
-  if (s != 0)
-    handle_error_en(s, "pthread_getaffinity_np");
-}
+// Timed accesses take a few ns when the page is resident, so the clock is the TSC
 static inline uint64_t getns(void)
 {
-  struct timespec ts;
-  int ret = clock_gettime(CLOCK_MONOTONIC, &ts);
-  assert(ret == 0);
-  return (((uint64_t)ts.tv_sec) * 1000000000ULL) + ts.tv_nsec;
+  return utility::tsc_clock::ns();
 }
 
 void initdata(uint64_t *region, int64_t rlen) {
@@ -86,6 +76,395 @@ void initdata(uint64_t *region, int64_t rlen) {
   }
 }
 
+struct bench_options {
+  std::string mode{"pattern"};
+  umapcpu::pattern_config pattern;
+  uint64_t working_set_pages{0};  // per thread; 0: all threads share the whole region
+  uint64_t accesses{0};           // per thread
+  std::string csv_file_name;
+  std::string histogram_file_name;
+  std::vector<umapcpu::placement> placements{std::begin(umapcpu::all_placements),
+                                             std::end(umapcpu::all_placements)};
+  std::string migration_file_name;
+  umapcpu::writeback_config writeback;
+  std::string writeback_file_name;
+};
+
+void disp_bench_env_variables(const bench_options &bopts) {
+  std::cerr
+    << "Benchmark Configuration (environment variables):\n"
+    << " UMAPCPU_MODE                    - currently: " << bopts.mode << " (pattern|migration|writeback)\n"
+    << " UMAPCPU_PATTERN                 - currently: " << umapcpu::pattern_label(bopts.pattern)
+    << " (sequential|strided[:stride pages]|random|zipfian[:theta]|hotset[:hot fraction[:hot probability]])\n"
+    << " UMAPCPU_WRITE_PERCENT           - currently: " << bopts.pattern.write_fraction * 100 << " percent of the accesses are writes\n"
+    << " UMAPCPU_WORKING_SET             - currently: " << bopts.working_set_pages
+    << " pages per thread (0: the threads share all the pages)\n"
+    << " UMAPCPU_ACCESSES                - currently: " << bopts.accesses << " accesses per thread\n"
+    << " UMAPCPU_SEED                    - currently: " << bopts.pattern.seed << "\n"
+    << " UMAPCPU_CSV                     - currently: " << bopts.csv_file_name << " (summary, one line per run)\n"
+    << " UMAPCPU_HISTOGRAM_CSV           - currently: " << bopts.histogram_file_name << " (latency histogram)\n"
+    << " UMAPCPU_PLACEMENTS              - currently: ";
+  for (std::size_t i = 0; i < bopts.placements.size(); ++i)
+    std::cerr << (i ? "," : "") << umapcpu::placement_name(bopts.placements[i]);
+  std::cerr
+    << " (migration; same_cpu,smt_sibling,same_socket,cross_socket)\n"
+    << " UMAPCPU_MIGRATION_CSV           - currently: " << bopts.migration_file_name << " (migration; one line per placement)\n"
+    << " UMAPCPU_WRITEBACK               - currently: " << umapcpu::writeback_name(bopts.writeback.kind)
+    << " (writeback; overwrite|sparse|append)\n"
+    << " UMAPCPU_RECORD_BYTES            - currently: " << bopts.writeback.record_bytes << " (writeback; append record size)\n"
+    << " UMAPCPU_STALL_NS                - currently: " << bopts.writeback.stall_ns << " (writeback; slower stores are stalls)\n"
+    << " UMAPCPU_WRITEBACK_CSV           - currently: " << bopts.writeback_file_name << " (writeback; one line per run)\n"
+    << std::endl;
+}
+
+bench_options get_bench_options(const utility::umt_optstruct_t &options) {
+  bench_options bopts;
+
+  const char *buf = std::getenv("UMAPCPU_MODE");
+  if (buf != nullptr) {
+    bopts.mode = buf;
+    if (bopts.mode != "pattern" && bopts.mode != "migration" && bopts.mode != "writeback") {
+      std::cerr << "Unknown UMAPCPU_MODE: " << bopts.mode << std::endl;
+      exit(1);
+    }
+  }
+
+  buf = std::getenv("UMAPCPU_PATTERN");
+  if (buf != nullptr && !umapcpu::parse_pattern(buf, &bopts.pattern)) {
+    std::cerr << "Invalid UMAPCPU_PATTERN: " << buf << std::endl;
+    exit(1);
+  }
+
+  buf = std::getenv("UMAPCPU_WRITE_PERCENT");
+  if (buf != nullptr)
+    bopts.pattern.write_fraction = std::min(std::max(std::stod(buf), 0.0), 100.0) / 100.0;
+
+  buf = std::getenv("UMAPCPU_SEED");
+  if (buf != nullptr)
+    bopts.pattern.seed = std::stoull(buf);
+
+  buf = std::getenv("UMAPCPU_WORKING_SET");
+  if (buf != nullptr)
+    bopts.working_set_pages = std::min((uint64_t)std::stoull(buf), options.numpages);
+  const uint64_t working_set = bopts.working_set_pages ? bopts.working_set_pages : options.numpages;
+
+  // By default every thread touches its working set once (or -a pages)
+  bopts.accesses = options.pages_to_access ? options.pages_to_access : working_set;
+  buf = std::getenv("UMAPCPU_ACCESSES");
+  if (buf != nullptr)
+    bopts.accesses = std::stoull(buf);
+
+  buf = std::getenv("UMAPCPU_CSV");
+  if (buf != nullptr)
+    bopts.csv_file_name = buf;
+
+  buf = std::getenv("UMAPCPU_HISTOGRAM_CSV");
+  if (buf != nullptr)
+    bopts.histogram_file_name = buf;
+
+  buf = std::getenv("UMAPCPU_PLACEMENTS");
+  if (buf != nullptr) {
+    bopts.placements.clear();
+    std::stringstream list(buf);
+    std::string name;
+    while (std::getline(list, name, ',')) {
+      bool found = false;
+      for (const umapcpu::placement p : umapcpu::all_placements) {
+        if (name == umapcpu::placement_name(p)) {
+          bopts.placements.push_back(p);
+          found = true;
+        }
+      }
+      if (!found) {
+        std::cerr << "Unknown placement in UMAPCPU_PLACEMENTS: " << name << std::endl;
+        exit(1);
+      }
+    }
+  }
+
+  buf = std::getenv("UMAPCPU_MIGRATION_CSV");
+  if (buf != nullptr)
+    bopts.migration_file_name = buf;
+
+  buf = std::getenv("UMAPCPU_WRITEBACK");
+  if (buf != nullptr && !umapcpu::parse_writeback(buf, &bopts.writeback.kind)) {
+    std::cerr << "Unknown UMAPCPU_WRITEBACK: " << buf << std::endl;
+    exit(1);
+  }
+
+  buf = std::getenv("UMAPCPU_RECORD_BYTES");
+  if (buf != nullptr)
+    bopts.writeback.record_bytes = std::max((uint64_t)std::stoull(buf), (uint64_t)sizeof(uint64_t));
+
+  buf = std::getenv("UMAPCPU_STALL_NS");
+  if (buf != nullptr)
+    bopts.writeback.stall_ns = std::stoull(buf);
+
+  buf = std::getenv("UMAPCPU_WRITEBACK_CSV");
+  if (buf != nullptr)
+    bopts.writeback_file_name = buf;
+
+  return bopts;
+}
+
+struct bench_result {
+  utility::latency_histogram latency;
+  utility::phase_record phase;
+  uint64_t reads{0};
+  uint64_t writes{0};
+};
+
+/// \brief Runs the timed accesses of all threads
+bench_result run_bench(uint64_t *arr, const utility::umt_optstruct_t &options, const bench_options &bopts,
+                       uint64_t pagesize, utility::phase_recorder &phases) {
+  const uint64_t words_per_page = pagesize / sizeof(uint64_t);
+  const uint64_t working_set = bopts.working_set_pages ? bopts.working_set_pages : options.numpages;
+  if (bopts.working_set_pages && bopts.working_set_pages * options.numthreads > options.numpages)
+    fprintf(stdout, "Note: the working sets of the threads overlap (%lu x %lu pages > %lu pages)\n",
+        options.numthreads, bopts.working_set_pages, options.numpages);
+
+  std::unique_ptr<utility::zipfian_distribution> zipf;
+  if (bopts.pattern.kind == umapcpu::pattern::zipfian)
+    zipf.reset(new utility::zipfian_distribution(working_set, bopts.pattern.zipf_theta));
+
+  utility::metrics &metrics = phases.metrics();
+  const utility::metrics::id latency_id = metrics.histogram("access latency", "ns");
+  const utility::metrics::id reads_id = metrics.counter("reads");
+  const utility::metrics::id writes_id = metrics.counter("writes");
+
+  bench_result result;
+  uint64_t checksum = 0;
+  // Data bytes are the bytes of the pages accessed, so the phase rate is a paging rate
+  phases.begin("Test", bopts.accesses * options.numthreads * pagesize);
+#pragma omp parallel reduction(+:checksum)
+  {
+    const uint64_t thread = omp_get_thread_num();
+    const umapcpu::page_sequence seq(bopts.pattern, working_set, thread, zipf.get());
+    // Working sets are consecutive windows of the region, one per thread
+    const uint64_t base = bopts.working_set_pages ? (thread * bopts.working_set_pages) % options.numpages : 0;
+    utility::metrics::thread_slot &slot = metrics.local();
+
+    for (uint64_t i = 0; i < bopts.accesses; ++i) {
+      const uint64_t page = (base + seq.page(i)) % options.numpages;
+      volatile uint64_t *const p = &arr[page * words_per_page + seq.word(i, words_per_page)];
+      const bool write = seq.is_write(i);
+
+      const uint64_t start = getns();
+      if (write)
+        *p = i;
+      else
+        checksum += *p;
+      slot.record(latency_id, getns() - start);
+      slot.add(write ? writes_id : reads_id);
+    }
+  }
+  result.phase = phases.end();
+  result.latency = metrics.merged(latency_id);
+  result.reads = metrics.total(reads_id);
+  result.writes = metrics.total(writes_id);
+  fprintf(stdout, "Checksum of the values read: %lu\n", checksum);
+  return result;
+}
+
+void print_result(const bench_result &result, const bench_options &bopts) {
+  const utility::latency_histogram &h = result.latency;
+  const double seconds = result.phase.wall_sec > 0.0 ? result.phase.wall_sec : 1e-9;
+  fprintf(stdout, "Pattern %s: %lu reads, %lu writes in %f seconds\n",
+      umapcpu::pattern_label(bopts.pattern).c_str(), result.reads, result.writes, seconds);
+  fprintf(stdout, "  Throughput: %f M accesses/sec\n", h.count() / seconds / 1e6);
+  fprintf(stdout, "  Page faults: %lu minor, %lu major (%f per access)\n",
+      result.phase.minor_faults, result.phase.major_faults,
+      h.count() ? (double)(result.phase.minor_faults + result.phase.major_faults) / h.count() : 0.0);
+  fprintf(stdout, "  Storage: read %lu bytes, wrote %lu bytes\n", result.phase.read_bytes, result.phase.write_bytes);
+  fprintf(stdout, "  Latency (ns): mean %.0f, min %lu, p50 %lu, p90 %lu, p99 %lu, p99.9 %lu, max %lu\n",
+      h.mean(), h.min(), h.percentile(0.5), h.percentile(0.9), h.percentile(0.99), h.percentile(0.999), h.max());
+}
+
+/// \brief Opens a CSV file for appending and writes the header if the file is new
+bool open_csv(const std::string &name, const char *const header, std::ofstream *ofs) {
+  ofs->open(name, std::ios::app);
+  if (!ofs->good()) {
+    std::cerr << "Failed to open " << name << std::endl;
+    return false;
+  }
+  if (ofs->tellp() == 0)
+    *ofs << header << "\n";
+  return true;
+}
+
+void write_csv(const bench_result &result, const utility::umt_optstruct_t &options, const bench_options &bopts,
+               uint64_t pagesize) {
+  const utility::latency_histogram &h = result.latency;
+  // Configuration columns shared by both files
+  std::ostringstream config;
+  config << umapcpu::pattern_label(bopts.pattern) << "," << (options.usemmap ? "mmap" : "umap") << ","
+         << options.numthreads << "," << options.numpages << "," << pagesize << ","
+         << umapcfg_get_max_pages_in_buffer() << "," << umapcfg_get_num_fillers() << ","
+         << umapcfg_get_num_evictors() << "," << bopts.working_set_pages << "," << bopts.pattern.write_fraction;
+  const char *const config_header = "pattern,backend,threads,pages,pagesize,umap_bufsize,umap_fillers,"
+                                    "umap_evictors,working_set_pages,write_fraction";
+
+  std::ofstream ofs;
+  if (!bopts.csv_file_name.empty()
+      && open_csv(bopts.csv_file_name, (std::string(config_header)
+          + ",accesses,seconds,accesses_per_sec,minor_faults,major_faults,read_bytes,write_bytes,"
+            "mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns").c_str(), &ofs)) {
+    const double seconds = result.phase.wall_sec > 0.0 ? result.phase.wall_sec : 1e-9;
+    ofs << config.str() << "," << h.count() << "," << result.phase.wall_sec << "," << h.count() / seconds << ","
+        << result.phase.minor_faults << "," << result.phase.major_faults << ","
+        << result.phase.read_bytes << "," << result.phase.write_bytes << ","
+        << h.mean() << "," << h.percentile(0.5) << "," << h.percentile(0.9) << "," << h.percentile(0.99) << ","
+        << h.percentile(0.999) << "," << h.max() << "\n";
+    ofs.close();
+  }
+
+  if (!bopts.histogram_file_name.empty()
+      && open_csv(bopts.histogram_file_name, (std::string(config_header)
+          + ",bucket_lower_ns,bucket_upper_ns,count").c_str(), &ofs)) {
+    for (int b = 0; b < utility::latency_histogram::k_num_buckets; ++b) {
+      if (h.bucket_count(b) == 0) continue;
+      ofs << config.str() << "," << utility::latency_histogram::bucket_lower(b) << ","
+          << utility::latency_histogram::bucket_upper(b) << "," << h.bucket_count(b) << "\n";
+    }
+    ofs.close();
+  }
+}
+
+/// \brief Runs every placement scenario on its own part of the region and reports the penalties
+void run_migration_bench(uint64_t *arr, const utility::umt_optstruct_t &options, const bench_options &bopts,
+                         uint64_t pagesize, utility::phase_recorder &phases) {
+  const std::vector<utility::cpu_info> cpus = utility::read_cpu_topology();
+  fprintf(stdout, "Topology: %lu CPUs available\n", cpus.size());
+  for (const auto &c : cpus)
+    fprintf(stdout, "  cpu %d: socket %d, core %d, node %d\n", c.cpu, c.package, c.core, c.node);
+
+  const uint64_t words_per_page = pagesize / sizeof(uint64_t);
+  const uint64_t pages_per_placement = options.numpages / bopts.placements.size();
+  std::vector<umapcpu::migration_result> results;
+  for (std::size_t s = 0; s < bopts.placements.size(); ++s) {
+    const umapcpu::placement kind = bopts.placements[s];
+    phases.begin(std::string("Migration ") + umapcpu::placement_name(kind));
+    results.push_back(umapcpu::run_migration(arr + s * pages_per_placement * words_per_page, pages_per_placement,
+                                             pagesize, kind, cpus, options.numthreads, bopts.pattern, getns));
+    phases.end();
+  }
+
+  // Penalties are relative to the first touch on the same CPU, if it was measured
+  double base_touch_ns = 0.0;
+  double base_rate = 0.0;
+  for (const auto &r : results) {
+    if (r.kind == umapcpu::placement::same_cpu && r.touch_latency.count() > 0) {
+      base_touch_ns = r.touch_latency.mean();
+      base_rate = r.touch_latency.count() / r.touch_sec;
+    }
+  }
+
+  std::ofstream ofs;
+  const bool csv = !bopts.migration_file_name.empty()
+      && open_csv(bopts.migration_file_name,
+                  "placement,backend,pattern,write_fraction,pairs,cpu_pairs,pages_per_pair,pagesize,"
+                  "fault_mean_ns,fault_p50_ns,fault_p99_ns,fault_pages_per_sec,"
+                  "touch_mean_ns,touch_p50_ns,touch_p99_ns,touch_pages_per_sec,touch_minor_faults,touch_major_faults,"
+                  "latency_penalty,throughput_penalty", &ofs);
+
+  fprintf(stdout, "%-13s %5s %10s %10s %10s %10s %10s %10s %12s %8s %8s\n", "Placement", "Pairs",
+      "Fault(ns)", "p50", "p99", "Touch(ns)", "p50", "p99", "Touch(M/s)", "Latency", "Rate");
+  for (const auto &r : results) {
+    if (r.pairs.empty() || r.pages_per_pair == 0) {
+      fprintf(stdout, "%-13s     - (no CPU pair with this placement)\n", umapcpu::placement_name(r.kind));
+      continue;
+    }
+    const utility::latency_histogram &f = r.fault_latency;
+    const utility::latency_histogram &t = r.touch_latency;
+    const double rate = t.count() / (r.touch_sec > 0.0 ? r.touch_sec : 1e-9);
+    const double fault_rate = f.count() / (r.fault_sec > 0.0 ? r.fault_sec : 1e-9);
+    // > 1: slower than same_cpu
+    const double latency_penalty = base_touch_ns > 0.0 ? t.mean() / base_touch_ns : 0.0;
+    const double rate_penalty = rate > 0.0 && base_rate > 0.0 ? base_rate / rate : 0.0;
+    fprintf(stdout, "%-13s %5lu %10.0f %10lu %10lu %10.0f %10lu %10lu %12.3f %8.2f %8.2f\n",
+        umapcpu::placement_name(r.kind), r.pairs.size(), f.mean(), f.percentile(0.5), f.percentile(0.99),
+        t.mean(), t.percentile(0.5), t.percentile(0.99), rate / 1e6, latency_penalty, rate_penalty);
+
+    if (csv) {
+      std::ostringstream pairs;
+      for (std::size_t i = 0; i < r.pairs.size(); ++i)
+        pairs << (i ? " " : "") << r.pairs[i].first.cpu << ":" << r.pairs[i].second.cpu;
+      ofs << umapcpu::placement_name(r.kind) << "," << (options.usemmap ? "mmap" : "umap") << ","
+          << umapcpu::pattern_label(bopts.pattern) << "," << bopts.pattern.write_fraction << ","
+          << r.pairs.size() << "," << pairs.str() << "," << r.pages_per_pair << "," << pagesize << ","
+          << f.mean() << "," << f.percentile(0.5) << "," << f.percentile(0.99) << "," << fault_rate << ","
+          << t.mean() << "," << t.percentile(0.5) << "," << t.percentile(0.99) << "," << rate << ","
+          << r.touch_minor_faults << "," << r.touch_major_faults << ","
+          << latency_penalty << "," << rate_penalty << "\n";
+    }
+  }
+  fprintf(stdout, "Latency and Rate are the touch latency and 1/throughput relative to same_cpu\n");
+}
+
+/// \brief Dirties the region, then writes the dirty pages back and unmaps the region
+void run_writeback_bench(uint64_t *arr, const utility::umt_optstruct_t &options, const bench_options &bopts,
+                         uint64_t pagesize, uint64_t totalbytes, utility::phase_recorder &phases) {
+  const umapcpu::writeback_config &config = bopts.writeback;
+  const uint64_t bufsize = options.usemmap ? 0 : umapcfg_get_max_pages_in_buffer();
+  if (bufsize >= options.numpages)
+    fprintf(stdout, "Note: the umap buffer (%lu pages) holds all the data (%lu pages), "
+        "so nothing is evicted before the drain\n", bufsize, options.numpages);
+
+  phases.begin(std::string("Writeback ") + umapcpu::writeback_name(config.kind));
+  const umapcpu::writeback_result result = umapcpu::run_writeback(arr, options.numpages, pagesize, config,
+      bopts.pattern, bopts.working_set_pages, bopts.accesses, getns);
+  const utility::phase_record dirty = phases.end();
+
+  // The pages still dirty are written back by msync (mmap) or by uunmap (umap)
+  phases.begin("Drain");
+  if (options.usemmap && ::msync(arr, totalbytes, MS_SYNC) != 0)
+    perror("msync");
+  utility::unmap_file(options.usemmap, totalbytes, arr);
+  const utility::phase_record drain = phases.end();
+
+  const utility::latency_histogram &h = result.latency;
+  const double dirty_sec = dirty.wall_sec > 0.0 ? dirty.wall_sec : 1e-9;
+  const double total_sec = dirty_sec + drain.wall_sec;
+  const uint64_t written = dirty.write_bytes + drain.write_bytes;
+  const double amplification = result.bytes_dirtied ? (double)written / result.bytes_dirtied : 0.0;
+  // Fraction of the threads' time spent in stores slower than the threshold
+  const double stall_fraction = (double)result.stall_ns / (dirty_sec * 1e9 * options.numthreads);
+
+  fprintf(stdout, "Writeback %s: %lu stores, %lu bytes dirtied in %f seconds\n",
+      umapcpu::writeback_name(config.kind), result.stores, result.bytes_dirtied, dirty_sec);
+  fprintf(stdout, "  Written: %lu bytes while writing, %lu bytes when draining (%f seconds)\n",
+      dirty.write_bytes, drain.write_bytes, drain.wall_sec);
+  fprintf(stdout, "  Write bandwidth: %f MB/s while writing, %f MB/s overall\n",
+      dirty.write_bytes / dirty_sec / 1e6, written / total_sec / 1e6);
+  fprintf(stdout, "  Write amplification: %f (bytes written / bytes dirtied)\n", amplification);
+  fprintf(stdout, "  Stalls: %lu stores slower than %lu ns, %f seconds per thread (%.1f%% of the time)\n",
+      result.stalls, config.stall_ns, result.stall_ns / 1e9 / options.numthreads, stall_fraction * 100);
+  fprintf(stdout, "  Page faults: %lu minor, %lu major\n", dirty.minor_faults, dirty.major_faults);
+  fprintf(stdout, "  Store latency (ns): mean %.0f, p50 %lu, p90 %lu, p99 %lu, p99.9 %lu, max %lu\n",
+      h.mean(), h.percentile(0.5), h.percentile(0.9), h.percentile(0.99), h.percentile(0.999), h.max());
+
+  std::ofstream ofs;
+  if (!bopts.writeback_file_name.empty()
+      && open_csv(bopts.writeback_file_name,
+                  "writeback,pattern,backend,threads,pages,pagesize,umap_bufsize,umap_fillers,umap_evictors,"
+                  "working_set_pages,record_bytes,stores,bytes_dirtied,seconds,drain_seconds,"
+                  "written_bytes,drain_written_bytes,read_bytes,write_mb_per_sec,overall_write_mb_per_sec,"
+                  "write_amplification,stall_ns,stalls,stall_sec_per_thread,stall_fraction,"
+                  "minor_faults,major_faults,mean_ns,p50_ns,p99_ns,p999_ns,max_ns", &ofs)) {
+    ofs << umapcpu::writeback_name(config.kind) << "," << umapcpu::pattern_label(bopts.pattern) << ","
+        << (options.usemmap ? "mmap" : "umap") << "," << options.numthreads << "," << options.numpages << ","
+        << pagesize << "," << bufsize << "," << umapcfg_get_num_fillers() << "," << umapcfg_get_num_evictors() << ","
+        << bopts.working_set_pages << "," << config.record_bytes << "," << result.stores << ","
+        << result.bytes_dirtied << "," << dirty.wall_sec << "," << drain.wall_sec << ","
+        << dirty.write_bytes << "," << drain.write_bytes << "," << dirty.read_bytes + drain.read_bytes << ","
+        << dirty.write_bytes / dirty_sec / 1e6 << "," << written / total_sec / 1e6 << ","
+        << amplification << "," << config.stall_ns << "," << result.stalls << ","
+        << result.stall_ns / 1e9 / options.numthreads << "," << stall_fraction << ","
+        << dirty.minor_faults << "," << dirty.major_faults << "," << h.mean() << "," << h.percentile(0.5) << ","
+        << h.percentile(0.99) << "," << h.percentile(0.999) << "," << h.max() << "\n";
+  }
+}
+
 int main(int argc, char **argv)
 {
   utility::umt_optstruct_t options;
@@ -93,9 +472,6 @@ int main(int argc, char **argv)
   int64_t totalbytes;
   uint64_t arraysize;
   void* base_addr;
-  std::random_device rd;
-  std::mt19937 gen(rd());
-  std::uniform_int_distribution<int> rnd_int(0, 39);
 
   pagesize = utility::umt_getpagesize();
 
@@ -103,53 +479,60 @@ int main(int argc, char **argv)
 
   omp_set_num_threads(options.numthreads);
 
+  const bench_options bopts = get_bench_options(options);
+  disp_bench_env_variables(bopts);
+  const auto pressure = utility::memory_pressure_from_env();
+
+  utility::phase_recorder phases("umapcpu");
+  phases.set_attribute("mode", bopts.mode);
+  phases.set_attribute("pattern", umapcpu::pattern_label(bopts.pattern));
+  phases.set_attribute("threads", options.numthreads);
+  phases.set_attribute("pages", options.numpages);
+  phases.set_attribute("pagesize", pagesize);
+  phases.set_attribute("usemmap", options.usemmap);
+  if (pressure) phases.set_attribute("memory_pressure", utility::pressure_backend_name(pressure->backend()));
+
   totalbytes = options.numpages*pagesize;
+  phases.begin("umap INIT");
   base_addr = utility::map_in_file(options.filename, options.initonly,
       options.noinit, options.usemmap, totalbytes);
   assert(base_addr != NULL);
- 
+  phases.end();
+
   fprintf(stdout, "%lu pages, %lu threads\n", options.numpages, options.numthreads);
 
-  uint64_t *arr = (uint64_t *) base_addr; 
+  uint64_t *arr = (uint64_t *) base_addr;
   arraysize = totalbytes/sizeof(int64_t);
 
-  uint64_t start = getns();
   if ( !options.noinit ) {
     // init data
+    phases.begin("Init", totalbytes);
     initdata(arr, arraysize);
-    fprintf(stdout, "Init took %f us\n", (double)(getns() - start)/1000000.0);
+    phases.end();
   }
 
-  const int testpages = 400;
-
-  if ( !options.initonly ) 
+  bool mapped = true;
+  if ( !options.initonly && bopts.mode == "migration" )
   {
-    std::vector<int> cpus{0, 10, 20, 30};
-
-    start = getns();
-#pragma omp parallel for
-    for (uint64_t page = 0; page < options.numpages - testpages; page += testpages) {
-      uint64_t sum = 0;
-
-      //cpu_setcpu(10);
-      for (int x = 0; x < testpages; x++) {
-        uint64_t* p = &arr[(page+x)*(pagesize/sizeof(uint64_t*))];
-        sum += *p;
-      }
-
-      cpu_setcpu(rnd_int(gen));
-
-      //cpu_setcpu(30);
-      for (int x = 0; x < testpages; ++x) {
-        uint64_t* p = &arr[(page+x)*(pagesize/sizeof(uint64_t*))];
-        *p = sum;
-      }
-    }
+    run_migration_bench(arr, options, bopts, pagesize, phases);
+  }
+  else if ( !options.initonly && bopts.mode == "writeback" )
+  {
+    run_writeback_bench(arr, options, bopts, pagesize, totalbytes, phases);
+    mapped = false;
+  }
+  else if ( !options.initonly )
+  {
+    const bench_result result = run_bench(arr, options, bopts, pagesize, phases);
+    print_result(result, bopts);
+    write_csv(result, options, bopts, pagesize);
+  }
 
-    fprintf(stdout, "test took %f us\n", (double)(getns() - start)/1000000.0);
+  if ( mapped ) {
+    phases.begin("umap TERM");
+    utility::unmap_file(options.usemmap, totalbytes, base_addr);
   }
-  
-  utility::unmap_file(options.usemmap, totalbytes, base_addr);
+  phases.finish();
 
   return 0;
 }
@@ -0,0 +1,167 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about the writeback benchmark
+/// Every thread only writes, so every page it touches becomes dirty and has to
+/// be written back when it is evicted; with a buffer smaller than the data,
+/// the evictors write while the threads run, and the threads stall when no
+/// free page is left. Three write patterns:
+///  overwrite - every word of a page, for the pages given by the access pattern
+///  sparse    - one word of a page, for the pages given by the access pattern
+///  append    - fixed-size records at the tail of a log shared by all threads
+/// Every store (a page for overwrite, a record for append) is timed; the ones
+/// slower than a threshold are counted as stalls.
+
+#ifndef UMAPCPU_WRITEBACK_HPP
+#define UMAPCPU_WRITEBACK_HPP
+
+#include <cstdint>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "../utility/histogram.hpp"
+#include "access_pattern.hpp"
+
+namespace umapcpu {
+
+enum class writeback {
+  overwrite,  // full pages
+  sparse,     // one word per page
+  append      // records at the tail of a shared log
+};
+
+const writeback all_writebacks[] = {writeback::overwrite, writeback::sparse, writeback::append};
+
+inline const char *writeback_name(const writeback w) {
+  switch (w) {
+    case writeback::overwrite: return "overwrite";
+    case writeback::sparse: return "sparse";
+    case writeback::append: return "append";
+  }
+  return "unknown";
+}
+
+inline bool parse_writeback(const std::string &name, writeback *w) {
+  for (const writeback candidate : all_writebacks) {
+    if (name == writeback_name(candidate)) {
+      *w = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+struct writeback_config {
+  writeback kind{writeback::overwrite};
+  uint64_t record_bytes{64};     // append
+  uint64_t stall_ns{10000};      // stores slower than this are stalls
+};
+
+struct writeback_result {
+  utility::latency_histogram latency;  // per page (overwrite, sparse) or per record (append)
+  uint64_t stores{0};
+  uint64_t bytes_dirtied{0};           // bytes stored by the threads
+  uint64_t stalls{0};
+  uint64_t stall_ns{0};                // sum over the threads
+};
+
+/// \brief Dirties the region following the write pattern
+/// \param accesses Pages written per thread; append writes as many bytes in records
+/// \param getns Clock in ns
+template <typename Clock>
+writeback_result run_writeback(uint64_t *const region, const uint64_t num_pages, const uint64_t pagesize,
+                               const writeback_config &config, const pattern_config &access,
+                               const uint64_t working_set_pages, const uint64_t accesses, Clock getns) {
+  const uint64_t words_per_page = pagesize / sizeof(uint64_t);
+  const uint64_t working_set = working_set_pages ? working_set_pages : num_pages;
+  const uint64_t record_words = std::max(config.record_bytes / sizeof(uint64_t), (uint64_t)1);
+  const uint64_t region_words = num_pages * words_per_page;
+  std::unique_ptr<utility::zipfian_distribution> zipf;
+  if (access.kind == pattern::zipfian && config.kind != writeback::append)
+    zipf.reset(new utility::zipfian_distribution(working_set, access.zipf_theta));
+
+  writeback_result result;
+  // Tail of the log, in words; it wraps around the region
+  std::atomic<uint64_t> tail(0);
+
+#pragma omp parallel
+  {
+    const uint64_t thread = omp_get_thread_num();
+    const page_sequence seq(access, working_set, thread, zipf.get());
+    const uint64_t base = working_set_pages ? (thread * working_set_pages) % num_pages : 0;
+    utility::latency_histogram latency;
+    uint64_t stalls = 0;
+    uint64_t stall_ns = 0;
+    uint64_t bytes_dirtied = 0;
+
+    const uint64_t stores = (config.kind == writeback::append)
+        ? accesses * words_per_page / record_words : accesses;
+    for (uint64_t i = 0; i < stores; ++i) {
+      uint64_t start;
+      uint64_t elapsed;
+      if (config.kind == writeback::append) {
+        const uint64_t offset = tail.fetch_add(record_words, std::memory_order_relaxed) % region_words;
+        volatile uint64_t *const p = region + offset;
+        const uint64_t words = std::min(record_words, region_words - offset);
+        start = getns();
+        for (uint64_t w = 0; w < words; ++w)
+          p[w] = i;
+        elapsed = getns() - start;
+        bytes_dirtied += words * sizeof(uint64_t);
+      } else {
+        const uint64_t page = (base + seq.page(i)) % num_pages;
+        volatile uint64_t *const p = region + page * words_per_page;
+        if (config.kind == writeback::overwrite) {
+          start = getns();
+          for (uint64_t w = 0; w < words_per_page; ++w)
+            p[w] = i;
+          elapsed = getns() - start;
+          bytes_dirtied += pagesize;
+        } else {
+          const uint64_t w = seq.word(i, words_per_page);
+          start = getns();
+          p[w] = i;
+          elapsed = getns() - start;
+          bytes_dirtied += sizeof(uint64_t);
+        }
+      }
+      latency.add(elapsed);
+      if (elapsed >= config.stall_ns) {
+        ++stalls;
+        stall_ns += elapsed;
+      }
+    }
+
+#pragma omp critical
+    {
+      result.latency.merge(latency);
+      result.stores += stores;
+      result.bytes_dirtied += bytes_dirtied;
+      result.stalls += stalls;
+      result.stall_ns += stall_ns;
+    }
+  }
+  return result;
+}
+
+} // namespace umapcpu
+
+#endif //UMAPCPU_WRITEBACK_HPP
@@ -0,0 +1,197 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about the hash table
+/// An open-addressing hash table of 8-byte keys and 8-byte values that lives
+/// in a mapped region (umap or mmap), so that it persists in its file:
+///  - The first page of the region is a header (the number of buckets and
+///    of records), so that a table can be reused with --noinit; the buckets
+///    follow, page aligned.
+///  - A bucket is one cache line of 4 slots; a key is looked up in its home
+///    bucket and then in the next ones (linear probing by bucket) until it is
+///    found or a bucket has an empty slot, so most lookups touch one cache
+///    line, hence one page.
+///  - Slots are never deleted. Inserting claims an empty slot with a CAS (to
+///    a reserved key), writes the value and then publishes the key; lookups
+///    and updates do not take locks, and an update is one atomic store.
+///  - The bulk load gives every thread a range of the keys and inserts them
+///    in batches sorted by home bucket, so that every batch sweeps the table
+///    once instead of faulting pages in a random order.
+/// Keys are stored as key + 2 (0: empty slot, 1: reserved slot). A value
+/// carries its key in its upper 48 bits and a version in its lower 16 bits,
+/// so that a lookup can check that it read the value of its own key.
+
+#ifndef UMAP_APPS_UMAPKV_HASH_TABLE_HPP
+#define UMAP_APPS_UMAPKV_HASH_TABLE_HPP
+
+#include <cstdint>
+#include <atomic>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "../utility/random.hpp"
+
+namespace umapkv {
+
+const uint64_t k_empty_key = 0;
+const uint64_t k_reserved_key = 1;
+const uint64_t k_slots_per_bucket = 4;
+const uint64_t k_table_magic = 0x756d61706b763031ULL; // "umapkv01"
+
+inline uint64_t make_value(const uint64_t key, const uint64_t version) {
+  return (key << 16) | (version & 0xFFFF);
+}
+
+inline bool value_matches(const uint64_t value, const uint64_t key) {
+  return (value >> 16) == (key & ((1ULL << 48) - 1));
+}
+
+struct slot {
+  std::atomic<uint64_t> key;
+  std::atomic<uint64_t> value;
+};
+
+struct bucket {
+  slot slots[k_slots_per_bucket];
+};
+static_assert(sizeof(bucket) == 64, "A bucket must be one cache line");
+
+struct table_header {
+  uint64_t magic;
+  uint64_t num_buckets;
+  uint64_t num_records;
+};
+
+class hash_table {
+ public:
+  /// \param region The mapped region; header_bytes of header, then the buckets
+  hash_table(void *const region, const uint64_t region_bytes, const uint64_t header_bytes)
+      : m_header(static_cast<table_header *>(region)),
+        m_buckets(reinterpret_cast<bucket *>(static_cast<char *>(region) + header_bytes)),
+        m_num_buckets((region_bytes - header_bytes) / sizeof(bucket)) {}
+
+  /// \brief Writes the header of an empty table (the buckets must be zero, e.g. a new file)
+  void init() {
+    m_header->magic = k_table_magic;
+    m_header->num_buckets = m_num_buckets;
+    m_header->num_records = 0;
+  }
+
+  /// \brief Whether the region holds a table of this size
+  bool valid() const {
+    return m_header->magic == k_table_magic && m_header->num_buckets == m_num_buckets;
+  }
+
+  uint64_t num_buckets() const { return m_num_buckets; }
+  uint64_t capacity() const { return m_num_buckets * k_slots_per_bucket; }
+  uint64_t num_records() const { return m_header->num_records; }
+  void set_num_records(const uint64_t n) { m_header->num_records = n; }
+
+  uint64_t home_bucket(const uint64_t key) const {
+    // Maps the hash to [0, #buckets) without a division
+    return static_cast<uint64_t>((static_cast<unsigned __int128>(utility::hash64(key)) * m_num_buckets) >> 64);
+  }
+
+  /// \brief Inserts a key that is not in the table
+  /// \return false if the table is full
+  bool insert(const uint64_t key, const uint64_t value) {
+    const uint64_t word = key + 2;
+    uint64_t b = home_bucket(key);
+    for (uint64_t probe = 0; probe < m_num_buckets; ++probe) {
+      for (slot &s : m_buckets[b].slots) {
+        uint64_t expected = k_empty_key;
+        if (s.key.load(std::memory_order_acquire) == k_empty_key
+            && s.key.compare_exchange_strong(expected, k_reserved_key, std::memory_order_acq_rel)) {
+          s.value.store(value, std::memory_order_relaxed);
+          s.key.store(word, std::memory_order_release);
+          return true;
+        }
+      }
+      b = (b + 1 == m_num_buckets) ? 0 : b + 1;
+    }
+    return false;
+  }
+
+  /// \brief Looks a key up
+  /// \return The slot of the key, or nullptr
+  slot *find(const uint64_t key) const {
+    const uint64_t word = key + 2;
+    uint64_t b = home_bucket(key);
+    for (uint64_t probe = 0; probe < m_num_buckets; ++probe) {
+      for (slot &s : m_buckets[b].slots) {
+        const uint64_t k = s.key.load(std::memory_order_acquire);
+        if (k == word) return &s;
+        if (k == k_empty_key) return nullptr;
+      }
+      b = (b + 1 == m_num_buckets) ? 0 : b + 1;
+    }
+    return nullptr;
+  }
+
+  bool read(const uint64_t key, uint64_t *const value) const {
+    const slot *const s = find(key);
+    if (s == nullptr) return false;
+    *value = s->value.load(std::memory_order_relaxed);
+    return true;
+  }
+
+  bool update(const uint64_t key, const uint64_t value) {
+    slot *const s = find(key);
+    if (s == nullptr) return false;
+    s->value.store(value, std::memory_order_relaxed);
+    return true;
+  }
+
+ private:
+  table_header *m_header;
+  bucket *m_buckets;
+  uint64_t m_num_buckets;
+};
+
+/// \brief Inserts the keys [0, num_records) with all threads, in batches sorted by home bucket
+/// \param batch_size Keys per batch and thread
+/// \return The number of keys that did not fit
+inline uint64_t bulk_load(hash_table &table, const uint64_t num_records, const uint64_t batch_size) {
+  uint64_t failed = 0;
+#pragma omp parallel reduction(+:failed)
+  {
+    const uint64_t num_threads = omp_get_num_threads();
+    const uint64_t thread = omp_get_thread_num();
+    const uint64_t first = num_records * thread / num_threads;
+    const uint64_t last = num_records * (thread + 1) / num_threads;
+
+    std::vector<std::pair<uint64_t, uint64_t>> batch; // (home bucket, key)
+    batch.reserve(std::min(batch_size, last - first));
+    for (uint64_t start = first; start < last; start += batch_size) {
+      const uint64_t end = std::min(start + batch_size, last);
+      batch.clear();
+      for (uint64_t key = start; key < end; ++key) batch.emplace_back(table.home_bucket(key), key);
+      std::sort(batch.begin(), batch.end());
+      for (const auto &item : batch) {
+        if (!table.insert(item.second, make_value(item.second, 0))) ++failed;
+      }
+    }
+  }
+  if (failed < num_records) table.set_num_records(num_records - failed);
+  return failed;
+}
+
+} // namespace umapkv
+#endif //UMAP_APPS_UMAPKV_HASH_TABLE_HPP
@@ -0,0 +1,412 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+// Key-value benchmark: bulk loads an open-addressing hash table in a file
+// mapped with umap or mmap (see hash_table.hpp), then runs a YCSB-like mix
+// of point reads, updates, scans and inserts with Zipfian or uniform keys
+// (see ycsb.hpp). Every operation is timed; the program prints the
+// throughput, the latency percentiles of every operation type, and the page
+// faults and storage I/O per operation, and appends them to a CSV file.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif // _GNU_SOURCE
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "umap/umap.h"
+#include "../utility/commandline.hpp"
+#include "../utility/umap_file.hpp"
+#include "../utility/histogram.hpp"
+#include "../utility/phase.hpp"
+#include "../utility/memory_pressure.hpp"
+#include "../utility/metrics.hpp"
+#include "../utility/cache_control.hpp"
+#include "hash_table.hpp"
+#include "ycsb.hpp"
+
+struct kv_options {
+  umapkv::workload_mix mix;
+  umapkv::key_distribution keys;
+  uint64_t records{0};            // 0: fill_percent of the slots
+  double fill_percent{70.0};
+  uint64_t operations{100000};    // per thread
+  uint64_t max_scan_length{100};
+  uint64_t seed{123};
+  uint64_t load_batch{1ULL << 20};
+  std::string csv_file_name;
+};
+
+void disp_kv_env_variables(const kv_options &kopts) {
+  std::cerr
+    << "Benchmark Configuration (environment variables):\n"
+    << " UMAPKV_WORKLOAD                 - currently: " << kopts.mix.name
+    << " (a|b|c|e|read:update:scan:insert percentages)\n"
+    << " UMAPKV_KEYS                     - currently: " << umapkv::key_distribution_label(kopts.keys)
+    << " (zipfian[:theta]|uniform)\n"
+    << " UMAPKV_RECORDS                  - currently: " << kopts.records << " records loaded (0: UMAPKV_FILL)\n"
+    << " UMAPKV_FILL                     - currently: " << kopts.fill_percent << " percent of the slots loaded\n"
+    << " UMAPKV_OPS                      - currently: " << kopts.operations << " operations per thread\n"
+    << " UMAPKV_SCAN_LENGTH              - currently: " << kopts.max_scan_length << " records at most per scan\n"
+    << " UMAPKV_SEED                     - currently: " << kopts.seed << "\n"
+    << " UMAPKV_LOAD_BATCH               - currently: " << kopts.load_batch << " keys per sorted batch of the load\n"
+    << " UMAPKV_CSV                      - currently: " << kopts.csv_file_name << " (summary, one line per run)\n"
+    << std::endl;
+}
+
+kv_options get_kv_options() {
+  kv_options kopts;
+
+  const char *buf = std::getenv("UMAPKV_WORKLOAD");
+  if (buf != nullptr && !umapkv::parse_workload(buf, &kopts.mix)) {
+    std::cerr << "Invalid UMAPKV_WORKLOAD: " << buf << std::endl;
+    exit(1);
+  }
+
+  buf = std::getenv("UMAPKV_KEYS");
+  if (buf != nullptr && !umapkv::parse_key_distribution(buf, &kopts.keys)) {
+    std::cerr << "Invalid UMAPKV_KEYS: " << buf << std::endl;
+    exit(1);
+  }
+
+  buf = std::getenv("UMAPKV_RECORDS");
+  if (buf != nullptr)
+    kopts.records = std::stoull(buf);
+
+  buf = std::getenv("UMAPKV_FILL");
+  if (buf != nullptr) {
+    kopts.fill_percent = std::stod(buf);
+    if (!(kopts.fill_percent > 0.0 && kopts.fill_percent <= 100.0)) {
+      std::cerr << "Invalid UMAPKV_FILL: " << buf << std::endl;
+      exit(1);
+    }
+  }
+
+  buf = std::getenv("UMAPKV_OPS");
+  if (buf != nullptr)
+    kopts.operations = std::stoull(buf);
+
+  buf = std::getenv("UMAPKV_SCAN_LENGTH");
+  if (buf != nullptr)
+    kopts.max_scan_length = std::max((uint64_t)std::stoull(buf), (uint64_t)1);
+
+  buf = std::getenv("UMAPKV_SEED");
+  if (buf != nullptr)
+    kopts.seed = std::stoull(buf);
+
+  buf = std::getenv("UMAPKV_LOAD_BATCH");
+  if (buf != nullptr)
+    kopts.load_batch = std::max((uint64_t)std::stoull(buf), (uint64_t)1);
+
+  buf = std::getenv("UMAPKV_CSV");
+  if (buf != nullptr)
+    kopts.csv_file_name = buf;
+
+  return kopts;
+}
+
+struct run_result {
+  utility::latency_histogram latency[umapkv::k_num_operations];
+  utility::latency_histogram all;
+  utility::phase_record phase;
+  uint64_t scanned{0};
+  uint64_t misses{0};     // loaded keys that were not found
+  uint64_t bad_values{0}; // values that are not the ones of their key
+  uint64_t full{0};       // inserts that did not fit
+
+  uint64_t operations() const { return all.count(); }
+};
+
+/// \brief Runs the operations of all threads
+run_result run_workload(umapkv::hash_table &table, const kv_options &kopts,
+                        utility::phase_recorder &phases) {
+  const uint64_t num_records = table.num_records();
+  std::unique_ptr<utility::zipfian_distribution> zipf;
+  if (kopts.keys.zipfian)
+    zipf.reset(new utility::zipfian_distribution(num_records, kopts.keys.theta));
+
+  utility::metrics &metrics = phases.metrics();
+  utility::metrics::id latency_ids[umapkv::k_num_operations];
+  for (int k = 0; k < umapkv::k_num_operations; ++k)
+    latency_ids[k] = metrics.histogram(std::string(umapkv::operation_name(static_cast<umapkv::operation>(k)))
+                                       + " latency", "ns");
+  const utility::metrics::id scanned_id = metrics.counter("scanned records");
+  const utility::metrics::id misses_id = metrics.counter("misses");
+  const utility::metrics::id bad_values_id = metrics.counter("bad values");
+  const utility::metrics::id full_id = metrics.counter("full");
+
+  std::atomic<uint64_t> next_key(num_records);
+  uint64_t checksum = 0;
+  phases.begin("Run");
+#pragma omp parallel reduction(+:checksum)
+  {
+    const uint64_t thread = omp_get_thread_num();
+    const umapkv::operation_generator gen(kopts.mix, num_records, kopts.max_scan_length, kopts.seed, thread,
+                                          zipf.get());
+    utility::metrics::thread_slot &slot = metrics.local();
+
+    for (uint64_t i = 0; i < kopts.operations; ++i) {
+      const umapkv::operation op = gen.op(i);
+      uint64_t value = 0;
+
+      const uint64_t start = utility::tsc_clock::ns();
+      switch (op) {
+        case umapkv::operation::read: {
+          const uint64_t key = gen.key(i);
+          if (!table.read(key, &value)) slot.add(misses_id);
+          else if (!umapkv::value_matches(value, key)) slot.add(bad_values_id);
+          checksum += value;
+          break;
+        }
+        case umapkv::operation::update: {
+          const uint64_t key = gen.key(i);
+          if (!table.update(key, umapkv::make_value(key, i + 1))) slot.add(misses_id);
+          break;
+        }
+        case umapkv::operation::scan: {
+          const uint64_t first = gen.key(i);
+          const uint64_t length = gen.scan_length(i);
+          for (uint64_t j = 0; j < length; ++j) {
+            const uint64_t key = (first + j) % num_records;
+            if (!table.read(key, &value)) slot.add(misses_id);
+            else if (!umapkv::value_matches(value, key)) slot.add(bad_values_id);
+            checksum += value;
+          }
+          slot.add(scanned_id, length);
+          break;
+        }
+        case umapkv::operation::insert: {
+          const uint64_t key = next_key++;
+          if (!table.insert(key, umapkv::make_value(key, 0))) slot.add(full_id);
+          break;
+        }
+      }
+      slot.record(latency_ids[static_cast<int>(op)], utility::tsc_clock::ns() - start);
+    }
+  }
+  run_result result;
+  result.phase = phases.end();
+  for (int k = 0; k < umapkv::k_num_operations; ++k) {
+    result.latency[k] = metrics.merged(latency_ids[k]);
+    result.all.merge(result.latency[k]);
+  }
+  result.scanned = metrics.total(scanned_id);
+  result.misses = metrics.total(misses_id);
+  result.bad_values = metrics.total(bad_values_id);
+  result.full = metrics.total(full_id);
+  table.set_num_records(next_key.load());
+  fprintf(stdout, "Checksum of the values read: %lu\n", checksum);
+  return result;
+}
+
+/// \brief Buffer size over data size; the umap buffer for umap, the memory left for the run for mmap
+double buffer_data_ratio(const utility::umt_optstruct_t &options, const uint64_t totalbytes,
+                         const utility::memory_pressure *const pressure) {
+  if (!options.usemmap)
+    return (double)umapcfg_get_max_pages_in_buffer() * umapcfg_get_umap_page_size() / totalbytes;
+  const std::size_t available = (pressure && pressure->free_bytes()) ? pressure->free_bytes()
+                                : utility::get_meminfo_bytes("MemAvailable");
+  return (double)available / totalbytes;
+}
+
+void print_result(const run_result &result, const kv_options &kopts, const double ratio) {
+  const double seconds = result.phase.wall_sec > 0.0 ? result.phase.wall_sec : 1e-9;
+  const uint64_t ops = result.operations();
+  const double per_op = ops ? 1.0 / ops : 0.0;
+  fprintf(stdout, "Workload %s, %s keys: %lu operations in %f seconds\n",
+      kopts.mix.name.c_str(), umapkv::key_distribution_label(kopts.keys).c_str(), ops, seconds);
+  fprintf(stdout, "  Throughput: %f K operations/sec\n", ops / seconds / 1e3);
+  fprintf(stdout, "  Buffer/data ratio: %f\n", ratio);
+  fprintf(stdout, "  Page faults: %lu minor, %lu major (%f per operation)\n",
+      result.phase.minor_faults, result.phase.major_faults,
+      (result.phase.minor_faults + result.phase.major_faults) * per_op);
+  fprintf(stdout, "  Storage: read %lu bytes, wrote %lu bytes (%.1f, %.1f per operation)\n",
+      result.phase.read_bytes, result.phase.write_bytes,
+      result.phase.read_bytes * per_op, result.phase.write_bytes * per_op);
+  if (result.scanned)
+    fprintf(stdout, "  Scans read %lu records\n", result.scanned);
+  fprintf(stdout, "  %-8s %10s %10s %10s %10s %10s %10s %10s\n",
+      "Latency", "count", "mean(ns)", "p50", "p90", "p99", "p99.9", "max");
+  for (int k = 0; k <= umapkv::k_num_operations; ++k) {
+    const utility::latency_histogram &h = (k < umapkv::k_num_operations) ? result.latency[k] : result.all;
+    if (h.count() == 0) continue;
+    fprintf(stdout, "  %-8s %10lu %10.0f %10lu %10lu %10lu %10lu %10lu\n",
+        (k < umapkv::k_num_operations) ? umapkv::operation_name(static_cast<umapkv::operation>(k)) : "all",
+        h.count(), h.mean(), h.percentile(0.5), h.percentile(0.9), h.percentile(0.99),
+        h.percentile(0.999), h.max());
+  }
+}
+
+/// \brief Appends one line to the summary CSV; writes the header if the file is new
+void write_csv(const run_result &result, const utility::umt_optstruct_t &options, const kv_options &kopts,
+               const uint64_t pagesize, const uint64_t num_records, const double ratio) {
+  if (kopts.csv_file_name.empty()) return;
+  std::ofstream ofs(kopts.csv_file_name, std::ios::app);
+  if (!ofs.good()) {
+    std::cerr << "Failed to open " << kopts.csv_file_name << std::endl;
+    return;
+  }
+  if (ofs.tellp() == 0) {
+    ofs << "workload,keys,backend,threads,pages,pagesize,umap_bufsize,buffer_data_ratio,records,"
+           "operations,seconds,ops_per_sec,minor_faults,major_faults,faults_per_op,read_bytes,write_bytes,"
+           "read_bytes_per_op,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns";
+    for (int k = 0; k < umapkv::k_num_operations; ++k) {
+      const std::string op = umapkv::operation_name(static_cast<umapkv::operation>(k));
+      ofs << "," << op << "_count," << op << "_p50_ns," << op << "_p99_ns," << op << "_p999_ns";
+    }
+    ofs << "\n";
+  }
+
+  const utility::latency_histogram &h = result.all;
+  const double seconds = result.phase.wall_sec > 0.0 ? result.phase.wall_sec : 1e-9;
+  const double ops = h.count() ? (double)h.count() : 1.0;
+  ofs << kopts.mix.name << "," << umapkv::key_distribution_label(kopts.keys) << ","
+      << (options.usemmap ? "mmap" : "umap") << "," << options.numthreads << "," << options.numpages << ","
+      << pagesize << "," << umapcfg_get_max_pages_in_buffer() << "," << ratio << "," << num_records << ","
+      << h.count() << "," << result.phase.wall_sec << "," << h.count() / seconds << ","
+      << result.phase.minor_faults << "," << result.phase.major_faults << ","
+      << (result.phase.minor_faults + result.phase.major_faults) / ops << ","
+      << result.phase.read_bytes << "," << result.phase.write_bytes << "," << result.phase.read_bytes / ops << ","
+      << h.mean() << "," << h.percentile(0.5) << "," << h.percentile(0.9) << "," << h.percentile(0.99) << ","
+      << h.percentile(0.999) << "," << h.max();
+  for (const auto &l : result.latency)
+    ofs << "," << l.count() << "," << l.percentile(0.5) << "," << l.percentile(0.99) << "," << l.percentile(0.999);
+  ofs << "\n";
+}
+
+int main(int argc, char **argv)
+{
+  utility::umt_optstruct_t options;
+  const uint64_t pagesize = utility::umt_getpagesize();
+
+  umt_getoptions(&options, argc, argv);
+  omp_set_num_threads(options.numthreads);
+
+  const kv_options kopts = get_kv_options();
+  disp_kv_env_variables(kopts);
+  const auto pressure = utility::memory_pressure_from_env();
+
+  if (options.numpages < 2) {
+    std::cerr << "The table needs at least 2 pages (a header and the buckets)" << std::endl;
+    return 1;
+  }
+  const uint64_t totalbytes = options.numpages * pagesize;
+
+  utility::phase_recorder phases("umapkv");
+  const utility::cache_mode cache = options.cold ? utility::cache_mode::cold
+                                  : (options.warm ? utility::cache_mode::warm : utility::cache_mode::as_is);
+  phases.set_attribute("workload", kopts.mix.name);
+  phases.set_attribute("keys", umapkv::key_distribution_label(kopts.keys));
+  phases.set_attribute("threads", options.numthreads);
+  phases.set_attribute("pages", options.numpages);
+  phases.set_attribute("pagesize", pagesize);
+  phases.set_attribute("usemmap", options.usemmap);
+  phases.set_attribute("cache", utility::cache_mode_name(cache));
+  if (pressure) phases.set_attribute("memory_pressure", utility::pressure_backend_name(pressure->backend()));
+
+  phases.begin("umap INIT");
+  void *const base_addr = utility::map_in_file(options.filename, options.initonly,
+      options.noinit, options.usemmap, totalbytes);
+  if (base_addr == nullptr) {
+    std::cerr << "Failed to map " << options.filename << std::endl;
+    return 1;
+  }
+  phases.end();
+
+  // The header takes the first page, so that the buckets are page aligned
+  umapkv::hash_table table(base_addr, totalbytes, pagesize);
+  fprintf(stdout, "%lu pages, %lu buckets, %lu slots, %lu threads\n",
+      options.numpages, table.num_buckets(), table.capacity(), options.numthreads);
+
+  if ( !options.noinit ) {
+    const uint64_t records = kopts.records ? kopts.records : (uint64_t)(table.capacity() * kopts.fill_percent / 100.0);
+    if (records == 0 || records > table.capacity()) {
+      std::cerr << records << " records do not fit in " << table.capacity() << " slots" << std::endl;
+      return 1;
+    }
+    table.init();
+    phases.begin("Load", records * sizeof(umapkv::slot));
+    const uint64_t failed = umapkv::bulk_load(table, records, kopts.load_batch);
+    const utility::phase_record load = phases.end();
+    fprintf(stdout, "Loaded %lu records in %f seconds (%f K records/sec)\n",
+        records - failed, load.wall_sec, (records - failed) / std::max(load.wall_sec, 1e-9) / 1e3);
+    if (failed) {
+      std::cerr << failed << " records did not fit in the table" << std::endl;
+      return 1;
+    }
+  } else if (!table.valid()) {
+    std::cerr << options.filename << " does not hold a table of " << options.numpages
+              << " pages; load it without --noinit" << std::endl;
+    return 1;
+  }
+
+  bool valid = true;
+  if ( !options.initonly ) {
+    const uint64_t num_records = table.num_records();
+    const uint64_t max_inserts = kopts.operations * options.numthreads * kopts.mix.percent[3] / 100.0;
+    if (num_records + max_inserts > table.capacity() * 0.95)
+      fprintf(stdout, "Note: the table may get full (%lu records and about %lu inserts, %lu slots)\n",
+          num_records, max_inserts, table.capacity());
+
+    if (cache != utility::cache_mode::as_is) {
+      if (cache == utility::cache_mode::cold) {
+        phases.begin("Evict");
+        if (utility::evict_mapped_file(options.filename, options.usemmap, totalbytes, base_addr) == nullptr) {
+          std::cerr << "Failed to map " << options.filename << " again" << std::endl;
+          return 1;
+        }
+      } else {
+        phases.begin("Prewarm", totalbytes);
+        utility::prewarm_region(base_addr, totalbytes, options.numthreads);
+      }
+      phases.end();
+      const utility::cache_state state = utility::check_cache_state(cache, base_addr, totalbytes,
+                                                                    {options.filename});
+      phases.set_attribute("region_resident", state.region_resident);
+    }
+
+    const double ratio = buffer_data_ratio(options, totalbytes, pressure.get());
+    phases.set_attribute("buffer_data_ratio", ratio);
+    const run_result result = run_workload(table, kopts, phases);
+    print_result(result, kopts, ratio);
+    write_csv(result, options, kopts, pagesize, num_records, ratio);
+
+    if (result.misses || result.bad_values || result.full) {
+      fprintf(stderr, "Validation failed: %lu keys not found, %lu wrong values, %lu inserts did not fit\n",
+          result.misses, result.bad_values, result.full);
+      valid = false;
+    }
+  }
+
+  phases.begin("umap TERM");
+  utility::unmap_file(options.usemmap, totalbytes, base_addr);
+  phases.finish();
+
+  return valid ? 0 : 1;
+}
@@ -0,0 +1,173 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about the workloads
+/// YCSB-like operation mixes (Cooper et al., SoCC 2010) over the loaded keys:
+///   a - update heavy: 50% reads, 50% updates
+///   b - read heavy:   95% reads, 5% updates
+///   c - read only:    100% reads
+///   e - short scans:  95% scans, 5% inserts
+/// or any mix given as read:update:scan:insert percentages (e.g. 80:10:10:0).
+/// The keys of reads, updates and scans follow a scrambled Zipfian
+/// distribution as in YCSB: the rank drawn from the Zipfian distribution is
+/// hashed, so that the popular keys are spread over the key space; or a
+/// uniform distribution. The hash table has no key order, so a scan of
+/// length l reads the keys k, k + 1, ..., k + l - 1 with l uniform in
+/// [1, max scan length]. Inserted keys are new keys after the loaded ones.
+/// Every operation of every thread is a function of (seed, thread, index).
+
+#ifndef UMAP_APPS_UMAPKV_YCSB_HPP
+#define UMAP_APPS_UMAPKV_YCSB_HPP
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <sstream>
+#include <memory>
+
+#include "../utility/random.hpp"
+
+namespace umapkv {
+
+enum class operation {
+  read = 0,
+  update,
+  scan,
+  insert
+};
+const int k_num_operations = 4;
+
+inline const char *operation_name(const operation op) {
+  switch (op) {
+    case operation::read: return "read";
+    case operation::update: return "update";
+    case operation::scan: return "scan";
+    case operation::insert: return "insert";
+  }
+  return "unknown";
+}
+
+struct workload_mix {
+  std::string name{"b"};
+  double percent[k_num_operations]{95, 5, 0, 0};
+};
+
+/// \brief Parses a | b | c | e | read:update:scan:insert
+inline bool parse_workload(const std::string &text, workload_mix *const mix) {
+  workload_mix m;
+  m.name = text;
+  if (text == "a") {
+    m.percent[0] = 50; m.percent[1] = 50; m.percent[2] = 0; m.percent[3] = 0;
+  } else if (text == "b") {
+    m.percent[0] = 95; m.percent[1] = 5; m.percent[2] = 0; m.percent[3] = 0;
+  } else if (text == "c") {
+    m.percent[0] = 100; m.percent[1] = 0; m.percent[2] = 0; m.percent[3] = 0;
+  } else if (text == "e") {
+    m.percent[0] = 0; m.percent[1] = 0; m.percent[2] = 95; m.percent[3] = 5;
+  } else {
+    std::istringstream ss(text);
+    std::string field;
+    double total = 0.0;
+    for (int i = 0; i < k_num_operations; ++i) {
+      if (!std::getline(ss, field, ':')) return false;
+      char *end = nullptr;
+      m.percent[i] = std::strtod(field.c_str(), &end);
+      if (end == field.c_str() || *end != '\0' || m.percent[i] < 0.0) return false;
+      total += m.percent[i];
+    }
+    if (std::getline(ss, field, ':') || total <= 0.0) return false;
+    for (double &p : m.percent) p = p * 100.0 / total;
+  }
+  *mix = m;
+  return true;
+}
+
+struct key_distribution {
+  bool zipfian{true};
+  double theta{0.99};
+};
+
+/// \brief Parses uniform | zipfian[:theta]
+inline bool parse_key_distribution(const std::string &text, key_distribution *const dist) {
+  key_distribution d;
+  if (text == "uniform") {
+    d.zipfian = false;
+  } else if (text.compare(0, 7, "zipfian") == 0) {
+    if (text.size() > 7) {
+      if (text[7] != ':') return false;
+      d.theta = std::atof(text.c_str() + 8);
+      if (!(d.theta > 0.0 && d.theta < 1.0)) return false;
+    }
+  } else {
+    return false;
+  }
+  *dist = d;
+  return true;
+}
+
+inline std::string key_distribution_label(const key_distribution &dist) {
+  if (!dist.zipfian) return "uniform";
+  std::ostringstream ss;
+  ss << "zipfian:" << dist.theta;
+  return ss.str();
+}
+
+/// \brief The operations of one thread
+class operation_generator {
+ public:
+  /// \param zipf Zipfian distribution over the loaded keys; nullptr for uniform keys
+  operation_generator(const workload_mix &mix, const uint64_t num_records, const uint64_t max_scan_length,
+                      const uint64_t seed, const uint64_t thread, const utility::zipfian_distribution *const zipf)
+      : m_num_records(num_records), m_max_scan_length(max_scan_length),
+        m_seed(utility::hash64(seed) ^ utility::hash64(thread + 1)), m_zipf(zipf) {
+    double sum = 0.0;
+    for (int i = 0; i < k_num_operations; ++i) {
+      sum += mix.percent[i] / 100.0;
+      m_cumulative[i] = sum;
+    }
+    m_cumulative[k_num_operations - 1] = 1.0;
+  }
+
+  operation op(const uint64_t i) const {
+    const double u = utility::to_unit_interval(utility::counter_random(m_seed, 3 * i));
+    for (int k = 0; k < k_num_operations; ++k) {
+      if (u < m_cumulative[k]) return static_cast<operation>(k);
+    }
+    return operation::read;
+  }
+
+  /// \brief Key of a read, an update or the first key of a scan
+  uint64_t key(const uint64_t i) const {
+    const uint64_t r = utility::counter_random(m_seed, 3 * i + 1);
+    if (m_zipf == nullptr) return r % m_num_records;
+    // Scrambled: the popular ranks are spread over the keys
+    const uint64_t rank = (*m_zipf)(utility::to_unit_interval(r));
+    return utility::hash64(rank) % m_num_records;
+  }
+
+  uint64_t scan_length(const uint64_t i) const {
+    return 1 + utility::counter_random(m_seed, 3 * i + 2) % m_max_scan_length;
+  }
+
+ private:
+  uint64_t m_num_records;
+  uint64_t m_max_scan_length;
+  uint64_t m_seed;
+  const utility::zipfian_distribution *m_zipf;
+  double m_cumulative[k_num_operations];
+};
+
+} // namespace umapkv
+#endif //UMAP_APPS_UMAPKV_YCSB_HPP
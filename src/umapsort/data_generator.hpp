@@ -0,0 +1,253 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about the data generator
+/// Keys are a function of (seed, index) only, so the data do not depend on the
+/// number of threads. Every record is built by record_traits::make(), with a
+/// salt drawn from a stream of its own for the key bytes past the first 64 bits.
+/// The generator and the validator compute the same order-independent
+/// fingerprint (count, sum and xor of record hashes); a sorted array with the
+/// same fingerprint as the generated one is a permutation of it with
+/// overwhelming probability.
+
+#ifndef UMAPSORT_DATA_GENERATOR_HPP
+#define UMAPSORT_DATA_GENERATOR_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fstream>
+#include <memory>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "record.hpp"
+#include "../utility/random.hpp"
+
+namespace umapsort {
+
+enum class distribution {
+  descending,     // n, n-1, ..., 1
+  sorted,         // 1, 2, ..., n
+  uniform,        // uniform random 64-bit keys
+  zipfian,        // Zipfian ranks over n values (param: theta), scrambled to 64-bit keys
+  few_unique,     // param (default 16) distinct random keys
+  nearly_sorted,  // sorted, with param percent (default 1) of the keys replaced by random ones
+  organ_pipe,     // 1, 2, ..., n/2, n/2, ..., 1
+  sawtooth        // ascending runs of param keys (default 65536)
+};
+
+const distribution all_distributions[] = {
+  distribution::descending, distribution::sorted, distribution::uniform, distribution::zipfian,
+  distribution::few_unique, distribution::nearly_sorted, distribution::organ_pipe, distribution::sawtooth
+};
+
+inline const char *distribution_name(const distribution d) {
+  switch (d) {
+    case distribution::descending: return "descending";
+    case distribution::sorted: return "sorted";
+    case distribution::uniform: return "uniform";
+    case distribution::zipfian: return "zipfian";
+    case distribution::few_unique: return "few_unique";
+    case distribution::nearly_sorted: return "nearly_sorted";
+    case distribution::organ_pipe: return "organ_pipe";
+    case distribution::sawtooth: return "sawtooth";
+  }
+  return "unknown";
+}
+
+struct distribution_config {
+  distribution kind{distribution::descending};
+  double param{0.0};   // 0 selects the default of the distribution
+  uint64_t seed{123};
+};
+
+/// \brief Parses a "name[:param]" distribution specification
+inline bool parse_distribution(const std::string &spec, distribution_config *const config) {
+  const std::size_t colon = spec.find(':');
+  const std::string name = spec.substr(0, colon);
+  bool found = false;
+  for (const distribution d : all_distributions) {
+    if (name == distribution_name(d)) {
+      config->kind = d;
+      found = true;
+    }
+  }
+  if (!found) return false;
+
+  config->param = 0.0;
+  if (colon != std::string::npos) {
+    try {
+      config->param = std::stod(spec.substr(colon + 1));
+    } catch (...) {
+      return false;
+    }
+    if (config->param <= 0.0) return false;
+  }
+  return true;
+}
+
+/// \brief Order-independent fingerprint of a multiset of records
+struct fingerprint {
+  uint64_t count{0};
+  uint64_t sum{0};
+  uint64_t xor_sum{0};
+
+  bool operator==(const fingerprint &other) const {
+    return count == other.count && sum == other.sum && xor_sum == other.xor_sum;
+  }
+  bool operator!=(const fingerprint &other) const {
+    return !(*this == other);
+  }
+};
+
+/// \brief Hash of all the bytes of a record, payload included
+template <typename Record>
+inline uint64_t record_hash(const Record &r) {
+  const unsigned char *const bytes = reinterpret_cast<const unsigned char *>(&r);
+  uint64_t h = sizeof(Record);
+  std::size_t i = 0;
+  for (; i + sizeof(uint64_t) <= sizeof(Record); i += sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, bytes + i, sizeof(word));
+    h = utility::hash64(h ^ word);
+  }
+  if (i < sizeof(Record)) {
+    uint64_t word = 0;
+    std::memcpy(&word, bytes + i, sizeof(Record) - i);
+    h = utility::hash64(h ^ word);
+  }
+  return h;
+}
+
+/// \brief Writes a fingerprint to a small text file
+inline bool save_fingerprint(const std::string &file_name, const fingerprint &fp) {
+  std::ofstream ofs(file_name);
+  ofs << fp.count << " " << fp.sum << " " << fp.xor_sum << std::endl;
+  return ofs.good();
+}
+
+/// \brief Reads a fingerprint written by save_fingerprint()
+inline bool load_fingerprint(const std::string &file_name, fingerprint *const fp) {
+  std::ifstream ifs(file_name);
+  return static_cast<bool>(ifs >> fp->count >> fp->sum >> fp->xor_sum);
+}
+
+/// \brief Returns the key of every index for a distribution
+class key_generator {
+ public:
+  key_generator(const distribution_config &config, const uint64_t n)
+      : m_kind(config.kind), m_seed(config.seed), m_n(n), m_param(config.param) {
+    if (m_kind == distribution::zipfian) {
+      m_zipf.reset(new utility::zipfian_distribution(std::max<uint64_t>(n, 2),
+                                                     (m_param > 0.0) ? m_param : 0.99));
+    } else if (m_param == 0.0) {
+      if (m_kind == distribution::few_unique) m_param = 16;
+      else if (m_kind == distribution::nearly_sorted) m_param = 1;
+      else if (m_kind == distribution::sawtooth) m_param = 65536;
+    }
+    m_count = std::max<uint64_t>(static_cast<uint64_t>(m_param), 1);
+  }
+
+  uint64_t operator()(const uint64_t i) const {
+    switch (m_kind) {
+      case distribution::descending:
+        return m_n - i;
+      case distribution::sorted:
+        return i + 1;
+      case distribution::uniform:
+        return utility::counter_random(m_seed, i);
+      case distribution::zipfian:
+        return utility::counter_random(m_seed + 1,
+            (*m_zipf)(utility::to_unit_interval(utility::counter_random(m_seed, i))));
+      case distribution::few_unique:
+        return utility::counter_random(m_seed + 1, utility::counter_random(m_seed, i) % m_count);
+      case distribution::nearly_sorted:
+        if (utility::to_unit_interval(utility::counter_random(m_seed, i)) * 100.0 < m_param)
+          return utility::counter_random(m_seed + 1, i) % m_n + 1;
+        return i + 1;
+      case distribution::organ_pipe:
+        return (i < (m_n + 1) / 2) ? i + 1 : m_n - i;
+      case distribution::sawtooth:
+        return i % m_count + 1;
+    }
+    return 0;
+  }
+
+ private:
+  distribution m_kind;
+  uint64_t m_seed;
+  uint64_t m_n;
+  double m_param;
+  uint64_t m_count;
+  std::unique_ptr<utility::zipfian_distribution> m_zipf;
+};
+
+/// \brief Fills an array with records drawn from a distribution, in parallel
+/// \return The fingerprint of the generated records
+template <typename Record>
+fingerprint generate_data(Record *const array, const uint64_t n, const distribution_config &config) {
+  const key_generator key(config, n);
+  uint64_t sum = 0;
+  uint64_t xor_sum = 0;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:sum) reduction(^:xor_sum)
+#endif
+  for (uint64_t i = 0; i < n; ++i) {
+    record_traits<Record>::make(&array[i], key(i), utility::counter_random(~config.seed, i));
+    const uint64_t h = record_hash(array[i]);
+    sum += h;
+    xor_sum ^= h;
+  }
+
+  fingerprint fp;
+  fp.count = n;
+  fp.sum = sum;
+  fp.xor_sum = xor_sum;
+  return fp;
+}
+
+/// \brief Checks sortedness and computes the fingerprint in one parallel pass
+/// \param fp Receives the fingerprint of the array
+/// \return The first index i such that array[i] is ordered before array[i - 1], or n if sorted
+template <typename Record, typename Compare>
+uint64_t scan_sorted_data(const Record *const array, const uint64_t n, const Compare comp,
+                          fingerprint *const fp) {
+  uint64_t sum = 0;
+  uint64_t xor_sum = 0;
+  uint64_t first_unsorted = n;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:sum) reduction(^:xor_sum) reduction(min:first_unsorted)
+#endif
+  for (uint64_t i = 0; i < n; ++i) {
+    const uint64_t h = record_hash(array[i]);
+    sum += h;
+    xor_sum ^= h;
+    if (i > 0 && i < first_unsorted && comp(array[i], array[i - 1]))
+      first_unsorted = i;
+  }
+
+  fp->count = n;
+  fp->sum = sum;
+  fp->xor_sum = xor_sum;
+  return first_unsorted;
+}
+
+} // namespace umapsort
+
+#endif //UMAPSORT_DATA_GENERATOR_HPP
@@ -0,0 +1,517 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about the external merge sort
+/// Phase 1 (run formation): the mapped array is read sequentially in chunks
+///   that fit in DRAM, each chunk is sorted in DRAM and written to a run file
+///   with a single large write.
+/// Phase 2 (merge): the output range is split across threads by key, each
+///   thread merges its slice of every run with a loser tree and writes its
+///   part of the mapped array sequentially.
+///   Run blocks are read with pread() into double buffers so that the next
+///   block is in flight while the current one is merged.
+///   The fan-in is bounded by the DRAM budget. If there are more runs, groups
+///   of runs are first merged into longer runs in a second run file, one
+///   group per thread, until the runs fit in a single merge.
+
+#ifndef UMAPSORT_EXTERNAL_SORT_HPP
+#define UMAPSORT_EXTERNAL_SORT_HPP
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif // _GNU_SOURCE
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <utility>
+#include <memory>
+#include <atomic>
+#include <future>
+#include <algorithm>
+#include <parallel/algorithm>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "loser_tree.hpp"
+#include "sort_io.hpp"
+#include "../utility/time.hpp"
+
+namespace umapsort {
+
+struct external_sort_config {
+  std::string run_file_name;   // temporary file that holds the sorted runs
+  uint64_t memory_bytes{0};    // DRAM budget for run formation and merge buffers
+  uint64_t io_block_bytes{0};  // granularity of reads/writes; rounded to this
+};
+
+struct external_sort_stats {
+  std::atomic<uint64_t> input_bytes_read{0};
+  std::atomic<uint64_t> run_bytes_written{0};
+  std::atomic<uint64_t> run_bytes_read{0};
+  std::atomic<uint64_t> output_bytes_written{0};
+  uint64_t num_runs{0};
+  uint64_t num_merge_passes{0};
+  uint64_t merge_block_bytes{0};
+  double run_formation_time{0.0};
+  double merge_time{0.0};
+};
+
+namespace external_sort_detail {
+
+using namespace io;
+
+/// \brief Sequential reader of a slice of a sorted run
+/// Holds two buffers; while the merge consumes one, the other is filled asynchronously.
+template <typename T>
+class run_reader {
+ public:
+  run_reader(const int fd, const uint64_t begin, const uint64_t end,
+             const uint64_t block_elements, external_sort_stats *const stats)
+      : m_fd(fd),
+        m_next(begin),
+        m_end(end),
+        m_block_elements(block_elements),
+        m_stats(stats),
+        m_front(block_elements),
+        m_back(block_elements),
+        m_front_size(0),
+        m_pos(0) {
+    m_front_size = fill(m_front.data(), m_next);
+    m_next += m_front_size;
+    prefetch();
+  }
+
+  ~run_reader() {
+    if (m_pending.valid()) m_pending.wait();
+  }
+
+  bool empty() const {
+    return m_pos == m_front_size;
+  }
+
+  const T &front() const {
+    return m_front[m_pos];
+  }
+
+  void pop() {
+    ++m_pos;
+    if (m_pos < m_front_size || !m_pending.valid()) return;
+    m_front_size = m_pending.get();
+    m_next += m_front_size;
+    m_pos = 0;
+    std::swap(m_front, m_back);
+    prefetch();
+  }
+
+ private:
+  uint64_t fill(T *const buf, const uint64_t first) {
+    const uint64_t count = std::min(m_block_elements, m_end - first);
+    if (count == 0) return 0;
+    if (!read_fully(m_fd, buf, count * sizeof(T), first * sizeof(T))) std::abort();
+    drop_from_page_cache(m_fd, first * sizeof(T), count * sizeof(T), false);
+    m_stats->run_bytes_read += count * sizeof(T);
+    return count;
+  }
+
+  void prefetch() {
+    if (m_next == m_end) return;
+    T *const buf = m_back.data();
+    const uint64_t first = m_next;
+    m_pending = std::async(std::launch::async, [this, buf, first]() { return fill(buf, first); });
+  }
+
+  int m_fd;
+  uint64_t m_next; // first element not yet requested
+  uint64_t m_end;
+  uint64_t m_block_elements;
+  external_sort_stats *m_stats;
+  std::vector<T> m_front;
+  std::vector<T> m_back;
+  uint64_t m_front_size;
+  uint64_t m_pos;
+  std::future<uint64_t> m_pending;
+};
+
+/// \brief Sequential writer into the mapped array
+/// Full buffers are copied out asynchronously while the merge fills the other buffer.
+template <typename T>
+class output_writer {
+ public:
+  output_writer(T *const dst, const uint64_t block_elements, external_sort_stats *const stats)
+      : m_dst(dst),
+        m_block_elements(block_elements),
+        m_stats(stats),
+        m_front(block_elements),
+        m_back(block_elements),
+        m_size(0) {}
+
+  void push(const T &value) {
+    m_front[m_size++] = value;
+    if (m_size == m_block_elements) flush();
+  }
+
+  void flush() {
+    if (m_pending.valid()) m_pending.wait();
+    if (m_size == 0) return;
+    const T *const src = m_front.data();
+    T *const dst = m_dst;
+    const uint64_t size = m_size;
+    m_pending = std::async(std::launch::async, [src, dst, size]() {
+      std::memcpy(dst, src, size * sizeof(T));
+    });
+    m_stats->output_bytes_written += size * sizeof(T);
+    m_dst += size;
+    m_size = 0;
+    std::swap(m_front, m_back);
+  }
+
+  void finish() {
+    flush();
+    if (m_pending.valid()) m_pending.wait();
+  }
+
+ private:
+  T *m_dst;
+  uint64_t m_block_elements;
+  external_sort_stats *m_stats;
+  std::vector<T> m_front;
+  std::vector<T> m_back;
+  uint64_t m_size;
+  std::future<void> m_pending;
+};
+
+/// \brief Sequential writer of a run into a run file
+/// Works like output_writer and also records the first element of every merge block of the run.
+template <typename T>
+class run_writer {
+ public:
+  run_writer(const int fd, const uint64_t first, const uint64_t block_elements,
+             std::vector<T> *const index, external_sort_stats *const stats)
+      : m_fd(fd),
+        m_next(first),
+        m_block_elements(block_elements),
+        m_index(index),
+        m_stats(stats),
+        m_front(block_elements),
+        m_back(block_elements),
+        m_size(0),
+        m_count(0) {}
+
+  void push(const T &value) {
+    if (m_count++ % m_block_elements == 0) m_index->push_back(value);
+    m_front[m_size++] = value;
+    if (m_size == m_block_elements) flush();
+  }
+
+  void flush() {
+    if (m_pending.valid()) m_pending.wait();
+    if (m_size == 0) return;
+    const T *const src = m_front.data();
+    const int fd = m_fd;
+    const uint64_t first = m_next;
+    const uint64_t size = m_size;
+    m_pending = std::async(std::launch::async, [fd, src, first, size]() {
+      if (!write_fully(fd, src, size * sizeof(T), first * sizeof(T))) std::abort();
+      drop_from_page_cache(fd, first * sizeof(T), size * sizeof(T), true);
+    });
+    m_stats->run_bytes_written += size * sizeof(T);
+    m_next += size;
+    m_size = 0;
+    std::swap(m_front, m_back);
+  }
+
+  void finish() {
+    flush();
+    if (m_pending.valid()) m_pending.wait();
+  }
+
+ private:
+  int m_fd;
+  uint64_t m_next; // position of the first element in m_front
+  uint64_t m_block_elements;
+  std::vector<T> *m_index;
+  external_sort_stats *m_stats;
+  std::vector<T> m_front;
+  std::vector<T> m_back;
+  uint64_t m_size;
+  uint64_t m_count;
+  std::future<void> m_pending;
+};
+
+/// \brief Merges slices [first, second) of a run file with a loser tree into a writer
+template <typename T, typename Compare, typename Writer>
+void merge_slices(const int fd, const std::vector<std::pair<uint64_t, uint64_t>> &slices,
+                  const uint64_t block_elements, Compare comp, external_sort_stats *const stats,
+                  Writer *const writer) {
+  std::vector<std::unique_ptr<run_reader<T>>> readers;
+  loser_tree<T, Compare> tree(slices.size(), comp);
+  for (std::size_t run = 0; run < slices.size(); ++run) {
+    readers.emplace_back(new run_reader<T>(fd, slices[run].first, slices[run].second, block_elements, stats));
+    if (!readers[run]->empty()) tree.set_leaf(run, readers[run]->front());
+  }
+  tree.build();
+
+  while (!tree.empty()) {
+    const std::size_t run = tree.winner();
+    writer->push(tree.top());
+    readers[run]->pop();
+    if (readers[run]->empty())
+      tree.exhaust_winner();
+    else
+      tree.replace_winner(readers[run]->front());
+  }
+  writer->finish();
+}
+
+/// \brief Returns the position of the first element in a run that is not less than key
+/// \param run_index The first element of every merge block of the run
+template <typename T, typename Compare>
+uint64_t run_lower_bound(const int fd, const uint64_t run_begin, const uint64_t run_size,
+                         const std::vector<T> &run_index, const uint64_t block_elements,
+                         const T &key, Compare comp) {
+  const uint64_t block = std::lower_bound(run_index.begin(), run_index.end(), key, comp) - run_index.begin();
+  if (block == 0) return 0;
+
+  // The answer lies in (block-1)*B + 1 ... block*B
+  const uint64_t first = (block - 1) * block_elements;
+  const uint64_t count = std::min(block_elements, run_size - first);
+  std::vector<T> buf(count);
+  if (!read_fully(fd, buf.data(), count * sizeof(T), (run_begin + first) * sizeof(T))) std::abort();
+  return first + (std::lower_bound(buf.begin(), buf.end(), key, comp) - buf.begin());
+}
+
+} // namespace external_sort_detail
+
+/// \brief Sorts a (mapped) array with an external merge sort
+/// \tparam T Type of elements; must be trivially copyable
+/// \tparam Compare Strict weak ordering on T
+/// \param array A pointer to the array, typically a umap/mmap region
+/// \param num_elements The number of elements
+/// \param comp Comparator
+/// \param config Run file and memory budget
+/// \param stats Receives I/O volume and phase times
+/// \return True on success
+template <typename T, typename Compare>
+bool external_sort(T *const array, const uint64_t num_elements, Compare comp,
+                   const external_sort_config &config, external_sort_stats *const stats) {
+  using namespace external_sort_detail;
+
+  if (num_elements == 0) return true;
+
+  int num_threads = 1;
+#ifdef _OPENMP
+  num_threads = ::omp_get_max_threads();
+#endif
+
+  const uint64_t io_block_bytes = std::max(config.io_block_bytes, static_cast<uint64_t>(sizeof(T)));
+
+  // Two run buffers so that writing run r overlaps loading and sorting run r+1
+  const uint64_t run_elements = std::max(config.memory_bytes / 2 / io_block_bytes, static_cast<uint64_t>(1))
+      * io_block_bytes / sizeof(T);
+  const uint64_t num_runs = (num_elements + run_elements - 1) / run_elements;
+
+  // Every merging thread keeps two buffers per input run and two output buffers.
+  // The fan-in is what fits in the budget; more runs take several merge passes.
+  const uint64_t blocks_per_thread = config.memory_bytes / io_block_bytes / num_threads;
+  if (num_runs > 1 && blocks_per_thread < 6) {
+    std::cerr << "External sort: a merge needs at least " << 6 * num_threads * io_block_bytes
+              << " bytes of memory (" << num_threads << " threads, " << io_block_bytes << " byte blocks), got "
+              << config.memory_bytes << std::endl;
+    return false;
+  }
+  const uint64_t fan_in = (blocks_per_thread >= 6) ? (blocks_per_thread - 2) / 2 : 2;
+  const uint64_t ways = std::min(num_runs, fan_in);
+  const uint64_t block_elements = std::max(config.memory_bytes / (num_threads * (2 * ways + 2)) / io_block_bytes,
+                                           static_cast<uint64_t>(1)) * io_block_bytes / sizeof(T);
+
+  stats->num_runs = num_runs;
+  stats->merge_block_bytes = block_elements * sizeof(T);
+
+  int fd = ::open(config.run_file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (fd == -1) {
+    std::string estr = "Failed to create " + config.run_file_name + ": ";
+    ::perror(estr.c_str());
+    return false;
+  }
+
+  // ---------- Run formation ---------- //
+  auto start = utility::elapsed_time_sec();
+  std::vector<uint64_t> run_begin(num_runs);
+  std::vector<uint64_t> run_size(num_runs);
+  std::vector<std::vector<T>> run_index(num_runs);
+  {
+    std::vector<T> buffers[2] = {std::vector<T>(std::min(run_elements, num_elements)),
+                                 std::vector<T>(std::min(run_elements, num_elements))};
+    std::future<bool> pending_write;
+
+    for (uint64_t run = 0; run < num_runs; ++run) {
+      const uint64_t first = run * run_elements;
+      const uint64_t count = std::min(run_elements, num_elements - first);
+      std::vector<T> &buf = buffers[run % 2];
+      run_begin[run] = first;
+      run_size[run] = count;
+
+      parallel_copy(array + first, count, buf.data());
+      stats->input_bytes_read += count * sizeof(T);
+
+      __gnu_parallel::sort(buf.begin(), buf.begin() + count, comp);
+
+      for (uint64_t i = 0; i < count; i += block_elements)
+        run_index[run].push_back(buf[i]);
+
+      if (pending_write.valid() && !pending_write.get()) {
+        ::close(fd);
+        return false;
+      }
+      const T *const src = buf.data();
+      pending_write = std::async(std::launch::async, [fd, src, count, first, stats]() {
+        if (!write_fully(fd, src, count * sizeof(T), first * sizeof(T))) return false;
+        drop_from_page_cache(fd, first * sizeof(T), count * sizeof(T), true);
+        stats->run_bytes_written += count * sizeof(T);
+        return true;
+      });
+    }
+    if (pending_write.valid() && !pending_write.get()) {
+      ::close(fd);
+      return false;
+    }
+  }
+  stats->run_formation_time = utility::elapsed_time_sec(start);
+
+  // ---------- Merge ---------- //
+  start = utility::elapsed_time_sec();
+
+  // Intermediate passes: every group of fan_in consecutive runs becomes one run, at the same
+  // place in the other run file
+  const std::string merge_file_name = config.run_file_name + ".merge";
+  int merge_fd = -1;
+  while (run_begin.size() > fan_in) {
+    if (merge_fd == -1) {
+      merge_fd = ::open(merge_file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+      if (merge_fd == -1) {
+        std::string estr = "Failed to create " + merge_file_name + ": ";
+        ::perror(estr.c_str());
+        ::close(fd);
+        ::unlink(config.run_file_name.c_str());
+        return false;
+      }
+    }
+
+    const uint64_t num_groups = (run_begin.size() + fan_in - 1) / fan_in;
+    std::vector<uint64_t> group_begin(num_groups);
+    std::vector<uint64_t> group_size(num_groups, 0);
+    std::vector<std::vector<T>> group_index(num_groups);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (uint64_t g = 0; g < num_groups; ++g) {
+      const uint64_t first_run = g * fan_in;
+      const uint64_t last_run = std::min(first_run + fan_in, static_cast<uint64_t>(run_begin.size()));
+      std::vector<std::pair<uint64_t, uint64_t>> slices;
+      for (uint64_t run = first_run; run < last_run; ++run) {
+        slices.push_back(std::make_pair(run_begin[run], run_begin[run] + run_size[run]));
+        group_size[g] += run_size[run];
+      }
+      group_begin[g] = run_begin[first_run];
+
+      run_writer<T> writer(merge_fd, group_begin[g], block_elements, &group_index[g], stats);
+      merge_slices<T>(fd, slices, block_elements, comp, stats, &writer);
+    }
+
+    run_begin.swap(group_begin);
+    run_size.swap(group_size);
+    run_index.swap(group_index);
+    std::swap(fd, merge_fd);
+    ++stats->num_merge_passes;
+  }
+  const uint64_t num_merged_runs = run_begin.size();
+
+  // Final pass: pick num_threads-1 splitters from the run indices, then locate them in every run.
+  // bounds[t][r] is the first position of run r merged by thread t.
+  std::vector<std::vector<uint64_t>> bounds(num_threads + 1, std::vector<uint64_t>(num_merged_runs, 0));
+  {
+    std::vector<T> samples;
+    for (const auto &index : run_index) samples.insert(samples.end(), index.begin(), index.end());
+    std::sort(samples.begin(), samples.end(), comp);
+
+    bounds[num_threads] = run_size;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int t = 1; t < num_threads; ++t) {
+      const T splitter = samples[samples.size() * t / num_threads];
+      for (uint64_t run = 0; run < num_merged_runs; ++run) {
+        bounds[t][run] = run_lower_bound(fd, run_begin[run], run_size[run],
+                                         run_index[run], block_elements, splitter, comp);
+      }
+    }
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static, 1)
+#endif
+  for (int t = 0; t < num_threads; ++t) {
+    uint64_t out_offset = 0;
+    std::vector<std::pair<uint64_t, uint64_t>> slices;
+    for (uint64_t run = 0; run < num_merged_runs; ++run) {
+      out_offset += bounds[t][run];
+      slices.push_back(std::make_pair(run_begin[run] + bounds[t][run], run_begin[run] + bounds[t + 1][run]));
+    }
+
+    output_writer<T> writer(array + out_offset, block_elements, stats);
+    merge_slices<T>(fd, slices, block_elements, comp, stats, &writer);
+  }
+  stats->merge_time = utility::elapsed_time_sec(start);
+
+  ::close(fd);
+  ::unlink(config.run_file_name.c_str());
+  if (merge_fd != -1) {
+    ::close(merge_fd);
+    ::unlink(merge_file_name.c_str());
+  }
+
+  return true;
+}
+
+/// \brief Prints the I/O volume and phase times of an external sort
+inline void print_external_sort_stats(const external_sort_stats &stats) {
+  const double gb = 1ULL << 30;
+  std::cerr << "External sort: " << stats.num_runs << " runs, "
+            << stats.num_merge_passes + 1 << " merge passes, "
+            << stats.merge_block_bytes << " byte merge blocks\n"
+            << "  Run formation took " << stats.run_formation_time << " seconds\n"
+            << "  Merge took " << stats.merge_time << " seconds\n"
+            << "  Input read (GB)\t" << stats.input_bytes_read / gb << "\n"
+            << "  Runs written (GB)\t" << stats.run_bytes_written / gb << "\n"
+            << "  Runs read (GB)\t" << stats.run_bytes_read / gb << "\n"
+            << "  Output written (GB)\t" << stats.output_bytes_written / gb << std::endl;
+}
+
+} // namespace umapsort
+
+#endif //UMAPSORT_EXTERNAL_SORT_HPP
@@ -0,0 +1,225 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about the indirect sort
+/// 1. One sequential pass extracts (key prefix, index) pairs into DRAM.
+/// 2. The pairs are sorted in DRAM. Pairs with equal prefixes are ordered by
+///    the whole key, read from the mapped array, when the prefix is not the
+///    whole key.
+/// 3. The records are permuted in place by following the cycles of the
+///    permutation, so every record is read and written once.
+///    Long cycles are cut into segments that are rotated in parallel; the
+///    first record of every segment is saved beforehand.
+
+#ifndef UMAPSORT_INDIRECT_SORT_HPP
+#define UMAPSORT_INDIRECT_SORT_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include <parallel/algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "record.hpp"
+#include "../utility/bitmap.hpp"
+#include "../utility/time.hpp"
+
+namespace umapsort {
+
+struct indirect_sort_stats {
+  uint64_t key_bytes_scanned{0};
+  uint64_t record_bytes_moved{0};
+  uint64_t num_cycles{0};
+  uint64_t num_segments{0};
+  double key_time{0.0};
+  double sort_time{0.0};
+  double permute_time{0.0};
+};
+
+namespace indirect_sort_detail {
+
+struct sort_entry {
+  uint64_t prefix;
+  uint64_t index;
+};
+
+template <typename Record>
+class entry_compare {
+ public:
+  entry_compare(const Record *const array, const bool descending)
+      : m_array(array), m_descending(descending) {}
+
+  bool operator()(const sort_entry &a, const sort_entry &b) const {
+    if (a.prefix != b.prefix) return (a.prefix < b.prefix) != m_descending;
+    if (!record_traits<Record>::prefix_is_key) {
+      const Record &ra = m_array[a.index];
+      const Record &rb = m_array[b.index];
+      if (record_traits<Record>::less(ra, rb)) return !m_descending;
+      if (record_traits<Record>::less(rb, ra)) return m_descending;
+    }
+    return a.index < b.index;
+  }
+
+ private:
+  const Record *m_array;
+  bool m_descending;
+};
+
+/// \brief A run of consecutive positions of a long cycle
+struct cycle_segment {
+  uint64_t head;         // first position written by this segment
+  std::size_t next;      // index of the segment that follows in the cycle
+};
+
+} // namespace indirect_sort_detail
+
+/// \brief Applies a permutation in place: array[i] <- old array[source[i]]
+/// Every record that is not already in place is read and written once.
+/// \param segment_length Cycles longer than this are split into segments of this length
+template <typename Record>
+void apply_permutation(Record *const array, const uint64_t *const source, const uint64_t n,
+                       const uint64_t segment_length, indirect_sort_stats *const stats) {
+  using namespace indirect_sort_detail;
+
+  std::vector<uint64_t> visited(utility::bitmap_size(n), 0);
+  std::vector<uint64_t> short_cycle_start(utility::bitmap_size(n), 0);
+  std::vector<cycle_segment> segments;
+  std::vector<uint64_t> heads;
+  uint64_t moved = 0;
+
+  // Find the cycles; record where short cycles start and cut long ones into segments
+  for (uint64_t i = 0; i < n; ++i) {
+    if (utility::get_bit(visited.data(), i)) continue;
+    utility::set_bit(visited.data(), i);
+    if (source[i] == i) continue;
+
+    heads.clear();
+    uint64_t length = 0;
+    for (uint64_t j = i; length == 0 || j != i; j = source[j], ++length) {
+      if (length % segment_length == 0) heads.push_back(j);
+      utility::set_bit(visited.data(), j);
+    }
+    moved += length;
+    ++stats->num_cycles;
+
+    if (heads.size() == 1) {
+      utility::set_bit(short_cycle_start.data(), i);
+    } else {
+      const std::size_t first = segments.size();
+      for (std::size_t k = 0; k < heads.size(); ++k) {
+        const std::size_t next = first + (k + 1) % heads.size();
+        segments.push_back(cycle_segment{heads[k], next});
+      }
+    }
+  }
+  stats->num_segments = segments.size();
+  stats->record_bytes_moved = moved * sizeof(Record);
+
+  // Long cycles: save the head of every segment, then rotate the segments in parallel
+  std::vector<Record> saved(segments.size());
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (std::size_t k = 0; k < segments.size(); ++k)
+    saved[k] = array[segments[k].head];
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (std::size_t k = 0; k < segments.size(); ++k) {
+    const uint64_t stop = segments[segments[k].next].head;
+    uint64_t j = segments[k].head;
+    while (source[j] != stop) {
+      array[j] = array[source[j]];
+      j = source[j];
+    }
+    array[j] = saved[segments[k].next];
+  }
+
+  // Short cycles: rotate each one with a single temporary
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 4096)
+#endif
+  for (uint64_t i = 0; i < n; ++i) {
+    if (!utility::get_bit(short_cycle_start.data(), i)) continue;
+    const Record tmp = array[i];
+    uint64_t j = i;
+    while (source[j] != i) {
+      array[j] = array[source[j]];
+      j = source[j];
+    }
+    array[j] = tmp;
+  }
+}
+
+/// \brief Sorts a (mapped) array of records through (key prefix, index) pairs held in DRAM
+/// Payloads are moved once, by the final in-place permutation.
+/// \tparam Record Record type with a record_traits specialization
+/// \param array A pointer to the array, typically a umap/mmap region
+/// \param num_records The number of records
+/// \param descending Sorts in descending order if true
+/// \param stats Receives the bytes moved and phase times
+template <typename Record>
+void indirect_sort(Record *const array, const uint64_t num_records, const bool descending,
+                   indirect_sort_stats *const stats) {
+  using namespace indirect_sort_detail;
+
+  auto start = utility::elapsed_time_sec();
+  std::vector<sort_entry> entries(num_records);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (uint64_t i = 0; i < num_records; ++i) {
+    entries[i].prefix = record_traits<Record>::key_prefix(array[i]);
+    entries[i].index = i;
+  }
+  stats->key_bytes_scanned = num_records * sizeof(Record);
+  stats->key_time = utility::elapsed_time_sec(start);
+
+  start = utility::elapsed_time_sec();
+  __gnu_parallel::sort(entries.begin(), entries.end(), entry_compare<Record>(array, descending));
+  std::vector<uint64_t> source(num_records);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (uint64_t i = 0; i < num_records; ++i)
+    source[i] = entries[i].index;
+  std::vector<sort_entry>().swap(entries);
+  stats->sort_time = utility::elapsed_time_sec(start);
+
+  start = utility::elapsed_time_sec();
+  apply_permutation(array, source.data(), num_records, 1ULL << 16, stats);
+  stats->permute_time = utility::elapsed_time_sec(start);
+}
+
+/// \brief Prints the bytes moved and phase times of an indirect sort
+inline void print_indirect_sort_stats(const indirect_sort_stats &stats) {
+  const double gb = 1ULL << 30;
+  std::cerr << "Indirect sort: " << stats.num_cycles << " cycles, "
+            << stats.num_segments << " long cycle segments\n"
+            << "  Key extraction took " << stats.key_time << " seconds\n"
+            << "  Key sort took " << stats.sort_time << " seconds\n"
+            << "  Permutation took " << stats.permute_time << " seconds\n"
+            << "  Records scanned (GB)\t" << stats.key_bytes_scanned / gb << "\n"
+            << "  Records moved (GB)\t" << stats.record_bytes_moved / gb << std::endl;
+}
+
+} // namespace umapsort
+
+#endif //UMAPSORT_INDIRECT_SORT_HPP
@@ -0,0 +1,119 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef UMAPSORT_LOSER_TREE_HPP
+#define UMAPSORT_LOSER_TREE_HPP
+
+#include <cstddef>
+#include <vector>
+#include <utility>
+
+namespace umapsort {
+
+/// \brief Tournament tree of losers used for k-way merging.
+/// Leaf i holds the current head of input sequence i.
+/// Internal nodes keep the loser of the match played there, so replacing
+/// the winner costs log2(k) comparisons and touches a single root-to-leaf path.
+/// Ties are broken by the sequence index, which keeps the merge stable.
+/// \tparam T Type of keys
+/// \tparam Compare Strict weak ordering on T
+template <typename T, typename Compare>
+class loser_tree {
+ public:
+  loser_tree(const std::size_t k, Compare comp)
+      : m_k(k),
+        m_comp(comp),
+        m_tree(k, k),
+        m_keys(k),
+        m_exhausted(k, true) {}
+
+  /// \brief Sets the head of sequence i; call build() once all leaves are set
+  void set_leaf(const std::size_t i, const T &key) {
+    m_keys[i] = key;
+    m_exhausted[i] = false;
+  }
+
+  /// \brief Plays the initial tournament
+  void build() {
+    if (m_k == 0) return;
+    m_tree[0] = play(1);
+  }
+
+  /// \brief Returns true if every sequence has been exhausted
+  bool empty() const {
+    return m_k == 0 || m_exhausted[m_tree[0]];
+  }
+
+  /// \brief Returns the index of the sequence holding the smallest head
+  std::size_t winner() const {
+    return m_tree[0];
+  }
+
+  /// \brief Returns the smallest head
+  const T &top() const {
+    return m_keys[m_tree[0]];
+  }
+
+  /// \brief Replaces the winner's head with the next key of its sequence
+  void replace_winner(const T &key) {
+    m_keys[m_tree[0]] = key;
+    replay(m_tree[0]);
+  }
+
+  /// \brief Marks the winner's sequence as exhausted
+  void exhaust_winner() {
+    m_exhausted[m_tree[0]] = true;
+    replay(m_tree[0]);
+  }
+
+ private:
+  /// \brief Returns true if the head of sequence a beats the head of sequence b
+  bool beats(const std::size_t a, const std::size_t b) const {
+    if (m_exhausted[a]) return false;
+    if (m_exhausted[b]) return true;
+    if (m_comp(m_keys[a], m_keys[b])) return true;
+    if (m_comp(m_keys[b], m_keys[a])) return false;
+    return a < b;
+  }
+
+  /// \brief Plays the sub-tournament rooted at node and returns its winner
+  std::size_t play(const std::size_t node) {
+    if (node >= m_k) return node - m_k;
+    const std::size_t left = play(2 * node);
+    const std::size_t right = play(2 * node + 1);
+    if (beats(left, right)) {
+      m_tree[node] = right;
+      return left;
+    }
+    m_tree[node] = left;
+    return right;
+  }
+
+  void replay(std::size_t winner) {
+    for (std::size_t node = (winner + m_k) / 2; node > 0; node /= 2) {
+      if (beats(m_tree[node], winner)) std::swap(m_tree[node], winner);
+    }
+    m_tree[0] = winner;
+  }
+
+  std::size_t m_k;
+  Compare m_comp;
+  std::vector<std::size_t> m_tree;
+  std::vector<T> m_keys;
+  std::vector<bool> m_exhausted;
+};
+
+} // namespace umapsort
+
+#endif //UMAPSORT_LOSER_TREE_HPP
@@ -0,0 +1,252 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about the in-place merge sort
+/// A bottom-up merge sort that needs no second array as large as the input
+/// (unlike __gnu_parallel's multiway mergesort), only one piece buffer per thread.
+/// 1. The mapped array is cut into chunks of one piece (a thread's share of the
+///    memory budget) that are sorted in place in parallel.
+/// 2. Every merge level merges pairs of adjacent runs. A merge larger than a
+///    piece is split into pieces by output position: the split point of both
+///    runs is found by binary search (co-rank), and the part of the first run
+///    after the split is rotated with the part of the second run before it.
+///    Splitting recursively in halves leaves every piece made of its part of
+///    the first run followed by its part of the second run.
+///    A rotation is three reversals, which swap blocks from both ends of a
+///    region: all accesses are sequential and split across tasks.
+/// 3. Every piece is merged by copying its part of the first run to the
+///    thread's buffer and merging forward into place.
+/// Every merge level thus streams over the mapped array once for the merges,
+/// plus the rotations, whose volume is printed.
+
+#ifndef UMAPSORT_MERGE_SORT_HPP
+#define UMAPSORT_MERGE_SORT_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "../utility/time.hpp"
+
+namespace umapsort {
+
+struct merge_sort_config {
+  uint64_t memory_bytes{0};
+};
+
+struct merge_sort_stats {
+  uint64_t num_runs{0};
+  uint64_t num_levels{0};
+  uint64_t piece_bytes{0};
+  std::atomic<uint64_t> num_pieces{0};
+  std::atomic<uint64_t> bytes_merged{0};
+  std::atomic<uint64_t> bytes_rotated{0};
+  double run_time{0.0};
+  double merge_time{0.0};
+};
+
+namespace merge_sort_detail {
+
+// Regions smaller than this many records are rotated or split by the current task
+constexpr uint64_t k_task_records = 1ULL << 16;
+
+template <typename Record>
+void reverse_region(Record *const first, Record *const last) {
+  const uint64_t half = (last - first) / 2;
+  if (half < k_task_records) {
+    std::reverse(first, last);
+    return;
+  }
+  // Every task swaps a block at the front with the mirrored block at the back
+#ifdef _OPENMP
+#pragma omp taskloop grainsize(k_task_records)
+#endif
+  for (uint64_t i = 0; i < half; ++i)
+    std::swap(first[i], *(last - 1 - i));
+}
+
+template <typename Record>
+void rotate_region(Record *const first, Record *const middle, Record *const last, merge_sort_stats *const stats) {
+  if (first == middle || middle == last) return;
+  stats->bytes_rotated += (last - first) * sizeof(Record);
+  if ((uint64_t)(last - first) < 2 * k_task_records) {
+    std::rotate(first, middle, last);
+    return;
+  }
+#ifdef _OPENMP
+#pragma omp task
+#endif
+  reverse_region(first, middle);
+  reverse_region(middle, last);
+#ifdef _OPENMP
+#pragma omp taskwait
+#endif
+  reverse_region(first, last);
+}
+
+/// \brief Returns how many of the first k records of the merge of a and b come from a
+/// On ties, records of a come first
+template <typename Record, typename Compare>
+uint64_t co_rank(const Record *const a, const uint64_t na, const Record *const b, const uint64_t nb,
+                 const uint64_t k, Compare comp) {
+  uint64_t lo = (k > nb) ? k - nb : 0;
+  uint64_t hi = std::min(k, na);
+  while (lo < hi) {
+    const uint64_t i = lo + (hi - lo) / 2;
+    const uint64_t j = k - i;
+    if (j > 0 && !comp(b[j - 1], a[i]))
+      lo = i + 1;
+    else
+      hi = i;
+  }
+  return lo;
+}
+
+/// \brief Merges [first, middle) and [middle, last) in place; middle - first must fit in the buffer
+template <typename Record, typename Compare>
+void merge_piece(Record *const first, Record *const middle, Record *const last, Compare comp,
+                 Record *const buffer, merge_sort_stats *const stats) {
+  stats->num_pieces++;
+  if (first == middle || middle == last || !comp(*middle, *(middle - 1))) return;
+  stats->bytes_merged += (last - first) * sizeof(Record);
+
+  const Record *a = buffer;
+  const Record *const a_end = std::copy(first, middle, buffer);
+  const Record *b = middle;
+  Record *out = first;
+  // out never passes b: it is behind b by the records of a not yet merged
+  while (a != a_end && b != last) {
+    if (comp(*b, *a))
+      *out++ = *b++;
+    else
+      *out++ = *a++;
+  }
+  std::copy(a, a_end, out);
+}
+
+/// \brief Merges [first, middle) and [middle, last) in place as num_pieces pieces of equal output size
+template <typename Record, typename Compare>
+void split_merge(Record *const first, Record *const middle, Record *const last, const uint64_t num_pieces,
+                 Compare comp, std::vector<std::vector<Record>> *const buffers, merge_sort_stats *const stats) {
+  if (num_pieces <= 1) {
+#ifdef _OPENMP
+    std::vector<Record> &buffer = (*buffers)[omp_get_thread_num()];
+#else
+    std::vector<Record> &buffer = (*buffers)[0];
+#endif
+    if (buffer.size() < (uint64_t)(middle - first))
+      buffer.resize(middle - first);
+    merge_piece(first, middle, last, comp, buffer.data(), stats);
+    return;
+  }
+
+  const uint64_t left_pieces = num_pieces / 2;
+  const uint64_t na = middle - first;
+  const uint64_t nb = last - middle;
+  const uint64_t k = (na + nb) * left_pieces / num_pieces;
+  const uint64_t i = co_rank(first, na, middle, nb, k, comp);
+
+  // [A low][A high][B low][B high] -> [A low][B low][A high][B high]
+  rotate_region(first + i, middle, middle + (k - i), stats);
+
+#ifdef _OPENMP
+#pragma omp task
+#endif
+  split_merge(first, first + i, first + k, left_pieces, comp, buffers, stats);
+  split_merge(first + k, first + k + (na - i), last, num_pieces - left_pieces, comp, buffers, stats);
+#ifdef _OPENMP
+#pragma omp taskwait
+#endif
+}
+
+/// \brief Merges two adjacent sorted runs in place
+template <typename Record, typename Compare>
+void merge_runs(Record *first, Record *const middle, Record *last, const uint64_t piece_records,
+                Compare comp, std::vector<std::vector<Record>> *const buffers, merge_sort_stats *const stats) {
+  if (first == middle || middle == last || !comp(*middle, *(middle - 1))) return;
+  // Records of the first run not after the second run's first one,
+  // and records of the second run not before the first run's last one, are in place
+  first = std::upper_bound(first, middle, *middle, comp);
+  last = std::lower_bound(middle, last, *(middle - 1), comp);
+  const uint64_t num_pieces = ((last - first) + piece_records - 1) / piece_records;
+  split_merge(first, middle, last, num_pieces, comp, buffers, stats);
+}
+
+} // namespace merge_sort_detail
+
+/// \brief Sorts a (mapped) array in place with a bottom-up parallel merge sort
+/// \param config memory_bytes is split into one piece buffer per thread
+template <typename Record, typename Compare>
+void merge_sort(Record *const arr, const uint64_t n, Compare comp, const merge_sort_config &config,
+                merge_sort_stats *const stats) {
+  using namespace merge_sort_detail;
+
+#ifdef _OPENMP
+  const int num_threads = omp_get_max_threads();
+#else
+  const int num_threads = 1;
+#endif
+  const uint64_t piece_records = std::max(config.memory_bytes / num_threads / sizeof(Record), (uint64_t)1);
+  stats->piece_bytes = piece_records * sizeof(Record);
+  if (n < 2) return;
+
+  auto start = utility::elapsed_time_sec();
+  const uint64_t num_runs = (n + piece_records - 1) / piece_records;
+  stats->num_runs = num_runs;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+  for (uint64_t r = 0; r < num_runs; ++r)
+    std::sort(arr + r * piece_records, arr + std::min((r + 1) * piece_records, n), comp);
+  stats->run_time = utility::elapsed_time_sec(start);
+
+  start = utility::elapsed_time_sec();
+  std::vector<std::vector<Record>> buffers(num_threads);
+  for (uint64_t width = piece_records; width < n; width *= 2) {
+    ++stats->num_levels;
+#ifdef _OPENMP
+#pragma omp parallel
+#pragma omp single
+#endif
+    for (uint64_t lo = 0; lo + width < n; lo += 2 * width) {
+      const uint64_t hi = std::min(lo + 2 * width, n);
+#ifdef _OPENMP
+#pragma omp task
+#endif
+      merge_runs(arr + lo, arr + lo + width, arr + hi, piece_records, comp, &buffers, stats);
+    }
+  }
+  stats->merge_time = utility::elapsed_time_sec(start);
+}
+
+inline void print_merge_sort_stats(const merge_sort_stats &stats) {
+  const double gb = 1ULL << 30;
+  std::cerr << "In-place merge sort: " << stats.num_runs << " runs, " << stats.num_levels << " merge levels, "
+            << stats.num_pieces << " pieces of " << stats.piece_bytes << " bytes\n"
+            << "  Run formation took " << stats.run_time << " seconds\n"
+            << "  Merge took " << stats.merge_time << " seconds\n"
+            << "  Records merged (GB)\t" << stats.bytes_merged / gb << "\n"
+            << "  Records rotated (GB)\t" << stats.bytes_rotated / gb << std::endl;
+}
+
+} // namespace umapsort
+
+#endif //UMAPSORT_MERGE_SORT_HPP
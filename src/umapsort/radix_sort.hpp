@@ -0,0 +1,445 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about the radix sort
+/// MSD passes: every thread builds a histogram of the current digit over its
+///   slice of the input, then scatters its slice into per-bucket
+///   write-combining buffers. A buffer is flushed when it reaches the next
+///   io block boundary of its destination, so every flush after the first
+///   one writes whole, aligned blocks. The buffers of a thread fit in its
+///   share of the DRAM budget: the MSD digit is narrowed until they do.
+///   Passes ping-pong between the mapped array and a scratch file.
+/// LSD: once a bucket fits in a thread's share of the DRAM budget it is read
+///   into DRAM, sorted on the remaining digits with an LSD radix sort and
+///   written to its final place in the mapped array. A bucket whose keys
+///   are all equal needs no sort and is copied in budget-sized chunks,
+///   whatever its size.
+/// Keys wider than key_bits are found while the first pass counts them,
+///   before anything is written, and fail the sort.
+
+#ifndef UMAPSORT_RADIX_SORT_HPP
+#define UMAPSORT_RADIX_SORT_HPP
+
+#include <cstdio>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <utility>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "sort_io.hpp"
+#include "../utility/time.hpp"
+
+namespace umapsort {
+
+struct radix_sort_config {
+  std::string scratch_file_name; // temporary file used by the MSD passes
+  uint64_t memory_bytes{0};      // DRAM budget shared by all threads
+  uint64_t io_block_bytes{0};    // size of a write-combining buffer
+  int key_bits{64};              // keys must be smaller than 2^key_bits
+  int digit_bits{8};
+  bool descending{false};
+};
+
+struct radix_sort_stats {
+  std::atomic<uint64_t> bytes_read{0};
+  std::atomic<uint64_t> bytes_written{0};
+  std::atomic<uint64_t> num_msd_passes{0};
+  std::atomic<uint64_t> num_lsd_buckets{0};
+  double time{0.0};
+};
+
+namespace radix_sort_detail {
+
+using namespace io;
+
+/// \brief Position of the MSD digits; level 0 is the most significant digit
+struct digit_layout {
+  int key_bits;
+  int digit_bits;
+
+  int num_levels() const {
+    return (key_bits + digit_bits - 1) / digit_bits;
+  }
+
+  /// \brief Number of bits below the digit of the level
+  int shift(const int level) const {
+    const int s = key_bits - (level + 1) * digit_bits;
+    return (s > 0) ? s : 0;
+  }
+
+  int width(const int level) const {
+    return key_bits - level * digit_bits - shift(level);
+  }
+};
+
+template <typename T, typename KeyOf>
+inline uint64_t bucket_of(const T &value, const KeyOf &key_of, const int shift, const int width,
+                          const bool descending) {
+  const uint64_t mask = (1ULL << width) - 1;
+  const uint64_t digit = (key_of(value) >> shift) & mask;
+  return descending ? mask - digit : digit;
+}
+
+/// \brief In-DRAM LSD radix sort on the bits [0, num_bits) of the keys
+/// \param array Input and output
+/// \param tmp Buffer of the same size as array
+template <typename T, typename KeyOf>
+void lsd_sort(T *const array, T *const tmp, const uint64_t n, const int num_bits, const int digit_bits,
+              const bool descending, const KeyOf &key_of) {
+  std::vector<uint64_t> count(1ULL << digit_bits);
+  T *src = array;
+  T *dst = tmp;
+
+  for (int shift = 0; shift < num_bits; shift += digit_bits) {
+    const int width = std::min(digit_bits, num_bits - shift);
+    const uint64_t num_buckets = 1ULL << width;
+
+    std::fill(count.begin(), count.begin() + num_buckets, 0);
+    for (uint64_t i = 0; i < n; ++i)
+      ++count[bucket_of(src[i], key_of, shift, width, descending)];
+
+    // Skip digits on which all keys agree
+    if (std::find(count.begin(), count.begin() + num_buckets, n) != count.begin() + num_buckets) continue;
+
+    uint64_t sum = 0;
+    for (uint64_t b = 0; b < num_buckets; ++b) {
+      const uint64_t c = count[b];
+      count[b] = sum;
+      sum += c;
+    }
+    for (uint64_t i = 0; i < n; ++i)
+      dst[count[bucket_of(src[i], key_of, shift, width, descending)]++] = src[i];
+    std::swap(src, dst);
+  }
+
+  if (src != array) std::copy(src, src + n, array);
+}
+
+template <typename T, typename KeyOf>
+class msd_sorter {
+ public:
+  msd_sorter(T *const array, const int scratch_fd, const radix_sort_config &config,
+             const KeyOf &key_of, radix_sort_stats *const stats)
+      : m_region(array),
+        m_scratch(scratch_fd),
+        m_config(config),
+        m_layout{config.key_bits, config.digit_bits},
+        m_key_of(key_of),
+        m_stats(stats),
+        m_num_threads(1) {
+#ifdef _OPENMP
+    m_num_threads = ::omp_get_max_threads();
+#endif
+    m_block_elements = std::max(config.io_block_bytes / sizeof(T), static_cast<uint64_t>(1));
+    m_thread_memory_elements = config.memory_bytes / m_num_threads / sizeof(T);
+
+    // A scatter holds a read block and one write-combining buffer per bucket
+    while (m_layout.digit_bits > 1 && scatter_elements(m_layout.digit_bits) > m_thread_memory_elements)
+      --m_layout.digit_bits;
+    if (scatter_elements(m_layout.digit_bits) > m_thread_memory_elements)
+      m_block_elements = std::max(m_thread_memory_elements / ((static_cast<uint64_t>(1) << m_layout.digit_bits) + 1),
+                                  static_cast<uint64_t>(1));
+  }
+
+  /// \return False if a key does not fit in key_bits; the array is then unchanged
+  bool sort(const uint64_t n) {
+    if (fits(n)) {
+      finish_bucket(m_region, 0, n, 0);
+    } else {
+      sort_range(m_region, m_scratch, 0, n, 0);
+    }
+    if (m_wide_keys > 0) {
+      std::cerr << "Radix sort: " << m_wide_keys << " keys do not fit in " << m_config.key_bits
+                << " bits (UMAPSORT_KEY_BITS)" << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  /// \brief Number of keys that have bits at or above key_bits
+  uint64_t count_wide_keys(const T *const values, const uint64_t n) const {
+    if (m_config.key_bits == 64) return 0;
+    uint64_t wide = 0;
+    for (uint64_t i = 0; i < n; ++i)
+      wide += (m_key_of(values[i]) >> m_config.key_bits) != 0;
+    return wide;
+  }
+
+  /// \brief A bucket can be finished in DRAM if it and its LSD buffer fit in a thread's share
+  bool fits(const uint64_t n) const {
+    return 2 * n <= m_thread_memory_elements;
+  }
+
+  /// \brief Elements a thread buffers during a scatter with digits of digit_bits bits
+  uint64_t scatter_elements(const int digit_bits) const {
+    return ((static_cast<uint64_t>(1) << digit_bits) + 1) * m_block_elements;
+  }
+
+  /// \brief Sorts [first, first + n) whose data currently is in src
+  void sort_range(const storage_view<T> &src, const storage_view<T> &dst,
+                  const uint64_t first, const uint64_t n, const int level) {
+    std::vector<std::pair<uint64_t, uint64_t>> buckets;
+    const bool moved = msd_pass(src, dst, first, n, level, &buckets);
+    if (m_wide_keys > 0) return;
+    if (!moved) {
+      // All keys share this digit; nothing was moved
+      if (level + 1 == m_layout.num_levels() || fits(n)) {
+        finish_bucket(src, first, n, level + 1);
+      } else {
+        sort_range(src, dst, first, n, level + 1);
+      }
+      return;
+    }
+
+    std::vector<std::pair<uint64_t, uint64_t>> small_buckets;
+    for (const auto &bucket : buckets) {
+      if (bucket.second == 0) continue;
+      if (level + 1 == m_layout.num_levels() || fits(bucket.second)) {
+        small_buckets.push_back(bucket);
+      } else {
+        sort_range(dst, src, bucket.first, bucket.second, level + 1);
+      }
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (std::size_t i = 0; i < small_buckets.size(); ++i) {
+      finish_bucket(dst, small_buckets[i].first, small_buckets[i].second, level + 1);
+    }
+  }
+
+  /// \brief Sorts a bucket on the digits from level on in DRAM and writes it to the mapped array
+  void finish_bucket(const storage_view<T> &src, const uint64_t first, const uint64_t n, const int level) {
+    const int remaining_bits = (level == 0) ? m_config.key_bits : m_layout.shift(level - 1);
+    if (remaining_bits == 0 || n <= 1) {
+      if (src.is_file()) copy_bucket(src, first, n);
+      return; // otherwise already in place
+    }
+
+    std::vector<T> buf(n);
+    src.read(first, n, buf.data());
+    m_stats->bytes_read += n * sizeof(T);
+    if (level == 0) {
+      m_wide_keys = count_wide_keys(buf.data(), n);
+      if (m_wide_keys > 0) return;
+    }
+
+    if (remaining_bits > 0 && n > 1) {
+      std::vector<T> tmp(n);
+      lsd_sort(buf.data(), tmp.data(), n, remaining_bits, m_config.digit_bits, m_config.descending, m_key_of);
+    }
+
+    m_region.write(first, n, buf.data());
+    m_stats->bytes_written += n * sizeof(T);
+    ++m_stats->num_lsd_buckets;
+  }
+
+  /// \brief Copies a bucket of equal keys to the mapped array through a buffer of a thread's share
+  void copy_bucket(const storage_view<T> &src, const uint64_t first, const uint64_t n) {
+    const uint64_t chunk = std::min(n, std::max(m_thread_memory_elements, m_block_elements));
+    std::vector<T> buf(chunk);
+    for (uint64_t i = first; i < first + n; i += chunk) {
+      const uint64_t count = std::min(chunk, first + n - i);
+      src.read(i, count, buf.data());
+      m_region.write(i, count, buf.data());
+    }
+    m_stats->bytes_read += n * sizeof(T);
+    m_stats->bytes_written += n * sizeof(T);
+    ++m_stats->num_lsd_buckets;
+  }
+
+  /// \brief Distributes [first, first + n) from src to dst by the digit of the level
+  /// \param buckets Receives the (first, size) of every bucket in dst
+  /// \return False if all keys fell in one bucket, in which case nothing is written
+  bool msd_pass(const storage_view<T> &src, const storage_view<T> &dst,
+                const uint64_t first, const uint64_t n, const int level,
+                std::vector<std::pair<uint64_t, uint64_t>> *const buckets) {
+    const int shift = m_layout.shift(level);
+    const int width = m_layout.width(level);
+    const uint64_t num_buckets = 1ULL << width;
+    const bool descending = m_config.descending;
+
+    // Per-thread histograms and offsets are separate allocations to avoid false sharing
+    std::vector<std::vector<uint64_t>> offsets(m_num_threads);
+    buckets->assign(num_buckets, std::make_pair(first, 0));
+    bool single_bucket = false;
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+    {
+      int thread_num = 0;
+      int num_threads = 1;
+#ifdef _OPENMP
+      thread_num = ::omp_get_thread_num();
+      num_threads = ::omp_get_num_threads();
+#endif
+      const uint64_t slice_begin = first + n * thread_num / num_threads;
+      const uint64_t slice_end = first + n * (thread_num + 1) / num_threads;
+      std::vector<T> block(m_block_elements);
+
+      std::vector<uint64_t> &hist = offsets[thread_num];
+      hist.assign(num_buckets, 0);
+      uint64_t wide = 0;
+      for (uint64_t i = slice_begin; i < slice_end; i += m_block_elements) {
+        const uint64_t count = std::min(m_block_elements, slice_end - i);
+        src.read(i, count, block.data());
+        for (uint64_t j = 0; j < count; ++j)
+          ++hist[bucket_of(block[j], m_key_of, shift, width, descending)];
+        if (level == 0) wide += count_wide_keys(block.data(), count);
+      }
+      if (wide > 0) m_wide_keys += wide;
+
+#ifdef _OPENMP
+#pragma omp barrier
+#pragma omp single
+#endif
+      {
+        // Turn the histograms into the first destination of every (bucket, thread) pair
+        uint64_t pos = first;
+        for (uint64_t b = 0; b < num_buckets; ++b) {
+          (*buckets)[b].first = pos;
+          for (int t = 0; t < num_threads; ++t) {
+            const uint64_t c = offsets[t][b];
+            offsets[t][b] = pos;
+            pos += c;
+          }
+          (*buckets)[b].second = pos - (*buckets)[b].first;
+          if ((*buckets)[b].second == n) single_bucket = true;
+        }
+      }
+
+      // Scatter through write-combining buffers unless all keys have the same digit
+      if (!single_bucket && m_wide_keys == 0) {
+        std::vector<uint64_t> &next = offsets[thread_num];
+        std::vector<T> wc(num_buckets * m_block_elements);
+        std::vector<uint64_t> fill(num_buckets, 0);
+        std::vector<uint64_t> limit(num_buckets);
+        for (uint64_t b = 0; b < num_buckets; ++b)
+          limit[b] = m_block_elements - next[b] % m_block_elements;
+
+        for (uint64_t i = slice_begin; i < slice_end; i += m_block_elements) {
+          const uint64_t count = std::min(m_block_elements, slice_end - i);
+          src.read(i, count, block.data());
+          for (uint64_t j = 0; j < count; ++j) {
+            const uint64_t b = bucket_of(block[j], m_key_of, shift, width, descending);
+            wc[b * m_block_elements + fill[b]] = block[j];
+            if (++fill[b] == limit[b]) {
+              dst.write(next[b], fill[b], &wc[b * m_block_elements]);
+              next[b] += fill[b];
+              fill[b] = 0;
+              limit[b] = m_block_elements;
+            }
+          }
+        }
+        for (uint64_t b = 0; b < num_buckets; ++b) {
+          dst.write(next[b], fill[b], &wc[b * m_block_elements]);
+        }
+      }
+    }
+
+    m_stats->bytes_read += n * sizeof(T);
+    if (single_bucket || m_wide_keys > 0) return false;
+
+    dst.sync(first, n);
+    m_stats->bytes_read += n * sizeof(T);
+    m_stats->bytes_written += n * sizeof(T);
+    ++m_stats->num_msd_passes;
+    return true;
+  }
+
+  storage_view<T> m_region;
+  storage_view<T> m_scratch;
+  radix_sort_config m_config;
+  digit_layout m_layout;
+  KeyOf m_key_of;
+  radix_sort_stats *m_stats;
+  int m_num_threads;
+  uint64_t m_block_elements;
+  uint64_t m_thread_memory_elements;
+  std::atomic<uint64_t> m_wide_keys{0};
+};
+
+} // namespace radix_sort_detail
+
+/// \brief Sorts a (mapped) array with a parallel MSD radix sort
+/// \tparam T Type of elements; must be trivially copyable
+/// \tparam KeyOf Functor returning the unsigned integer key of an element
+/// \param array A pointer to the array, typically a umap/mmap region
+/// \param num_elements The number of elements
+/// \param key_of Key extractor
+/// \param config Scratch file, memory budget and digit configuration
+/// \param stats Receives I/O volume and the number of passes
+/// \return True on success
+template <typename T, typename KeyOf>
+bool radix_sort(T *const array, const uint64_t num_elements, const KeyOf &key_of,
+                const radix_sort_config &config, radix_sort_stats *const stats) {
+  if (config.key_bits < 1 || config.key_bits > 64 || config.digit_bits < 1 || config.digit_bits > 16) {
+    std::cerr << "Invalid radix sort configuration: key bits " << config.key_bits
+              << ", digit bits " << config.digit_bits << std::endl;
+    return false;
+  }
+  if (num_elements == 0) return true;
+
+  const int fd = ::open(config.scratch_file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (fd == -1) {
+    std::string estr = "Failed to create " + config.scratch_file_name + ": ";
+    ::perror(estr.c_str());
+    return false;
+  }
+  if (::posix_fallocate(fd, 0, num_elements * sizeof(T)) != 0) {
+    std::cerr << "Failed to pre-allocate " << num_elements * sizeof(T) << " bytes in "
+              << config.scratch_file_name << std::endl;
+    ::close(fd);
+    return false;
+  }
+
+  const auto start = utility::elapsed_time_sec();
+  radix_sort_detail::msd_sorter<T, KeyOf> sorter(array, fd, config, key_of, stats);
+  const bool sorted = sorter.sort(num_elements);
+  stats->time = utility::elapsed_time_sec(start);
+
+  ::close(fd);
+  ::unlink(config.scratch_file_name.c_str());
+
+  return sorted;
+}
+
+/// \brief Prints the I/O volume and the number of passes of a radix sort
+inline void print_radix_sort_stats(const radix_sort_stats &stats) {
+  const double gb = 1ULL << 30;
+  std::cerr << "Radix sort: " << stats.num_msd_passes << " MSD passes, "
+            << stats.num_lsd_buckets << " buckets finished in DRAM\n"
+            << "  Bytes read (GB)\t" << stats.bytes_read / gb << "\n"
+            << "  Bytes written (GB)\t" << stats.bytes_written / gb << std::endl;
+}
+
+} // namespace umapsort
+
+#endif //UMAPSORT_RADIX_SORT_HPP
@@ -0,0 +1,156 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about records
+/// Every record type provides a record_traits specialization with:
+///   name()          - name used by UMAPSORT_RECORD
+///   prefix_is_key   - true if key_prefix() is the whole key
+///   key_prefix(r)   - the first 64 bits of the key as an unsigned integer,
+///                     ordered like the key
+///   less(a, b)      - strict weak ordering on the whole key
+///   make(r, key, salt) - writes a record whose key prefix is 'key'; keys longer
+///                     than 64 bits take their remaining bytes from 'salt', so
+///                     that equal prefixes do not imply equal keys. The payload
+///                     is derived from the whole key
+///   payload_ok(r)   - checks the payload written by make()
+
+#ifndef UMAPSORT_RECORD_HPP
+#define UMAPSORT_RECORD_HPP
+
+#include <cstdint>
+#include <cstring>
+
+namespace umapsort {
+
+/// \brief 16-byte key/value record
+struct kv_record {
+  uint64_t key;
+  uint64_t value;
+};
+
+/// \brief 100-byte record in the sort benchmark (gensort) layout: 10-byte key, 90-byte payload
+struct gensort_record {
+  unsigned char key[10];
+  unsigned char payload[90];
+};
+
+static_assert(sizeof(kv_record) == 16, "kv_record must be 16 bytes");
+static_assert(sizeof(gensort_record) == 100, "gensort_record must be 100 bytes");
+
+namespace record_detail {
+inline uint64_t mix(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+} // namespace record_detail
+
+template <typename Record>
+struct record_traits;
+
+template <>
+struct record_traits<uint64_t> {
+  static const char *name() { return "u64"; }
+  static const bool prefix_is_key = true;
+  static uint64_t key_prefix(const uint64_t &r) { return r; }
+  static bool less(const uint64_t &a, const uint64_t &b) { return a < b; }
+  static void make(uint64_t *const r, const uint64_t key, const uint64_t) { *r = key; }
+  static bool payload_ok(const uint64_t &) { return true; }
+};
+
+template <>
+struct record_traits<kv_record> {
+  static const char *name() { return "kv16"; }
+  static const bool prefix_is_key = true;
+  static uint64_t key_prefix(const kv_record &r) { return r.key; }
+  static bool less(const kv_record &a, const kv_record &b) { return a.key < b.key; }
+  static void make(kv_record *const r, const uint64_t key, const uint64_t) {
+    r->key = key;
+    r->value = record_detail::mix(key);
+  }
+  static bool payload_ok(const kv_record &r) { return r.value == record_detail::mix(r.key); }
+};
+
+template <>
+struct record_traits<gensort_record> {
+  static const char *name() { return "gensort100"; }
+  static const bool prefix_is_key = false;
+
+  /// \brief The first 8 key bytes read as a big-endian integer
+  static uint64_t key_prefix(const gensort_record &r) {
+    uint64_t prefix = 0;
+    for (int i = 0; i < 8; ++i) prefix = (prefix << 8) | r.key[i];
+    return prefix;
+  }
+
+  static bool less(const gensort_record &a, const gensort_record &b) {
+    return std::memcmp(a.key, b.key, sizeof(a.key)) < 0;
+  }
+
+  static void make(gensort_record *const r, const uint64_t key, const uint64_t salt) {
+    for (int i = 0; i < 8; ++i) r->key[i] = static_cast<unsigned char>(key >> (56 - 8 * i));
+    r->key[8] = static_cast<unsigned char>(salt >> 8);
+    r->key[9] = static_cast<unsigned char>(salt);
+    fill_payload(r->key, r->payload);
+  }
+
+  static bool payload_ok(const gensort_record &r) {
+    unsigned char expected[sizeof(r.payload)];
+    fill_payload(r.key, expected);
+    return std::memcmp(expected, r.payload, sizeof(r.payload)) == 0;
+  }
+
+ private:
+  static void fill_payload(const unsigned char *const key, unsigned char *const payload) {
+    uint64_t prefix = 0;
+    for (int i = 0; i < 8; ++i) prefix = (prefix << 8) | key[i];
+    uint64_t h = record_detail::mix(prefix ^ record_detail::mix((uint64_t(key[8]) << 8) | key[9]));
+    for (std::size_t i = 0; i < sizeof(gensort_record::payload); ++i) {
+      if (i % 8 == 0) h = record_detail::mix(h + i);
+      payload[i] = static_cast<unsigned char>(h >> (8 * (i % 8)));
+    }
+  }
+};
+
+/// \brief Orders records by ascending key
+template <typename Record>
+struct key_less {
+  bool operator()(const Record &a, const Record &b) const {
+    return record_traits<Record>::less(a, b);
+  }
+};
+
+/// \brief Orders records by descending key
+template <typename Record>
+struct key_greater {
+  bool operator()(const Record &a, const Record &b) const {
+    return record_traits<Record>::less(b, a);
+  }
+};
+
+/// \brief Key extractor for the radix sort
+template <typename Record>
+struct key_prefix_of {
+  uint64_t operator()(const Record &r) const {
+    return record_traits<Record>::key_prefix(r);
+  }
+};
+
+} // namespace umapsort
+
+#endif //UMAPSORT_RECORD_HPP
@@ -0,0 +1,163 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about the relational operators
+/// Both operators work on tables of kv_record sorted by key.
+/// The work is split across threads by key range: every thread gets a slice of
+/// the (left) table that does not split a run of equal keys, and the matching
+/// slice of the right table is found by binary search.
+/// Every operator runs twice over its slices: once to count the output records
+/// of every thread (so the output file can be sized and every thread knows
+/// where to write), and once to write them.
+
+#ifndef UMAPSORT_RELATIONAL_HPP
+#define UMAPSORT_RELATIONAL_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "record.hpp"
+#include "data_generator.hpp"
+#include "../utility/random.hpp"
+
+namespace umapsort {
+
+/// \brief Output record of the join: one per matching (left, right) pair
+struct join_record {
+  uint64_t key;
+  uint64_t left_value;
+  uint64_t right_value;
+};
+
+/// \brief Output record of the group-by: one per distinct key
+struct group_record {
+  uint64_t key;
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+};
+
+/// \brief Number of output records and a checksum of their values
+struct operator_result {
+  uint64_t count{0};
+  uint64_t checksum{0};
+};
+
+/// \brief Returns the first position in a sorted table whose key is not less than key
+inline uint64_t table_lower_bound(const kv_record *const table, const uint64_t n, const uint64_t key) {
+  return std::lower_bound(table, table + n, key,
+                          [](const kv_record &r, const uint64_t k) { return r.key < k; }) - table;
+}
+
+/// \brief Returns the first position in a sorted table whose key is greater than key
+inline uint64_t table_upper_bound(const kv_record *const table, const uint64_t n, const uint64_t key) {
+  return std::upper_bound(table, table + n, key,
+                          [](const uint64_t k, const kv_record &r) { return k < r.key; }) - table;
+}
+
+/// \brief Splits a sorted table into num_parts slices without splitting runs of equal keys
+/// \return num_parts + 1 bounds
+inline std::vector<uint64_t> key_aligned_bounds(const kv_record *const table, const uint64_t n,
+                                                const int num_parts) {
+  std::vector<uint64_t> bounds(num_parts + 1, n);
+  bounds[0] = 0;
+  for (int p = 1; p < num_parts; ++p) {
+    uint64_t i = std::max(n * p / num_parts, bounds[p - 1]);
+    if (i > 0 && i < n && table[i].key == table[i - 1].key)
+      i = table_upper_bound(table, n, table[i - 1].key);
+    bounds[p] = i;
+  }
+  return bounds;
+}
+
+/// \brief Fills a table with keys drawn from a distribution and reduced to num_keys distinct values
+/// Values are random, drawn with value_seed.
+inline void init_table(kv_record *const table, const uint64_t n, const distribution_config &config,
+                       const uint64_t num_keys, const uint64_t value_seed) {
+  const key_generator key(config, n);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (uint64_t i = 0; i < n; ++i) {
+    table[i].key = key(i) % num_keys;
+    table[i].value = utility::counter_random(value_seed, i);
+  }
+}
+
+/// \brief Merge join of two sorted slices
+/// \param out Receives the joined records in key order; if nullptr, only counts them
+inline operator_result merge_join(const kv_record *const left, uint64_t i, const uint64_t left_end,
+                                  const kv_record *const right, uint64_t j, const uint64_t right_end,
+                                  join_record *out) {
+  operator_result result;
+  while (i < left_end && j < right_end) {
+    if (left[i].key < right[j].key) {
+      ++i;
+    } else if (right[j].key < left[i].key) {
+      ++j;
+    } else {
+      const uint64_t key = left[i].key;
+      uint64_t left_sum = 0;
+      uint64_t right_sum = 0;
+      uint64_t i_end = i;
+      uint64_t j_end = j;
+      for (; i_end < left_end && left[i_end].key == key; ++i_end) left_sum += left[i_end].value;
+      for (; j_end < right_end && right[j_end].key == key; ++j_end) right_sum += right[j_end].value;
+
+      result.count += (i_end - i) * (j_end - j);
+      result.checksum += left_sum * (j_end - j) + right_sum * (i_end - i);
+      if (out != nullptr) {
+        for (uint64_t a = i; a < i_end; ++a)
+          for (uint64_t b = j; b < j_end; ++b)
+            *out++ = join_record{key, left[a].value, right[b].value};
+      }
+      i = i_end;
+      j = j_end;
+    }
+  }
+  return result;
+}
+
+/// \brief Streaming aggregation of a sorted slice
+/// \param out Receives one record per distinct key; if nullptr, only counts them
+inline operator_result group_by(const kv_record *const table, uint64_t i, const uint64_t end,
+                                group_record *out) {
+  operator_result result;
+  while (i < end) {
+    group_record g{table[i].key, 0, 0, table[i].value, table[i].value};
+    for (; i < end && table[i].key == g.key; ++i) {
+      ++g.count;
+      g.sum += table[i].value;
+      g.min = std::min(g.min, table[i].value);
+      g.max = std::max(g.max, table[i].value);
+    }
+    ++result.count;
+    result.checksum += g.sum;
+    if (out != nullptr) *out++ = g;
+  }
+  return result;
+}
+
+} // namespace umapsort
+
+#endif //UMAPSORT_RELATIONAL_HPP
@@ -0,0 +1,383 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about the sample sort
+/// 1. Splitters are picked from a random sample of the mapped array.
+///    Splitters that occur more than once in the sample get an equality
+///    partition of their own, so heavy keys do not make one huge partition.
+/// 2. Every thread reads its slice of the mapped array sequentially and appends
+///    each record to a per-thread buffer of its partition. Full buffers are
+///    appended to the partition file with one large write.
+///    Partition files are spread over the given directories (e.g. one per device).
+/// 3. Partitions are read back in key order, sorted in DRAM and copied to their
+///    final place in the mapped array. The next partition is read while the
+///    current one is sorted and written. A partition that does not fit in DRAM
+///    (bad sample) is copied out and sorted with the external merge sort.
+
+#ifndef UMAPSORT_SAMPLE_SORT_HPP
+#define UMAPSORT_SAMPLE_SORT_HPP
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif // _GNU_SOURCE
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <future>
+#include <algorithm>
+#include <parallel/algorithm>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "sort_io.hpp"
+#include "external_sort.hpp"
+#include "../utility/random.hpp"
+#include "../utility/time.hpp"
+
+namespace umapsort {
+
+struct sample_sort_config {
+  std::vector<std::string> partition_dirs;  // partition files are spread over these directories
+  std::string partition_file_name;          // partition i is <dir>/<partition_file_name>.<i>
+  std::string overflow_file_name;           // run file of the external sort of oversized partitions
+  uint64_t memory_bytes{0};                 // DRAM budget for append buffers and partition sorts
+  uint64_t io_block_bytes{0};               // append buffers are a multiple of this
+  uint64_t num_partitions{0};               // 0: enough partitions for every one to fit in DRAM
+  uint64_t oversampling{64};                // samples per partition
+};
+
+struct sample_sort_stats {
+  std::atomic<uint64_t> input_bytes_read{0};
+  std::atomic<uint64_t> partition_bytes_written{0};
+  std::atomic<uint64_t> partition_bytes_read{0};
+  std::atomic<uint64_t> output_bytes_written{0};
+  uint64_t num_partitions{0};
+  uint64_t num_equal_partitions{0};
+  uint64_t num_oversized_partitions{0};
+  uint64_t largest_partition_bytes{0};
+  uint64_t append_block_bytes{0};
+  double sample_time{0.0};
+  double partition_time{0.0};
+  double sort_time{0.0};
+};
+
+namespace sample_sort_detail {
+
+using namespace io;
+
+/// \brief Maps records to partitions
+/// Partition 2i holds the records between splitter i-1 and splitter i,
+/// partition 2i+1 the records equal to splitter i if it is an equality partition
+/// (otherwise they belong to partition 2i and 2i+1 stays empty).
+template <typename T, typename Compare>
+class classifier {
+ public:
+  classifier(std::vector<T> splitters, std::vector<char> equal, Compare comp)
+      : m_splitters(std::move(splitters)), m_equal(std::move(equal)), m_comp(comp) {}
+
+  std::size_t num_partitions() const {
+    return 2 * m_splitters.size() + 1;
+  }
+
+  bool is_equal_partition(const std::size_t p) const {
+    return p % 2 == 1;
+  }
+
+  bool is_used(const std::size_t p) const {
+    return p % 2 == 0 || m_equal[p / 2];
+  }
+
+  std::size_t operator()(const T &x) const {
+    const std::size_t i = std::lower_bound(m_splitters.begin(), m_splitters.end(), x, m_comp)
+        - m_splitters.begin();
+    if (i < m_splitters.size() && m_equal[i] && !m_comp(x, m_splitters[i])) return 2 * i + 1;
+    return 2 * i;
+  }
+
+ private:
+  std::vector<T> m_splitters;
+  std::vector<char> m_equal;
+  Compare m_comp;
+};
+
+/// \brief Per-thread append buffer of one partition
+template <typename T>
+class append_buffer {
+ public:
+  void push(const T &value, const uint64_t capacity, const int fd, std::atomic<uint64_t> *const size,
+            sample_sort_stats *const stats) {
+    if (m_data.empty()) m_data.resize(capacity);
+    m_data[m_size++] = value;
+    if (m_size == capacity) flush(fd, size, stats);
+  }
+
+  /// \brief Appends the buffer to the partition file
+  void flush(const int fd, std::atomic<uint64_t> *const size, sample_sort_stats *const stats) {
+    if (m_size == 0) return;
+    const uint64_t first = size->fetch_add(m_size);
+    if (!write_fully(fd, m_data.data(), m_size * sizeof(T), first * sizeof(T))) std::abort();
+    drop_from_page_cache(fd, first * sizeof(T), m_size * sizeof(T), true);
+    stats->partition_bytes_written += m_size * sizeof(T);
+    m_size = 0;
+  }
+
+ private:
+  std::vector<T> m_data;
+  uint64_t m_size{0};
+};
+
+/// \brief Reads a whole partition file into a buffer
+template <typename T>
+uint64_t load_partition(const int fd, const uint64_t first, const uint64_t count, T *const buf,
+                        sample_sort_stats *const stats) {
+  if (count == 0) return 0;
+  if (!read_fully(fd, buf, count * sizeof(T), first * sizeof(T))) std::abort();
+  drop_from_page_cache(fd, first * sizeof(T), count * sizeof(T), false);
+  stats->partition_bytes_read += count * sizeof(T);
+  return count;
+}
+
+} // namespace sample_sort_detail
+
+/// \brief Sorts a (mapped) array with a sample sort through partition files
+/// \tparam T Type of elements; must be trivially copyable
+/// \tparam Compare Strict weak ordering on T
+/// \param array A pointer to the array, typically a umap/mmap region
+/// \param num_elements The number of elements
+/// \param comp Comparator
+/// \param config Partition files and memory budget
+/// \param stats Receives I/O volume and phase times
+/// \return True on success
+template <typename T, typename Compare>
+bool sample_sort(T *const array, const uint64_t num_elements, Compare comp,
+                 const sample_sort_config &config, sample_sort_stats *const stats) {
+  using namespace sample_sort_detail;
+
+  if (num_elements == 0) return true;
+
+  int num_threads = 1;
+#ifdef _OPENMP
+  num_threads = ::omp_get_max_threads();
+#endif
+
+  const uint64_t io_block_bytes = std::max(config.io_block_bytes, static_cast<uint64_t>(sizeof(T)));
+
+  // Two partition buffers so that reading partition p+1 overlaps sorting partition p.
+  // Partitions are sized for 3/4 of a buffer to leave room for sampling error.
+  const uint64_t buffer_elements = std::max(config.memory_bytes / 2 / sizeof(T), static_cast<uint64_t>(1));
+  uint64_t num_splitters = config.num_partitions;
+  if (num_splitters == 0)
+    num_splitters = (num_elements + buffer_elements * 3 / 4) / std::max(buffer_elements * 3 / 4, static_cast<uint64_t>(1));
+  num_splitters = std::min(std::max(num_splitters, static_cast<uint64_t>(1)), num_elements) - 1;
+
+  // ---------- Sampling ---------- //
+  auto start = utility::elapsed_time_sec();
+  std::vector<T> splitters;
+  std::vector<char> equal;
+  if (num_splitters > 0) {
+    const uint64_t num_samples = std::min((num_splitters + 1) * config.oversampling, num_elements);
+    std::vector<T> samples(num_samples);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (uint64_t i = 0; i < num_samples; ++i)
+      samples[i] = array[utility::counter_random(num_elements, i) % num_elements];
+    std::sort(samples.begin(), samples.end(), comp);
+
+    // A key that fills half a partition's worth of samples gets an equality partition
+    const uint64_t heavy = std::max(num_samples / (num_splitters + 1) / 2, static_cast<uint64_t>(2));
+    for (uint64_t k = 1; k <= num_splitters; ++k) {
+      const T &s = samples[num_samples * k / (num_splitters + 1)];
+      if (!splitters.empty() && !comp(splitters.back(), s)) continue;
+      const auto range = std::equal_range(samples.begin(), samples.end(), s, comp);
+      splitters.push_back(s);
+      equal.push_back(static_cast<uint64_t>(range.second - range.first) >= heavy);
+    }
+  }
+  const classifier<T, Compare> classify(splitters, equal, comp);
+  const std::size_t num_partitions = classify.num_partitions();
+  stats->sample_time = utility::elapsed_time_sec(start);
+
+  std::vector<int> fds(num_partitions, -1);
+  for (std::size_t p = 0; p < num_partitions; ++p) {
+    if (!classify.is_used(p)) continue;
+    const std::string &dir = config.partition_dirs.empty() ? std::string(".")
+        : config.partition_dirs[p % config.partition_dirs.size()];
+    const std::string name = dir + "/" + config.partition_file_name + "." + std::to_string(p);
+    fds[p] = ::open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fds[p] == -1) {
+      std::string estr = "Failed to create " + name + ": ";
+      ::perror(estr.c_str());
+      for (const int fd : fds) if (fd != -1) ::close(fd);
+      return false;
+    }
+    ::unlink(name.c_str());
+  }
+
+  // ---------- Partitioning ---------- //
+  start = utility::elapsed_time_sec();
+  const uint64_t used_partitions = splitters.size() + 1
+      + std::count(equal.begin(), equal.end(), static_cast<char>(1));
+  const uint64_t block_elements = std::max(config.memory_bytes / num_threads / used_partitions / io_block_bytes,
+                                           static_cast<uint64_t>(1)) * io_block_bytes / sizeof(T);
+  stats->append_block_bytes = block_elements * sizeof(T);
+
+  std::vector<std::atomic<uint64_t>> sizes(num_partitions);
+  for (auto &s : sizes) s = 0;
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+  {
+    int t = 0;
+#ifdef _OPENMP
+    t = ::omp_get_thread_num();
+#endif
+    const uint64_t first = num_elements * t / num_threads;
+    const uint64_t last = num_elements * (t + 1) / num_threads;
+    std::vector<append_buffer<T>> buffers(num_partitions);
+    for (uint64_t i = first; i < last; ++i) {
+      const std::size_t p = classify(array[i]);
+      buffers[p].push(array[i], block_elements, fds[p], &sizes[p], stats);
+    }
+    for (std::size_t p = 0; p < num_partitions; ++p)
+      buffers[p].flush(fds[p], &sizes[p], stats);
+    stats->input_bytes_read += (last - first) * sizeof(T);
+  }
+  stats->partition_time = utility::elapsed_time_sec(start);
+
+  // ---------- Partition sorts ---------- //
+  start = utility::elapsed_time_sec();
+  std::vector<uint64_t> offsets(num_partitions + 1, 0);
+  for (std::size_t p = 0; p < num_partitions; ++p) {
+    offsets[p + 1] = offsets[p] + sizes[p];
+    if (sizes[p] > 0) {
+      ++stats->num_partitions;
+      if (classify.is_equal_partition(p)) ++stats->num_equal_partitions;
+      stats->largest_partition_bytes = std::max(stats->largest_partition_bytes, sizes[p] * sizeof(T));
+    }
+  }
+
+  {
+    const uint64_t largest = stats->largest_partition_bytes / sizeof(T);
+    const uint64_t buffer_size = std::min(buffer_elements, largest);
+    std::vector<T> buffers[2] = {std::vector<T>(buffer_size), std::vector<T>(buffer_size)};
+    std::future<uint64_t> pending;
+    std::size_t pending_partition = num_partitions;
+    int current = 0;
+
+    for (std::size_t p = 0; p < num_partitions; ++p) {
+      const uint64_t count = sizes[p];
+      if (count == 0) continue;
+      T *const dst = array + offsets[p];
+
+      if (count > buffer_elements) {
+        // Oversized partition: copy it out through one buffer, then sort it externally
+        if (pending.valid()) pending.wait();
+        for (uint64_t i = 0; i < count; i += buffer_elements) {
+          const uint64_t n = std::min(buffer_elements, count - i);
+          load_partition(fds[p], i, n, buffers[current].data(), stats);
+          parallel_copy(buffers[current].data(), n, dst + i);
+        }
+        stats->output_bytes_written += count * sizeof(T);
+        if (!classify.is_equal_partition(p)) {
+          ++stats->num_oversized_partitions;
+          // The external sort has the whole budget, so the partition buffers are released meanwhile
+          std::vector<T>().swap(buffers[0]);
+          std::vector<T>().swap(buffers[1]);
+          external_sort_config ext_config;
+          ext_config.run_file_name = config.overflow_file_name;
+          ext_config.memory_bytes = config.memory_bytes;
+          ext_config.io_block_bytes = config.io_block_bytes;
+          external_sort_stats ext_stats;
+          if (!external_sort(dst, count, comp, ext_config, &ext_stats)) {
+            for (const int fd : fds) if (fd != -1) ::close(fd);
+            return false;
+          }
+          buffers[0].resize(buffer_size);
+          buffers[1].resize(buffer_size);
+        }
+        continue;
+      }
+
+      if (pending_partition == p) {
+        pending.get();
+      } else {
+        load_partition(fds[p], 0, count, buffers[current].data(), stats);
+      }
+      T *const buf = buffers[current].data();
+
+      // Read the next partition that fits while this one is sorted and written
+      pending_partition = num_partitions;
+      for (std::size_t q = p + 1; q < num_partitions; ++q) {
+        if (sizes[q] == 0) continue;
+        if (sizes[q] <= buffer_elements) {
+          T *const next = buffers[1 - current].data();
+          const int fd = fds[q];
+          const uint64_t next_count = sizes[q];
+          pending = std::async(std::launch::async, [fd, next_count, next, stats]() {
+            return load_partition(fd, 0, next_count, next, stats);
+          });
+          pending_partition = q;
+        }
+        break;
+      }
+
+      if (!classify.is_equal_partition(p))
+        __gnu_parallel::sort(buf, buf + count, comp);
+      parallel_copy(buf, count, dst);
+      stats->output_bytes_written += count * sizeof(T);
+      if (pending_partition != num_partitions) current = 1 - current;
+    }
+  }
+  stats->sort_time = utility::elapsed_time_sec(start);
+
+  for (const int fd : fds) if (fd != -1) ::close(fd);
+
+  return true;
+}
+
+/// \brief Prints the I/O volume and phase times of a sample sort
+inline void print_sample_sort_stats(const sample_sort_stats &stats) {
+  const double gb = 1ULL << 30;
+  std::cerr << "Sample sort: " << stats.num_partitions << " partitions ("
+            << stats.num_equal_partitions << " equal-key, "
+            << stats.num_oversized_partitions << " oversized), largest "
+            << stats.largest_partition_bytes << " bytes, "
+            << stats.append_block_bytes << " byte append blocks\n"
+            << "  Sampling took " << stats.sample_time << " seconds\n"
+            << "  Partitioning took " << stats.partition_time << " seconds\n"
+            << "  Partition sorts took " << stats.sort_time << " seconds\n"
+            << "  Input read (GB)\t" << stats.input_bytes_read / gb << "\n"
+            << "  Partitions written (GB)\t" << stats.partition_bytes_written / gb << "\n"
+            << "  Partitions read (GB)\t" << stats.partition_bytes_read / gb << "\n"
+            << "  Output written (GB)\t" << stats.output_bytes_written / gb << std::endl;
+}
+
+} // namespace umapsort
+
+#endif //UMAPSORT_SAMPLE_SORT_HPP
@@ -0,0 +1,385 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about the selection
+/// 1. A random sample of the mapped array is sorted in DRAM. For every
+///    requested rank, two sample elements around the rank's position in the
+///    sample bracket the answer.
+/// 2. One parallel sequential pass over the array counts, for every bracket
+///    [lo, hi], the elements below lo, equal to lo, between lo and hi and
+///    equal to hi, and copies the elements strictly between lo and hi to DRAM.
+/// 3. The rank is then either lo, hi or found with nth_element among the
+///    copied elements.
+/// If the answer is outside the bracket (unlucky sample) the bracket is widened
+/// towards it; if too many elements fall in the bracket (e.g. heavy keys), a
+/// uniform sample of them is kept and becomes the sample of a narrower bracket.
+/// Both cost one more pass.
+/// Top-k selects the k-th element, then one more pass collects the elements
+/// before it.
+
+#ifndef UMAPSORT_SELECTION_HPP
+#define UMAPSORT_SELECTION_HPP
+
+#include <cstdint>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <parallel/algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "../utility/random.hpp"
+#include "../utility/time.hpp"
+
+namespace umapsort {
+
+struct selection_config {
+  uint64_t memory_bytes{0};  // DRAM budget for the sample and the copied candidates
+};
+
+struct selection_stats {
+  uint64_t sample_size{0};
+  uint64_t num_passes{0};
+  uint64_t bytes_scanned{0};
+  uint64_t max_candidates{0};
+  double sample_time{0.0};
+  double pass_time{0.0};
+  double select_time{0.0};
+};
+
+namespace selection_detail {
+
+/// \brief Search state of one rank
+template <typename T>
+struct rank_search {
+  uint64_t rank;
+  bool done{false};
+  T answer;
+
+  // Sorted elements that represent 'span' elements of the array, starting at rank 'base'
+  std::vector<T> sample;
+  uint64_t base{0};
+  uint64_t span{0};
+  uint64_t margin{0};
+
+  // The answer is known to be within [known_lo, known_hi]
+  bool has_known_lo{false};
+  bool has_known_hi{false};
+  T known_lo;
+  T known_hi;
+
+  // Bracket of the next pass and its counts
+  bool has_lo{false};
+  bool has_hi{false};
+  T lo;
+  T hi;
+  uint64_t below{0};
+  uint64_t eq_lo{0};
+  uint64_t inside{0};
+  uint64_t eq_hi{0};
+  bool overflow{false};
+  std::vector<T> candidates;
+};
+
+/// \brief Distance in the sample between a rank's position and its bracket ends
+/// Brackets then hold about 4 / sqrt(sample size) of the elements the sample represents.
+inline uint64_t initial_margin(const uint64_t sample_size) {
+  return std::max(static_cast<uint64_t>(2.0 * std::sqrt(static_cast<double>(sample_size))),
+                  static_cast<uint64_t>(1));
+}
+
+/// \brief Picks the bracket of a rank from its sample, within the known bounds
+template <typename T, typename Compare>
+void choose_bracket(rank_search<T> &s, Compare comp) {
+  const uint64_t size = s.sample.size();
+  const uint64_t pos = (s.span == 0) ? 0 : std::min((s.rank - s.base) * size / s.span, size);
+
+  s.has_lo = s.has_known_lo;
+  s.lo = s.known_lo;
+  if (pos >= s.margin && pos - s.margin < size) {
+    const T &candidate = s.sample[pos - s.margin];
+    if (!s.has_lo || comp(s.lo, candidate)) {
+      s.has_lo = true;
+      s.lo = candidate;
+    }
+  }
+
+  s.has_hi = s.has_known_hi;
+  s.hi = s.known_hi;
+  if (pos + s.margin < size) {
+    const T &candidate = s.sample[pos + s.margin];
+    if (!s.has_hi || comp(candidate, s.hi)) {
+      s.has_hi = true;
+      s.hi = candidate;
+    }
+  }
+}
+
+/// \brief Counts and copies the elements of every active bracket in one parallel pass
+template <typename T, typename Compare>
+void filter_pass(const T *const array, const uint64_t n, std::vector<rank_search<T>> &searches,
+                 const uint64_t candidate_limit, Compare comp) {
+  for (auto &s : searches) {
+    s.below = s.eq_lo = s.inside = s.eq_hi = 0;
+    s.overflow = false;
+    s.candidates.clear();
+  }
+
+  int num_threads = 1;
+#ifdef _OPENMP
+  num_threads = ::omp_get_max_threads();
+#endif
+  // A narrower bracket needs a sample of a few thousand elements to make progress
+  const uint64_t thread_limit = std::max(candidate_limit / num_threads, static_cast<uint64_t>(1024));
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+  {
+    std::vector<uint64_t> counts(4 * searches.size(), 0);
+    std::vector<std::vector<T>> local(searches.size());
+    std::vector<char> overflow(searches.size(), 0);
+
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for (uint64_t i = 0; i < n; ++i) {
+      const T &x = array[i];
+      for (std::size_t k = 0; k < searches.size(); ++k) {
+        const rank_search<T> &s = searches[k];
+        if (s.done) continue;
+        if (s.has_lo && comp(x, s.lo)) {
+          ++counts[4 * k];
+        } else if (s.has_lo && !comp(s.lo, x)) {
+          ++counts[4 * k + 1];
+        } else if (!s.has_hi || comp(x, s.hi)) {
+          // Keep a uniform sample (reservoir) of the elements if there are too many
+          const uint64_t seen = counts[4 * k + 2]++;
+          if (seen < thread_limit) {
+            local[k].push_back(x);
+          } else {
+            overflow[k] = 1;
+            const uint64_t j = utility::counter_random(k, i) % (seen + 1);
+            if (j < thread_limit) local[k][j] = x;
+          }
+        } else if (!comp(s.hi, x)) {
+          ++counts[4 * k + 3];
+        }
+      }
+    }
+
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+    for (std::size_t k = 0; k < searches.size(); ++k) {
+      rank_search<T> &s = searches[k];
+      s.below += counts[4 * k];
+      s.eq_lo += counts[4 * k + 1];
+      s.inside += counts[4 * k + 2];
+      s.eq_hi += counts[4 * k + 3];
+      s.overflow = s.overflow || overflow[k];
+      s.candidates.insert(s.candidates.end(), local[k].begin(), local[k].end());
+    }
+  }
+}
+
+/// \brief Finishes a search or sets it up for another pass
+template <typename T, typename Compare>
+void resolve(rank_search<T> &s, Compare comp) {
+  uint64_t r = s.rank;
+  if (r < s.below) {
+    // The answer is below the bracket: widen downwards
+    s.has_known_hi = true;
+    s.known_hi = s.lo;
+    s.margin *= 4;
+    return;
+  }
+  r -= s.below;
+  if (r < s.eq_lo) {
+    s.answer = s.lo;
+    s.done = true;
+    return;
+  }
+  r -= s.eq_lo;
+  if (r < s.inside) {
+    if (!s.overflow) {
+      std::nth_element(s.candidates.begin(), s.candidates.begin() + r, s.candidates.end(), comp);
+      s.answer = s.candidates[r];
+      s.done = true;
+    } else {
+      // Too many elements in the bracket: use the copied ones as the sample of a narrower bracket
+      s.has_known_lo = s.has_lo;
+      s.known_lo = s.lo;
+      s.has_known_hi = s.has_hi;
+      s.known_hi = s.hi;
+      s.sample.swap(s.candidates);
+      __gnu_parallel::sort(s.sample.begin(), s.sample.end(), comp);
+      s.base = s.below + s.eq_lo;
+      s.span = s.inside;
+      s.margin = initial_margin(s.sample.size());
+    }
+    return;
+  }
+  r -= s.inside;
+  if (r < s.eq_hi) {
+    s.answer = s.hi;
+    s.done = true;
+    return;
+  }
+  // The answer is above the bracket: widen upwards
+  s.has_known_lo = true;
+  s.known_lo = s.hi;
+  s.margin *= 4;
+}
+
+} // namespace selection_detail
+
+/// \brief Returns the elements of the given ranks in the order defined by comp,
+/// i.e. the elements that would be at those positions if the array were sorted
+/// \tparam T Type of elements; must be trivially copyable
+/// \param array A pointer to the array, typically a umap/mmap region
+/// \param num_elements The number of elements
+/// \param ranks Ranks in [0, num_elements)
+/// \param comp Strict weak ordering on T
+/// \param config Memory budget
+/// \param stats Receives the number of passes and phase times
+template <typename T, typename Compare>
+std::vector<T> select_ranks(const T *const array, const uint64_t num_elements, const std::vector<uint64_t> &ranks,
+                            Compare comp, const selection_config &config, selection_stats *const stats) {
+  using namespace selection_detail;
+
+  if (ranks.empty() || num_elements == 0) return std::vector<T>();
+
+  // Every bracket copies about 4 n / sqrt(sample size) elements; size the sample so that
+  // all brackets use at most half of the memory budget, and the sample at most a quarter.
+  // With a small budget, brackets overflow and are narrowed in more passes.
+  const uint64_t candidate_limit = std::max(config.memory_bytes / 2 / ranks.size() / sizeof(T),
+                                            static_cast<uint64_t>(1));
+  const double root = 8.0 * num_elements / candidate_limit;
+  const uint64_t sample_limit = std::max(config.memory_bytes / 4 / sizeof(T), static_cast<uint64_t>(4096));
+  const uint64_t sample_size = std::min(std::max(static_cast<uint64_t>(std::min(root * root, 1e18)),
+                                                 static_cast<uint64_t>(4096)),
+                                        std::min(sample_limit, num_elements));
+  const uint64_t margin = initial_margin(sample_size);
+  stats->sample_size = sample_size;
+
+  auto start = utility::elapsed_time_sec();
+  std::vector<T> sample(sample_size);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (uint64_t i = 0; i < sample_size; ++i)
+    sample[i] = array[utility::counter_random(num_elements, i) % num_elements];
+  __gnu_parallel::sort(sample.begin(), sample.end(), comp);
+
+  std::vector<rank_search<T>> searches(ranks.size());
+  for (std::size_t k = 0; k < ranks.size(); ++k) {
+    searches[k].rank = ranks[k];
+    searches[k].sample = sample;
+    searches[k].span = num_elements;
+    searches[k].margin = margin;
+  }
+  stats->sample_time = utility::elapsed_time_sec(start);
+
+  while (std::any_of(searches.begin(), searches.end(), [](const rank_search<T> &s) { return !s.done; })) {
+    if (stats->num_passes == 64) {
+      std::cerr << "Selection did not converge in " << stats->num_passes << " passes" << std::endl;
+      std::abort();
+    }
+    start = utility::elapsed_time_sec();
+    for (auto &s : searches)
+      if (!s.done) choose_bracket(s, comp);
+    filter_pass(array, num_elements, searches, candidate_limit, comp);
+    ++stats->num_passes;
+    stats->bytes_scanned += num_elements * sizeof(T);
+    stats->pass_time += utility::elapsed_time_sec(start);
+
+    start = utility::elapsed_time_sec();
+    for (auto &s : searches) {
+      if (s.done) continue;
+      stats->max_candidates = std::max(stats->max_candidates, static_cast<uint64_t>(s.candidates.size()));
+      resolve(s, comp);
+      std::vector<T>().swap(s.candidates);
+    }
+    stats->select_time += utility::elapsed_time_sec(start);
+  }
+
+  std::vector<T> answers;
+  for (const auto &s : searches) answers.push_back(s.answer);
+  return answers;
+}
+
+/// \brief Returns the first k elements in the order defined by comp, sorted
+template <typename T, typename Compare>
+std::vector<T> select_top_k(const T *const array, const uint64_t num_elements, const uint64_t k,
+                            Compare comp, const selection_config &config, selection_stats *const stats) {
+  if (k == 0 || num_elements == 0) return std::vector<T>();
+  const uint64_t count = std::min(k, num_elements);
+  const T last = select_ranks(array, num_elements, std::vector<uint64_t>(1, count - 1), comp, config, stats)[0];
+
+  // Collect the elements before 'last' and the ones equal to it; keep the first 'count'
+  auto start = utility::elapsed_time_sec();
+  std::vector<T> before;
+  std::vector<T> equal;
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+  {
+    std::vector<T> local_before;
+    std::vector<T> local_equal;
+#ifdef _OPENMP
+#pragma omp for schedule(static) nowait
+#endif
+    for (uint64_t i = 0; i < num_elements; ++i) {
+      if (comp(array[i], last)) local_before.push_back(array[i]);
+      else if (!comp(last, array[i]) && local_equal.size() < count) local_equal.push_back(array[i]);
+    }
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+    {
+      before.insert(before.end(), local_before.begin(), local_before.end());
+      equal.insert(equal.end(), local_equal.begin(), local_equal.end());
+    }
+  }
+  ++stats->num_passes;
+  stats->bytes_scanned += num_elements * sizeof(T);
+  stats->pass_time += utility::elapsed_time_sec(start);
+
+  start = utility::elapsed_time_sec();
+  __gnu_parallel::sort(before.begin(), before.end(), comp);
+  equal.resize(count - before.size());
+  before.insert(before.end(), equal.begin(), equal.end());
+  stats->select_time += utility::elapsed_time_sec(start);
+  return before;
+}
+
+/// \brief Prints the passes and phase times of a selection
+inline void print_selection_stats(const selection_stats &stats) {
+  const double gb = 1ULL << 30;
+  std::cerr << "Selection: " << stats.sample_size << " samples, " << stats.num_passes << " passes, "
+            << stats.max_candidates << " candidates at most\n"
+            << "  Sampling took " << stats.sample_time << " seconds\n"
+            << "  Filter passes took " << stats.pass_time << " seconds\n"
+            << "  In-memory selection took " << stats.select_time << " seconds\n"
+            << "  Scanned (GB)\t" << stats.bytes_scanned / gb << std::endl;
+}
+
+} // namespace umapsort
+
+#endif //UMAPSORT_SELECTION_HPP
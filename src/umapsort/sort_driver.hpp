@@ -0,0 +1,297 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about the sort driver
+/// Reads the UMAPSORT_* environment variables and runs the selected sort
+/// algorithm on a mapped array. Shared by umapsort, umapjoin and umapgroupby.
+
+#ifndef UMAPSORT_SORT_DRIVER_HPP
+#define UMAPSORT_SORT_DRIVER_HPP
+
+#include <cstdlib>
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <parallel/algorithm>
+
+#include "../utility/commandline.hpp"
+#include "external_sort.hpp"
+#include "radix_sort.hpp"
+#include "indirect_sort.hpp"
+#include "sample_sort.hpp"
+#include "merge_sort.hpp"
+#include "selection.hpp"
+#include "record.hpp"
+#include "data_generator.hpp"
+
+namespace umapsort {
+
+enum class sort_mode {
+  quicksort,  // __gnu_parallel quicksort directly on the mapped region
+  external,   // external merge sort (run formation + k-way merge)
+  radix,      // MSD radix sort with write-combining scatters, LSD in DRAM
+  indirect,   // sort (key prefix, index) pairs in DRAM, then permute the records once
+  sample,     // partition into files by sampled splitters, then sort every partition in DRAM
+  merge,      // bottom-up merge sort in place, with rotation-based parallel merges
+  select      // no sort: find quantiles or the top-k with sampled brackets and a filter pass
+};
+
+const sort_mode all_sort_modes[] = {sort_mode::quicksort, sort_mode::external, sort_mode::radix, sort_mode::indirect,
+                                    sort_mode::sample, sort_mode::merge, sort_mode::select};
+
+inline const char *sort_mode_name(sort_mode mode) {
+  switch (mode) {
+    case sort_mode::quicksort: return "quicksort";
+    case sort_mode::external: return "external";
+    case sort_mode::radix: return "radix";
+    case sort_mode::indirect: return "indirect";
+    case sort_mode::sample: return "sample";
+    case sort_mode::merge: return "merge";
+    case sort_mode::select: return "select";
+  }
+  return "unknown";
+}
+
+struct sort_options {
+  sort_mode mode{sort_mode::quicksort};
+  std::string record{"u64"};
+  uint64_t memory_bytes{0};
+  int key_bits{64};
+  int digit_bits{8};
+  uint64_t num_partitions{0};
+  std::vector<double> quantiles{0.5};
+  uint64_t top_k{0};
+  std::vector<std::string> partition_dirs;
+  std::string tmp_file_name;
+  distribution_config data;
+  std::string order{"auto"};
+  std::string fingerprint_file_name;
+};
+
+inline void disp_sort_env_variables(const sort_options &sopts) {
+  std::cerr
+    << "Sort Configuration (environment variables):\n"
+    << " UMAPSORT_MODE                   - currently: " << sort_mode_name(sopts.mode)
+    << " (quicksort|external|radix|indirect|sample|merge|select)\n"
+    << " UMAPSORT_RECORD                 - currently: " << sopts.record << " (u64|kv16|gensort100)\n"
+    << " UMAPSORT_MEMORY                 - currently: " << sopts.memory_bytes << " bytes of DRAM for external/radix/sample/merge sort and select\n"
+    << " UMAPSORT_KEY_BITS               - currently: " << sopts.key_bits << " bits (radix sort)\n"
+    << " UMAPSORT_DIGIT_BITS             - currently: " << sopts.digit_bits << " bits (radix sort)\n"
+    << " UMAPSORT_PARTITIONS             - currently: " << sopts.num_partitions
+    << " (sample sort; 0: enough for every partition to fit in UMAPSORT_MEMORY)\n"
+    << " UMAPSORT_QUANTILES              - currently: ";
+  for (std::size_t i = 0; i < sopts.quantiles.size(); ++i)
+    std::cerr << (i ? "," : "") << sopts.quantiles[i];
+  std::cerr
+    << " (select; comma separated, in [0, 1])\n"
+    << " UMAPSORT_TOP_K                  - currently: " << sopts.top_k << " (select; finds the top-k instead of quantiles if not 0)\n"
+    << " UMAPSORT_DISTRIBUTION           - currently: " << distribution_name(sopts.data.kind)
+    << (sopts.data.param > 0.0 ? ":" + std::to_string(sopts.data.param) : std::string())
+    << " (descending|sorted|uniform|zipfian[:theta]|few_unique[:count]|nearly_sorted[:percent]|organ_pipe|sawtooth[:length])\n"
+    << " UMAPSORT_SEED                   - currently: " << sopts.data.seed << "\n"
+    << " UMAPSORT_ORDER                  - currently: " << sopts.order
+    << " (auto|ascending|descending; auto sorts descending if the first key is 1)\n"
+    << std::endl;
+}
+
+inline sort_options get_sort_options(const utility::umt_optstruct_t &options, uint64_t pagesize) {
+  sort_options sopts;
+
+  const char *buf = std::getenv("UMAPSORT_MODE");
+  if (buf != nullptr) {
+    const std::string mode(buf);
+    bool found = false;
+    for (const sort_mode m : all_sort_modes) {
+      if (mode == sort_mode_name(m)) {
+        sopts.mode = m;
+        found = true;
+      }
+    }
+    if (!found) {
+      std::cerr << "Unknown UMAPSORT_MODE: " << mode << std::endl;
+      exit(1);
+    }
+  }
+
+  buf = std::getenv("UMAPSORT_RECORD");
+  if (buf != nullptr)
+    sopts.record = buf;
+
+  // By default the external/radix/sample/merge sorts use as much DRAM as the umap buffer
+  sopts.memory_bytes = options.bufsize * pagesize;
+  buf = std::getenv("UMAPSORT_MEMORY");
+  if (buf != nullptr)
+    sopts.memory_bytes = std::stoull(buf);
+
+  buf = std::getenv("UMAPSORT_KEY_BITS");
+  if (buf != nullptr)
+    sopts.key_bits = std::stoi(buf);
+
+  buf = std::getenv("UMAPSORT_DIGIT_BITS");
+  if (buf != nullptr)
+    sopts.digit_bits = std::stoi(buf);
+
+  buf = std::getenv("UMAPSORT_PARTITIONS");
+  if (buf != nullptr)
+    sopts.num_partitions = std::stoull(buf);
+
+  buf = std::getenv("UMAPSORT_QUANTILES");
+  if (buf != nullptr) {
+    sopts.quantiles.clear();
+    std::stringstream list(buf);
+    std::string q;
+    while (std::getline(list, q, ',')) {
+      sopts.quantiles.push_back(std::stod(q));
+      if (sopts.quantiles.back() < 0.0 || sopts.quantiles.back() > 1.0) {
+        std::cerr << "Invalid UMAPSORT_QUANTILES: " << buf << std::endl;
+        exit(1);
+      }
+    }
+  }
+
+  buf = std::getenv("UMAPSORT_TOP_K");
+  if (buf != nullptr)
+    sopts.top_k = std::stoull(buf);
+
+  // Sample sort partitions go to the -d directories (comma separated), if given,
+  // or next to the data file
+  const std::string file_name(options.filename);
+  if (options.dirname_given) {
+    std::stringstream dirs(options.dirname);
+    std::string dir;
+    while (std::getline(dirs, dir, ','))
+      if (!dir.empty()) sopts.partition_dirs.push_back(dir);
+  }
+  if (sopts.partition_dirs.empty()) {
+    const std::size_t slash = file_name.rfind('/');
+    sopts.partition_dirs.push_back(slash == std::string::npos ? "." : file_name.substr(0, slash + 1));
+  }
+
+  buf = std::getenv("UMAPSORT_DISTRIBUTION");
+  if (buf != nullptr && !parse_distribution(buf, &sopts.data)) {
+    std::cerr << "Invalid UMAPSORT_DISTRIBUTION: " << buf << std::endl;
+    exit(1);
+  }
+
+  buf = std::getenv("UMAPSORT_SEED");
+  if (buf != nullptr)
+    sopts.data.seed = std::stoull(buf);
+
+  buf = std::getenv("UMAPSORT_ORDER");
+  if (buf != nullptr) {
+    sopts.order = buf;
+    if (sopts.order != "auto" && sopts.order != "ascending" && sopts.order != "descending") {
+      std::cerr << "Unknown UMAPSORT_ORDER: " << sopts.order << std::endl;
+      exit(1);
+    }
+  }
+
+  sopts.tmp_file_name = std::string(options.filename) + ".tmp";
+  sopts.fingerprint_file_name = std::string(options.filename) + ".fingerprint";
+
+  return sopts;
+}
+
+/// \brief Sorts a (mapped) array of records with the algorithm selected in the options
+/// \param descending Must agree with comp; used by the modes that do not take a comparator
+template <typename Record, typename Compare>
+void sort_region(Record *arr, uint64_t arraysize, Compare comp, bool descending,
+                 const sort_options &sopts, uint64_t pagesize) {
+  if (sopts.mode == sort_mode::external) {
+    external_sort_config config;
+    config.run_file_name = sopts.tmp_file_name;
+    config.memory_bytes = sopts.memory_bytes;
+    config.io_block_bytes = pagesize;
+
+    external_sort_stats stats;
+    if (!external_sort(arr, arraysize, comp, config, &stats)) {
+      std::cerr << "External sort failed" << std::endl;
+      exit(1);
+    }
+    print_external_sort_stats(stats);
+  }
+  else if (sopts.mode == sort_mode::radix) {
+    if (!record_traits<Record>::prefix_is_key) {
+      std::cerr << "Radix sort requires keys of at most 64 bits" << std::endl;
+      exit(1);
+    }
+    radix_sort_config config;
+    config.scratch_file_name = sopts.tmp_file_name;
+    config.memory_bytes = sopts.memory_bytes;
+    config.io_block_bytes = pagesize;
+    config.key_bits = sopts.key_bits;
+    config.digit_bits = sopts.digit_bits;
+    config.descending = descending;
+
+    radix_sort_stats stats;
+    if (!radix_sort(arr, arraysize, key_prefix_of<Record>(), config, &stats)) {
+      std::cerr << "Radix sort failed" << std::endl;
+      exit(1);
+    }
+    print_radix_sort_stats(stats);
+  }
+  else if (sopts.mode == sort_mode::sample) {
+    const std::size_t slash = sopts.tmp_file_name.rfind('/');
+    sample_sort_config config;
+    config.partition_dirs = sopts.partition_dirs;
+    config.partition_file_name = sopts.tmp_file_name.substr(slash == std::string::npos ? 0 : slash + 1);
+    config.overflow_file_name = sopts.tmp_file_name;
+    config.memory_bytes = sopts.memory_bytes;
+    config.io_block_bytes = pagesize;
+    config.num_partitions = sopts.num_partitions;
+
+    sample_sort_stats stats;
+    if (!sample_sort(arr, arraysize, comp, config, &stats)) {
+      std::cerr << "Sample sort failed" << std::endl;
+      exit(1);
+    }
+    print_sample_sort_stats(stats);
+  }
+  else if (sopts.mode == sort_mode::merge) {
+    merge_sort_config config;
+    config.memory_bytes = sopts.memory_bytes;
+
+    merge_sort_stats stats;
+    merge_sort(arr, arraysize, comp, config, &stats);
+    print_merge_sort_stats(stats);
+  }
+  else if (sopts.mode == sort_mode::indirect) {
+    indirect_sort_stats stats;
+    indirect_sort(arr, arraysize, descending, &stats);
+    print_indirect_sort_stats(stats);
+  }
+  else if (sopts.mode == sort_mode::select) {
+    std::cerr << "The select mode does not sort" << std::endl;
+    exit(1);
+  }
+  else {
+    __gnu_parallel::sort(arr, &arr[arraysize], comp, __gnu_parallel::quicksort_tag());
+  }
+}
+
+/// \brief Sorts a (mapped) array of records by key
+template <typename Record>
+void sort_records(Record *arr, uint64_t arraysize, bool descending, const sort_options &sopts, uint64_t pagesize) {
+  if (descending)
+    sort_region(arr, arraysize, key_greater<Record>(), true, sopts, pagesize);
+  else
+    sort_region(arr, arraysize, key_less<Record>(), false, sopts, pagesize);
+}
+
+} // namespace umapsort
+
+#endif //UMAPSORT_SORT_DRIVER_HPP
@@ -0,0 +1,132 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef UMAPSORT_SORT_IO_HPP
+#define UMAPSORT_SORT_IO_HPP
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif // _GNU_SOURCE
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace umapsort {
+namespace io {
+
+inline bool read_fully(const int fd, void *const buf, const std::size_t size, const off_t offset) {
+  std::size_t done = 0;
+  while (done < size) {
+    const ssize_t ret = ::pread(fd, static_cast<char *>(buf) + done, size - done, offset + done);
+    if (ret <= 0) {
+      ::perror("pread");
+      return false;
+    }
+    done += ret;
+  }
+  return true;
+}
+
+inline bool write_fully(const int fd, const void *const buf, const std::size_t size, const off_t offset) {
+  std::size_t done = 0;
+  while (done < size) {
+    const ssize_t ret = ::pwrite(fd, static_cast<const char *>(buf) + done, size - done, offset + done);
+    if (ret <= 0) {
+      ::perror("pwrite");
+      return false;
+    }
+    done += ret;
+  }
+  return true;
+}
+
+/// \brief Writes back and drops the given file range from the page cache
+/// so that temporary files do not act as a hidden cache
+inline void drop_from_page_cache(const int fd, const off_t offset, const std::size_t size, const bool dirty) {
+  if (dirty)
+    ::sync_file_range(fd, offset, size,
+                      SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+  ::posix_fadvise(fd, offset, size, POSIX_FADV_DONTNEED);
+}
+
+/// \brief Copies a range between DRAM and the mapped array using all threads
+/// so that page faults on the mapped side are served in parallel
+template <typename T>
+void parallel_copy(const T *const src, const uint64_t num_elements, T *const dst) {
+  const uint64_t chunk = 1ULL << 16;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (uint64_t i = 0; i < num_elements; i += chunk) {
+    std::memcpy(dst + i, src + i, std::min(chunk, num_elements - i) * sizeof(T));
+  }
+}
+
+/// \brief An array that lives either in a (mapped) region or in a file accessed with pread/pwrite
+/// Lets multi-pass algorithms ping-pong between the mapped array and a scratch file
+/// with the same code.
+template <typename T>
+class storage_view {
+ public:
+  explicit storage_view(T *const array) : m_array(array), m_fd(-1) {}
+  explicit storage_view(const int fd) : m_array(nullptr), m_fd(fd) {}
+
+  bool is_file() const {
+    return m_array == nullptr;
+  }
+
+  void read(const uint64_t first, const uint64_t count, T *const buf) const {
+    if (count == 0) return;
+    if (m_array) {
+      std::memcpy(buf, m_array + first, count * sizeof(T));
+    } else {
+      if (!read_fully(m_fd, buf, count * sizeof(T), first * sizeof(T))) std::abort();
+      drop_from_page_cache(m_fd, first * sizeof(T), count * sizeof(T), false);
+    }
+  }
+
+  void write(const uint64_t first, const uint64_t count, const T *const buf) const {
+    if (count == 0) return;
+    if (m_array) {
+      std::memcpy(m_array + first, buf, count * sizeof(T));
+    } else {
+      if (!write_fully(m_fd, buf, count * sizeof(T), first * sizeof(T))) std::abort();
+    }
+  }
+
+  /// \brief Writes back and drops the dirty pages of a scratch file
+  void sync(const uint64_t first, const uint64_t count) const {
+    if (m_array == nullptr) drop_from_page_cache(m_fd, first * sizeof(T), count * sizeof(T), true);
+  }
+
+ private:
+  T *m_array;
+  int m_fd;
+};
+
+} // namespace io
+} // namespace umapsort
+
+#endif //UMAPSORT_SORT_IO_HPP
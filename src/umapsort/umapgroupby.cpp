@@ -0,0 +1,180 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2019 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+
+// Sort-based group-by of a mapped key/value table:
+// the table is sorted with the umapsort engine, then aggregated in parallel
+// (count, sum, min and max of the values of every key) into a mapped output file.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif // _GNU_SOURCE
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#include "umap/umap.h"
+#include "../utility/commandline.hpp"
+#include "../utility/umap_file.hpp"
+#include "../utility/time.hpp"
+#include "../utility/phase.hpp"
+#include "sort_driver.hpp"
+#include "relational.hpp"
+
+using namespace std;
+
+uint64_t get_num_keys(uint64_t num_records) {
+  // By default every group has 16 records on average
+  uint64_t num_keys = std::max(num_records / 16, (uint64_t)1);
+  const char *buf = std::getenv("UMAPGROUPBY_KEYS");
+  if (buf != nullptr)
+    num_keys = std::max(std::stoull(buf), 1ULL);
+
+  std::cerr
+    << "Group-by Configuration (environment variables):\n"
+    << " UMAPGROUPBY_KEYS                - currently: " << num_keys << " distinct keys\n"
+    << std::endl;
+  return num_keys;
+}
+
+/// \brief Aggregates a sorted table with one thread per key range
+/// \param out Receives the groups in key order, or nullptr to count the groups
+/// \param counts The groups of every thread (input if out is not nullptr)
+umapsort::operator_result parallel_group_by(const umapsort::kv_record *table, uint64_t num_records,
+                                            umapsort::group_record *out, std::vector<uint64_t> *counts) {
+  const int num_threads = omp_get_max_threads();
+  const std::vector<uint64_t> bounds = umapsort::key_aligned_bounds(table, num_records, num_threads);
+
+  std::vector<uint64_t> offsets(num_threads + 1, 0);
+  if (out != nullptr) {
+    for (int t = 0; t < num_threads; ++t)
+      offsets[t + 1] = offsets[t] + (*counts)[t];
+  }
+  counts->assign(num_threads, 0);
+
+  uint64_t total = 0;
+  uint64_t checksum = 0;
+#pragma omp parallel for schedule(static, 1) reduction(+:total) reduction(+:checksum)
+  for (int t = 0; t < num_threads; ++t) {
+    const umapsort::operator_result r = umapsort::group_by(table, bounds[t], bounds[t + 1],
+                                                           out ? out + offsets[t] : nullptr);
+    (*counts)[t] = r.count;
+    total += r.count;
+    checksum += r.checksum;
+  }
+
+  umapsort::operator_result result;
+  result.count = total;
+  result.checksum = checksum;
+  return result;
+}
+
+/// \brief Checks that the groups are in key order and add up to the table
+void validate_groups(const umapsort::group_record *out, uint64_t num_groups,
+                     const umapsort::kv_record *table, uint64_t num_records) {
+  uint64_t table_sum = 0;
+#pragma omp parallel for reduction(+:table_sum)
+  for (uint64_t i = 0; i < num_records; ++i)
+    table_sum += table[i].value;
+
+  uint64_t count = 0;
+  uint64_t sum = 0;
+  uint64_t bad = 0;
+#pragma omp parallel for reduction(+:count) reduction(+:sum) reduction(+:bad)
+  for (uint64_t i = 0; i < num_groups; ++i) {
+    count += out[i].count;
+    sum += out[i].sum;
+    if ((i > 0 && out[i].key <= out[i - 1].key) || out[i].count == 0 || out[i].min > out[i].max)
+      ++bad;
+  }
+
+  if (count != num_records || sum != table_sum || bad != 0) {
+    fprintf(stderr, "Group-by validation failed: %lu records (expected %lu), sum %lu (expected %lu), %lu bad groups\n",
+        count, num_records, sum, table_sum, bad);
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  utility::umt_optstruct_t options;
+  umt_getoptions(&options, argc, argv);
+
+  const uint64_t pagesize = (uint64_t)utility::get_umap_page_size();
+  omp_set_num_threads(options.numthreads);
+
+  const umapsort::sort_options sopts = umapsort::get_sort_options(options, pagesize);
+  umapsort::disp_sort_env_variables(sopts);
+
+  const std::string base_name(options.filename);
+  const uint64_t table_bytes = options.numpages * pagesize;
+  const uint64_t num_records = table_bytes / sizeof(umapsort::kv_record);
+  const uint64_t num_keys = get_num_keys(num_records);
+
+  utility::phase_recorder phases("umapgroupby");
+  phases.set_attribute("mode", umapsort::sort_mode_name(sopts.mode));
+  phases.set_attribute("distribution", umapsort::distribution_name(sopts.data.kind));
+  phases.set_attribute("threads", options.numthreads);
+  phases.set_attribute("pages", options.numpages);
+  phases.set_attribute("pagesize", pagesize);
+  phases.set_attribute("memory", sopts.memory_bytes);
+  phases.set_attribute("usemmap", options.usemmap);
+
+  phases.begin("umap INIT");
+  auto table = (umapsort::kv_record *)utility::map_in_file(base_name, options.initonly,
+      options.noinit, options.usemmap, table_bytes);
+  if (table == nullptr)
+    return -1;
+  phases.end();
+  fprintf(stderr, "Group-by: %lu records, %lu threads\n", num_records, options.numthreads);
+
+  if ( !options.noinit ) {
+    phases.begin("Init");
+    umapsort::init_table(table, num_records, sopts.data, num_keys, ~sopts.data.seed);
+    phases.end();
+  }
+
+  if ( !options.initonly ) {
+    phases.begin("Sort", table_bytes);
+    umapsort::sort_records(table, num_records, false, sopts, pagesize);
+    phases.end();
+
+    phases.begin("Group count");
+    std::vector<uint64_t> counts;
+    const umapsort::operator_result expected = parallel_group_by(table, num_records, nullptr, &counts);
+    phases.end();
+    fprintf(stderr, "Group-by produces %lu groups\n", expected.count);
+
+    // The output file is a whole number of pages; records past the groups are zero
+    const uint64_t out_bytes = std::max((expected.count * sizeof(umapsort::group_record) + pagesize - 1) / pagesize,
+                                        (uint64_t)1) * pagesize;
+    auto out = (umapsort::group_record *)utility::map_in_file(base_name + ".out", false, false,
+        options.usemmap, out_bytes);
+    if (out == nullptr)
+      return -1;
+
+    phases.begin("Group write");
+    parallel_group_by(table, num_records, out, &counts);
+    phases.end();
+
+    phases.begin("Validate");
+    validate_groups(out, expected.count, table, num_records);
+    phases.end();
+
+    phases.begin("Output flush");
+    utility::unmap_file(options.usemmap, out_bytes, out);
+    phases.end();
+  }
+
+  phases.begin("umap TERM");
+  utility::unmap_file(options.usemmap, table_bytes, table);
+  phases.finish();
+
+  return 0;
+}
@@ -0,0 +1,243 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2019 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+
+// Sort-merge join of two mapped key/value tables:
+// both tables are sorted with the umapsort engine, then joined in parallel
+// (key ranges across threads) into a mapped output file.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif // _GNU_SOURCE
+
+#include <iostream>
+#include <string>
+#include <algorithm>
+#include <vector>
+
+#include <omp.h>
+
+#include "umap/umap.h"
+#include "../utility/commandline.hpp"
+#include "../utility/umap_file.hpp"
+#include "../utility/time.hpp"
+#include "../utility/phase.hpp"
+#include "sort_driver.hpp"
+#include "relational.hpp"
+
+using namespace std;
+
+struct join_options {
+  uint64_t right_pages;
+  uint64_t num_keys;
+};
+
+void disp_join_env_variables(const join_options &jopts) {
+  std::cerr
+    << "Join Configuration (environment variables):\n"
+    << " UMAPJOIN_RIGHT_PAGES            - currently: " << jopts.right_pages << " pages in the right table\n"
+    << " UMAPJOIN_KEYS                   - currently: " << jopts.num_keys << " distinct keys\n"
+    << std::endl;
+}
+
+join_options get_join_options(const utility::umt_optstruct_t &options, uint64_t pagesize) {
+  join_options jopts;
+
+  jopts.right_pages = options.numpages;
+  const char *buf = std::getenv("UMAPJOIN_RIGHT_PAGES");
+  if (buf != nullptr)
+    jopts.right_pages = std::stoull(buf);
+
+  // By default every left key matches one right record on average
+  jopts.num_keys = options.numpages * pagesize / sizeof(umapsort::kv_record);
+  buf = std::getenv("UMAPJOIN_KEYS");
+  if (buf != nullptr)
+    jopts.num_keys = std::stoull(buf);
+  if (jopts.num_keys == 0)
+    jopts.num_keys = 1;
+
+  return jopts;
+}
+
+/// \brief Joins two sorted tables with one thread per key range
+/// \param out Receives the join in key order, or nullptr to count the output records
+/// \param counts The output records of every thread (input if out is not nullptr)
+umapsort::operator_result parallel_join(const umapsort::kv_record *left, uint64_t num_left,
+                                        const umapsort::kv_record *right, uint64_t num_right,
+                                        umapsort::join_record *out, std::vector<uint64_t> *counts) {
+  const int num_threads = omp_get_max_threads();
+  const std::vector<uint64_t> left_bounds = umapsort::key_aligned_bounds(left, num_left, num_threads);
+  std::vector<uint64_t> right_bounds(num_threads + 1, num_right);
+  right_bounds[0] = 0;
+  for (int t = 1; t < num_threads; ++t) {
+    if (left_bounds[t] < num_left)
+      right_bounds[t] = umapsort::table_lower_bound(right, num_right, left[left_bounds[t]].key);
+  }
+
+  std::vector<uint64_t> offsets(num_threads + 1, 0);
+  if (out != nullptr) {
+    for (int t = 0; t < num_threads; ++t)
+      offsets[t + 1] = offsets[t] + (*counts)[t];
+  }
+  counts->assign(num_threads, 0);
+
+  uint64_t total = 0;
+  uint64_t checksum = 0;
+#pragma omp parallel for schedule(static, 1) reduction(+:total) reduction(+:checksum)
+  for (int t = 0; t < num_threads; ++t) {
+    const umapsort::operator_result r = umapsort::merge_join(
+        left, left_bounds[t], left_bounds[t + 1], right, right_bounds[t], right_bounds[t + 1],
+        out ? out + offsets[t] : nullptr);
+    (*counts)[t] = r.count;
+    total += r.count;
+    checksum += r.checksum;
+  }
+
+  umapsort::operator_result result;
+  result.count = total;
+  result.checksum = checksum;
+  return result;
+}
+
+/// \brief Counts and sums the join of two sorted tables serially, in one pass over both, without the merge join
+/// Memory does not grow with the tables; exits if a table is out of order.
+umapsort::operator_result reference_join(const umapsort::kv_record *left, uint64_t num_left,
+                                         const umapsort::kv_record *right, uint64_t num_right) {
+  umapsort::operator_result result;
+  uint64_t i = 0;
+  uint64_t j = 0;
+  while (i < num_left && j < num_right) {
+    const uint64_t key = std::min(left[i].key, right[j].key);
+    // Number of records and sum of their values of the key in every table
+    uint64_t left_count = 0, left_sum = 0;
+    for (; i < num_left && left[i].key == key; ++i, ++left_count) left_sum += left[i].value;
+    uint64_t right_count = 0, right_sum = 0;
+    for (; j < num_right && right[j].key == key; ++j, ++right_count) right_sum += right[j].value;
+
+    if ((i < num_left && left[i].key < key) || (j < num_right && right[j].key < key)) {
+      fprintf(stderr, "Join validation failed: the tables are not sorted at records %lu and %lu\n", i, j);
+      exit(1);
+    }
+
+    // Every left record of the key matches every right record of the key
+    result.count += left_count * right_count;
+    result.checksum += left_count * right_count * key + left_sum * right_count + right_sum * left_count;
+  }
+  return result;
+}
+
+/// \brief Checks that the output is in key order and holds the matches of the reference
+void validate_join(const umapsort::join_record *out, uint64_t count, const umapsort::operator_result &expected) {
+  uint64_t checksum = 0;
+  uint64_t unsorted = 0;
+#pragma omp parallel for reduction(+:checksum) reduction(+:unsorted)
+  for (uint64_t i = 0; i < count; ++i) {
+    checksum += out[i].key + out[i].left_value + out[i].right_value;
+    if (i > 0 && out[i].key < out[i - 1].key)
+      ++unsorted;
+  }
+
+  if (count != expected.count || checksum != expected.checksum || unsorted != 0) {
+    fprintf(stderr, "Join validation failed: %lu records (expected %lu), checksum %lu (expected %lu), %lu out of order\n",
+        count, expected.count, checksum, expected.checksum, unsorted);
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  utility::umt_optstruct_t options;
+  umt_getoptions(&options, argc, argv);
+
+  const uint64_t pagesize = (uint64_t)utility::get_umap_page_size();
+  omp_set_num_threads(options.numthreads);
+
+  const umapsort::sort_options sopts = umapsort::get_sort_options(options, pagesize);
+  const join_options jopts = get_join_options(options, pagesize);
+  umapsort::disp_sort_env_variables(sopts);
+  disp_join_env_variables(jopts);
+
+  const std::string base_name(options.filename);
+  const uint64_t left_bytes = options.numpages * pagesize;
+  const uint64_t right_bytes = jopts.right_pages * pagesize;
+
+  utility::phase_recorder phases("umapjoin");
+  phases.set_attribute("mode", umapsort::sort_mode_name(sopts.mode));
+  phases.set_attribute("distribution", umapsort::distribution_name(sopts.data.kind));
+  phases.set_attribute("threads", options.numthreads);
+  phases.set_attribute("pages", options.numpages);
+  phases.set_attribute("pagesize", pagesize);
+  phases.set_attribute("memory", sopts.memory_bytes);
+  phases.set_attribute("usemmap", options.usemmap);
+
+  phases.begin("umap INIT");
+  auto left = (umapsort::kv_record *)utility::map_in_file(base_name + ".left", options.initonly,
+      options.noinit, options.usemmap, left_bytes);
+  auto right = (umapsort::kv_record *)utility::map_in_file(base_name + ".right", options.initonly,
+      options.noinit, options.usemmap, right_bytes);
+  if (left == nullptr || right == nullptr)
+    return -1;
+  phases.end();
+
+  const uint64_t num_left = left_bytes / sizeof(umapsort::kv_record);
+  const uint64_t num_right = right_bytes / sizeof(umapsort::kv_record);
+  fprintf(stderr, "Join: %lu x %lu records, %lu threads\n", num_left, num_right, options.numthreads);
+
+  if ( !options.noinit ) {
+    phases.begin("Init");
+    // Both tables draw their keys from the same distribution; only their values differ
+    umapsort::init_table(left, num_left, sopts.data, jopts.num_keys, ~sopts.data.seed);
+    umapsort::init_table(right, num_right, sopts.data, jopts.num_keys, ~(sopts.data.seed + 1));
+    phases.end();
+  }
+
+  if ( !options.initonly ) {
+    umapsort::sort_options table_sopts = sopts;
+
+    phases.begin("Sort left", left_bytes);
+    table_sopts.tmp_file_name = base_name + ".left.tmp";
+    umapsort::sort_records(left, num_left, false, table_sopts, pagesize);
+    phases.end();
+
+    phases.begin("Sort right", right_bytes);
+    table_sopts.tmp_file_name = base_name + ".right.tmp";
+    umapsort::sort_records(right, num_right, false, table_sopts, pagesize);
+    phases.end();
+
+    phases.begin("Join count");
+    std::vector<uint64_t> counts;
+    const umapsort::operator_result joined = parallel_join(left, num_left, right, num_right, nullptr, &counts);
+    phases.end();
+    fprintf(stderr, "Join produces %lu records\n", joined.count);
+
+    // The output file is a whole number of pages; records past the join are zero
+    const uint64_t out_bytes = std::max((joined.count * sizeof(umapsort::join_record) + pagesize - 1) / pagesize,
+                                        (uint64_t)1) * pagesize;
+    auto out = (umapsort::join_record *)utility::map_in_file(base_name + ".out", false, false,
+        options.usemmap, out_bytes);
+    if (out == nullptr)
+      return -1;
+
+    phases.begin("Join write");
+    parallel_join(left, num_left, right, num_right, out, &counts);
+    phases.end();
+
+    phases.begin("Validate");
+    validate_join(out, joined.count, reference_join(left, num_left, right, num_right));
+    phases.end();
+
+    phases.begin("Output flush");
+    utility::unmap_file(options.usemmap, out_bytes, out);
+    phases.end();
+  }
+
+  phases.begin("umap TERM");
+  utility::unmap_file(options.usemmap, left_bytes, left);
+  utility::unmap_file(options.usemmap, right_bytes, right);
+  phases.finish();
+
+  return 0;
+}
@@ -15,6 +15,7 @@
 #include <random>
 #include <string>
 #include <vector>
+#include <functional>
 #include <parallel/algorithm>
 
 #include <sys/types.h>
@@ -27,70 +28,204 @@
 #include "../utility/commandline.hpp"
 #include "../utility/umap_file.hpp"
 #include "../utility/time.hpp"
+#include "../utility/mmap.hpp"
+#include "../utility/phase.hpp"
+#include "../utility/memory_pressure.hpp"
+#include "../utility/metrics.hpp"
+#include "../utility/cache_control.hpp"
+#include "sort_driver.hpp"
 
 using namespace std;
 
 bool sort_ascending = true;
 
-void initdata(uint64_t *region, uint64_t rlen) {
-  fprintf(stderr, "initdata: %p, from %lu to %lu\n", region, (rlen), (rlen - rlen));
-#pragma omp parallel for
-  for(uint64_t i=0; i < rlen; ++i)
-    region[i] = (uint64_t) (rlen - i);
+template <typename Record>
+uint64_t key_of(const Record &r) {
+  return umapsort::record_traits<Record>::key_prefix(r);
 }
 
-void print_context(uint64_t i, uint64_t* region, uint64_t rlen) {
+template <typename Record>
+umapsort::fingerprint initdata(Record *region, uint64_t rlen, const umapsort::distribution_config &data) {
+  fprintf(stderr, "initdata: %p, %lu records, %s distribution, seed %lu\n",
+      region, rlen, umapsort::distribution_name(data.kind), data.seed);
+  return umapsort::generate_data(region, rlen, data);
+}
+
+template <typename Record>
+void print_context(uint64_t i, Record* region, uint64_t rlen) {
   fprintf(stderr,
-      "Worker %d found an error at index %lu, %lu != lt %lu!\n",
-      omp_get_thread_num(), i, region[i], i+1);
+      "Found an error at index %lu, %lu is out of order after %lu\n",
+      i, key_of(region[i]), key_of(region[i-1]));
 
   fprintf(stderr, "\tContext ");
   if (i < 3) {
-    for (int j=0; j < 7; j++)
-      fprintf(stderr, "%lu ", region[j]);
+    for (uint64_t j=0; j < 7 && j < rlen; j++)
+      fprintf(stderr, "%lu ", key_of(region[j]));
 
   }
   else if (i > (rlen-4)) {
     for (uint64_t j=rlen-8; j < rlen; j++)
-      fprintf(stderr, "%lu ", region[j]);
+      fprintf(stderr, "%lu ", key_of(region[j]));
     fprintf(stderr, "\n");
   }
   else {
     fprintf(stderr,
       "i-3 i-2 i-1 i i+1 i+2 i+3:%lu %lu %lu %lu %lu %lu %lu",
-        region[i-3], region[i-2], region[i-1], region[i]
-      , region[i+1], region[i+2], region[i+3]);
+        key_of(region[i-3]), key_of(region[i-2]), key_of(region[i-1]), key_of(region[i])
+      , key_of(region[i+1]), key_of(region[i+2]), key_of(region[i+3]));
   }
   fprintf(stderr, "\n");
   exit(1);
 }
 
-void validatedata(uint64_t *region, uint64_t rlen) {
-  bool failed = false;
-
-  if (sort_ascending == true) {
-#pragma omp parallel for private(failed)
-    for(uint64_t i = 0; i < rlen; ++i) {
-      if ( !failed && region[i] != (i+1) ) {
-#pragma omp critical
-        {
-          failed = true;
-          print_context(i, region, rlen);
-        }
+/// \brief Checks that the region is sorted and holds the records written by initdata
+/// \param expected The fingerprint of the initial data, or nullptr if unknown
+template <typename Record>
+void validatedata(Record *region, uint64_t rlen, const umapsort::fingerprint *expected) {
+  umapsort::fingerprint fp;
+  const uint64_t first_unsorted = sort_ascending
+    ? umapsort::scan_sorted_data(region, rlen, umapsort::key_less<Record>(), &fp)
+    : umapsort::scan_sorted_data(region, rlen, umapsort::key_greater<Record>(), &fp);
+
+  if (first_unsorted < rlen)
+    print_context(first_unsorted, region, rlen);
+
+  if (expected == nullptr) {
+    fprintf(stderr, "Initial data fingerprint not found, only checked the order\n");
+  }
+  else if (fp != *expected) {
+    fprintf(stderr, "Sorted data do not match the initial data: fingerprint %lu/%lu/%lu, expected %lu/%lu/%lu\n",
+        fp.count, fp.sum, fp.xor_sum, expected->count, expected->sum, expected->xor_sum);
+    exit(1);
+  }
+}
+
+/// \brief Finds the requested quantiles or top-k in sort order and checks their ranks
+template <typename Record, typename Compare>
+void select_region(Record *arr, uint64_t arraysize, Compare comp, const umapsort::sort_options &sopts,
+                   utility::phase_recorder &phases) {
+  umapsort::selection_config config;
+  config.memory_bytes = sopts.memory_bytes;
+  umapsort::selection_stats stats;
+
+  std::vector<uint64_t> ranks;
+  std::vector<Record> answers;
+  phases.begin("Select", arraysize * sizeof(Record));
+  utility::metrics &metrics = phases.metrics();
+  metrics.add(metrics.counter("records selected from"), arraysize);
+  if (sopts.top_k > 0) {
+    answers = umapsort::select_top_k(arr, arraysize, sopts.top_k, comp, config, &stats);
+    fprintf(stderr, "Top %lu:", answers.size());
+    for (uint64_t i = 0; i < answers.size() && i < 10; ++i)
+      fprintf(stderr, " %lu", key_of(answers[i]));
+    fprintf(stderr, "%s\n", answers.size() > 10 ? " ..." : "");
+    // The last one has rank k-1; the others must not be ordered after it
+    for (uint64_t i = 1; i < answers.size(); ++i) {
+      if (comp(answers[i], answers[i-1])) {
+        fprintf(stderr, "Top-k is not sorted at %lu\n", i);
+        exit(1);
       }
     }
+    ranks.push_back(answers.size() - 1);
+    answers.erase(answers.begin(), answers.end() - 1);
   }
   else {
-#pragma omp parallel for private(failed)
-    for(uint64_t i = 0; i < rlen; ++i) {
-      if ( !failed && region[i] != (rlen - i) ) {
-#pragma omp critical
-        {
-          failed = true;
-          print_context(i, region, rlen);
-        }
-      }
+    for (const double q : sopts.quantiles)
+      ranks.push_back((uint64_t)(q * (arraysize - 1)));
+    answers = umapsort::select_ranks(arr, arraysize, ranks, comp, config, &stats);
+    for (std::size_t i = 0; i < ranks.size(); ++i)
+      fprintf(stderr, "Quantile %f (rank %lu): %lu\n", sopts.quantiles[i], ranks[i], key_of(answers[i]));
+  }
+  const double select_time = phases.end().wall_sec;
+  fprintf(stderr, "Select: %f M records/sec\n", arraysize / select_time / 1e6);
+  umapsort::print_selection_stats(stats);
+
+  // An element has rank r if fewer than r+1 elements are before it and more than r are not after it
+  phases.begin("Validate");
+  for (std::size_t k = 0; k < ranks.size(); ++k) {
+    uint64_t before = 0;
+    uint64_t not_after = 0;
+#pragma omp parallel for reduction(+:before) reduction(+:not_after)
+    for (uint64_t i = 0; i < arraysize; ++i) {
+      if (comp(arr[i], answers[k])) ++before;
+      if (!comp(answers[k], arr[i])) ++not_after;
+    }
+    if (before > ranks[k] || not_after <= ranks[k]) {
+      fprintf(stderr, "Rank %lu is wrong: %lu records before, %lu not after %lu\n",
+          ranks[k], before, not_after, key_of(answers[k]));
+      exit(1);
+    }
+  }
+  phases.end();
+}
+
+/// \brief Initializes, sorts and validates the mapped region as an array of records
+/// \param set_cache_state Called between the initialization and the sort (--cold/--warm)
+template <typename Record>
+void run(void *region, uint64_t totalbytes, const utility::umt_optstruct_t &options,
+         const umapsort::sort_options &sopts, uint64_t pagesize, utility::phase_recorder &phases,
+         const std::function<void()> &set_cache_state) {
+  Record *arr = (Record *) region;
+  const uint64_t arraysize = totalbytes/sizeof(Record);
+
+  fprintf(stderr, "%lu %lu-byte records (%s)\n", arraysize, sizeof(Record),
+      umapsort::record_traits<Record>::name());
+
+  umapsort::fingerprint initial;
+  bool have_fingerprint = false;
+
+  if ( !options.noinit ) {
+    // init data
+    phases.begin("INIT", totalbytes);
+    initial = initdata(arr, arraysize, sopts.data);
+    have_fingerprint = true;
+    phases.end();
+    if (!umapsort::save_fingerprint(sopts.fingerprint_file_name, initial))
+      fprintf(stderr, "Failed to write %s\n", sopts.fingerprint_file_name.c_str());
+  }
+  else {
+    have_fingerprint = umapsort::load_fingerprint(sopts.fingerprint_file_name, &initial);
+  }
+
+  if ( !options.initonly )
+    set_cache_state();
+
+  if ( !options.initonly && sopts.mode == umapsort::sort_mode::select ) {
+    if (sopts.order == "descending")
+      select_region(arr, arraysize, umapsort::key_greater<Record>(), sopts, phases);
+    else
+      select_region(arr, arraysize, umapsort::key_less<Record>(), sopts, phases);
+  }
+  else if ( !options.initonly )
+  {
+    phases.begin("Sort", totalbytes);
+    // The algorithm is a phase of its own under Sort, so that reports of several modes line up
+    utility::metrics &metrics = phases.metrics();
+    metrics.begin(umapsort::sort_mode_name(sopts.mode));
+    metrics.add(metrics.counter("records sorted"), arraysize);
+    if (sopts.order == "auto")
+      sort_ascending = (key_of(arr[0]) != 1);
+    else
+      sort_ascending = (sopts.order == "ascending");
+
+    if (sort_ascending == true) {
+      printf("Sorting in Ascending Order\n");
+      umapsort::sort_records(arr, arraysize, false, sopts, pagesize);
+    }
+    else {
+      printf("Sorting in Descending Order\n");
+      umapsort::sort_records(arr, arraysize, true, sopts, pagesize);
     }
+
+    metrics.end();
+    const double sort_time = phases.end().wall_sec;
+    fprintf(stderr, "Sort (%s): %f M records/sec, %f MB/sec\n",
+        umapsort::sort_mode_name(sopts.mode), arraysize / sort_time / 1e6,
+        arraysize * sizeof(Record) / sort_time / 1e6);
+
+    phases.begin("Validate", totalbytes);
+    validatedata(arr, arraysize, have_fingerprint ? &initial : nullptr);
+    phases.end();
   }
 }
 
@@ -99,13 +234,13 @@ int main(int argc, char **argv)
   utility::umt_optstruct_t options;
   uint64_t pagesize;
   uint64_t totalbytes;
-  uint64_t arraysize;
   std::vector<void*> mappings;
   std::vector<std::string> filenames;
   std::vector<uint64_t> mapsize;
   void* range;
 
-  auto start = utility::elapsed_time_sec();
+  // Held until the end of the run
+  const auto pressure = utility::memory_pressure_from_env();
 
   umt_getoptions(&options, argc, argv);
 
@@ -113,6 +248,9 @@ int main(int argc, char **argv)
 
   omp_set_num_threads(options.numthreads);
 
+  utility::phase_recorder phases("umapsort");
+  phases.begin("umap INIT");
+
   totalbytes = options.numpages*pagesize;
   range = utility::map_in_file(options.filename, options.initonly, options.noinit, options.usemmap, totalbytes);
   if (range == nullptr)
@@ -151,41 +289,60 @@ int main(int argc, char **argv)
     mapsize.push_back(totalbytes);
   }
 
-  fprintf(stderr, "umap INIT took %f seconds\n", utility::elapsed_time_sec(start));
+  phases.end();
   fprintf(stderr, "%lu pages, %lu bytes, %lu threads\n", options.numpages, totalbytes, options.numthreads);
 
-  uint64_t *arr = (uint64_t *) mappings[0];
-  arraysize = totalbytes/sizeof(uint64_t);
-
-  start = utility::elapsed_time_sec();
-  if ( !options.noinit ) {
-    // init data
-    initdata(arr, arraysize);
-    fprintf(stderr, "INIT took %f seconds\n", utility::elapsed_time_sec(start));
-  }
-
-  if ( !options.initonly )
-  {
-    start = utility::elapsed_time_sec();
-    sort_ascending = (arr[0] != 1);
-
-    if (sort_ascending == true) {
-      printf("Sorting in Ascending Order\n");
-      __gnu_parallel::sort(arr, &arr[arraysize], std::less<uint64_t>(), __gnu_parallel::quicksort_tag());
-    }
-    else {
-      printf("Sorting in Descending Order\n");
-      __gnu_parallel::sort(arr, &arr[arraysize], std::greater<uint64_t>(), __gnu_parallel::quicksort_tag());
+  const umapsort::sort_options sopts = umapsort::get_sort_options(options, pagesize);
+  umapsort::disp_sort_env_variables(sopts);
+
+  phases.set_attribute("mode", umapsort::sort_mode_name(sopts.mode));
+  phases.set_attribute("record", sopts.record);
+  phases.set_attribute("distribution", umapsort::distribution_name(sopts.data.kind));
+  phases.set_attribute("threads", options.numthreads);
+  phases.set_attribute("pages", options.numpages);
+  phases.set_attribute("pagesize", pagesize);
+  phases.set_attribute("memory", sopts.memory_bytes);
+  phases.set_attribute("usemmap", options.usemmap);
+  if (pressure) phases.set_attribute("memory_pressure", utility::pressure_backend_name(pressure->backend()));
+
+  const utility::cache_mode cache = options.cold ? utility::cache_mode::cold
+                                  : (options.warm ? utility::cache_mode::warm : utility::cache_mode::as_is);
+  phases.set_attribute("cache", utility::cache_mode_name(cache));
+  if (filenames.empty()) filenames.push_back(options.filename);
+  auto set_cache_state = [&]() {
+    if (cache == utility::cache_mode::as_is) return;
+    if (cache == utility::cache_mode::cold) {
+      phases.begin("Evict");
+      for (std::size_t i = 0; i < mappings.size(); ++i) {
+        if (utility::evict_mapped_file(filenames[i], options.usemmap, mapsize[i], mappings[i]) == nullptr) {
+          std::cerr << "Failed to map " << filenames[i] << " again" << std::endl;
+          std::exit(1);
+        }
+      }
+    } else {
+      phases.begin("Prewarm", totalbytes);
+      utility::prewarm_region(mappings[0], totalbytes, options.numthreads);
     }
+    phases.end();
+    const utility::cache_state state = utility::check_cache_state(cache, mappings[0], totalbytes, filenames);
+    phases.set_attribute("region_resident", state.region_resident);
+  };
 
-    fprintf(stderr, "Sort took %f seconds\n", utility::elapsed_time_sec(start));
-
-    start = utility::elapsed_time_sec();
-    validatedata(arr, arraysize);
-    fprintf(stderr, "Validate took %f seconds\n", utility::elapsed_time_sec(start));
+  if (sopts.record == umapsort::record_traits<uint64_t>::name()) {
+    run<uint64_t>(mappings[0], totalbytes, options, sopts, pagesize, phases, set_cache_state);
+  }
+  else if (sopts.record == umapsort::record_traits<umapsort::kv_record>::name()) {
+    run<umapsort::kv_record>(mappings[0], totalbytes, options, sopts, pagesize, phases, set_cache_state);
+  }
+  else if (sopts.record == umapsort::record_traits<umapsort::gensort_record>::name()) {
+    run<umapsort::gensort_record>(mappings[0], totalbytes, options, sopts, pagesize, phases, set_cache_state);
+  }
+  else {
+    std::cerr << "Unknown UMAPSORT_RECORD: " << sopts.record << std::endl;
+    return -1;
   }
 
-  start = utility::elapsed_time_sec();
+  phases.begin("umap TERM");
 
   if (options.numfiles > 1) {
     for ( int i = 0; i < options.numfiles; ++i) {
@@ -197,7 +354,7 @@ int main(int argc, char **argv)
     utility::unmap_file(options.usemmap, mapsize[0], mappings[0]);
   }
 
-  fprintf(stderr, "umap TERM took %f seconds\n", utility::elapsed_time_sec(start));
+  phases.finish();
 
   return 0;
 }
@@ -0,0 +1,157 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about the stencil
+/// A Jacobi heat stencil on a 3D grid of doubles with two time buffers:
+/// step t reads buffer t % 2 and writes buffer (t + 1) % 2. The boundary
+/// cells are the same in both buffers and are never written.
+///  - 7-point: the cell and its 6 face neighbors; 27-point: the 3x3x3 cube,
+///    weighted by the distance class (center, face, edge, corner). The
+///    weights sum to 1.
+///  - Temporal blocking by a wavefront over z: a sweep advances the grid by
+///    T steps; at wavefront w it computes plane 1 + w - 2t of level t, for
+///    every level t < T at once. A plane of level t needs planes z - 1, z,
+///    z + 1 of level t - 1, which were computed by earlier wavefronts, and it
+///    overwrites plane z of level t - 2, which no plane still to be computed
+///    needs (hence the skew of 2 planes per level with 2 buffers). The planes
+///    of one wavefront are independent and their rows are shared by the
+///    threads.
+///  - A sweep reads and writes every page of both buffers about once, so
+///    with a buffer of at least 2 x (2T + 2) planes a page is reused by T
+///    steps before it is evicted, instead of being faulted in once per step.
+/// A row is computed by the same code in every schedule, so a blocked run
+/// gives the same bits as step by step sweeps.
+
+#ifndef UMAP_APPS_UMAPSTENCIL_STENCIL_HPP
+#define UMAP_APPS_UMAPSTENCIL_STENCIL_HPP
+
+#include <cstdint>
+#include <string>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace umapstencil {
+
+enum class shape {
+  seven_point,
+  twenty_seven_point
+};
+
+inline const char *shape_name(const shape s) {
+  return (s == shape::seven_point) ? "7" : "27";
+}
+
+/// \brief Parses 7 | 27
+inline bool parse_shape(const std::string &text, shape *const s) {
+  if (text == "7") *s = shape::seven_point;
+  else if (text == "27") *s = shape::twenty_seven_point;
+  else return false;
+  return true;
+}
+
+/// \brief Weights by the number of non-zero offsets: center, face, edge, corner
+const double k_weights7[2] = {0.4, 0.1};
+const double k_weights27[4] = {0.5, 0.05, 0.0125, 0.00625};
+
+struct grid {
+  uint64_t nx{0};
+  uint64_t ny{0};
+  uint64_t nz{0};
+
+  uint64_t cells() const { return nx * ny * nz; }
+  uint64_t plane_cells() const { return nx * ny; }
+  uint64_t interior_cells() const { return (nx - 2) * (ny - 2) * (nz - 2); }
+  uint64_t index(const uint64_t x, const uint64_t y, const uint64_t z) const { return (z * ny + y) * nx + x; }
+};
+
+/// \brief Computes the interior cells of row (y, z)
+inline void update_row(const grid &g, const shape s, const double *const in, double *const out,
+                       const uint64_t y, const uint64_t z) {
+  const uint64_t row = g.index(0, y, z);
+  double *const o = out + row;
+  if (s == shape::seven_point) {
+    const double *const c = in + row;
+    const double *const north = c - g.nx;
+    const double *const south = c + g.nx;
+    const double *const below = c - g.plane_cells();
+    const double *const above = c + g.plane_cells();
+    for (uint64_t x = 1; x + 1 < g.nx; ++x)
+      o[x] = k_weights7[0] * c[x]
+           + k_weights7[1] * (c[x - 1] + c[x + 1] + north[x] + south[x] + below[x] + above[x]);
+    return;
+  }
+  for (uint64_t x = 1; x + 1 < g.nx; ++x) o[x] = 0.0;
+  for (int dz = -1; dz <= 1; ++dz) {
+    for (int dy = -1; dy <= 1; ++dy) {
+      // The middle cell of the row has offsets (0, dy, dz), its sides one more
+      const int offsets = (dy != 0) + (dz != 0);
+      const double w_middle = k_weights27[offsets];
+      const double w_side = k_weights27[offsets + 1];
+      const double *const r = in + g.index(0, y + dy, z + dz);
+      for (uint64_t x = 1; x + 1 < g.nx; ++x)
+        o[x] += w_middle * r[x] + w_side * (r[x - 1] + r[x + 1]);
+    }
+  }
+}
+
+/// \brief Advances the grid by num_steps steps from step first_step, in one wavefront sweep
+/// Must be called by all the threads of a parallel region.
+inline void sweep(const grid &g, const shape s, double *const buffers[2], const uint64_t first_step,
+                  const uint64_t num_steps) {
+  const uint64_t planes = g.nz - 2;
+  const uint64_t rows = g.ny - 2;
+  const uint64_t num_wavefronts = planes + 2 * (num_steps - 1);
+  for (uint64_t w = 0; w < num_wavefronts; ++w) {
+    // Levels whose plane 1 + w - 2t is in [1, nz - 2]
+    const uint64_t first_level = (w + 1 > planes) ? (w + 2 - planes) / 2 : 0;
+    const uint64_t last_level = std::min(num_steps - 1, w / 2);
+    const uint64_t num_rows = (last_level - first_level + 1) * rows;
+#pragma omp for schedule(static)
+    for (uint64_t r = 0; r < num_rows; ++r) {
+      const uint64_t level = first_level + r / rows;
+      const uint64_t y = 1 + r % rows;
+      const uint64_t z = 1 + w - 2 * level;
+      const uint64_t step = first_step + level;
+      update_row(g, s, buffers[step % 2], buffers[(step + 1) % 2], y, z);
+    }
+  }
+}
+
+/// \brief Advances the grid from buffers[0] by num_steps steps, time_block steps per sweep
+/// \return The buffer that holds the result
+inline double *run(const grid &g, const shape s, double *const buffers[2], const uint64_t num_steps,
+                   const uint64_t time_block) {
+#pragma omp parallel
+  for (uint64_t step = 0; step < num_steps; step += time_block)
+    sweep(g, s, buffers, step, std::min(time_block, num_steps - step));
+  return buffers[num_steps % 2];
+}
+
+/// \brief Advances the grid one step at a time, plane by plane (the reference of run)
+inline double *run_reference(const grid &g, const shape s, double *const buffers[2], const uint64_t num_steps) {
+  for (uint64_t step = 0; step < num_steps; ++step) {
+#pragma omp parallel for schedule(static)
+    for (uint64_t z = 1; z < g.nz - 1; ++z)
+      for (uint64_t y = 1; y + 1 < g.ny; ++y)
+        update_row(g, s, buffers[step % 2], buffers[(step + 1) % 2], y, z);
+  }
+  return buffers[num_steps % 2];
+}
+
+} // namespace umapstencil
+#endif //UMAP_APPS_UMAPSTENCIL_STENCIL_HPP
@@ -0,0 +1,338 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+// Stencil benchmark: runs a 7-point or 27-point Jacobi heat stencil on a 3D
+// grid whose two time buffers live in a file mapped with umap or mmap, with
+// temporal blocking by a wavefront over the planes (see stencil.hpp), so
+// that every page is read and written once per block of time steps. The
+// program prints the updates per second and the bytes faulted in and moved
+// to and from storage per update, and appends them to a CSV file.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif // _GNU_SOURCE
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "umap/umap.h"
+#include "../utility/commandline.hpp"
+#include "../utility/umap_file.hpp"
+#include "../utility/phase.hpp"
+#include "../utility/memory_pressure.hpp"
+#include "../utility/cache_control.hpp"
+#include "../utility/random.hpp"
+#include "stencil.hpp"
+
+struct stencil_options {
+  umapstencil::shape points{umapstencil::shape::seven_point};
+  umapstencil::grid dims;         // 0: the largest cube that fits in the file
+  uint64_t steps{8};
+  uint64_t time_block{4};
+  uint64_t seed{123};
+  bool validate{false};
+  std::string csv_file_name;
+};
+
+void disp_stencil_env_variables(const stencil_options &sopts) {
+  std::cerr
+    << "Benchmark Configuration (environment variables):\n"
+    << " UMAPSTENCIL_POINTS              - currently: " << umapstencil::shape_name(sopts.points) << " (7|27)\n"
+    << " UMAPSTENCIL_DIMS                - currently: " << sopts.dims.nx << ":" << sopts.dims.ny << ":"
+    << sopts.dims.nz << " (nx:ny:nz; 0:0:0: the largest cube that fits)\n"
+    << " UMAPSTENCIL_STEPS               - currently: " << sopts.steps << " time steps\n"
+    << " UMAPSTENCIL_TIME_BLOCK          - currently: " << sopts.time_block << " time steps per sweep\n"
+    << " UMAPSTENCIL_SEED                - currently: " << sopts.seed << "\n"
+    << " UMAPSTENCIL_VALIDATE            - currently: " << sopts.validate
+    << " (1: compare with step by step sweeps in memory)\n"
+    << " UMAPSTENCIL_CSV                 - currently: " << sopts.csv_file_name << " (summary, one line per run)\n"
+    << std::endl;
+}
+
+/// \brief Parses nx:ny:nz
+bool parse_dims(const std::string &text, umapstencil::grid *const g) {
+  std::istringstream ss(text);
+  char sep1 = 0, sep2 = 0;
+  umapstencil::grid d;
+  if (!(ss >> d.nx >> sep1 >> d.ny >> sep2 >> d.nz) || sep1 != ':' || sep2 != ':' || !ss.eof()) return false;
+  if (d.nx < 3 || d.ny < 3 || d.nz < 3) return false;
+  *g = d;
+  return true;
+}
+
+stencil_options get_stencil_options() {
+  stencil_options sopts;
+
+  const char *buf = std::getenv("UMAPSTENCIL_POINTS");
+  if (buf != nullptr && !umapstencil::parse_shape(buf, &sopts.points)) {
+    std::cerr << "Invalid UMAPSTENCIL_POINTS: " << buf << std::endl;
+    exit(1);
+  }
+
+  buf = std::getenv("UMAPSTENCIL_DIMS");
+  if (buf != nullptr && !parse_dims(buf, &sopts.dims)) {
+    std::cerr << "Invalid UMAPSTENCIL_DIMS (nx:ny:nz, each at least 3): " << buf << std::endl;
+    exit(1);
+  }
+
+  buf = std::getenv("UMAPSTENCIL_STEPS");
+  if (buf != nullptr)
+    sopts.steps = std::stoull(buf);
+
+  buf = std::getenv("UMAPSTENCIL_TIME_BLOCK");
+  if (buf != nullptr)
+    sopts.time_block = std::max((uint64_t)std::stoull(buf), (uint64_t)1);
+
+  buf = std::getenv("UMAPSTENCIL_SEED");
+  if (buf != nullptr)
+    sopts.seed = std::stoull(buf);
+
+  buf = std::getenv("UMAPSTENCIL_VALIDATE");
+  if (buf != nullptr)
+    sopts.validate = std::stoull(buf) != 0;
+
+  buf = std::getenv("UMAPSTENCIL_CSV");
+  if (buf != nullptr)
+    sopts.csv_file_name = buf;
+
+  return sopts;
+}
+
+/// \brief Bytes of one time buffer, rounded up to pages so that the second one is page aligned
+uint64_t buffer_bytes(const umapstencil::grid &g, const uint64_t pagesize) {
+  return (g.cells() * sizeof(double) + pagesize - 1) / pagesize * pagesize;
+}
+
+/// \brief The largest cube whose two buffers fit in totalbytes
+umapstencil::grid largest_cube(const uint64_t totalbytes, const uint64_t pagesize) {
+  umapstencil::grid g;
+  uint64_t n = (uint64_t)std::cbrt((double)totalbytes / 2 / sizeof(double)) + 1;
+  for (; n >= 3; --n) {
+    g.nx = g.ny = g.nz = n;
+    if (2 * buffer_bytes(g, pagesize) <= totalbytes) return g;
+  }
+  g.nx = g.ny = g.nz = 0;
+  return g;
+}
+
+/// \brief Writes the initial grid to both buffers, so that their boundaries are the same
+void init_grid(const umapstencil::grid &g, double *const a, double *const b, const uint64_t seed) {
+#pragma omp parallel for schedule(static)
+  for (uint64_t z = 0; z < g.nz; ++z) {
+    for (uint64_t i = g.index(0, 0, z); i < g.index(0, 0, z + 1); ++i) {
+      a[i] = utility::to_unit_interval(utility::counter_random(seed, i));
+      b[i] = a[i];
+    }
+  }
+}
+
+/// \brief Number of cells that differ between two grids
+uint64_t count_mismatches(const umapstencil::grid &g, const double *const a, const double *const b) {
+  uint64_t mismatches = 0;
+#pragma omp parallel for schedule(static) reduction(+:mismatches)
+  for (uint64_t i = 0; i < g.cells(); ++i)
+    mismatches += (a[i] != b[i]);
+  return mismatches;
+}
+
+double interior_sum(const umapstencil::grid &g, const double *const u) {
+  double sum = 0.0;
+#pragma omp parallel for schedule(static) reduction(+:sum)
+  for (uint64_t z = 1; z < g.nz - 1; ++z)
+    for (uint64_t y = 1; y + 1 < g.ny; ++y)
+      for (uint64_t x = 1; x + 1 < g.nx; ++x)
+        sum += u[g.index(x, y, z)];
+  return sum;
+}
+
+struct run_result {
+  utility::phase_record phase;
+  uint64_t updates{0};
+  uint64_t sweeps{0};
+  uint64_t window_bytes{0}; // of both buffers, touched by the planes of one wavefront and their neighbors
+
+  double gupdates() const { return phase.wall_sec > 0.0 ? updates / phase.wall_sec / 1e9 : 0.0; }
+  double per_update(const double x) const { return updates ? x / updates : 0.0; }
+};
+
+void print_result(const run_result &r, const umapstencil::grid &g, const stencil_options &sopts,
+                  const uint64_t pagesize, const double buffer_grid_ratio) {
+  fprintf(stdout, "%lux%lux%lu grid, %s-point stencil: %lu steps in %lu sweeps of up to %lu steps\n",
+      g.nx, g.ny, g.nz, umapstencil::shape_name(sopts.points), sopts.steps, r.sweeps, sopts.time_block);
+  fprintf(stdout, "  %lu updates in %f seconds: %f GUpdates/sec\n", r.updates, r.phase.wall_sec, r.gupdates());
+  fprintf(stdout, "  Buffer/grid ratio: %f (both buffers); wavefront window: %lu bytes\n",
+      buffer_grid_ratio, r.window_bytes);
+  fprintf(stdout, "  Page faults: %lu minor, %lu major; %.2f bytes faulted in per update\n",
+      r.phase.minor_faults, r.phase.major_faults,
+      r.per_update((double)(r.phase.minor_faults + r.phase.major_faults) * pagesize));
+  fprintf(stdout, "  Storage: read %lu bytes, wrote %lu bytes; %.2f bytes moved per update"
+      " (%.2f if every page were read and written once per sweep)\n",
+      r.phase.read_bytes, r.phase.write_bytes, r.per_update((double)r.phase.read_bytes + r.phase.write_bytes),
+      r.per_update(2.0 * sizeof(double) * g.cells() * r.sweeps));
+}
+
+/// \brief Appends one line to the summary CSV; writes the header if the file is new
+void write_csv(const run_result &r, const utility::umt_optstruct_t &options, const stencil_options &sopts,
+               const umapstencil::grid &g, const uint64_t pagesize, const double buffer_grid_ratio) {
+  if (sopts.csv_file_name.empty()) return;
+  std::ofstream ofs(sopts.csv_file_name, std::ios::app);
+  if (!ofs.good()) {
+    std::cerr << "Failed to open " << sopts.csv_file_name << std::endl;
+    return;
+  }
+  if (ofs.tellp() == 0) {
+    ofs << "points,backend,threads,pages,pagesize,umap_bufsize,buffer_grid_ratio,nx,ny,nz,steps,time_block,"
+           "sweeps,window_bytes,updates,seconds,gupdates_per_sec,minor_faults,major_faults,faulted_bytes_per_update,"
+           "read_bytes,write_bytes,moved_bytes_per_update\n";
+  }
+  ofs << umapstencil::shape_name(sopts.points) << "," << (options.usemmap ? "mmap" : "umap") << ","
+      << options.numthreads << "," << options.numpages << "," << pagesize << ","
+      << umapcfg_get_max_pages_in_buffer() << "," << buffer_grid_ratio << ","
+      << g.nx << "," << g.ny << "," << g.nz << "," << sopts.steps << "," << sopts.time_block << ","
+      << r.sweeps << "," << r.window_bytes << "," << r.updates << "," << r.phase.wall_sec << "," << r.gupdates() << ","
+      << r.phase.minor_faults << "," << r.phase.major_faults << ","
+      << r.per_update((double)(r.phase.minor_faults + r.phase.major_faults) * pagesize) << ","
+      << r.phase.read_bytes << "," << r.phase.write_bytes << ","
+      << r.per_update((double)r.phase.read_bytes + r.phase.write_bytes) << "\n";
+}
+
+int main(int argc, char **argv)
+{
+  utility::umt_optstruct_t options;
+  const uint64_t pagesize = utility::umt_getpagesize();
+
+  umt_getoptions(&options, argc, argv);
+  omp_set_num_threads(options.numthreads);
+
+  const stencil_options sopts = get_stencil_options();
+  disp_stencil_env_variables(sopts);
+  const auto pressure = utility::memory_pressure_from_env();
+
+  const uint64_t totalbytes = options.numpages * pagesize;
+  const umapstencil::grid g = sopts.dims.nx ? sopts.dims : largest_cube(totalbytes, pagesize);
+  const uint64_t grid_bytes = buffer_bytes(g, pagesize);
+  if (g.nx == 0 || 2 * grid_bytes > totalbytes) {
+    std::cerr << "The two buffers of the grid do not fit in " << options.numpages << " pages" << std::endl;
+    return 1;
+  }
+
+  utility::phase_recorder phases("umapstencil");
+  const utility::cache_mode cache = options.cold ? utility::cache_mode::cold
+                                  : (options.warm ? utility::cache_mode::warm : utility::cache_mode::as_is);
+  phases.set_attribute("points", umapstencil::shape_name(sopts.points));
+  phases.set_attribute("nx", g.nx);
+  phases.set_attribute("ny", g.ny);
+  phases.set_attribute("nz", g.nz);
+  phases.set_attribute("steps", sopts.steps);
+  phases.set_attribute("time_block", sopts.time_block);
+  phases.set_attribute("threads", options.numthreads);
+  phases.set_attribute("pages", options.numpages);
+  phases.set_attribute("pagesize", pagesize);
+  phases.set_attribute("usemmap", options.usemmap);
+  phases.set_attribute("cache", utility::cache_mode_name(cache));
+  if (pressure) phases.set_attribute("memory_pressure", utility::pressure_backend_name(pressure->backend()));
+
+  phases.begin("umap INIT");
+  void *const base_addr = utility::map_in_file(options.filename, options.initonly,
+      options.noinit, options.usemmap, totalbytes);
+  if (base_addr == nullptr) {
+    std::cerr << "Failed to map " << options.filename << std::endl;
+    return 1;
+  }
+  phases.end();
+
+  // Buffer 0 holds the grid at step 0; buffer 1 starts at the next page
+  double *const buffers[2] = {static_cast<double *>(base_addr),
+                              reinterpret_cast<double *>(static_cast<char *>(base_addr) + grid_bytes)};
+
+  if ( !options.noinit ) {
+    phases.begin("Init", 2 * g.cells() * sizeof(double));
+    init_grid(g, buffers[0], buffers[1], sopts.seed);
+    phases.end();
+  }
+
+  bool valid = true;
+  if ( !options.initonly ) {
+    // The reference starts from the same grid, also with --noinit
+    std::vector<double> reference[2];
+    if (sopts.validate) {
+      reference[0].assign(buffers[0], buffers[0] + g.cells());
+      reference[1] = reference[0];
+    }
+
+    if (cache != utility::cache_mode::as_is) {
+      if (cache == utility::cache_mode::cold) {
+        phases.begin("Evict");
+        if (utility::evict_mapped_file(options.filename, options.usemmap, totalbytes, base_addr) == nullptr) {
+          std::cerr << "Failed to map " << options.filename << " again" << std::endl;
+          return 1;
+        }
+      } else {
+        phases.begin("Prewarm", totalbytes);
+        utility::prewarm_region(base_addr, totalbytes, options.numthreads);
+      }
+      phases.end();
+      const utility::cache_state state = utility::check_cache_state(cache, base_addr, totalbytes,
+                                                                    {options.filename});
+      phases.set_attribute("region_resident", state.region_resident);
+    }
+
+    const double buffer = options.usemmap
+        ? (double)((pressure && pressure->free_bytes()) ? pressure->free_bytes()
+                                                        : utility::get_meminfo_bytes("MemAvailable"))
+        : (double)umapcfg_get_max_pages_in_buffer() * umapcfg_get_umap_page_size();
+    const double buffer_grid_ratio = buffer / (2.0 * grid_bytes);
+    phases.set_attribute("buffer_grid_ratio", buffer_grid_ratio);
+
+    run_result result;
+    result.updates = g.interior_cells() * sopts.steps;
+    result.sweeps = (sopts.steps + sopts.time_block - 1) / sopts.time_block;
+    result.window_bytes = 2 * (2 * std::min(sopts.time_block, sopts.steps) + 2) * g.plane_cells() * sizeof(double);
+    phases.begin("Stencil", result.sweeps * 2 * 2 * g.cells() * sizeof(double));
+    const double *const u = umapstencil::run(g, sopts.points, buffers, sopts.steps, sopts.time_block);
+    result.phase = phases.end();
+    print_result(result, g, sopts, pagesize, buffer_grid_ratio);
+    write_csv(result, options, sopts, g, pagesize, buffer_grid_ratio);
+    fprintf(stdout, "Sum of the interior cells: %.10e\n", interior_sum(g, u));
+
+    if (sopts.validate) {
+      phases.begin("Validate");
+      double *const reference_buffers[2] = {reference[0].data(), reference[1].data()};
+      const double *const expected = umapstencil::run_reference(g, sopts.points, reference_buffers, sopts.steps);
+      const uint64_t mismatches = count_mismatches(g, u, expected);
+      phases.end();
+      fprintf(stdout, "Validation: %lu cells differ from step by step sweeps\n", mismatches);
+      valid = (mismatches == 0);
+    }
+  }
+
+  phases.begin("umap TERM");
+  utility::unmap_file(options.usemmap, totalbytes, base_addr);
+  phases.finish();
+
+  return valid ? 0 : 1;
+}
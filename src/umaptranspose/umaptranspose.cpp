@@ -0,0 +1,378 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+// Out-of-core transpose: permutes the axes of a row-major 2D or 3D array in
+// a file mapped with umap or mmap into another mapped file, with the tiled
+// transpose of utility/transpose.hpp, e.g. a frame-major cube into a
+// time-major one. Prints the bandwidth, the page faults and the storage I/O
+// of the transpose; --generate writes a test array and --validate checks
+// every element of the output.
+
+#include <unistd.h>
+#include <getopt.h>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "umap/umap.h"
+#include "../utility/umap_file.hpp"
+#include "../utility/file.hpp"
+#include "../utility/phase.hpp"
+#include "../utility/memory_pressure.hpp"
+#include "../utility/cache_control.hpp"
+#include "../utility/transpose.hpp"
+
+struct transpose_options {
+  std::string input_file_name;
+  std::string output_file_name;
+  uint64_t dims[3]{1, 0, 0};
+  int num_dims{0};
+  int order[3]{0, 2, 1};
+  size_t element_bytes{8};
+  size_t run_bytes{0}; // 0: the umap page size
+  size_t memory_bytes{0}; // 0: the umap buffer size
+  int num_threads{0};  // 0: OpenMP default
+  bool use_mmap{false};
+  bool generate{false};
+  bool validate{false};
+  utility::cache_mode cache{utility::cache_mode::as_is};
+};
+
+/// \brief An element of element_bytes bytes; the transpose only copies elements
+template <size_t Bytes>
+struct element {
+  unsigned char bytes[Bytes];
+};
+
+/// \brief Test pattern: byte j of element i is byte j % 8 of i
+template <size_t Bytes>
+element<Bytes> pattern(const uint64_t i) {
+  element<Bytes> e;
+  for (size_t j = 0; j < Bytes; ++j) e.bytes[j] = static_cast<unsigned char>(i >> (8 * (j % 8)));
+  return e;
+}
+
+void usage() {
+  std::cout << "Transpose options:\n"
+            << "-i\tInput file name (a row-major array)\n"
+            << "-o\tOutput file name (created)\n"
+            << "-d\tExtents of the input, slowest first: ROWSxCOLS or D0xD1xD2\n"
+            << "-a\tInput axis of every output axis, slowest first, e.g. 1,0 or 2,0,1"
+               " (default: swap the last two axes)\n"
+            << "-e\tBytes per element: 1, 2, 4, 8 or 16 (default: 8)\n"
+            << "-b\tBytes per contiguous run of a tile (default: the umap page size)\n"
+            << "-m\tBytes of DRAM for the tile buffers of all threads (default: the umap buffer size)\n"
+            << "-t\t#threads (default: OpenMP default)\n"
+            << "-s\tUse system mmap\n"
+            << "--generate\tWrite a test array to the input file first\n"
+            << "--validate\tCheck every element of the output\n"
+            << "--cold\tEvict the input from memory before the transpose\n"
+            << "--warm\tRead the input into memory before the transpose\n"
+            << "UMAP_* environment variables configure umap; MEMORY_PRESSURE_* the memory left for the run"
+            << std::endl;
+}
+
+/// \brief Parses ROWSxCOLS or D0xD1xD2
+bool parse_dims(const std::string &text, transpose_options &options) {
+  std::vector<uint64_t> dims;
+  std::istringstream ss(text);
+  std::string field;
+  while (std::getline(ss, field, 'x')) {
+    if (field.empty() || field.find_first_not_of("0123456789") != std::string::npos) return false;
+    dims.push_back(std::stoull(field));
+    if (dims.back() == 0) return false;
+  }
+  if (dims.size() != 2 && dims.size() != 3) return false;
+  options.num_dims = dims.size();
+  options.dims[0] = 1;
+  std::copy(dims.begin(), dims.end(), options.dims + (3 - dims.size()));
+  return true;
+}
+
+void parse_options(int argc, char **argv, transpose_options &options) {
+  static const struct option long_options[] = {
+      {"generate", no_argument, nullptr, 'G'},
+      {"validate", no_argument, nullptr, 'X'},
+      {"cold", no_argument, nullptr, 'C'},
+      {"warm", no_argument, nullptr, 'W'},
+      {nullptr, 0, nullptr, 0}
+  };
+  std::string order_text;
+  int c;
+  while ((c = getopt_long(argc, argv, "i:o:d:a:e:b:m:t:sh", long_options, nullptr)) != -1) {
+    switch (c) {
+      case 'i': /// Required
+        options.input_file_name = optarg;
+        break;
+
+      case 'o': /// Required
+        options.output_file_name = optarg;
+        break;
+
+      case 'd': /// Required
+        if (!parse_dims(optarg, options)) {
+          std::cerr << "Invalid extents: " << optarg << std::endl;
+          std::exit(1);
+        }
+        break;
+
+      case 'a':order_text = optarg;
+        break;
+
+      case 'e':options.element_bytes = std::stoull(optarg);
+        break;
+
+      case 'b':options.run_bytes = std::stoull(optarg);
+        break;
+
+      case 'm':options.memory_bytes = std::stoull(optarg);
+        break;
+
+      case 't':options.num_threads = std::stoi(optarg);
+        break;
+
+      case 's':options.use_mmap = true;
+        break;
+
+      case 'G':options.generate = true;
+        break;
+
+      case 'X':options.validate = true;
+        break;
+
+      case 'C':options.cache = utility::cache_mode::cold;
+        break;
+
+      case 'W':options.cache = utility::cache_mode::warm;
+        break;
+
+      case 'h':usage();
+        std::exit(0);
+
+      default:usage();
+        std::exit(1);
+    }
+  }
+
+  if (options.input_file_name.empty() || options.output_file_name.empty() || options.num_dims == 0) {
+    std::cerr << "-i, -o and -d are required" << std::endl;
+    std::exit(1);
+  }
+  // A 2D order applies to the last two axes; a 3D one needs 3D extents
+  if (!order_text.empty()
+      && (!utility::parse_axis_order(order_text, options.order)
+          || (options.num_dims == 2 && std::count(order_text.begin(), order_text.end(), ',') != 1))) {
+    std::cerr << "Invalid axis order for " << options.num_dims << " axes: " << order_text << std::endl;
+    std::exit(1);
+  }
+  const size_t e = options.element_bytes;
+  if (e != 1 && e != 2 && e != 4 && e != 8 && e != 16) {
+    std::cerr << "Unsupported element size " << e << "; use 1, 2, 4, 8 or 16" << std::endl;
+    std::exit(1);
+  }
+  if (options.run_bytes == 0) options.run_bytes = umapcfg_get_umap_page_size();
+  if (options.memory_bytes == 0) options.memory_bytes = umapcfg_get_max_pages_in_buffer() * umapcfg_get_umap_page_size();
+}
+
+void disp_transpose_options(const transpose_options &options) {
+  std::cout << "Transpose options:"
+            << "\nInput file: " << options.input_file_name
+            << "\nOutput file: " << options.output_file_name
+            << "\nExtents: " << options.dims[0] << " x " << options.dims[1] << " x " << options.dims[2]
+            << "\nAxis order: " << options.order[0] << "," << options.order[1] << "," << options.order[2]
+            << "\nBytes per element: " << options.element_bytes
+            << "\nBytes per run: " << options.run_bytes
+            << "\nBytes of tile buffers: " << options.memory_bytes
+            << "\n#threads: " << omp_get_max_threads()
+            << "\nUse system mmap: " << options.use_mmap
+            << "\nGenerate: " << options.generate
+            << "\nCache: " << utility::cache_mode_name(options.cache) << std::endl;
+}
+
+// Umap requires page size aligned files
+size_t umap_page_aligned_size(const size_t size) {
+  const size_t page_size = umapcfg_get_umap_page_size();
+  return (size + page_size - 1) / page_size * page_size;
+}
+
+/// \brief Maps the input; creates it if generate, otherwise it must hold size bytes
+/// \return The mapped size, or 0 on errors (printed)
+size_t map_input(const transpose_options &options, const size_t size, void **const addr) {
+  const size_t aligned_size = umap_page_aligned_size(size);
+  if (!options.generate) {
+    const ssize_t file_size = utility::get_file_size(options.input_file_name);
+    if (file_size < static_cast<ssize_t>(size)) {
+      std::cerr << options.input_file_name << " has " << file_size << " bytes, less than " << size << std::endl;
+      return 0;
+    }
+    // Umap maps whole pages
+    if (!options.use_mmap && !utility::extend_file_size(options.input_file_name, aligned_size)) return 0;
+  }
+  const size_t mapped_size = options.generate ? aligned_size : utility::get_file_size(options.input_file_name);
+  *addr = utility::map_in_file(options.input_file_name, false, !options.generate, options.use_mmap, mapped_size);
+  if (*addr == nullptr) {
+    std::cerr << "Failed to map " << options.input_file_name << std::endl;
+    return 0;
+  }
+  return mapped_size;
+}
+
+template <size_t Bytes>
+void generate(element<Bytes> *const in, const uint64_t num_elements) {
+#pragma omp parallel for schedule(static)
+  for (uint64_t i = 0; i < num_elements; ++i) in[i] = pattern<Bytes>(i);
+}
+
+/// \brief Number of output elements that are not the test pattern of their input element
+template <size_t Bytes>
+uint64_t count_mismatches(const element<Bytes> *const out, const uint64_t dims[3], const int order[3]) {
+  const uint64_t out_dims[3] = {dims[order[0]], dims[order[1]], dims[order[2]]};
+  uint64_t mismatches = 0;
+#pragma omp parallel for schedule(static) reduction(+:mismatches)
+  for (uint64_t j0 = 0; j0 < out_dims[0]; ++j0) {
+    for (uint64_t j1 = 0; j1 < out_dims[1]; ++j1) {
+      for (uint64_t j2 = 0; j2 < out_dims[2]; ++j2) {
+        uint64_t i[3];
+        i[order[0]] = j0;
+        i[order[1]] = j1;
+        i[order[2]] = j2;
+        const element<Bytes> expected = pattern<Bytes>((i[0] * dims[1] + i[1]) * dims[2] + i[2]);
+        const element<Bytes> &got = out[(j0 * out_dims[1] + j1) * out_dims[2] + j2];
+        mismatches += (std::memcmp(expected.bytes, got.bytes, Bytes) != 0);
+      }
+    }
+  }
+  return mismatches;
+}
+
+/// \brief Makes the input cold or warm and checks it
+void set_cache_state(const transpose_options &options, void *const addr, const size_t size,
+                     utility::phase_recorder &phases) {
+  if (options.cache == utility::cache_mode::cold) {
+    phases.begin("Evict");
+    if (!utility::evict_mapped_file(options.input_file_name, options.use_mmap, size, addr)) {
+      std::cerr << "Failed to map " << options.input_file_name << " again" << std::endl;
+      std::abort();
+    }
+  } else {
+    phases.begin("Prewarm", size);
+    utility::prewarm_region(addr, size, omp_get_max_threads());
+  }
+  phases.end();
+  const utility::cache_state state = utility::check_cache_state(options.cache, addr, size,
+                                                                {options.input_file_name});
+  phases.set_attribute("region_resident", state.region_resident);
+}
+
+template <size_t Bytes>
+bool run(const transpose_options &options, utility::phase_recorder &phases) {
+  const uint64_t num_elements = options.dims[0] * options.dims[1] * options.dims[2];
+  const size_t size = num_elements * Bytes;
+
+  phases.begin("umap INIT");
+  void *in_addr = nullptr;
+  const size_t in_size = map_input(options, size, &in_addr);
+  if (in_size == 0) return false;
+  const size_t out_size = umap_page_aligned_size(size);
+  void *const out_addr = utility::map_in_file(options.output_file_name, false, false, options.use_mmap, out_size);
+  if (out_addr == nullptr) {
+    std::cerr << "Failed to map " << options.output_file_name << std::endl;
+    return false;
+  }
+  phases.end();
+
+  element<Bytes> *const in = static_cast<element<Bytes> *>(in_addr);
+  element<Bytes> *const out = static_cast<element<Bytes> *>(out_addr);
+  if (options.generate) {
+    phases.begin("Generate", size);
+    generate<Bytes>(in, num_elements);
+    phases.end();
+  }
+  if (options.cache != utility::cache_mode::as_is) set_cache_state(options, in_addr, in_size, phases);
+
+  uint64_t tile[3];
+  utility::transpose_tile(options.dims, options.order, options.run_bytes / Bytes,
+                          utility::transpose_buffer_elements<element<Bytes>>(options.memory_bytes), tile);
+  std::cout << "Tile: " << tile[0] << " x " << tile[1] << " x " << tile[2] << " elements ("
+            << tile[0] * tile[1] * tile[2] * Bytes << " bytes)" << std::endl;
+
+  phases.begin("Transpose", 2 * size);
+  utility::transpose(in, out, options.dims, options.order, options.run_bytes, options.memory_bytes);
+  const utility::phase_record record = phases.end();
+  const double seconds = record.wall_sec > 0.0 ? record.wall_sec : 1e-9;
+  std::cout << "Transpose time (s)\t" << record.wall_sec << "\n"
+            << "Bandwidth (GB/s, read + written)\t" << 2.0 * size / seconds / 1e9 << "\n"
+            << "#of minor page faults\t" << record.minor_faults << "\n"
+            << "#of major page faults\t" << record.major_faults << "\n"
+            << "Storage read (bytes)\t" << record.read_bytes << "\t(" << (double)record.read_bytes / size
+            << " x the array)\n"
+            << "Storage written (bytes)\t" << record.write_bytes << "\t(" << (double)record.write_bytes / size
+            << " x the array)" << std::endl;
+
+  bool valid = true;
+  if (options.validate) {
+    phases.begin("Validate", size);
+    const uint64_t mismatches = count_mismatches<Bytes>(out, options.dims, options.order);
+    phases.end();
+    std::cout << "Validation: " << mismatches << " elements differ from the test pattern" << std::endl;
+    valid = (mismatches == 0);
+  }
+
+  phases.begin("umap TERM");
+  utility::unmap_file(options.use_mmap, out_size, out_addr);
+  utility::unmap_file(options.use_mmap, in_size, in_addr);
+  phases.end();
+  return valid;
+}
+
+int main(int argc, char **argv) {
+  transpose_options options;
+  parse_options(argc, argv, options);
+  if (options.num_threads > 0) omp_set_num_threads(options.num_threads);
+  disp_transpose_options(options);
+  const auto pressure = utility::memory_pressure_from_env();
+
+  utility::phase_recorder phases("umaptranspose");
+  phases.set_attribute("dims", std::to_string(options.dims[0]) + "x" + std::to_string(options.dims[1]) + "x"
+                               + std::to_string(options.dims[2]));
+  phases.set_attribute("order", std::to_string(options.order[0]) + "," + std::to_string(options.order[1]) + ","
+                                + std::to_string(options.order[2]));
+  phases.set_attribute("element_bytes", options.element_bytes);
+  phases.set_attribute("run_bytes", options.run_bytes);
+  phases.set_attribute("memory_bytes", options.memory_bytes);
+  phases.set_attribute("threads", omp_get_max_threads());
+  phases.set_attribute("usemmap", options.use_mmap);
+  phases.set_attribute("cache", utility::cache_mode_name(options.cache));
+  if (pressure) phases.set_attribute("memory_pressure", utility::pressure_backend_name(pressure->backend()));
+
+  bool valid = false;
+  switch (options.element_bytes) {
+    case 1: valid = run<1>(options, phases); break;
+    case 2: valid = run<2>(options, phases); break;
+    case 4: valid = run<4>(options, phases); break;
+    case 8: valid = run<8>(options, phases); break;
+    case 16: valid = run<16>(options, phases); break;
+  }
+  phases.finish();
+  return valid ? 0 : 1;
+}
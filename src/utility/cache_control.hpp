@@ -0,0 +1,206 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about cold and warm runs
+/// Puts a mapped region, and the files behind it, in a known cache state
+/// before a measured phase, without root (no drop_caches):
+///  cold - the dirty pages are written back, the pages of the region are paged
+///         out (MADV_PAGEOUT, Linux 5.4 or later; MADV_DONTNEED otherwise) and
+///         the files are dropped from the page cache (posix_fadvise
+///         DONTNEED). A umap region is unmapped and mapped again instead
+///         (evict_mapped_file in umap_file.hpp), which empties its buffer.
+///  warm - the region is read by several threads in large blocks: every
+///         block is advised MADV_WILLNEED, so that it is read at once, and
+///         then one byte of every page of it is loaded.
+/// The state is then checked with mincore(): the fraction of the region that
+/// is resident and the fraction of the files in the page cache. Pages that
+/// other processes map or lock stay cached; a warm region larger than the
+/// memory (or than the umap buffer) cannot be fully resident.
+
+#ifndef UMAP_APPS_UTILITY_CACHE_CONTROL_HPP
+#define UMAP_APPS_UTILITY_CACHE_CONTROL_HPP
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <iostream>
+#include <algorithm>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mmap.hpp"
+
+namespace utility {
+
+enum class cache_mode {
+  as_is,  // whatever the previous runs left
+  cold,
+  warm
+};
+
+inline const char *cache_mode_name(const cache_mode mode) {
+  switch (mode) {
+    case cache_mode::as_is: return "as-is";
+    case cache_mode::cold: return "cold";
+    case cache_mode::warm: return "warm";
+  }
+  return "unknown";
+}
+
+/// \brief Fraction of the pages of a region that are resident (mincore); -1 on errors
+inline double resident_fraction(const void *const addr, const std::size_t length) {
+  if (length == 0) return 0.0;
+  const std::size_t page_size = get_page_size();
+  const uintptr_t first = reinterpret_cast<uintptr_t>(addr) / page_size * page_size;
+  const uintptr_t last = reinterpret_cast<uintptr_t>(addr) + length;
+  const std::size_t num_pages = (last - first + page_size - 1) / page_size;
+  std::vector<unsigned char> vec(num_pages);
+  if (::mincore(reinterpret_cast<void *>(first), last - first, vec.data()) != 0) {
+    ::perror("mincore");
+    return -1.0;
+  }
+  std::size_t resident = 0;
+  for (const unsigned char v : vec) resident += (v & 1);
+  return static_cast<double>(resident) / num_pages;
+}
+
+/// \brief Fraction of the pages of a file that are in the page cache; -1 on errors
+inline double file_cached_fraction(const std::string &file_name) {
+  const int fd = ::open(file_name.c_str(), O_RDONLY);
+  if (fd == -1) {
+    ::perror(("open " + file_name).c_str());
+    return -1.0;
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+    ::close(fd);
+    return st.st_size == 0 ? 0.0 : -1.0;
+  }
+  void *const addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    ::perror(("mmap " + file_name).c_str());
+    return -1.0;
+  }
+  const double fraction = resident_fraction(addr, st.st_size);
+  ::munmap(addr, st.st_size);
+  return fraction;
+}
+
+/// \brief Writes back and drops the cached pages of a file (posix_fadvise DONTNEED)
+inline bool drop_file_cache(const std::string &file_name) {
+  const int fd = ::open(file_name.c_str(), O_RDONLY);
+  if (fd == -1) {
+    ::perror(("open " + file_name).c_str());
+    return false;
+  }
+  ::fdatasync(fd);
+  const int ret = ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  ::close(fd);
+  if (ret != 0) {
+    std::cerr << "posix_fadvise(DONTNEED) failed for " << file_name << ": " << std::strerror(ret) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/// \brief Pages out a region of a file mapping (mmap) and drops the file from the page cache
+/// The dirty pages are written back first, so that they can be dropped.
+inline bool evict_region(void *const addr, const std::size_t length, const std::string &file_name) {
+  const std::size_t page_size = get_page_size();
+  void *const first = reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(addr) / page_size * page_size);
+  const std::size_t span = reinterpret_cast<uintptr_t>(addr) + length - reinterpret_cast<uintptr_t>(first);
+  if (::msync(first, span, MS_SYNC) != 0) ::perror("msync");
+#ifdef MADV_PAGEOUT
+  // Not supported before Linux 5.4; MADV_DONTNEED then only unmaps the pages
+  if (::madvise(first, span, MADV_PAGEOUT) != 0 && ::madvise(first, span, MADV_DONTNEED) != 0)
+    ::perror("madvise");
+#else
+  if (::madvise(first, span, MADV_DONTNEED) != 0) ::perror("madvise");
+#endif
+  return file_name.empty() || drop_file_cache(file_name);
+}
+
+/// \brief Reads a region with several threads, in blocks of block_bytes
+inline void prewarm_region(const void *const addr, const std::size_t length, int num_threads,
+                           const std::size_t block_bytes = 8ULL << 20) {
+  if (length == 0) return;
+  num_threads = std::max(num_threads, 1);
+  const std::size_t page_size = get_page_size();
+  const uintptr_t base = reinterpret_cast<uintptr_t>(addr);
+  const std::size_t num_blocks = (length + block_bytes - 1) / block_bytes;
+  std::atomic<std::size_t> next_block(0);
+
+  auto reader = [&]() {
+    for (std::size_t b = next_block++; b < num_blocks; b = next_block++) {
+      const uintptr_t first = base + b * block_bytes;
+      const std::size_t size = std::min<std::size_t>(block_bytes, base + length - first);
+      const uintptr_t aligned = first / page_size * page_size;
+      ::madvise(reinterpret_cast<void *>(aligned), first + size - aligned, MADV_WILLNEED);
+      touch_pages(reinterpret_cast<const void *>(first), size);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int t = 1; t < num_threads; ++t) threads.emplace_back(reader);
+  reader();
+  for (auto &t : threads) t.join();
+}
+
+/// \brief Residency of a region and of its files after it was made cold or warm
+struct cache_state {
+  double region_resident{0.0};  // fraction of the pages of the region
+  double files_cached{0.0};     // fraction of the pages of the files in the page cache
+  bool as_expected{true};
+};
+
+/// \brief Measures the residency of a region and its files, prints it, and warns if it is not the one of the mode
+/// Cold: at most 1% of the region and 5% of the files; warm: at least 95% of the region.
+inline cache_state check_cache_state(const cache_mode mode, const void *const addr, const std::size_t length,
+                                     const std::vector<std::string> &file_names) {
+  cache_state state;
+  state.region_resident = resident_fraction(addr, length);
+
+  std::size_t cached_bytes = 0;
+  std::size_t file_bytes = 0;
+  for (const auto &f : file_names) {
+    const ssize_t size = get_file_size(f);
+    const double cached = file_cached_fraction(f);
+    if (size <= 0 || cached < 0.0) continue;
+    cached_bytes += cached * size;
+    file_bytes += size;
+  }
+  state.files_cached = file_bytes ? static_cast<double>(cached_bytes) / file_bytes : 0.0;
+
+  if (mode == cache_mode::cold)
+    state.as_expected = state.region_resident <= 0.01 && state.files_cached <= 0.05;
+  else if (mode == cache_mode::warm)
+    state.as_expected = state.region_resident >= 0.95;
+
+  std::fprintf(stderr, "Cache %s: %.1f%% of the region resident, %.1f%% of the files in the page cache%s\n",
+               cache_mode_name(mode), state.region_resident * 100.0, state.files_cached * 100.0,
+               state.as_expected ? "" : " (WARNING: not as expected)");
+  return state;
+}
+
+} // namespace utility
+#endif //UMAP_APPS_UTILITY_CACHE_CONTROL_HPP
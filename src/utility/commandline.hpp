@@ -31,6 +31,8 @@ typedef struct {
   int noinit;         // Init already done, so skip it
   int usemmap;
   int shuffle;
+  int cold;           // Evict the region before the measured phase
+  int warm;           // Pre-read the region before the measured phase
 
   long pagesize;
   uint64_t bufsize;
@@ -46,6 +48,7 @@ typedef struct {
   uint64_t pages_to_access;  // 0 (default) - access all pages
   char const* filename; // file name or basename
   char const* dirname; // dir name or basename
+  int dirname_given;   // -d was given
 } umt_optstruct_t;
 
 static char const* DIRNAME = "/mnt/intel/";
@@ -61,12 +64,14 @@ static void usage(char* pname)
 {
   std::cerr
   << "Usage: " << pname << " [--initonly] [--noinit] [--directio]"
-  <<                       " [--usemmap] [-p #] [-t #] [-b #] [-f name]\n\n"
+  <<                       " [--usemmap] [--cold|--warm] [-p #] [-t #] [-b #] [-f name]\n\n"
   << " --help                      - This message\n"
   << " --initonly                  - Initialize file, then stop\n"
   << " --noinit                    - Use previously initialized file\n"
   << " --usemmap                   - Use mmap instead of umap\n"
   << " --shuffle                   - Shuffle memory accesses (instead of sequential access)\n"
+  << " --cold                      - Evict the region and its files from memory before measuring\n"
+  << " --warm                      - Read the region into memory before measuring\n"
   << " -p # of pages               - default: " << NUMPAGES << std::endl
   << " -t # of app threads         - default: " << NUMTHREADS << std::endl
   << " -a # pages to access        - default: 0 - access all pages\n"
@@ -82,6 +87,12 @@ static void usage(char* pname)
   << " UMAP_BUFSIZE                    - currently: " << umapcfg_get_max_pages_in_buffer() << " pages\n"
   << " UMAP_EVICT_LOW_WATER_THRESHOLD  - currently: " << umapcfg_get_evict_low_water_threshold() << " percent full\n"
   << " UMAP_EVICT_HIGH_WATER_THRESHOLD - currently: " << umapcfg_get_evict_high_water_threshold() << " percent full\n"
+  << std::endl
+  << " Memory pressure (see utility/memory_pressure.hpp):\n"
+  << " MEMORY_PRESSURE_FREE            - bytes left for the run (e.g. 8G)\n"
+  << " MEMORY_PRESSURE_SCHEDULE        - seconds:bytes steps (e.g. 0:8G,10:2G)\n"
+  << " MEMORY_PRESSURE_PERIOD          - seconds after which the schedule starts over\n"
+  << " MEMORY_PRESSURE_BACKEND         - auto, cgroup or balloon\n"
   << std::endl;
   exit(1);
 }
@@ -95,6 +106,8 @@ void umt_getoptions(utility::umt_optstruct_t* testops, int argc, char *argv[])
   testops->noinit = 0;
   testops->usemmap = 0;
   testops->shuffle = 0;
+  testops->cold = 0;
+  testops->warm = 0;
   testops->pages_to_access = 0;
   testops->numpages = NUMPAGES;
   testops->numthreads = NUMTHREADS;
@@ -103,6 +116,7 @@ void umt_getoptions(utility::umt_optstruct_t* testops, int argc, char *argv[])
   testops->num_evictor_threads = umapcfg_get_num_evictors();
   testops->filename = FILENAME;
   testops->dirname = DIRNAME;
+  testops->dirname_given = 0;
   testops->numfiles = NUMFILES;
   testops->pagesize = umapcfg_get_umap_page_size();
   testops->readahead = umapcfg_get_read_ahead();
@@ -116,6 +130,8 @@ void umt_getoptions(utility::umt_optstruct_t* testops, int argc, char *argv[])
       {"noinit",    no_argument,  &testops->noinit,   1 },
       {"usemmap",   no_argument,  &testops->usemmap,  1 },
       {"shuffle",   no_argument,  &testops->shuffle,  1 },
+      {"cold",      no_argument,  &testops->cold,     1 },
+      {"warm",      no_argument,  &testops->warm,     1 },
       {"help",      no_argument,  NULL,  0 },
       {0,           0,            0,     0 }
     };
@@ -148,6 +164,7 @@ void umt_getoptions(utility::umt_optstruct_t* testops, int argc, char *argv[])
         break;
       case 'd':
         testops->dirname = optarg;
+        testops->dirname_given = 1;
         break;
       case 'f':
         testops->filename = optarg;
@@ -158,6 +175,11 @@ void umt_getoptions(utility::umt_optstruct_t* testops, int argc, char *argv[])
     }
   }
 
+  if (testops->cold && testops->warm) {
+    std::cerr << "--cold and --warm are exclusive\n";
+    usage(pname);
+  }
+
   if (testops->numpages < testops->pages_to_access) {
     std::cerr << "Invalid -a argument " << testops->pages_to_access << "\n";
     usage(pname);
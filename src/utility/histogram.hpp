@@ -0,0 +1,105 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about the latency histogram
+/// Log-linear buckets: values below 8 have their own bucket, and every power
+/// of two above is split into 8 buckets, so a bucket is at most 12.5% wide.
+/// Adding a value is a few instructions, so every thread can keep its own
+/// histogram in the timed loop; the histograms are merged afterwards.
+
+#ifndef UMAP_APPS_UTILITY_HISTOGRAM_HPP
+#define UMAP_APPS_UTILITY_HISTOGRAM_HPP
+
+#include <cstdint>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+namespace utility {
+
+class latency_histogram {
+ public:
+  static constexpr int k_sub_bits = 3;
+  static constexpr int k_num_buckets = 64 << k_sub_bits;
+
+  latency_histogram() : m_buckets(k_num_buckets, 0) {}
+
+  static int bucket_of(const uint64_t value) {
+    if (value < (1ULL << k_sub_bits)) return (int)value;
+    const int e = 63 - __builtin_clzll(value);
+    const int sub = (int)((value >> (e - k_sub_bits)) & ((1ULL << k_sub_bits) - 1));
+    return ((e - k_sub_bits + 1) << k_sub_bits) + sub;
+  }
+
+  /// \brief Smallest value that falls in bucket b
+  static uint64_t bucket_lower(const int b) {
+    if (b < (1 << k_sub_bits)) return (uint64_t)b;
+    const int e = (b >> k_sub_bits) + k_sub_bits - 1;
+    const uint64_t sub = b & ((1 << k_sub_bits) - 1);
+    return ((1ULL << k_sub_bits) + sub) << (e - k_sub_bits);
+  }
+
+  /// \brief Largest value that falls in bucket b
+  static uint64_t bucket_upper(const int b) {
+    return (b + 1 < k_num_buckets) ? bucket_lower(b + 1) - 1 : std::numeric_limits<uint64_t>::max();
+  }
+
+  void add(const uint64_t value) {
+    ++m_buckets[bucket_of(value)];
+    ++m_count;
+    m_sum += value;
+    m_min = std::min(m_min, value);
+    m_max = std::max(m_max, value);
+  }
+
+  void merge(const latency_histogram &other) {
+    for (int b = 0; b < k_num_buckets; ++b)
+      m_buckets[b] += other.m_buckets[b];
+    m_count += other.m_count;
+    m_sum += other.m_sum;
+    m_min = std::min(m_min, other.m_min);
+    m_max = std::max(m_max, other.m_max);
+  }
+
+  uint64_t count() const { return m_count; }
+  uint64_t sum() const { return m_sum; }
+  uint64_t min() const { return m_count ? m_min : 0; }
+  uint64_t max() const { return m_max; }
+  double mean() const { return m_count ? (double)m_sum / m_count : 0.0; }
+  uint64_t bucket_count(const int b) const { return m_buckets[b]; }
+
+  /// \brief Returns an upper bound of the q-quantile (q in [0, 1]), exact within a bucket
+  uint64_t percentile(const double q) const {
+    if (m_count == 0) return 0;
+    const uint64_t rank = std::min((uint64_t)(q * m_count), m_count - 1);
+    uint64_t seen = 0;
+    for (int b = 0; b < k_num_buckets; ++b) {
+      seen += m_buckets[b];
+      if (seen > rank) return std::min(bucket_upper(b), m_max);
+    }
+    return m_max;
+  }
+
+ private:
+  std::vector<uint64_t> m_buckets;
+  uint64_t m_count{0};
+  uint64_t m_sum{0};
+  uint64_t m_min{std::numeric_limits<uint64_t>::max()};
+  uint64_t m_max{0};
+};
+
+} // namespace utility
+
+#endif //UMAP_APPS_UTILITY_HISTOGRAM_HPP
@@ -0,0 +1,375 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about memory pressure
+/// Emulates a node with only N bytes of memory left for the benchmark, without
+/// root. Two backends:
+///  cgroup  - if the memory.max of the cgroup of the process is writable (a
+///            delegated cgroup v2, e.g. systemd-run --user -p Delegate=yes),
+///            it is set to the memory the cgroup uses at the start plus N. The
+///            page cache of the process is charged to the cgroup, so mmap and
+///            umap are reclaimed as on a small node. The limit is restored at
+///            the end.
+///  balloon - otherwise, anonymous memory is allocated and mlocked until N
+///            bytes of the MemAvailable at the start are left. If the mlock
+///            limit (ulimit -l) is too low, the balloon is only touched and can
+///            be swapped out; disable swap for exact results.
+/// Both are sized once from the start, not from the memory the run itself uses,
+/// so runs are repeatable. A schedule changes N during the run to emulate
+/// noisy neighbours: "0:8G,10:2G,20:8G" leaves 8 GB, 2 GB after 10 seconds,
+/// and 8 GB again after 20 seconds; with a period, it starts over.
+
+#ifndef UMAP_APPS_UTILITY_MEMORY_PRESSURE_HPP
+#define UMAP_APPS_UTILITY_MEMORY_PRESSURE_HPP
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "mmap.hpp"
+
+namespace utility {
+
+enum class pressure_backend {
+  automatic,  // cgroup if it is delegated, balloon otherwise
+  cgroup,
+  balloon
+};
+
+inline const char *pressure_backend_name(const pressure_backend b) {
+  switch (b) {
+    case pressure_backend::automatic: return "auto";
+    case pressure_backend::cgroup: return "cgroup";
+    case pressure_backend::balloon: return "balloon";
+  }
+  return "unknown";
+}
+
+inline bool parse_pressure_backend(const std::string &name, pressure_backend *b) {
+  for (const pressure_backend candidate :
+       {pressure_backend::automatic, pressure_backend::cgroup, pressure_backend::balloon}) {
+    if (name == pressure_backend_name(candidate)) {
+      *b = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+/// \brief From `at_sec` seconds after the start of the schedule, leave `free_bytes`
+struct pressure_step {
+  double at_sec{0.0};
+  std::size_t free_bytes{0};
+};
+
+/// \brief Parses a size such as 4096, 512K, 64M or 8G
+inline bool parse_bytes(const std::string &text, std::size_t *bytes) {
+  char *end = nullptr;
+  const double value = std::strtod(text.c_str(), &end);
+  if (end == text.c_str() || value < 0.0) return false;
+  std::size_t unit = 1;
+  const std::string suffix(end);
+  if (suffix == "K" || suffix == "k") unit = 1ULL << 10;
+  else if (suffix == "M" || suffix == "m") unit = 1ULL << 20;
+  else if (suffix == "G" || suffix == "g") unit = 1ULL << 30;
+  else if (suffix == "T" || suffix == "t") unit = 1ULL << 40;
+  else if (!suffix.empty()) return false;
+  *bytes = (std::size_t)(value * unit);
+  return true;
+}
+
+/// \brief Parses a schedule such as "0:8G,10:2G,20:8G"; the times must increase
+inline bool parse_pressure_schedule(const std::string &text, std::vector<pressure_step> *steps) {
+  steps->clear();
+  std::stringstream ss(text);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    const std::size_t colon = item.find(':');
+    if (colon == std::string::npos) return false;
+    pressure_step step;
+    char *end = nullptr;
+    step.at_sec = std::strtod(item.c_str(), &end);
+    if (end != item.c_str() + colon || step.at_sec < 0.0) return false;
+    if (!parse_bytes(item.substr(colon + 1), &step.free_bytes)) return false;
+    if (!steps->empty() && step.at_sec <= steps->back().at_sec) return false;
+    steps->push_back(step);
+  }
+  return !steps->empty();
+}
+
+namespace pressure_detail {
+
+/// \brief The balloon grows by mappings of up to this size
+const std::size_t k_balloon_chunk_bytes = 64ULL << 20;
+
+/// \brief The directory of the cgroup v2 of the process, or "" if it has none
+inline std::string own_cgroup_dir() {
+  std::ifstream ifs("/proc/self/cgroup");
+  std::string line;
+  while (std::getline(ifs, line)) {
+    if (line.compare(0, 3, "0::") != 0) continue;
+    const std::string path = line.substr(3);
+    // The unified hierarchy is at /sys/fs/cgroup, or at /sys/fs/cgroup/unified on hybrid systems
+    for (const std::string root : {"/sys/fs/cgroup", "/sys/fs/cgroup/unified"}) {
+      if (::access((root + "/cgroup.controllers").c_str(), F_OK) == 0)
+        return root + (path == "/" ? "" : path);
+    }
+  }
+  return std::string();
+}
+
+inline bool read_value(const std::string &file_name, std::string *value) {
+  std::ifstream ifs(file_name);
+  return static_cast<bool>(std::getline(ifs, *value));
+}
+
+inline bool write_value(const std::string &file_name, const std::string &value) {
+  std::ofstream ofs(file_name);
+  ofs << value << std::endl;
+  return static_cast<bool>(ofs);
+}
+
+} // namespace pressure_detail
+
+class memory_pressure {
+ public:
+  /// \brief Chooses the backend; nothing is held until set_free_bytes() or start_schedule()
+  explicit memory_pressure(const pressure_backend preferred = pressure_backend::automatic) {
+    if (preferred != pressure_backend::balloon) {
+      const std::string dir = pressure_detail::own_cgroup_dir();
+      std::string current;
+      if (!dir.empty() && ::access((dir + "/memory.max").c_str(), W_OK) == 0
+          && pressure_detail::read_value(dir + "/memory.max", &m_original_max)
+          && pressure_detail::read_value(dir + "/memory.current", &current)) {
+        m_backend = pressure_backend::cgroup;
+        m_cgroup_dir = dir;
+        m_reference_bytes = std::stoull(current);
+      } else if (preferred == pressure_backend::cgroup) {
+        std::cerr << "memory_pressure: memory.max of the cgroup of the process is not writable"
+                  << " (a delegated cgroup v2 is required)" << std::endl;
+        std::exit(1);
+      }
+    }
+    if (m_backend != pressure_backend::cgroup) {
+      m_backend = pressure_backend::balloon;
+      m_reference_bytes = get_meminfo_bytes("MemAvailable");
+      // Try to lock as much as allowed
+      struct rlimit limit;
+      if (::getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        ::setrlimit(RLIMIT_MEMLOCK, &limit);
+      }
+    }
+  }
+
+  ~memory_pressure() {
+    stop_schedule();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_backend == pressure_backend::cgroup)
+      pressure_detail::write_value(m_cgroup_dir + "/memory.max", m_original_max);
+    else
+      resize_balloon(0);
+  }
+
+  memory_pressure(const memory_pressure &) = delete;
+  memory_pressure &operator=(const memory_pressure &) = delete;
+
+  pressure_backend backend() const { return m_backend; }
+
+  /// \brief MemAvailable (balloon) or memory.current (cgroup) at the start
+  std::size_t reference_bytes() const { return m_reference_bytes; }
+
+  std::size_t free_bytes() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_free_bytes;
+  }
+
+  std::size_t balloon_bytes() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_balloon_bytes;
+  }
+
+  /// \brief Leaves free_bytes for the process; returns false if it could not
+  bool set_free_bytes(const std::size_t free_bytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_free_bytes = free_bytes;
+    if (m_backend == pressure_backend::cgroup) {
+      if (!pressure_detail::write_value(m_cgroup_dir + "/memory.max", std::to_string(m_reference_bytes + free_bytes))) {
+        std::cerr << "memory_pressure: failed to write " << m_cgroup_dir << "/memory.max" << std::endl;
+        return false;
+      }
+      return true;
+    }
+    if (free_bytes > m_reference_bytes) {
+      std::cerr << "memory_pressure: only " << m_reference_bytes << " bytes were available, not "
+                << free_bytes << std::endl;
+    }
+    return resize_balloon(free_bytes < m_reference_bytes ? m_reference_bytes - free_bytes : 0);
+  }
+
+  /// \brief Follows the schedule in a thread, and starts over every period_sec if it is not 0
+  void start_schedule(const std::vector<pressure_step> &steps, const double period_sec = 0.0) {
+    stop_schedule();
+    m_stop = false;
+    m_thread = std::thread([this, steps, period_sec]() {
+      const auto start = std::chrono::steady_clock::now();
+      for (double base = 0.0; ; base += period_sec) {
+        for (const auto &step : steps) {
+          const auto at = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+              std::chrono::duration<double>(base + step.at_sec));
+          std::unique_lock<std::mutex> lock(m_stop_mutex);
+          if (m_stop_cv.wait_until(lock, at, [this]() { return m_stop; })) return;
+          lock.unlock();
+          set_free_bytes(step.free_bytes);
+        }
+        if (period_sec <= 0.0) return;
+      }
+    });
+  }
+
+  void stop_schedule() {
+    if (!m_thread.joinable()) return;
+    {
+      std::lock_guard<std::mutex> lock(m_stop_mutex);
+      m_stop = true;
+    }
+    m_stop_cv.notify_all();
+    m_thread.join();
+  }
+
+ private:
+  /// \brief Grows or shrinks the balloon to bytes; called with m_mutex held
+  bool resize_balloon(const std::size_t bytes) {
+    const std::size_t page_size = ::sysconf(_SC_PAGE_SIZE);
+    const std::size_t target = (bytes / page_size) * page_size;
+
+    while (m_balloon_bytes < target) {
+      const std::size_t size = std::min(pressure_detail::k_balloon_chunk_bytes, target - m_balloon_bytes);
+      void *chunk = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (chunk == MAP_FAILED) {
+        ::perror("memory_pressure: mmap");
+        return false;
+      }
+      if (::mlock(chunk, size) != 0) {
+        if (m_locked) {
+          std::cerr << "memory_pressure: mlock failed (" << std::strerror(errno)
+                    << "); the balloon can be swapped out" << std::endl;
+          m_locked = false;
+        }
+      }
+      // Distinct from the zero page, and not compressible to nothing
+      std::memset(chunk, 0xA5, size);
+      m_chunks.emplace_back(chunk, size);
+      m_balloon_bytes += size;
+    }
+
+    while (m_balloon_bytes > target) {
+      auto &last = m_chunks.back();
+      const std::size_t release = std::min(last.second, m_balloon_bytes - target);
+      ::munmap(static_cast<char *>(last.first) + last.second - release, release);
+      last.second -= release;
+      m_balloon_bytes -= release;
+      if (last.second == 0) m_chunks.pop_back();
+    }
+    return true;
+  }
+
+  pressure_backend m_backend{pressure_backend::balloon};
+  std::string m_cgroup_dir;
+  std::string m_original_max;
+  std::size_t m_reference_bytes{0};
+  std::size_t m_free_bytes{0};
+
+  mutable std::mutex m_mutex;
+  std::vector<std::pair<void *, std::size_t>> m_chunks;
+  std::size_t m_balloon_bytes{0};
+  bool m_locked{true};
+
+  std::thread m_thread;
+  std::mutex m_stop_mutex;
+  std::condition_variable m_stop_cv;
+  bool m_stop{false};
+};
+
+/// \brief Memory pressure configured by environment variables, or nullptr if none is asked for
+///  MEMORY_PRESSURE_FREE     - bytes to leave (e.g. 8G)
+///  MEMORY_PRESSURE_SCHEDULE - seconds:bytes steps (e.g. 0:8G,10:2G); overrides MEMORY_PRESSURE_FREE
+///  MEMORY_PRESSURE_PERIOD   - seconds after which the schedule starts over (default: 0, once)
+///  MEMORY_PRESSURE_BACKEND  - auto, cgroup or balloon (default: auto)
+/// Exits on invalid values.
+inline std::unique_ptr<memory_pressure> memory_pressure_from_env() {
+  std::unique_ptr<memory_pressure> pressure;
+  const char *free_text = std::getenv("MEMORY_PRESSURE_FREE");
+  const char *schedule_text = std::getenv("MEMORY_PRESSURE_SCHEDULE");
+  if (free_text == nullptr && schedule_text == nullptr) return pressure;
+
+  pressure_backend backend = pressure_backend::automatic;
+  const char *buf = std::getenv("MEMORY_PRESSURE_BACKEND");
+  if (buf != nullptr && !parse_pressure_backend(buf, &backend)) {
+    std::cerr << "Invalid MEMORY_PRESSURE_BACKEND: " << buf << std::endl;
+    std::exit(1);
+  }
+  double period_sec = 0.0;
+  buf = std::getenv("MEMORY_PRESSURE_PERIOD");
+  if (buf != nullptr) period_sec = std::atof(buf);
+
+  std::vector<pressure_step> steps;
+  if (schedule_text != nullptr) {
+    if (!parse_pressure_schedule(schedule_text, &steps)) {
+      std::cerr << "Invalid MEMORY_PRESSURE_SCHEDULE: " << schedule_text << std::endl;
+      std::exit(1);
+    }
+    if (period_sec > 0.0 && period_sec <= steps.back().at_sec) {
+      std::cerr << "MEMORY_PRESSURE_PERIOD must be longer than the schedule" << std::endl;
+      std::exit(1);
+    }
+  } else {
+    pressure_step step;
+    if (!parse_bytes(free_text, &step.free_bytes)) {
+      std::cerr << "Invalid MEMORY_PRESSURE_FREE: " << free_text << std::endl;
+      std::exit(1);
+    }
+    steps.push_back(step);
+  }
+
+  pressure.reset(new memory_pressure(backend));
+  // The first step is in place before the run starts
+  if (steps.front().at_sec == 0.0) pressure->set_free_bytes(steps.front().free_bytes);
+  if (steps.size() > 1 || steps.front().at_sec > 0.0 || period_sec > 0.0) pressure->start_schedule(steps, period_sec);
+  std::cerr << "Memory pressure (" << pressure_backend_name(pressure->backend()) << "): "
+            << (schedule_text != nullptr ? schedule_text : free_text) << " free" << std::endl;
+  return pressure;
+}
+
+} // namespace utility
+
+#endif //UMAP_APPS_UTILITY_MEMORY_PRESSURE_HPP
@@ -0,0 +1,456 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about metrics
+/// A metrics registry collects counters, histograms (see histogram.hpp) and
+/// the time of named phases per thread. Every phase_recorder (see phase.hpp)
+/// owns one: the phases of the recorder are its top-level phases, and the
+/// recorder exports both as one text, JSON or CSV report.
+///  - tsc_clock reads the TSC when it is invariant (constant_tsc and
+///    nonstop_tsc in /proc/cpuinfo), calibrated once against CLOCK_MONOTONIC;
+///    otherwise it reads CLOCK_MONOTONIC.
+///  - Every OpenMP thread writes to its own slot only, and the slots are
+///    padded, so that no two threads write to the same cache line; the slots
+///    are merged when the report is made. Not for nested parallel regions;
+///    the workers of a task_scheduler use slot(worker index) instead.
+///  - Counters and histograms are registered by name before the parallel
+///    regions that use them; the returned ids index the slots.
+///  - Phases nest: begin("BFS") and then begin("level 3") times "BFS/level 3".
+///    Every thread has its own stack of phases; the time of a phase is
+///    reported as the sum over the threads and as the longest thread.
+
+#ifndef UMAP_APPS_UTILITY_METRICS_HPP
+#define UMAP_APPS_UTILITY_METRICS_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "histogram.hpp"
+
+namespace utility {
+
+namespace metrics_detail {
+
+inline uint64_t monotonic_ns() {
+  struct timespec ts;
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/// \brief Whether the TSC ticks at a constant rate, also in deep C-states
+inline bool has_invariant_tsc() {
+  std::ifstream ifs("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(ifs, line)) {
+    if (line.compare(0, 5, "flags") != 0) continue;
+    line += " ";
+    return line.find(" constant_tsc ") != std::string::npos && line.find(" nonstop_tsc ") != std::string::npos;
+  }
+  return false;
+}
+
+struct clock_source {
+  bool tsc{false};
+  uint64_t base_ticks{0};
+  double ns_per_tick{1.0};
+};
+
+inline clock_source calibrate() {
+  clock_source source;
+#if defined(__x86_64__) || defined(__i386__)
+  if (has_invariant_tsc()) {
+    // 10 ms against CLOCK_MONOTONIC: better than 0.01% on an idle CPU
+    const uint64_t ns0 = monotonic_ns();
+    const uint64_t tick0 = __rdtsc();
+    uint64_t ns1;
+    while ((ns1 = monotonic_ns()) - ns0 < 10000000ULL) {}
+    const uint64_t tick1 = __rdtsc();
+    source.tsc = true;
+    source.base_ticks = tick0;
+    source.ns_per_tick = (double)(ns1 - ns0) / (tick1 - tick0);
+    return source;
+  }
+#endif
+  source.base_ticks = monotonic_ns();
+  return source;
+}
+
+inline const clock_source &source() {
+  static const clock_source s = calibrate();
+  return s;
+}
+
+/// \brief Quotes a string for JSON and CSV (the names used here have no quotes or control characters)
+inline std::string quote(const std::string &text) {
+  return "\"" + text + "\"";
+}
+
+} // namespace metrics_detail
+
+/// \brief Cheap timestamps: the TSC if it is invariant, CLOCK_MONOTONIC otherwise
+struct tsc_clock {
+  static uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    if (metrics_detail::source().tsc) return __rdtsc();
+#endif
+    return metrics_detail::monotonic_ns();
+  }
+
+  static double ns_per_tick() { return metrics_detail::source().ns_per_tick; }
+
+  /// \brief Nanoseconds since the calibration; differences are durations
+  static uint64_t ns() { return (uint64_t)((ticks() - metrics_detail::source().base_ticks) * ns_per_tick()); }
+
+  static double seconds(const uint64_t ticks) { return ticks * ns_per_tick() / 1e9; }
+
+  static bool uses_tsc() { return metrics_detail::source().tsc; }
+};
+
+class metrics {
+ public:
+  typedef std::size_t id;
+
+  /// \brief Time spent in a phase by one thread, or merged over the threads
+  struct phase_stat {
+    uint64_t calls{0};
+    uint64_t ticks{0};      // sum over the threads
+    uint64_t max_ticks{0};  // longest thread
+    uint64_t threads{0};
+  };
+
+  /// \brief What one thread records; get it once per parallel region with local()
+  class thread_slot {
+   public:
+    void add(const id counter, const uint64_t value = 1) { m_counters[k_pad + counter] += value; }
+
+    void record(const id histogram, const uint64_t value) { m_histograms[histogram]->h.add(value); }
+
+    void begin(const std::string &name) {
+      m_path_lengths.push_back(m_path.size());
+      if (!m_path.empty()) m_path += "/";
+      m_path += name;
+      // Phases are reported in the order they first begin, so parents come before their children
+      if (m_phases.find(m_path) == m_phases.end()) {
+        m_phase_order.push_back(m_path);
+        m_phases.emplace(m_path, phase_stat());
+      }
+      m_starts.push_back(tsc_clock::ticks());
+    }
+
+    void end() {
+      if (m_starts.empty()) return;
+      const uint64_t elapsed = tsc_clock::ticks() - m_starts.back();
+      phase_stat &stat = m_phases[m_path];
+      ++stat.calls;
+      stat.ticks += elapsed;
+      m_path.resize(m_path_lengths.back());
+      m_path_lengths.pop_back();
+      m_starts.pop_back();
+    }
+
+   private:
+    friend class metrics;
+    // Words before and after the counters of a thread, so that no cache line holds counters of two threads
+    static const std::size_t k_pad = 8;
+
+    struct padded_histogram {
+      char before[64];
+      latency_histogram h;
+      char after[64];
+    };
+
+    thread_slot() : m_counters(2 * k_pad, 0) {}
+
+    std::vector<uint64_t> m_counters;
+    std::vector<std::unique_ptr<padded_histogram>> m_histograms;
+    std::string m_path;
+    std::vector<std::size_t> m_path_lengths;
+    std::vector<uint64_t> m_starts;
+    std::map<std::string, phase_stat> m_phases;
+    std::vector<std::string> m_phase_order;
+  };
+
+  /// \brief Times a phase of the calling thread until the end of the scope
+  class scoped_phase {
+   public:
+    scoped_phase(thread_slot &slot, const std::string &name) : m_slot(&slot) { m_slot->begin(name); }
+    scoped_phase(scoped_phase &&other) : m_slot(other.m_slot) { other.m_slot = nullptr; }
+    ~scoped_phase() { if (m_slot) m_slot->end(); }
+
+   private:
+    thread_slot *m_slot;
+  };
+
+  /// \param num_threads Slots; 0: enough for every OpenMP thread
+  explicit metrics(const std::string &program, std::size_t num_threads = 0) : m_program(program) {
+    tsc_clock::ticks();  // calibrates the clock before any phase starts
+    if (num_threads == 0) {
+#ifdef _OPENMP
+      num_threads = std::max(omp_get_max_threads(), omp_get_num_procs());
+#else
+      num_threads = 1;
+#endif
+    }
+    for (std::size_t t = 0; t < num_threads; ++t)
+      m_slots.emplace_back(new thread_slot());
+  }
+
+  metrics(const metrics &) = delete;
+  metrics &operator=(const metrics &) = delete;
+
+  /// \brief Registers a counter (or returns the one of that name); not in a parallel region
+  id counter(const std::string &name) {
+    for (id i = 0; i < m_counter_names.size(); ++i)
+      if (m_counter_names[i] == name) return i;
+    m_counter_names.push_back(name);
+    for (auto &slot : m_slots)
+      slot->m_counters.insert(slot->m_counters.end() - thread_slot::k_pad, 0);
+    return m_counter_names.size() - 1;
+  }
+
+  /// \brief Registers a histogram (or returns the one of that name); not in a parallel region
+  /// \param unit Unit of the values, for the report (e.g. "ns" for tsc_clock::ns() differences)
+  id histogram(const std::string &name, const std::string &unit = "") {
+    for (id i = 0; i < m_histogram_names.size(); ++i)
+      if (m_histogram_names[i] == name) return i;
+    m_histogram_names.push_back(name);
+    m_histogram_units.push_back(unit);
+    for (auto &slot : m_slots)
+      slot->m_histograms.emplace_back(new thread_slot::padded_histogram());
+    return m_histogram_names.size() - 1;
+  }
+
+  /// \brief The slot of the calling thread
+  thread_slot &local() {
+#ifdef _OPENMP
+    return *m_slots[omp_get_thread_num() % m_slots.size()];
+#else
+    return *m_slots[0];
+#endif
+  }
+
+  /// \brief The slot of a thread that is not numbered by OpenMP, e.g. a task_scheduler worker
+  thread_slot &slot(const std::size_t thread) { return *m_slots[thread % m_slots.size()]; }
+
+  void add(const id counter, const uint64_t value = 1) { local().add(counter, value); }
+  void record(const id histogram, const uint64_t value) { local().record(histogram, value); }
+  void begin(const std::string &name) { local().begin(name); }
+  void end() { local().end(); }
+  scoped_phase phase(const std::string &name) { return scoped_phase(local(), name); }
+
+  /// \brief Sum of a counter over the threads
+  uint64_t total(const id counter) const {
+    uint64_t sum = 0;
+    for (const auto &slot : m_slots) sum += slot->m_counters[thread_slot::k_pad + counter];
+    return sum;
+  }
+
+  /// \brief A histogram merged over the threads
+  latency_histogram merged(const id histogram) const {
+    latency_histogram h;
+    for (const auto &slot : m_slots) h.merge(slot->m_histograms[histogram]->h);
+    return h;
+  }
+
+  /// \brief Phases merged over the threads, in the order they were first seen
+  std::vector<std::pair<std::string, phase_stat>> phases() const {
+    std::vector<std::pair<std::string, phase_stat>> merged;
+    for (const auto &slot : m_slots) {
+      for (const auto &path : slot->m_phase_order) {
+        const phase_stat &s = slot->m_phases.at(path);
+        auto found = std::find_if(merged.begin(), merged.end(),
+                                  [&path](const std::pair<std::string, phase_stat> &p) { return p.first == path; });
+        if (found == merged.end()) {
+          merged.emplace_back(path, phase_stat());
+          found = merged.end() - 1;
+        }
+        found->second.calls += s.calls;
+        found->second.ticks += s.ticks;
+        found->second.max_ticks = std::max(found->second.max_ticks, s.ticks);
+        ++found->second.threads;
+      }
+    }
+    return merged;
+  }
+
+  /// \brief Whether anything was recorded besides the phases of the master thread
+  bool detailed() const {
+    if (!m_counter_names.empty() || !m_histogram_names.empty()) return true;
+    for (const auto &p : phases())
+      if (p.second.threads > 1 || p.first.find('/') != std::string::npos) return true;
+    return false;
+  }
+
+  void print(std::ostream &os) const {
+    char line[256];
+    std::snprintf(line, sizeof(line), "Metrics of %s (%lu thread slots, clock: %s, %.4f ns/tick)\n",
+                  m_program.c_str(), (unsigned long)m_slots.size(),
+                  tsc_clock::uses_tsc() ? "TSC" : "CLOCK_MONOTONIC", tsc_clock::ns_per_tick());
+    os << line;
+
+    const auto merged_phases = phases();
+    if (!merged_phases.empty()) {
+      std::snprintf(line, sizeof(line), "%-36s %10s %8s %12s %12s\n", "Phase", "Calls", "Threads", "Sum(s)",
+                    "Longest(s)");
+      os << line;
+      for (const auto &p : merged_phases) {
+        // Nested phases are indented under their parent
+        const std::size_t depth = std::count(p.first.begin(), p.first.end(), '/');
+        const std::size_t slash = p.first.rfind('/');
+        const std::string label = std::string(2 * depth, ' ')
+            + (slash == std::string::npos ? p.first : p.first.substr(slash + 1));
+        std::snprintf(line, sizeof(line), "%-36s %10lu %8lu %12.6f %12.6f\n", label.c_str(),
+                      (unsigned long)p.second.calls, (unsigned long)p.second.threads,
+                      tsc_clock::seconds(p.second.ticks), tsc_clock::seconds(p.second.max_ticks));
+        os << line;
+      }
+    }
+
+    if (!m_counter_names.empty()) {
+      std::snprintf(line, sizeof(line), "%-36s %16s %16s %16s\n", "Counter", "Total", "Min/thread", "Max/thread");
+      os << line;
+      for (id c = 0; c < m_counter_names.size(); ++c) {
+        uint64_t min = UINT64_MAX;
+        uint64_t max = 0;
+        for (const auto &slot : m_slots) {
+          const uint64_t v = slot->m_counters[thread_slot::k_pad + c];
+          if (v == 0) continue;  // idle slots
+          min = std::min(min, v);
+          max = std::max(max, v);
+        }
+        std::snprintf(line, sizeof(line), "%-36s %16lu %16lu %16lu\n", m_counter_names[c].c_str(),
+                      (unsigned long)total(c), (unsigned long)(max ? min : 0), (unsigned long)max);
+        os << line;
+      }
+    }
+
+    if (!m_histogram_names.empty()) {
+      std::snprintf(line, sizeof(line), "%-36s %12s %10s %10s %10s %10s %10s %10s\n", "Histogram", "Count", "Mean",
+                    "p50", "p90", "p99", "p99.9", "Max");
+      os << line;
+      for (id i = 0; i < m_histogram_names.size(); ++i) {
+        const latency_histogram h = merged(i);
+        const std::string label = m_histogram_names[i]
+            + (m_histogram_units[i].empty() ? "" : " (" + m_histogram_units[i] + ")");
+        std::snprintf(line, sizeof(line), "%-36s %12lu %10.0f %10lu %10lu %10lu %10lu %10lu\n", label.c_str(),
+                      (unsigned long)h.count(), h.mean(), (unsigned long)h.percentile(0.5),
+                      (unsigned long)h.percentile(0.9), (unsigned long)h.percentile(0.99),
+                      (unsigned long)h.percentile(0.999), (unsigned long)h.max());
+        os << line;
+      }
+    }
+    os << std::flush;
+  }
+
+  /// \brief The report as one JSON object
+  std::string to_json() const {
+    using metrics_detail::quote;
+    std::ostringstream ss;
+    ss << "{\"clock\":" << quote(tsc_clock::uses_tsc() ? "tsc" : "monotonic")
+       << ",\"ns_per_tick\":" << tsc_clock::ns_per_tick() << ",\"threads\":" << m_slots.size();
+
+    ss << ",\"thread_phases\":[";
+    const auto merged_phases = phases();
+    for (std::size_t i = 0; i < merged_phases.size(); ++i) {
+      const phase_stat &s = merged_phases[i].second;
+      ss << (i ? "," : "") << "{\"path\":" << quote(merged_phases[i].first) << ",\"calls\":" << s.calls
+         << ",\"threads\":" << s.threads << ",\"sum_sec\":" << tsc_clock::seconds(s.ticks)
+         << ",\"longest_sec\":" << tsc_clock::seconds(s.max_ticks) << "}";
+    }
+
+    ss << "],\"counters\":[";
+    for (id c = 0; c < m_counter_names.size(); ++c) {
+      ss << (c ? "," : "") << "{\"name\":" << quote(m_counter_names[c]) << ",\"total\":" << total(c)
+         << ",\"per_thread\":[";
+      for (std::size_t t = 0; t < m_slots.size(); ++t)
+        ss << (t ? "," : "") << m_slots[t]->m_counters[thread_slot::k_pad + c];
+      ss << "]}";
+    }
+
+    ss << "],\"histograms\":[";
+    for (id i = 0; i < m_histogram_names.size(); ++i) {
+      const latency_histogram h = merged(i);
+      ss << (i ? "," : "") << "{\"name\":" << quote(m_histogram_names[i]) << ",\"unit\":"
+         << quote(m_histogram_units[i]) << ",\"count\":" << h.count() << ",\"mean\":" << h.mean()
+         << ",\"min\":" << h.min() << ",\"p50\":" << h.percentile(0.5) << ",\"p90\":" << h.percentile(0.9)
+         << ",\"p99\":" << h.percentile(0.99) << ",\"p999\":" << h.percentile(0.999) << ",\"max\":" << h.max()
+         << "}";
+    }
+    ss << "]}";
+    return ss.str();
+  }
+
+  /// \brief The report as CSV lines of program,section,name,thread,stat,value ("all" threads for merged values)
+  std::string to_csv() const {
+    std::ostringstream ss;
+    auto row = [&](const char *section, const std::string &name, const std::string &thread, const char *stat,
+                   const double value) {
+      ss << m_program << "," << section << "," << name << "," << thread << "," << stat << "," << value << "\n";
+    };
+
+    for (const auto &p : phases()) {
+      row("phase", p.first, "all", "calls", p.second.calls);
+      row("phase", p.first, "all", "threads", p.second.threads);
+      row("phase", p.first, "all", "sum_sec", tsc_clock::seconds(p.second.ticks));
+      row("phase", p.first, "all", "longest_sec", tsc_clock::seconds(p.second.max_ticks));
+    }
+    for (id c = 0; c < m_counter_names.size(); ++c) {
+      row("counter", m_counter_names[c], "all", "total", total(c));
+      for (std::size_t t = 0; t < m_slots.size(); ++t)
+        row("counter", m_counter_names[c], std::to_string(t), "value", m_slots[t]->m_counters[thread_slot::k_pad + c]);
+    }
+    for (id i = 0; i < m_histogram_names.size(); ++i) {
+      const latency_histogram h = merged(i);
+      row("histogram", m_histogram_names[i], "all", "count", h.count());
+      row("histogram", m_histogram_names[i], "all", "mean", h.mean());
+      row("histogram", m_histogram_names[i], "all", "min", h.min());
+      row("histogram", m_histogram_names[i], "all", "p50", h.percentile(0.5));
+      row("histogram", m_histogram_names[i], "all", "p90", h.percentile(0.9));
+      row("histogram", m_histogram_names[i], "all", "p99", h.percentile(0.99));
+      row("histogram", m_histogram_names[i], "all", "p999", h.percentile(0.999));
+      row("histogram", m_histogram_names[i], "all", "max", h.max());
+    }
+    return ss.str();
+  }
+
+ private:
+  std::string m_program;
+  std::vector<std::unique_ptr<thread_slot>> m_slots;
+  std::vector<std::string> m_counter_names;
+  std::vector<std::string> m_histogram_names;
+  std::vector<std::string> m_histogram_units;
+};
+
+} // namespace utility
+
+#endif //UMAP_APPS_UTILITY_METRICS_HPP
@@ -24,6 +24,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include <fcntl.h>
 #include <iostream>
 #include <cstddef>
+#include <cstdint>
+#include <string>
 
 #include "file.hpp"
 
@@ -158,6 +160,15 @@ inline void munmap(void *const addr, const size_t length, const bool call_msync)
   }
 }
 
+/// \brief Reads one byte of every page of a range, so that the pages are faulted in
+inline void touch_pages(const void *const addr, const size_t length) {
+  if (length == 0) return;
+  static const std::size_t page_size = get_page_size();
+  const uintptr_t last = reinterpret_cast<uintptr_t>(addr) + length;
+  for (uintptr_t p = reinterpret_cast<uintptr_t>(addr); p < last; p = (p / page_size + 1) * page_size)
+    static_cast<void>(*reinterpret_cast<const volatile char *>(p));
+}
+
 /// \brief Returns the number of page faults caused by the process
 /// \return A pair of #of minor and major page faults
 inline std::pair<std::size_t, std::size_t> get_num_page_faults()
@@ -181,6 +192,91 @@ inline std::pair<std::size_t, std::size_t> get_num_page_faults()
 #endif
   return std::make_pair(minflt, majflt);
 }
+
+/// \brief Returns the number of bytes the process caused to be read from
+/// and written to the storage layer (read_bytes and write_bytes in /proc/self/io)
+/// \return A pair of #of bytes read and written
+inline std::pair<std::size_t, std::size_t> get_io_bytes()
+{
+  std::size_t read_bytes = 0;
+  std::size_t write_bytes = 0;
+#ifdef __linux__
+  FILE *f = ::fopen("/proc/self/io", "r");
+  if (f) {
+    char name[64];
+    std::size_t value;
+    while (::fscanf(f, "%63[^:]: %lu\n", name, &value) == 2) {
+      if (std::string(name) == "read_bytes") read_bytes = value;
+      else if (std::string(name) == "write_bytes") write_bytes = value;
+    }
+    fclose(f);
+  } else {
+    std::cerr << "Failed to open /proc/self/io" << std::endl;
+  }
+#else
+#warning "get_io_bytes() is not supported in this environment"
+#endif
+  return std::make_pair(read_bytes, write_bytes);
+}
+
+/// \brief Memory of the process in bytes, from /proc/self/smaps_rollup
+struct memory_footprint {
+  std::size_t rss{0};
+  std::size_t pss{0};            // shared pages are split between the processes mapping them
+  std::size_t shared{0};         // resident pages also mapped by another process
+  std::size_t private_bytes{0};  // resident pages mapped by this process only
+};
+
+inline memory_footprint get_memory_footprint()
+{
+  memory_footprint footprint;
+#ifdef __linux__
+  FILE *f = ::fopen("/proc/self/smaps_rollup", "r");
+  if (f) {
+    char line[256];
+    while (::fgets(line, sizeof(line), f)) {
+      char name[64];
+      std::size_t kb;
+      if (::sscanf(line, "%63[^:]: %lu kB", name, &kb) != 2) continue;
+      const std::string key(name);
+      if (key == "Rss") footprint.rss = kb * 1024;
+      else if (key == "Pss") footprint.pss = kb * 1024;
+      else if (key == "Shared_Clean" || key == "Shared_Dirty") footprint.shared += kb * 1024;
+      else if (key == "Private_Clean" || key == "Private_Dirty") footprint.private_bytes += kb * 1024;
+    }
+    fclose(f);
+  } else {
+    std::cerr << "Failed to open /proc/self/smaps_rollup" << std::endl;
+  }
+#else
+#warning "get_memory_footprint() is not supported in this environment"
+#endif
+  return footprint;
+}
+
+/// \brief Returns a field of /proc/meminfo (e.g. "Cached") in bytes, or 0
+inline std::size_t get_meminfo_bytes(const std::string &field)
+{
+  std::size_t bytes = 0;
+#ifdef __linux__
+  FILE *f = ::fopen("/proc/meminfo", "r");
+  if (f) {
+    char line[256];
+    while (::fgets(line, sizeof(line), f)) {
+      char name[64];
+      std::size_t kb;
+      if (::sscanf(line, "%63[^:]: %lu", name, &kb) == 2 && field == name) {
+        bytes = kb * 1024;
+        break;
+      }
+    }
+    fclose(f);
+  }
+#else
+#warning "get_meminfo_bytes() is not supported in this environment"
+#endif
+  return bytes;
+}
 } // namespace utility
 
 #endif //SIMPLE_BFS_MMAP_UTILITY_HPP
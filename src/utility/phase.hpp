@@ -0,0 +1,272 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about phases
+/// A phase_recorder splits a run into named phases and records, for every
+/// phase, wall time (tsc_clock), CPU time of the whole process (application
+/// and umap threads), bytes read from and written to storage (/proc/self/io)
+/// and minor/major page faults (/proc/self/stat).
+/// It owns the metrics registry of the run (see metrics.hpp): its phases are
+/// the top-level phases of the registry, and the phases an app begins in the
+/// registry while one of them runs are nested under it.
+/// finish() prints the phases and the metrics to stderr and, if the
+/// PHASE_LOG_FILE environment variable is set, appends them to that file:
+/// one JSON line per run with the run attributes, the phases and the metrics
+/// by default, CSV if the name ends with .csv, text if it ends with .txt;
+/// $PHASE_LOG_FORMAT (json|csv|text) overrides the name.
+
+#ifndef UMAP_APPS_UTILITY_PHASE_HPP
+#define UMAP_APPS_UTILITY_PHASE_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <utility>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "mmap.hpp"
+#include "metrics.hpp"
+
+namespace utility {
+
+/// \brief Resources used by one phase
+struct phase_record {
+  std::string name;
+  double wall_sec{0.0};
+  double cpu_sec{0.0};
+  uint64_t read_bytes{0};
+  uint64_t write_bytes{0};
+  uint64_t minor_faults{0};
+  uint64_t major_faults{0};
+  uint64_t data_bytes{0};  // bytes of data processed by the phase (0 if not meaningful)
+};
+
+/// \brief Returns the user + system CPU time of the process (all threads) in seconds
+inline double get_process_cpu_time() {
+  struct rusage usage;
+  if (::getrusage(RUSAGE_SELF, &usage) != 0) {
+    ::perror("getrusage");
+    return 0.0;
+  }
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+      + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+namespace phase_detail {
+
+/// \brief Returns the text after "key": in a flat JSON object, or an empty string
+inline std::string json_value(const std::string &object, const std::string &key) {
+  const std::string quoted = "\"" + key + "\":";
+  const std::size_t pos = object.find(quoted);
+  if (pos == std::string::npos) return std::string();
+  std::size_t begin = pos + quoted.size();
+  if (begin < object.size() && object[begin] == '"') {
+    const std::size_t end = object.find('"', begin + 1);
+    return object.substr(begin + 1, end - begin - 1);
+  }
+  const std::size_t end = object.find_first_of(",}", begin);
+  return object.substr(begin, end - begin);
+}
+
+} // namespace phase_detail
+
+/// \brief Reads the phases back from a line written by phase_recorder::to_json()
+inline std::vector<phase_record> parse_phase_records(const std::string &json) {
+  std::vector<phase_record> records;
+  std::size_t pos = json.find("\"phases\":[");
+  if (pos == std::string::npos) return records;
+  // The metrics of the run follow the phases
+  const std::size_t list_end = json.find(']', pos);
+  while ((pos = json.find('{', pos)) != std::string::npos && pos < list_end) {
+    const std::size_t end = json.find('}', pos);
+    if (end == std::string::npos) break;
+    const std::string object = json.substr(pos, end - pos + 1);
+    phase_record r;
+    r.name = phase_detail::json_value(object, "name");
+    r.wall_sec = std::atof(phase_detail::json_value(object, "wall_sec").c_str());
+    r.cpu_sec = std::atof(phase_detail::json_value(object, "cpu_sec").c_str());
+    r.read_bytes = std::strtoull(phase_detail::json_value(object, "read_bytes").c_str(), nullptr, 10);
+    r.write_bytes = std::strtoull(phase_detail::json_value(object, "write_bytes").c_str(), nullptr, 10);
+    r.minor_faults = std::strtoull(phase_detail::json_value(object, "minor_faults").c_str(), nullptr, 10);
+    r.major_faults = std::strtoull(phase_detail::json_value(object, "major_faults").c_str(), nullptr, 10);
+    r.data_bytes = std::strtoull(phase_detail::json_value(object, "data_bytes").c_str(), nullptr, 10);
+    records.push_back(r);
+    pos = end;
+  }
+  return records;
+}
+
+class phase_recorder {
+ public:
+  /// \param metric_slots Threads of the metrics; 0: every OpenMP thread, so construct the recorder after
+  ///        the number of threads is set
+  explicit phase_recorder(const std::string &program, const std::size_t metric_slots = 0)
+      : m_program(program), m_running(false), m_metrics(program, metric_slots) {}
+
+  /// \brief Per-thread counters, histograms and nested phases of the run
+  utility::metrics &metrics() { return m_metrics; }
+
+  /// \brief Adds a run attribute (e.g. a configuration value) to the machine-readable record
+  template <typename T>
+  void set_attribute(const std::string &key, const T &value) {
+    std::ostringstream ss;
+    ss << value;
+    m_attributes.emplace_back(key, ss.str());
+  }
+
+  /// \brief Starts a phase; ends the current one if any
+  /// Phases begun in metrics() while this one runs must end before it.
+  /// \param data_bytes Bytes of data the phase processes, for the effective bandwidth
+  void begin(const std::string &name, const uint64_t data_bytes = 0) {
+    if (m_running) end();
+    m_current = phase_record();
+    m_current.name = name;
+    m_current.data_bytes = data_bytes;
+    m_start_io = get_io_bytes();
+    m_start_faults = get_num_page_faults();
+    m_start_cpu = get_process_cpu_time();
+    m_metrics.begin(name);
+    m_start_ticks = tsc_clock::ticks();
+    m_running = true;
+  }
+
+  /// \brief Ends the current phase and prints its wall time
+  const phase_record &end() {
+    if (!m_running) return m_records.empty() ? m_current : m_records.back();
+    m_current.wall_sec = tsc_clock::seconds(tsc_clock::ticks() - m_start_ticks);
+    m_metrics.end();
+    m_current.cpu_sec = get_process_cpu_time() - m_start_cpu;
+    const auto io = get_io_bytes();
+    const auto faults = get_num_page_faults();
+    m_current.read_bytes = io.first - m_start_io.first;
+    m_current.write_bytes = io.second - m_start_io.second;
+    m_current.minor_faults = faults.first - m_start_faults.first;
+    m_current.major_faults = faults.second - m_start_faults.second;
+    m_records.push_back(m_current);
+    m_running = false;
+
+    fprintf(stderr, "%s took %f seconds\n", m_current.name.c_str(), m_current.wall_sec);
+    return m_records.back();
+  }
+
+  const std::vector<phase_record> &records() const {
+    return m_records;
+  }
+
+  /// \brief Prints one row per phase
+  void print_summary(std::ostream &os = std::cerr) const {
+    char line[256];
+    std::snprintf(line, sizeof(line), "%-16s %10s %10s %6s %12s %12s %12s %10s %10s %10s\n",
+                  "Phase", "Wall(s)", "CPU(s)", "CPU/W", "Read(MB)", "Written(MB)",
+                  "MinorFlt", "MajorFlt", "IO(MB/s)", "Data(MB/s)");
+    os << line;
+    for (const auto &r : m_records) {
+      const double wall = (r.wall_sec > 0.0) ? r.wall_sec : 1e-9;
+      std::snprintf(line, sizeof(line), "%-16s %10.3f %10.3f %6.2f %12.1f %12.1f %12lu %10lu %10.1f %10.1f\n",
+                    r.name.c_str(), r.wall_sec, r.cpu_sec, r.cpu_sec / wall,
+                    r.read_bytes / 1e6, r.write_bytes / 1e6,
+                    (unsigned long)r.minor_faults, (unsigned long)r.major_faults,
+                    (r.read_bytes + r.write_bytes) / 1e6 / wall, r.data_bytes / 1e6 / wall);
+      os << line;
+    }
+    os << std::flush;
+  }
+
+  /// \brief Returns the run and its metrics as one JSON object
+  std::string to_json() const {
+    std::ostringstream ss;
+    ss << "{\"program\":\"" << m_program << "\",\"time\":" << std::time(nullptr);
+    for (const auto &a : m_attributes)
+      ss << ",\"" << a.first << "\":\"" << a.second << "\"";
+    ss << ",\"phases\":[";
+    for (std::size_t i = 0; i < m_records.size(); ++i) {
+      const auto &r = m_records[i];
+      ss << (i ? "," : "") << "{\"name\":\"" << r.name << "\""
+         << ",\"wall_sec\":" << r.wall_sec << ",\"cpu_sec\":" << r.cpu_sec
+         << ",\"read_bytes\":" << r.read_bytes << ",\"write_bytes\":" << r.write_bytes
+         << ",\"minor_faults\":" << r.minor_faults << ",\"major_faults\":" << r.major_faults
+         << ",\"data_bytes\":" << r.data_bytes << "}";
+    }
+    ss << "],\"metrics\":" << m_metrics.to_json() << "}";
+    return ss.str();
+  }
+
+  /// \brief Returns the phases and the metrics as CSV lines of program,section,name,thread,stat,value
+  std::string to_csv() const {
+    std::ostringstream ss;
+    for (const auto &r : m_records) {
+      const std::pair<const char *, double> stats[] = {
+        {"wall_sec", r.wall_sec}, {"cpu_sec", r.cpu_sec}, {"read_bytes", (double)r.read_bytes},
+        {"write_bytes", (double)r.write_bytes}, {"minor_faults", (double)r.minor_faults},
+        {"major_faults", (double)r.major_faults}, {"data_bytes", (double)r.data_bytes}};
+      for (const auto &s : stats)
+        ss << m_program << ",run," << r.name << ",all," << s.first << "," << s.second << "\n";
+    }
+    return ss.str() + m_metrics.to_csv();
+  }
+
+  /// \brief Ends the current phase, prints the phases and the metrics, and appends them to $PHASE_LOG_FILE
+  void finish() {
+    if (m_running) end();
+    print_summary();
+    if (m_metrics.detailed()) m_metrics.print(std::cerr);
+
+    const char *log = std::getenv("PHASE_LOG_FILE");
+    if (log == nullptr) return;
+    const std::string name(log);
+    std::string format = "json";
+    if (name.size() >= 4 && name.compare(name.size() - 4, 4, ".csv") == 0) format = "csv";
+    else if (name.size() >= 4 && name.compare(name.size() - 4, 4, ".txt") == 0) format = "text";
+    const char *buf = std::getenv("PHASE_LOG_FORMAT");
+    if (buf != nullptr) format = buf;
+
+    std::ofstream ofs(name, std::ios::app);
+    if (format == "csv") {
+      if (ofs.tellp() == 0) ofs << "program,section,name,thread,stat,value\n";
+      ofs << to_csv();
+    } else if (format == "text") {
+      print_summary(ofs);
+      m_metrics.print(ofs);
+    } else {
+      ofs << to_json() << std::endl;
+    }
+    if (!ofs.good())
+      std::cerr << "Failed to write " << name << std::endl;
+  }
+
+ private:
+  std::string m_program;
+  std::vector<std::pair<std::string, std::string>> m_attributes;
+  std::vector<phase_record> m_records;
+  phase_record m_current;
+  bool m_running;
+  utility::metrics m_metrics;
+  uint64_t m_start_ticks{0};
+  double m_start_cpu{0.0};
+  std::pair<std::size_t, std::size_t> m_start_io;
+  std::pair<std::size_t, std::size_t> m_start_faults;
+};
+
+} // namespace utility
+
+#endif //UMAP_APPS_UTILITY_PHASE_HPP
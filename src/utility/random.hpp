@@ -0,0 +1,110 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+#ifndef UMAP_APPS_UTILITY_RANDOM_HPP
+#define UMAP_APPS_UTILITY_RANDOM_HPP
+
+#include <cstdint>
+#include <cmath>
+#include <iostream>
+
+namespace utility {
+
+/// \brief 64-bit mixing function (splitmix64 finalizer)
+inline uint64_t hash64(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+/// \brief Returns the i-th number of the random stream 'seed'
+/// Any thread can generate any element, so parallel generation
+/// gives the same data regardless of the number of threads.
+inline uint64_t counter_random(const uint64_t seed, const uint64_t i) {
+  return hash64(hash64(seed) ^ i);
+}
+
+/// \brief Maps a random 64-bit number to [0, 1)
+inline double to_unit_interval(const uint64_t x) {
+  return static_cast<double>(x >> 11) * (1.0 / static_cast<double>(1ULL << 53));
+}
+
+/// \brief Zipfian distribution over [0, n); 0 is the most frequent value
+/// Uses the algorithm from Gray et al., "Quickly Generating Billion-Record
+/// Synthetic Databases" (as in YCSB). theta must be in (0, 1).
+class zipfian_distribution {
+ public:
+  zipfian_distribution(const uint64_t n, const double theta)
+      : m_n(n), m_theta(theta) {
+    if (!(theta > 0.0 && theta < 1.0)) {
+      std::cerr << "Zipfian theta must be in (0, 1): " << theta << std::endl;
+      std::abort();
+    }
+    m_zetan = zeta(n, theta);
+    const double zeta2 = zeta(2, theta);
+    m_alpha = 1.0 / (1.0 - theta);
+    m_eta = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / m_zetan);
+    m_half_pow_theta = 1.0 + std::pow(0.5, theta);
+  }
+
+  /// \brief Returns the value for a uniform random number u in [0, 1)
+  uint64_t operator()(const double u) const {
+    const double uz = u * m_zetan;
+    if (uz < 1.0) return 0;
+    if (uz < m_half_pow_theta) return 1;
+    const uint64_t v = static_cast<uint64_t>(m_n * std::pow(m_eta * u - m_eta + 1.0, m_alpha));
+    return (v < m_n) ? v : m_n - 1;
+  }
+
+  uint64_t size() const {
+    return m_n;
+  }
+
+  double theta() const {
+    return m_theta;
+  }
+
+ private:
+  /// \brief sum_{i=1}^{n} 1/i^theta; the tail beyond 2^24 terms is approximated
+  /// with the Euler-Maclaurin formula, which is exact to well below 1e-9 there
+  static double zeta(const uint64_t n, const double theta) {
+    const uint64_t exact_terms = (n < (1ULL << 24)) ? n : (1ULL << 24);
+    double sum = 0.0;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:sum)
+#endif
+    for (uint64_t i = 1; i <= exact_terms; ++i)
+      sum += 1.0 / std::pow(static_cast<double>(i), theta);
+
+    if (n > exact_terms) {
+      const double m = static_cast<double>(exact_terms);
+      const double x = static_cast<double>(n);
+      sum += (std::pow(x, 1.0 - theta) - std::pow(m, 1.0 - theta)) / (1.0 - theta)
+          + (std::pow(x, -theta) - std::pow(m, -theta)) / 2.0;
+    }
+    return sum;
+  }
+
+  uint64_t m_n;
+  double m_theta;
+  double m_zetan;
+  double m_alpha;
+  double m_eta;
+  double m_half_pow_theta;
+};
+
+} // namespace utility
+
+#endif //UMAP_APPS_UTILITY_RANDOM_HPP
@@ -0,0 +1,79 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef UMAP_APPS_UTILITY_STATISTICS_HPP
+#define UMAP_APPS_UTILITY_STATISTICS_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+namespace utility {
+
+/// \brief Mean, standard deviation and 95% confidence interval of the mean of repeated trials
+struct sample_summary {
+  std::size_t count{0};
+  double mean{0.0};
+  double stddev{0.0};
+  double min{0.0};
+  double max{0.0};
+  double median{0.0};
+  double ci_low{0.0};   // 95% confidence interval of the mean (Student's t)
+  double ci_high{0.0};
+};
+
+/// \brief Two-sided 95% quantile of Student's t distribution with df degrees of freedom
+inline double student_t_95(const std::size_t df) {
+  static const double table[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+  if (df == 0) return 0.0;
+  if (df <= 30) return table[df - 1];
+  if (df <= 60) return 2.000;
+  if (df <= 120) return 1.980;
+  return 1.960;
+}
+
+inline sample_summary summarize(std::vector<double> values) {
+  sample_summary s;
+  s.count = values.size();
+  if (values.empty()) return s;
+
+  std::sort(values.begin(), values.end());
+  s.min = values.front();
+  s.max = values.back();
+  const std::size_t mid = values.size() / 2;
+  s.median = (values.size() % 2) ? values[mid] : (values[mid - 1] + values[mid]) / 2;
+
+  double sum = 0.0;
+  for (const double v : values) sum += v;
+  s.mean = sum / values.size();
+
+  if (values.size() > 1) {
+    double sq = 0.0;
+    for (const double v : values) sq += (v - s.mean) * (v - s.mean);
+    s.stddev = std::sqrt(sq / (values.size() - 1));
+  }
+  const double half_width = student_t_95(values.size() - 1) * s.stddev / std::sqrt((double)values.size());
+  s.ci_low = s.mean - half_width;
+  s.ci_high = s.mean + half_width;
+  return s;
+}
+
+} // namespace utility
+
+#endif //UMAP_APPS_UTILITY_STATISTICS_HPP
@@ -0,0 +1,564 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about the task scheduler
+/// A work-stealing scheduler for the parallelism an OpenMP loop cannot
+/// express: nested, irregular tasks (e.g. the edges of a hub vertex split
+/// across threads) and I/O (prefetches, gathers from a mapped file) that
+/// overlaps with compute.
+///  - Every worker owns a Chase-Lev deque (work_stealing_deque): it pushes and
+///    pops its tasks at the bottom; an idle worker steals the oldest task at
+///    the top of a random victim. The thread that creates the scheduler is
+///    worker 0 and runs tasks while it waits for a task group.
+///  - A task_group counts its unfinished tasks; wait() runs tasks, of any
+///    group, until the tasks of the group are done.
+///  - At most num_threads workers run compute tasks at once; they hold a run
+///    slot. Code about to block on I/O (faults on a mapped file, reads) opens
+///    an io_scope: the worker gives its slot up for the scope, so that a
+///    spare I/O worker runs compute tasks meanwhile. A worker that is over the
+///    limit when its task ends goes to sleep.
+///  - spawn_io() queues a task that mostly waits for I/O, e.g. a prefetch. It
+///    runs without a slot on an idle worker, usually a spare one.
+///  - parallel_for splits its range lazily (lazy binary splitting): a worker
+///    runs grain-sized chunks of its range, and gives half of what is left
+///    away only when its deque is empty, i.e. when its earlier half was stolen.
+///    Chunks stay large while every worker is busy and become small when some
+///    are idle, without tuning a chunk size per loop.
+/// task_scheduler_from_env() selects the runtime of an app: TASK_RUNTIME=omp
+/// (default) or tasks; TASK_IO_WORKERS spare workers (default: as many as
+/// the threads).
+
+#ifndef UMAP_APPS_UTILITY_TASK_SCHEDULER_HPP
+#define UMAP_APPS_UTILITY_TASK_SCHEDULER_HPP
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+#include <iostream>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "metrics.hpp"
+
+namespace utility {
+
+/// \brief Chase-Lev work-stealing deque of pointers
+/// The C11 formulation of Le, Pop, Cohen and Zappa Nardelli (PPoPP 2013).
+/// Only the owner calls push() and pop(); any thread calls steal(). The ring
+/// doubles when it is full; old rings are kept until the deque is destroyed,
+/// since a thief may still read them.
+template <typename T>
+class work_stealing_deque {
+ public:
+  explicit work_stealing_deque(const std::size_t log_capacity = 8) : m_top(0), m_bottom(0) {
+    m_rings.emplace_back(new ring(std::size_t(1) << log_capacity));
+    m_ring.store(m_rings.back().get(), std::memory_order_relaxed);
+  }
+
+  work_stealing_deque(const work_stealing_deque &) = delete;
+  work_stealing_deque &operator=(const work_stealing_deque &) = delete;
+
+  void push(T *const item) {
+    const int64_t b = m_bottom.load(std::memory_order_relaxed);
+    const int64_t t = m_top.load(std::memory_order_acquire);
+    ring *r = m_ring.load(std::memory_order_relaxed);
+    if (b - t > static_cast<int64_t>(r->capacity()) - 1) r = grow(r, t, b);
+    r->at(b).store(item, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_bottom.store(b + 1, std::memory_order_relaxed);
+  }
+
+  /// \return The newest item, or nullptr if the deque is empty
+  T *pop() {
+    const int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+    ring *const r = m_ring.load(std::memory_order_relaxed);
+    m_bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = m_top.load(std::memory_order_relaxed);
+    if (t > b) {
+      m_bottom.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    T *item = r->at(b).load(std::memory_order_relaxed);
+    if (t == b) {
+      // The last item: a thief may take it at the same time
+      if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        item = nullptr;
+      m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return item;
+  }
+
+  /// \return The oldest item, or nullptr if the deque is empty or another thread took it first
+  T *steal() {
+    int64_t t = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t b = m_bottom.load(std::memory_order_acquire);
+    if (t >= b) return nullptr;
+    ring *const r = m_ring.load(std::memory_order_acquire);
+    T *const item = r->at(t).load(std::memory_order_relaxed);
+    if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+      return nullptr;
+    return item;
+  }
+
+  /// \brief Whether the deque looks empty; exact for the owner when there are no thieves
+  bool empty() const {
+    return m_bottom.load(std::memory_order_relaxed) <= m_top.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct ring {
+    explicit ring(const std::size_t capacity) : mask(capacity - 1), items(new std::atomic<T *>[capacity]) {}
+    std::size_t capacity() const { return mask + 1; }
+    std::atomic<T *> &at(const int64_t i) { return items[static_cast<std::size_t>(i) & mask]; }
+
+    std::size_t mask;
+    std::unique_ptr<std::atomic<T *>[]> items;
+  };
+
+  ring *grow(ring *const old, const int64_t t, const int64_t b) {
+    m_rings.emplace_back(new ring(old->capacity() * 2));
+    ring *const r = m_rings.back().get();
+    for (int64_t i = t; i < b; ++i)
+      r->at(i).store(old->at(i).load(std::memory_order_relaxed), std::memory_order_relaxed);
+    m_ring.store(r, std::memory_order_release);
+    return r;
+  }
+
+  // The owner writes bottom, the thieves write top: separate cache lines
+  std::atomic<int64_t> m_top;
+  char m_pad[64 - sizeof(std::atomic<int64_t>)];
+  std::atomic<int64_t> m_bottom;
+  std::atomic<ring *> m_ring;
+  std::vector<std::unique_ptr<ring>> m_rings;
+};
+
+class task_scheduler;
+
+/// \brief Tasks that are waited for together
+class task_group {
+ public:
+  task_group() : m_pending(0) {}
+  task_group(const task_group &) = delete;
+  task_group &operator=(const task_group &) = delete;
+
+  bool done() const { return m_pending.load(std::memory_order_acquire) == 0; }
+
+ private:
+  friend class task_scheduler;
+  std::atomic<int64_t> m_pending;
+};
+
+class task_scheduler {
+ public:
+  /// \brief What one worker did, for the report
+  struct worker_stats {
+    uint64_t tasks{0};     // compute tasks run
+    uint64_t steals{0};    // of them, stolen from another worker
+    uint64_t io_tasks{0};  // tasks of spawn_io()
+    uint64_t io_scopes{0}; // times the slot was given up in an io_scope
+  };
+
+  /// \brief Gives the run slot of the calling worker up until the end of the scope
+  class io_scope {
+   public:
+    explicit io_scope(task_scheduler &scheduler) : m_scheduler(nullptr) {
+      if (current().scheduler == &scheduler) {
+        m_scheduler = &scheduler;
+        ++m_scheduler->m_workers[current().index]->stats.io_scopes;
+        m_scheduler->release_slot();
+      }
+    }
+    ~io_scope() {
+      if (m_scheduler) m_scheduler->m_active.fetch_add(1);
+    }
+    io_scope(const io_scope &) = delete;
+    io_scope &operator=(const io_scope &) = delete;
+
+   private:
+    task_scheduler *m_scheduler;
+  };
+
+  /// \param num_threads Compute tasks that run at once; 0: omp_get_max_threads()
+  /// \param num_io_workers Spare workers that run while others wait for I/O; -1: num_threads
+  explicit task_scheduler(int num_threads = 0, int num_io_workers = -1)
+      : m_active(0), m_queued(0), m_io_queued(0), m_sleeping(0), m_stop(false) {
+    if (num_threads <= 0) {
+#ifdef _OPENMP
+      num_threads = omp_get_max_threads();
+#else
+      num_threads = std::max(1U, std::thread::hardware_concurrency());
+#endif
+    }
+    if (num_io_workers < 0) num_io_workers = num_threads;
+    m_num_threads = num_threads;
+
+    for (int w = 0; w < num_threads + num_io_workers; ++w)
+      m_workers.emplace_back(new worker());
+
+    if (current().scheduler != nullptr) {
+      std::cerr << "A task scheduler is already running on this thread" << std::endl;
+      std::abort();
+    }
+    current().scheduler = this;
+    current().index = 0;
+    m_active.store(num_threads);  // worker 0 and the other compute workers start with a slot
+    for (int w = 1; w < num_workers(); ++w)
+      m_workers[w]->thread = std::thread(&task_scheduler::worker_loop, this, w, w < num_threads);
+  }
+
+  ~task_scheduler() {
+    m_stop.store(true);
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_wakeup.notify_all();
+    }
+    for (int w = 1; w < num_workers(); ++w)
+      m_workers[w]->thread.join();
+    current().scheduler = nullptr;
+    current().index = -1;
+  }
+
+  task_scheduler(const task_scheduler &) = delete;
+  task_scheduler &operator=(const task_scheduler &) = delete;
+
+  int num_threads() const { return m_num_threads; }
+  int num_io_workers() const { return num_workers() - m_num_threads; }
+  int num_workers() const { return static_cast<int>(m_workers.size()); }
+
+  /// \brief Index of the calling worker, e.g. for metrics::slot(); 0 outside of the workers
+  static int worker_index() { return std::max(current().index, 0); }
+
+  const worker_stats &stats(const int worker) const { return m_workers[worker]->stats; }
+
+  /// \brief Runs a task of the group on some worker
+  void spawn(task_group &group, std::function<void()> body) {
+    group.m_pending.fetch_add(1, std::memory_order_relaxed);
+    task *const t = new task{std::move(body), &group};
+    if (current().scheduler == this) {
+      m_workers[current().index]->deque.push(t);
+    } else {
+      std::lock_guard<std::mutex> lock(m_inject_mutex);
+      m_injected.push_back(t);
+    }
+    m_queued.fetch_add(1);
+    if (m_sleeping.load() > 0 && m_active.load() < m_num_threads) wake_one();
+  }
+
+  /// \brief Runs a task of the group that mostly waits for I/O, without holding a run slot
+  void spawn_io(task_group &group, std::function<void()> body) {
+    group.m_pending.fetch_add(1, std::memory_order_relaxed);
+    {
+      std::lock_guard<std::mutex> lock(m_io_mutex);
+      m_io_tasks.push_back(new task{std::move(body), &group});
+    }
+    m_io_queued.fetch_add(1);
+    if (m_sleeping.load() > 0) wake_one();
+  }
+
+  /// \brief Runs tasks until the tasks of the group are done
+  void wait(task_group &group) {
+    const bool is_worker = (current().scheduler == this);
+    while (!group.done()) {
+      if (is_worker) {
+        bool stolen = false;
+        task *const t = find_task(current().index, &stolen);
+        if (t) {
+          run_task(current().index, t, stolen);
+          continue;
+        }
+        // Without spare workers, nobody else may run the I/O tasks of the group
+        task *const io = find_io_task();
+        if (io) {
+          io_scope scope(*this);
+          run_io_task(current().index, io);
+          continue;
+        }
+      }
+      std::this_thread::yield();
+    }
+  }
+
+  /// \brief Runs body(first, last) over subranges of [begin, end) and waits for them
+  /// \param grain The smallest subrange; 0: about 1/64 of the range per thread
+  template <typename function>
+  void parallel_for(const uint64_t begin, const uint64_t end, const function &body, uint64_t grain = 0) {
+    if (begin >= end) return;
+    if (grain == 0) grain = std::max<uint64_t>(1, (end - begin) / (static_cast<uint64_t>(m_num_threads) * 64));
+    task_group group;
+    if (current().scheduler == this) {
+      run_range(group, begin, end, body, grain);
+    } else {
+      spawn(group, [this, &group, begin, end, &body, grain]() { run_range(group, begin, end, body, grain); });
+    }
+    wait(group);
+  }
+
+ private:
+  struct task {
+    std::function<void()> body;
+    task_group *group;
+  };
+
+  /// Only its own thread writes to a worker; workers are allocated one by one
+  struct worker {
+    work_stealing_deque<task> deque;
+    worker_stats stats;
+    uint64_t random_state{0};
+    std::thread thread;
+  };
+
+  struct thread_state {
+    task_scheduler *scheduler;
+    int index;
+  };
+
+  static thread_state &current() {
+    static thread_local thread_state state{nullptr, -1};
+    return state;
+  }
+
+  template <typename function>
+  void run_range(task_group &group, uint64_t begin, uint64_t end, const function &body, const uint64_t grain) {
+    const work_stealing_deque<task> &deque = m_workers[current().index]->deque;
+    while (end - begin > grain) {
+      if (deque.empty()) {
+        const uint64_t middle = begin + (end - begin) / 2;
+        spawn(group, [this, &group, middle, end, &body, grain]() { run_range(group, middle, end, body, grain); });
+        end = middle;
+      } else {
+        body(begin, begin + grain);
+        begin += grain;
+      }
+    }
+    body(begin, end);
+  }
+
+  task *find_task(const int index, bool *const stolen) {
+    worker &self = *m_workers[index];
+    task *t = self.deque.pop();
+    if (t) {
+      m_queued.fetch_sub(1);
+      return t;
+    }
+    if (m_queued.load() == 0) return nullptr;
+    {
+      std::lock_guard<std::mutex> lock(m_inject_mutex);
+      if (!m_injected.empty()) {
+        t = m_injected.front();
+        m_injected.pop_front();
+        m_queued.fetch_sub(1);
+        return t;
+      }
+    }
+    const uint64_t n = m_workers.size();
+    for (uint64_t attempt = 0; attempt < n; ++attempt) {
+      // xorshift64
+      uint64_t &x = self.random_state;
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      const uint64_t victim = x % n;
+      if (victim == static_cast<uint64_t>(index)) continue;
+      t = m_workers[victim]->deque.steal();
+      if (t) {
+        m_queued.fetch_sub(1);
+        *stolen = true;
+        return t;
+      }
+    }
+    return nullptr;
+  }
+
+  task *find_io_task() {
+    if (m_io_queued.load() == 0) return nullptr;
+    std::lock_guard<std::mutex> lock(m_io_mutex);
+    if (m_io_tasks.empty()) return nullptr;
+    task *const t = m_io_tasks.front();
+    m_io_tasks.pop_front();
+    m_io_queued.fetch_sub(1);
+    return t;
+  }
+
+  void run_task(const int index, task *const t, const bool stolen) {
+    t->body();
+    t->group->m_pending.fetch_sub(1, std::memory_order_acq_rel);
+    delete t;
+    ++m_workers[index]->stats.tasks;
+    if (stolen) ++m_workers[index]->stats.steals;
+  }
+
+  void run_io_task(const int index, task *const t) {
+    t->body();
+    t->group->m_pending.fetch_sub(1, std::memory_order_acq_rel);
+    delete t;
+    ++m_workers[index]->stats.io_tasks;
+  }
+
+  bool try_acquire_slot() {
+    int active = m_active.load();
+    while (active < m_num_threads)
+      if (m_active.compare_exchange_weak(active, active + 1)) return true;
+    return false;
+  }
+
+  /// \brief Gives the slot up if more workers hold one than allowed (after an io_scope)
+  bool try_shed_slot() {
+    int active = m_active.load();
+    while (active > m_num_threads)
+      if (m_active.compare_exchange_weak(active, active - 1)) return true;
+    return false;
+  }
+
+  void release_slot() {
+    m_active.fetch_sub(1);
+    if (m_sleeping.load() > 0 && m_queued.load() > 0) wake_one();
+  }
+
+  void wake_one() {
+    // Taking the lock orders the notification after the check of a worker going to sleep
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_wakeup.notify_one();
+  }
+
+  bool has_work_for_sleeper() const {
+    return m_io_queued.load() > 0 || (m_queued.load() > 0 && m_active.load() < m_num_threads);
+  }
+
+  void worker_loop(const int index, bool active) {
+    current().scheduler = this;
+    current().index = index;
+    m_workers[index]->random_state = 0x9E3779B97F4A7C15ULL * (index + 1);
+
+    // Rounds without work before an idle worker sleeps
+    const int k_idle_rounds = 64;
+    int idle = 0;
+    while (!m_stop.load()) {
+      if (!active) active = try_acquire_slot();
+      if (active) {
+        bool stolen = false;
+        task *const t = find_task(index, &stolen);
+        if (t) {
+          run_task(index, t, stolen);
+          idle = 0;
+          if (try_shed_slot()) active = false;
+          continue;
+        }
+      }
+      task *const io = find_io_task();
+      if (io) {
+        if (active) {
+          io_scope scope(*this);
+          run_io_task(index, io);
+        } else {
+          run_io_task(index, io);
+        }
+        idle = 0;
+        continue;
+      }
+      if (++idle < k_idle_rounds) {
+        std::this_thread::yield();
+        continue;
+      }
+
+      idle = 0;
+      if (active) {
+        release_slot();
+        active = false;
+      }
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_sleeping.fetch_add(1);
+      m_wakeup.wait(lock, [this]() { return m_stop.load() || has_work_for_sleeper(); });
+      m_sleeping.fetch_sub(1);
+    }
+    if (active) m_active.fetch_sub(1);
+  }
+
+  int m_num_threads;
+  std::vector<std::unique_ptr<worker>> m_workers;
+
+  std::atomic<int> m_active;        // workers holding a run slot
+  std::atomic<int64_t> m_queued;    // compute tasks in the deques and the injection queue
+  std::atomic<int64_t> m_io_queued; // tasks in the I/O queue
+  std::atomic<int> m_sleeping;
+  std::atomic<bool> m_stop;
+
+  std::mutex m_inject_mutex;
+  std::deque<task *> m_injected;  // spawned by threads that are not workers
+  std::mutex m_io_mutex;
+  std::deque<task *> m_io_tasks;
+
+  std::mutex m_mutex;
+  std::condition_variable m_wakeup;
+};
+
+/// \brief Adds the tasks, steals and I/O hand-offs of every worker to the per-thread counters of the metrics
+/// The metrics need a slot per worker (num_workers()).
+inline void record_task_scheduler_stats(const task_scheduler &scheduler, metrics &m) {
+  const metrics::id tasks_id = m.counter("tasks");
+  const metrics::id steals_id = m.counter("steals");
+  const metrics::id io_tasks_id = m.counter("I/O tasks");
+  const metrics::id io_scopes_id = m.counter("I/O scopes");
+  for (int w = 0; w < scheduler.num_workers(); ++w) {
+    const task_scheduler::worker_stats &s = scheduler.stats(w);
+    metrics::thread_slot &slot = m.slot(w);
+    slot.add(tasks_id, s.tasks);
+    slot.add(steals_id, s.steals);
+    slot.add(io_tasks_id, s.io_tasks);
+    slot.add(io_scopes_id, s.io_scopes);
+  }
+}
+
+/// \brief The task scheduler selected by TASK_RUNTIME=tasks, or nullptr for OpenMP
+/// Compute threads: omp_get_max_threads(); spare I/O workers: TASK_IO_WORKERS.
+inline std::unique_ptr<task_scheduler> task_scheduler_from_env() {
+  std::unique_ptr<task_scheduler> scheduler;
+  const char *runtime = std::getenv("TASK_RUNTIME");
+  if (runtime == nullptr || std::string(runtime) == "omp") return scheduler;
+  if (std::string(runtime) != "tasks") {
+    std::cerr << "Invalid TASK_RUNTIME: " << runtime << " (omp or tasks)" << std::endl;
+    std::exit(1);
+  }
+
+  int num_io_workers = -1;
+  const char *buf = std::getenv("TASK_IO_WORKERS");
+  if (buf != nullptr) {
+    num_io_workers = std::atoi(buf);
+    if (num_io_workers < 0) {
+      std::cerr << "Invalid TASK_IO_WORKERS: " << buf << std::endl;
+      std::exit(1);
+    }
+  }
+
+  scheduler.reset(new task_scheduler(0, num_io_workers));
+  std::cerr << "Task runtime: " << scheduler->num_threads() << " threads, " << scheduler->num_io_workers()
+            << " I/O workers" << std::endl;
+  return scheduler;
+}
+
+} // namespace utility
+#endif //UMAP_APPS_UTILITY_TASK_SCHEDULER_HPP
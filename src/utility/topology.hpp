@@ -0,0 +1,136 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about the CPU topology
+/// The topology is read from sysfs: the socket (physical package) and core
+/// of every CPU from /sys/devices/system/cpu/cpuN/topology, and the NUMA node
+/// of every CPU from /sys/devices/system/node/nodeN/cpulist.
+/// Only the CPUs the process may run on (sched_getaffinity) are listed.
+
+#ifndef UMAP_APPS_UTILITY_TOPOLOGY_HPP
+#define UMAP_APPS_UTILITY_TOPOLOGY_HPP
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif // _GNU_SOURCE
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+#include <sched.h>
+#include <pthread.h>
+
+namespace utility {
+
+struct cpu_info {
+  int cpu{0};
+  int package{0};  // socket
+  int core{0};     // core id, unique within a package
+  int node{0};     // NUMA node
+};
+
+/// \brief Parses a sysfs CPU list such as "0-3,8,10-11"
+inline std::vector<int> parse_cpu_list(const std::string &list) {
+  std::vector<int> cpus;
+  std::stringstream ss(list);
+  std::string range;
+  while (std::getline(ss, range, ',')) {
+    if (range.empty() || range == "\n") continue;
+    const std::size_t dash = range.find('-');
+    const int first = std::atoi(range.substr(0, dash).c_str());
+    const int last = (dash == std::string::npos) ? first : std::atoi(range.substr(dash + 1).c_str());
+    for (int c = first; c <= last; ++c)
+      cpus.push_back(c);
+  }
+  return cpus;
+}
+
+/// \brief Reads one integer from a sysfs file, or returns fallback
+inline int read_sysfs_int(const std::string &path, const int fallback) {
+  std::ifstream ifs(path);
+  int value;
+  if (ifs >> value) return value;
+  return fallback;
+}
+
+/// \brief Returns the CPUs the process may run on, with their socket, core and NUMA node
+inline std::vector<cpu_info> read_cpu_topology() {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (::sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    ::perror("sched_getaffinity");
+    return std::vector<cpu_info>();
+  }
+
+  std::vector<int> node_of(CPU_SETSIZE, 0);
+  for (int node = 0; ; ++node) {
+    std::ifstream ifs("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    if (!ifs.good()) {
+      // Nodes may be numbered with gaps; stop after a few missing ones
+      if (node > 64) break;
+      continue;
+    }
+    std::string list;
+    std::getline(ifs, list);
+    for (const int c : parse_cpu_list(list))
+      if (c < CPU_SETSIZE) node_of[c] = node;
+  }
+
+  std::vector<cpu_info> cpus;
+  for (int c = 0; c < CPU_SETSIZE; ++c) {
+    if (!CPU_ISSET(c, &allowed)) continue;
+    const std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(c) + "/topology/";
+    cpu_info info;
+    info.cpu = c;
+    info.package = read_sysfs_int(dir + "physical_package_id", 0);
+    // Without topology information every CPU is its own core
+    info.core = read_sysfs_int(dir + "core_id", c);
+    info.node = node_of[c];
+    cpus.push_back(info);
+  }
+  return cpus;
+}
+
+/// \brief Binds the calling thread to one CPU
+inline bool bind_to_cpu(const int cpu) {
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  CPU_SET(cpu, &cpuset);
+  const int s = ::pthread_setaffinity_np(::pthread_self(), sizeof(cpuset), &cpuset);
+  if (s != 0) {
+    std::cerr << "pthread_setaffinity_np(" << cpu << ") failed: " << s << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/// \brief Binds the calling thread to a set of CPUs (e.g. the one it had before bind_to_cpu)
+inline bool bind_to_cpus(const cpu_set_t &cpuset) {
+  const int s = ::pthread_setaffinity_np(::pthread_self(), sizeof(cpuset), &cpuset);
+  if (s != 0) {
+    std::cerr << "pthread_setaffinity_np failed: " << s << std::endl;
+    return false;
+  }
+  return true;
+}
+
+} // namespace utility
+
+#endif //UMAP_APPS_UTILITY_TOPOLOGY_HPP
@@ -0,0 +1,235 @@
+/*
+This file is part of UMAP.  For copyright information see the COPYRIGHT
+file in the top level directory, or at
+https://github.com/LLNL/umap/blob/master/COPYRIGHT
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License (as published by the Free
+Software Foundation) version 2.1 dated February 1999.  This program is
+distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the IMPLIED WARRANTY OF MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the terms and conditions of the GNU Lesser General Public License
+for more details.  You should have received a copy of the GNU Lesser General
+Public License along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/// Memo about the transpose
+/// Permutes the axes of a row-major 2D or 3D array, e.g. a frame-major cube
+/// (k, y, x) into a time-major one (y, x, k), from one mapped region to
+/// another, so that neither array has to fit in memory.
+///  - The array is cut into tiles. A tile spans run_bytes (one I/O, e.g. the
+///    umap page size) along the fastest input axis and along the axis that
+///    becomes the fastest output axis, and more of the other axes up to
+///    run_bytes x run_bytes / element size bytes in all. So a tile reads and
+///    writes whole runs of run_bytes instead of one element per page.
+///  - The two buffers of every thread share memory_bytes / #threads. When a
+///    tile of run_bytes x run_bytes / element size bytes does not fit (large
+///    pages), the runs of the two fast axes are shortened, the longer first,
+///    until it does: shorter runs, but no allocation beyond the budget.
+///  - Every thread gathers a tile into its own buffer with one memcpy per
+///    input run, permutes it into a second buffer in output order, and
+///    writes it back with one memcpy per output run. The permutation in
+///    memory is cache-oblivious: it halves the longest extent of the box
+///    until the box fits in any cache, so no cache size is tuned.
+///  - The tiles are taken in output order (dynamic schedule), so the output
+///    is written as one front that moves through the region, while the
+///    reads jump between the input runs of the tiles.
+/// An axis order lists, for every output axis from the slowest to the
+/// fastest, the input axis it comes from; {0, 2, 1} transposes every 2D
+/// slice of a 3D array.
+
+#ifndef UMAP_APPS_UTILITY_TRANSPOSE_HPP
+#define UMAP_APPS_UTILITY_TRANSPOSE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace utility {
+
+const uint64_t k_transpose_base_elements = 256;
+
+/// \brief Whether order is a permutation of {0, 1, 2}
+inline bool valid_axis_order(const int order[3]) {
+  bool seen[3] = {false, false, false};
+  for (int k = 0; k < 3; ++k) {
+    if (order[k] < 0 || order[k] > 2 || seen[order[k]]) return false;
+    seen[order[k]] = true;
+  }
+  return true;
+}
+
+/// \brief Parses a comma separated axis order, e.g. 1,0 or 2,0,1; a 2D order applies to the last two axes
+inline bool parse_axis_order(const std::string &text, int order[3]) {
+  std::vector<int> axes;
+  std::istringstream ss(text);
+  std::string field;
+  while (std::getline(ss, field, ',')) {
+    if (field.size() != 1 || field[0] < '0' || field[0] > '2') return false;
+    axes.push_back(field[0] - '0');
+  }
+  if (axes.size() == 2) {
+    order[0] = 0;
+    order[1] = axes[0] + 1;
+    order[2] = axes[1] + 1;
+  } else if (axes.size() == 3) {
+    std::copy(axes.begin(), axes.end(), order);
+  } else {
+    return false;
+  }
+  return valid_axis_order(order);
+}
+
+namespace transpose_detail {
+
+/// \brief Copies the box [lo, hi) of a tile (input order, extents e) to dst (strides per input axis)
+template <typename T>
+void permute_box(const T *const src, const uint64_t e[3], T *const dst, const uint64_t dst_stride[3],
+                 const int fastest_output_axis, uint64_t lo[3], uint64_t hi[3]) {
+  uint64_t longest = 0;
+  for (int k = 1; k < 3; ++k) {
+    if (hi[k] - lo[k] > hi[longest] - lo[longest]) longest = k;
+  }
+  const uint64_t volume = (hi[0] - lo[0]) * (hi[1] - lo[1]) * (hi[2] - lo[2]);
+  if (volume > k_transpose_base_elements && hi[longest] - lo[longest] > 1) {
+    const uint64_t mid = lo[longest] + (hi[longest] - lo[longest]) / 2;
+    const uint64_t saved_hi = hi[longest];
+    hi[longest] = mid;
+    permute_box(src, e, dst, dst_stride, fastest_output_axis, lo, hi);
+    hi[longest] = saved_hi;
+    const uint64_t saved_lo = lo[longest];
+    lo[longest] = mid;
+    permute_box(src, e, dst, dst_stride, fastest_output_axis, lo, hi);
+    lo[longest] = saved_lo;
+    return;
+  }
+  // The innermost loop writes along the fastest output axis
+  const int f = fastest_output_axis;
+  const int a = (f == 0) ? 1 : 0;
+  const int b = (f == 2) ? 1 : 2;
+  const uint64_t src_stride[3] = {e[1] * e[2], e[2], 1};
+  for (uint64_t i = lo[a]; i < hi[a]; ++i) {
+    for (uint64_t j = lo[b]; j < hi[b]; ++j) {
+      const T *s = src + i * src_stride[a] + j * src_stride[b] + lo[f] * src_stride[f];
+      T *d = dst + i * dst_stride[a] + j * dst_stride[b] + lo[f] * dst_stride[f];
+      for (uint64_t k = lo[f]; k < hi[f]; ++k, s += src_stride[f], d += dst_stride[f]) *d = *s;
+    }
+  }
+}
+
+} // namespace transpose_detail
+
+/// \brief Extents of the tiles of transpose()
+/// \param max_elements Elements of one tile buffer
+inline void transpose_tile(const uint64_t dims[3], const int order[3], const std::size_t run_elements,
+                           const uint64_t max_elements, uint64_t tile[3]) {
+  const uint64_t run = std::max<std::size_t>(1, run_elements);
+  const uint64_t budget = std::max<uint64_t>(1, max_elements);
+  const uint64_t limit = (run > budget / run) ? budget : run * run;
+  tile[0] = tile[1] = tile[2] = 1;
+  tile[2] = std::min(dims[2], run);
+  tile[order[2]] = std::min(dims[order[2]], (order[2] == 2) ? limit : run);
+  // Halve the longer run of the two fast axes until the tile fits
+  while (order[2] != 2 && tile[2] * tile[order[2]] > limit) {
+    const int axis = (tile[2] >= tile[order[2]]) ? 2 : order[2];
+    tile[axis] = (tile[axis] + 1) / 2;
+  }
+  // The other axes get what is left of the limit, the outer output axes last
+  for (int k = 1; k >= 0; --k) {
+    const int axis = order[k];
+    if (axis == 2 || axis == order[2]) continue;
+    const uint64_t volume = tile[0] * tile[1] * tile[2];
+    tile[axis] = std::min(dims[axis], std::max<uint64_t>(1, limit / volume));
+  }
+}
+
+/// \brief Elements of one tile buffer of transpose(): each thread has two
+template <typename T>
+uint64_t transpose_buffer_elements(const std::size_t memory_bytes) {
+#ifdef _OPENMP
+  const uint64_t num_threads = omp_get_max_threads();
+#else
+  const uint64_t num_threads = 1;
+#endif
+  return memory_bytes / num_threads / 2 / sizeof(T);
+}
+
+/// \brief out = in with its axes permuted; out has the extents dims[order[0]], dims[order[1]], dims[order[2]]
+/// \param dims Extents of in, the last one is the fastest
+/// \param run_bytes Bytes of the contiguous runs read and written (e.g. the page size)
+/// \param memory_bytes Bytes of DRAM for the tile buffers of all threads
+/// \return false if order is not a permutation of {0, 1, 2}
+template <typename T>
+bool transpose(const T *const in, T *const out, const uint64_t dims[3], const int order[3],
+               const std::size_t run_bytes, const std::size_t memory_bytes) {
+  if (!valid_axis_order(order)) return false;
+  if (dims[0] == 0 || dims[1] == 0 || dims[2] == 0) return true;
+  uint64_t tile[3];
+  transpose_tile(dims, order, run_bytes / sizeof(T), transpose_buffer_elements<T>(memory_bytes), tile);
+  const uint64_t num_tiles[3] = {(dims[0] + tile[0] - 1) / tile[0], (dims[1] + tile[1] - 1) / tile[1],
+                                 (dims[2] + tile[2] - 1) / tile[2]};
+  const uint64_t total_tiles = num_tiles[0] * num_tiles[1] * num_tiles[2];
+  const uint64_t out_dims[3] = {dims[order[0]], dims[order[1]], dims[order[2]]};
+
+#pragma omp parallel
+  {
+    std::vector<T> gathered(tile[0] * tile[1] * tile[2]);
+    std::vector<T> permuted(gathered.size());
+#pragma omp for schedule(dynamic)
+    for (uint64_t t = 0; t < total_tiles; ++t) {
+      // Tile coordinates in output order: order[2] is the fastest
+      uint64_t coord[3];
+      uint64_t rest = t;
+      for (int k = 2; k >= 0; --k) {
+        coord[order[k]] = rest % num_tiles[order[k]];
+        rest /= num_tiles[order[k]];
+      }
+      uint64_t lo[3], e[3];
+      for (int k = 0; k < 3; ++k) {
+        lo[k] = coord[k] * tile[k];
+        e[k] = std::min(tile[k], dims[k] - lo[k]);
+      }
+
+      for (uint64_t i = 0; i < e[0]; ++i)
+        for (uint64_t j = 0; j < e[1]; ++j)
+          std::memcpy(&gathered[(i * e[1] + j) * e[2]], in + ((lo[0] + i) * dims[1] + lo[1] + j) * dims[2] + lo[2],
+                      e[2] * sizeof(T));
+
+      const uint64_t f[3] = {e[order[0]], e[order[1]], e[order[2]]};
+      uint64_t dst_stride[3];
+      dst_stride[order[0]] = f[1] * f[2];
+      dst_stride[order[1]] = f[2];
+      dst_stride[order[2]] = 1;
+      uint64_t box_lo[3] = {0, 0, 0};
+      uint64_t box_hi[3] = {e[0], e[1], e[2]};
+      transpose_detail::permute_box(gathered.data(), e, permuted.data(), dst_stride, order[2], box_lo, box_hi);
+
+      const uint64_t out_lo[3] = {lo[order[0]], lo[order[1]], lo[order[2]]};
+      for (uint64_t i = 0; i < f[0]; ++i)
+        for (uint64_t j = 0; j < f[1]; ++j)
+          std::memcpy(out + ((out_lo[0] + i) * out_dims[1] + out_lo[1] + j) * out_dims[2] + out_lo[2],
+                      &permuted[(i * f[1] + j) * f[2]], f[2] * sizeof(T));
+    }
+  }
+  return true;
+}
+
+/// \brief out (cols x rows) = the transpose of in (rows x cols), both row-major
+template <typename T>
+void transpose_2d(const T *const in, T *const out, const uint64_t rows, const uint64_t cols,
+                  const std::size_t run_bytes, const std::size_t memory_bytes) {
+  const uint64_t dims[3] = {1, rows, cols};
+  const int order[3] = {0, 2, 1};
+  transpose(in, out, dims, order, run_bytes, memory_bytes);
+}
+
+} // namespace utility
+
+#endif //UMAP_APPS_UTILITY_TRANSPOSE_HPP
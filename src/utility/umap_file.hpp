@@ -24,6 +24,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include "umap/umap.h"
+#include "cache_control.hpp"
 
 namespace utility {
 
@@ -140,7 +141,7 @@ void* map_in_file(
 void unmap_file(bool usemmap, uint64_t numbytes, void* region)
 {
   if ( usemmap ) {
-    if ( munmap(region, numbytes) < 0 ) {
+    if ( ::munmap(region, numbytes) < 0 ) {
       std::ostringstream ss;
       ss << "munmap failure: ";
       perror(ss.str().c_str());
@@ -157,5 +158,21 @@ void unmap_file(bool usemmap, uint64_t numbytes, void* region)
   }
 }
 
+/// \brief Makes a mapped file cold (see cache_control.hpp)
+/// A mmap region is paged out and the file is dropped from the page cache; a
+/// umap region is unmapped, which writes back and empties its buffer, and
+/// mapped again at the same address.
+/// \return The region, or NULL if it could not be mapped again
+void* evict_mapped_file(const std::string &filename, bool usemmap, uint64_t numbytes, void* region)
+{
+  if ( usemmap ) {
+    evict_region(region, numbytes, filename);
+    return region;
+  }
+  unmap_file(usemmap, numbytes, region);
+  drop_file_cache(filename);
+  return map_in_file(filename, false, true, usemmap, numbytes, region);
+}
+
 }
 #endif